@@ -8,8 +8,22 @@ struct Material {
 
 uniform Material material;
 
+#ifdef INSTANCED
+in vec3 instance_color;
+#endif
+
 void main() {
+#ifdef LOD_FADE
+    // From lod_fade.glsl
+    if (lod_faded_out()) {
+        discard;
+    }
+#endif
+#ifdef INSTANCED
+    FragColor = vec4(instance_color, 1.0f);
+#else
     FragColor = vec4(material.color, 1.0f);
+#endif
     // FragColor = vec4(1, 0, 0, 1);
 }
 
@@ -9,9 +9,21 @@ layout (std140) uniform matrices {
     mat4 view;
 };
 
+#ifdef INSTANCED
+// Renderer::InstanceData, one per instance
+layout (location = 3) in mat4 a_model;
+layout (location = 10) in vec3 a_color;
+
+out vec3 instance_color;
+#else
 uniform mat4 model;
+#endif
 
 void main() {
+#ifdef INSTANCED
+    mat4 model = a_model;
+    instance_color = a_color;
+#endif
     gl_Position = projection * view * model * vec4(a_position, 1.0f);
 }
 
@@ -12,6 +12,12 @@ struct Material {
 uniform Material material;
 
 void main() {
+#ifdef LOD_FADE
+    // From lod_fade.glsl
+    if (lod_faded_out()) {
+        discard;
+    }
+#endif
     FragColor = vec4(material.color, 1.0f) * texture(material.texture_diffuse1, tex_coords);
     // FragColor = vec4(1, 0, 0, 1);
 }
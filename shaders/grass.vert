@@ -3,52 +3,66 @@
 layout (location = 0) in vec3 a_position;
 layout (location = 1) in vec3 a_normal;
 // layout (location = 2) in mat4 a_tex_coords;
-layout (location = 3) in mat4 a_model;
-layout (location = 7) in mat4 a_inverse_model;
+
+// GrassInstance - written by grass_cull.geom
+layout (location = 3) in vec3 a_instance_position;
+// yaw, scale x, scale y, seed. all normalized
+layout (location = 4) in vec4 a_instance_data;
 
 out vec3 normal;
 out vec3 frag_pos; // fragment position
 
-// layout (std140) uniform matrices {
-//     mat4 projection;
-//     mat4 view;
-// };
+// Has to match GrassInstance::max_scale
+#define MAX_SCALE 4.0
+#define TWO_PI 6.28318530718
 
-// at most N grass
-// #define MAX_GRASS 100
-// uniform mat4 models[MAX_GRASS];
-// uniform mat3 inverse_models[MAX_GRASS];
 uniform mat4 projection;
 uniform mat4 view;
 uniform float time;
+// Set per lod by GrassCuller::render
+uniform float lod_width_scale;
 
 // eh
 float random2d(vec2 coord) {
     return fract(sin(dot(coord.xy, vec2(12.9898, 78.233))) * 43758.5453);
 }
 
+// translate * scale * rotate(yaw) - same order as Transform::get_mat4
+mat4 instance_model() {
+    // The byte is yaw / 360 * 256 but arrives divided by 255
+    float yaw = a_instance_data.x * (TWO_PI * 255.0 / 256.0);
+    float c = cos(yaw);
+    float s = sin(yaw);
+    vec3 scale = vec3(a_instance_data.y * MAX_SCALE, a_instance_data.z * MAX_SCALE, 1.0);
+    return mat4(
+        vec4(scale * vec3(c, 0, -s), 0),
+        vec4(scale * vec3(0, 1, 0), 0),
+        vec4(scale * vec3(s, 0, c), 0),
+        vec4(a_instance_position, 1)
+    );
+}
+
 void main() {
     const float mult = 0.22;
     float offset = 0;
     // Only offset position if it is the middle 2 vertices
     if (a_position.y >= 0.5f) {
         float random = random2d(a_position.xy);
-        offset = mult * sin(time) - (a_position.x * 0.1 + random * 0.1);
+        float phase = a_instance_data.w * TWO_PI;
+        offset = mult * sin(time + phase) - (a_position.x * 0.1 + random * 0.1);
         if (a_position.y == 1.0f) {
             offset = ((offset + 0.5) + (offset - 0.5));
         }
     }
 
-    vec3 position = (a_model * vec4(a_position, 1.0f)).xyz;
-    position.x += offset;
+    mat4 model = instance_model();
+    vec3 local_position = vec3(a_position.x * lod_width_scale, a_position.yz);
+    frag_pos = (model * vec4(local_position, 1.0f)).xyz;
 
+    vec3 position = frag_pos;
+    position.x += offset;
     gl_Position = projection * view * vec4(position, 1);
-    // gl_Position = vec4(0, 0.1, 0, 1);
 
-    frag_pos = vec3(a_model * vec4(a_position, 1.0f));
-    // mat3 inverse_model = mat3(transpose(inverse(a_model)));
-    mat3 inverse_model = mat3(a_inverse_model);
+    mat3 inverse_model = transpose(inverse(mat3(model)));
     normal = normalize(inverse_model * a_normal);
 }
-
-
@@ -0,0 +1,52 @@
+#version 410 core
+
+// One vertex per blade of grass, reads GrassInstance
+layout (location = 0) in vec3 a_position;
+// yaw, scale and seed. passed through untouched
+layout (location = 1) in uint a_packed;
+
+out vec3 v_position;
+flat out uint v_packed;
+// -1 if the blade is culled
+flat out int v_lod;
+
+// left, right, bottom, top, near, far. normals point inwards
+uniform vec4 frustum_planes[6];
+uniform vec3 camera_pos;
+uniform float cull_radius;
+// upper distance of each lod bucket. anything further away gets culled
+uniform vec3 lod_distances;
+// only 1 in far_lod_density blades survive in the last lod
+uniform uint far_lod_density;
+
+uint hash(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+void main() {
+    v_position = a_position;
+    v_packed = a_packed;
+    v_lod = -1;
+
+    for (int i = 0; i < 6; i++) {
+        if (dot(frustum_planes[i].xyz, a_position) + frustum_planes[i].w < -cull_radius) {
+            return;
+        }
+    }
+
+    float dist = distance(camera_pos, a_position);
+    if (dist < lod_distances.x) {
+        v_lod = 0;
+    }
+    else if (dist < lod_distances.y) {
+        v_lod = 1;
+    }
+    else if (dist < lod_distances.z && hash(a_packed) % far_lod_density == 0u) {
+        v_lod = 2;
+    }
+}
@@ -1,6 +1,6 @@
 #version 410 core
 
-layout (location = 0) in vec3 a_position;
+layout (location = 0) in vec4 a_position;
 layout (location = 1) in vec3 a_normal;
 // layout (location = 2) in vec2 a_tex_coord;
 
@@ -12,13 +12,38 @@ layout (std140) uniform Matrices {
     mat4 view;
 };
 
+#ifdef INSTANCED
+// Renderer::InstanceData, one per instance
+layout (location = 3) in mat4 a_model;
+layout (location = 7) in mat3 a_inverse_model;
+layout (location = 10) in vec3 a_color;
+
+out vec3 instance_color;
+#else
 uniform mat4 model; // converts vectors to world_space
 uniform mat3 inverse_model;
+#endif
+
+// Quantized vertices have a w of 0 and octahedral normals, see QuantizedVertex
+vec3 unpack_normal(vec4 position, vec3 normal) {
+    if (position.w != 0.0f) {
+        return normal;
+    }
+    vec3 n = vec3(normal.xy, 1.0f - abs(normal.x) - abs(normal.y));
+    float fold = max(-n.z, 0.0f);
+    n.xy += vec2(n.x >= 0.0f ? -fold : fold, n.y >= 0.0f ? -fold : fold);
+    return n;
+}
 
 void main() {
-    gl_Position = projection * view * model * vec4(a_position, 1.0f);
-    frag_pos = vec3(model * vec4(a_position, 1.0f));
-    normal = normalize(inverse_model * a_normal);
+#ifdef INSTANCED
+    mat4 model = a_model;
+    mat3 inverse_model = a_inverse_model;
+    instance_color = a_color;
+#endif
+    gl_Position = projection * view * model * vec4(a_position.xyz, 1.0f);
+    frag_pos = vec3(model * vec4(a_position.xyz, 1.0f));
+    normal = normalize(inverse_model * unpack_normal(a_position, a_normal));
 
     // normal = (inverse_view * a_normal);
     // normal = normalize(inverse_view * a_normal);
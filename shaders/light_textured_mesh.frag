@@ -8,6 +8,10 @@ struct Material {
     float shininess;
 };
 
+// NOTE: the light structs and the Lights block follow std140 and have
+// to match the GpuData structs in light.hpp and Renderer::LightBlock.
+// floats are placed after vec3s to fill their padding. Point and spot
+// lights are read out of texture buffers in the same layout
 struct DirLight {
     vec3 direction;
     vec3 ambient;
@@ -17,35 +21,33 @@ struct DirLight {
 
 struct PointLight {
     vec3 position;
-
     float constant;
-    float linear;
-    float quadratic;
-
     vec3 ambient;
+    float linear;
     vec3 diffuse;
+    float quadratic;
     vec3 specular;
 };
 
 struct SpotLight {
     vec3 position;
-    vec3 direction;
-
     float constant;
+    vec3 direction;
     float linear;
-    float quadratic;
-
-    float inner_cutoff;
-    float outer_cutoff;
-
     vec3 ambient;
+    float quadratic;
     vec3 diffuse;
+    float inner_cutoff;
     vec3 specular;
+    float outer_cutoff;
 };
 
 vec3 calc_dir_light(DirLight light, vec3 normal, vec3 view_dir);
 vec3 calc_point_light(PointLight light, vec3 normal, vec3 frag_pos, vec3 view_dir);
 vec3 calc_spot_light(SpotLight light, vec3 normal, vec3 frag_pos, vec3 view_dir);
+PointLight fetch_point_light(int i);
+SpotLight fetch_spot_light(int i);
+int cluster_index();
 float calc_attenuation(float distance, float radius, float max_intensity, float falloff);
 
 in vec3 normal;
@@ -54,22 +56,39 @@ in vec2 tex_coord;
 
 out vec4 FragColor;
 
-#define MAX_POINT_LIGHTS 4
-#define MAX_SPOT_LIGHTS  4
-#define MAX_DIR_LIGHTS   4
+#define MAX_DIR_LIGHTS 4
+
+layout (std140) uniform Lights {
+    // How many lights are actually in use
+    uint n_point_lights_used;
+    uint n_spot_lights_used;
+    uint n_dir_lights_used;
+    vec3 view_pos;
+    DirLight dir_lights[MAX_DIR_LIGHTS];
+    // See LightClusters
+    uvec3 cluster_grid_size;
+    float cluster_z_scale;
+    vec2 cluster_tile_scale;
+    float cluster_z_bias;
+    float camera_near;
+    float camera_far;
+};
 
-// How many point lights are actually in use
-uniform uint n_point_lights_used;
-uniform uint n_spot_lights_used;
-uniform uint n_dir_lights_used;
+uniform samplerBuffer point_light_data;
+uniform samplerBuffer spot_light_data;
+// (offset into cluster_light_indices, point count | spot count << 16)
+uniform usamplerBuffer cluster_grid;
+uniform usamplerBuffer cluster_light_indices;
 
 uniform Material material;
-uniform DirLight dir_lights[MAX_DIR_LIGHTS];
-uniform PointLight point_lights[MAX_POINT_LIGHTS];
-uniform SpotLight spot_lights[MAX_SPOT_LIGHTS];
-uniform vec3 view_pos;
 
 void main() {
+#ifdef LOD_FADE
+    // From lod_fade.glsl
+    if (lod_faded_out()) {
+        discard;
+    }
+#endif
     vec3 view_direction = normalize(view_pos - frag_pos);
     // vec3 view_direction = normalize(-frag_pos);
 
@@ -78,12 +97,20 @@ void main() {
         result += calc_dir_light(dir_lights[i], normal, view_direction);
     }
 
-    for (uint i = 0; i < n_point_lights_used; i++) {
-        result += calc_point_light(point_lights[i], normal, frag_pos, view_direction);
+    // Only the lights whose range touches this fragment's cluster
+    uvec2 cluster = texelFetch(cluster_grid, cluster_index()).xy;
+    int offset = int(cluster.x);
+    int n_point = int(cluster.y & 0xFFFFu);
+    int n_spot = int(cluster.y >> 16);
+
+    for (int i = 0; i < n_point; i++) {
+        int light = int(texelFetch(cluster_light_indices, offset + i).x);
+        result += calc_point_light(fetch_point_light(light), normal, frag_pos, view_direction);
     }
 
-    for (uint i = 0; i < n_spot_lights_used; i++) {
-        result += calc_spot_light(spot_lights[i], normal, frag_pos, view_direction);
+    for (int i = 0; i < n_spot; i++) {
+        int light = int(texelFetch(cluster_light_indices, offset + n_point + i).x);
+        result += calc_spot_light(fetch_spot_light(light), normal, frag_pos, view_direction);
     }
 
     FragColor = vec4(result, 1.0f);
@@ -96,6 +123,55 @@ void main() {
     // }
 }
 
+int cluster_index() {
+    // Linear view depth from the depth buffer value
+    float ndc_z = gl_FragCoord.z * 2.0f - 1.0f;
+    float depth = (2.0f * camera_near * camera_far)
+        / (camera_far + camera_near - ndc_z * (camera_far - camera_near));
+    float slice = log(depth) * cluster_z_scale + cluster_z_bias;
+    uint z = uint(clamp(slice, 0.0f, float(cluster_grid_size.z - 1u)));
+    uvec2 tile = uvec2(min(gl_FragCoord.xy * cluster_tile_scale, vec2(cluster_grid_size.xy - 1u)));
+    return int(tile.x + cluster_grid_size.x * (tile.y + cluster_grid_size.y * z));
+}
+
+PointLight fetch_point_light(int i) {
+    vec4 t0 = texelFetch(point_light_data, i * 4);
+    vec4 t1 = texelFetch(point_light_data, i * 4 + 1);
+    vec4 t2 = texelFetch(point_light_data, i * 4 + 2);
+    vec4 t3 = texelFetch(point_light_data, i * 4 + 3);
+
+    PointLight light;
+    light.position = t0.xyz;
+    light.constant = t0.w;
+    light.ambient = t1.xyz;
+    light.linear = t1.w;
+    light.diffuse = t2.xyz;
+    light.quadratic = t2.w;
+    light.specular = t3.xyz;
+    return light;
+}
+
+SpotLight fetch_spot_light(int i) {
+    vec4 t0 = texelFetch(spot_light_data, i * 5);
+    vec4 t1 = texelFetch(spot_light_data, i * 5 + 1);
+    vec4 t2 = texelFetch(spot_light_data, i * 5 + 2);
+    vec4 t3 = texelFetch(spot_light_data, i * 5 + 3);
+    vec4 t4 = texelFetch(spot_light_data, i * 5 + 4);
+
+    SpotLight light;
+    light.position = t0.xyz;
+    light.constant = t0.w;
+    light.direction = t1.xyz;
+    light.linear = t1.w;
+    light.ambient = t2.xyz;
+    light.quadratic = t2.w;
+    light.diffuse = t3.xyz;
+    light.inner_cutoff = t3.w;
+    light.specular = t4.xyz;
+    light.outer_cutoff = t4.w;
+    return light;
+}
+
 vec3 calc_dir_light(DirLight light, vec3 normal, vec3 view_dir) {
     vec3 light_dir = normalize(-light.direction);
     // diffuse shading
@@ -0,0 +1,11 @@
+// Renderer adds this to the fragment stage of the LOD_FADE variants only,
+// discard keeps the gpu from rejecting hidden fragments early.
+// 4x4 ordered dither, two lods cross fading draw complementary pixels of it
+uniform float lod_fade;
+const int lod_dither[16] = int[16](0, 8, 2, 10, 12, 4, 14, 6, 3, 11, 1, 9, 15, 7, 13, 5);
+
+bool lod_faded_out() {
+    ivec2 p = ivec2(gl_FragCoord.xy) & 3;
+    float threshold = (float(lod_dither[p.y * 4 + p.x]) + 0.5f) / 16.0f;
+    return lod_fade > 0.0f ? threshold > lod_fade : threshold <= -lod_fade;
+}
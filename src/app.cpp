@@ -1,3 +1,5 @@
+#include <cmath>
+#include <cstring>
 #include <glm/gtc/type_ptr.hpp>
 #include <glad/glad.h>
 #include "app.hpp"
@@ -5,20 +7,23 @@
 #include "engine.hpp"
 #include "utils.hpp"
 #include "fs.hpp"
+#include "debug.hpp"
+#include "random.hpp"
 
 void App::init() {
     camera.velocity = 25;
     camera.transform.position = {0, 5, 7};
     camera.far = 500;
 
-    scene.set_skybox({
+    // Decoded in the background, shows up a few frames in
+    scene.set_skybox(assets.load_skybox({
         "textures/skybox/right.jpg",
         "textures/skybox/left.jpg",
         "textures/skybox/top.jpg",
         "textures/skybox/bottom.jpg",
         "textures/skybox/front.jpg",
         "textures/skybox/back.jpg"
-    });
+    }));
     ground.transform.scale = {
         200,
         1,
@@ -69,19 +74,21 @@ void App::init() {
         }
     };
     grass_mesh.indices = {
+        // lod 0
         0, 1, 3,
         1, 2, 3,
-        0, 3, 4
+        0, 3, 4,
+        // lod 1 & 2 - a single triangle
+        1, 2, 4
     };
     grass_mesh.create_buffers();
 
-    create_random_grass();
-    init_instance_vbo();
-
-    grass_mesh.draw_command.mode = DrawCommandMode::TRIANGLES;
-    grass_mesh.draw_command.type = DrawCommandType::DRAW_ELEMENTS_INSTANCED;
-    grass_mesh.draw_command.vertex_count = grass_mesh.indices.size();
-    grass_mesh.draw_command.instance_count = ngrass;
+    GrassCuller& culler = grass_field.culler;
+    culler.lods[0] = { 30, 0, 9, 0.125f };
+    culler.lods[1] = { 90, 9, 3, 0.5f };
+    culler.lods[2] = { camera.far, 9, 3, 0.25f };
+    grass_field.ground_height = 1;
+    grass_field.init(grass_mesh);
 }
 
 void App::update() {
@@ -89,111 +96,380 @@ void App::update() {
     /*    grass_shader.reload();*/
     /*}*/
 
+    grass_field.update(camera);
+    // The field has no edge so the ground just follows the camera around
+    ground.transform.position.x = camera.transform.position.x;
+    ground.transform.position.z = camera.transform.position.z;
+    ground.transform.scale.x = grass_field.view_radius * 2;
+    ground.transform.scale.z = grass_field.view_radius * 2;
+
     render_grass();
+    update_capsules();
 
     if (engine::cursor_enabled) {
         ImGui::Begin("scene");
         utils::imgui_cube("ground", ground);
         ImGui::Spacing();
         utils::imgui_point_light("light", light);
+        ImGui::Spacing();
+        imgui_grass();
+        ImGui::Spacing();
+        ImGui::DragInt("lamp count", &lamp_count, 10, 0, MAX_POINT_LIGHTS - 1);
+        if (ImGui::Button("spawn lamps")) {
+            spawn_lamps();
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("clear lamps")) {
+            clear_lamps();
+        }
+        ImGui::DragInt("grid cells", &grid_cell_count, 100, 4, 100000);
+        if (ImGui::Button(grid ? "remove grid" : "create grid")) {
+            toggle_grid();
+        }
+        ImGui::DragInt("store objects", &store_object_count, 1000, 0, 1000000);
+        if (ImGui::Button("spawn store objects")) {
+            spawn_store_objects();
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("clear store objects")) {
+            clear_store_objects();
+        }
+        ImGui::DragInt("lod capsules", &lod_object_count, 100, 0, 100000);
+        if (ImGui::Button("spawn lod capsules")) {
+            spawn_lod_objects();
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("clear lod capsules")) {
+            clear_lod_objects();
+        }
+        ImGui::Checkbox("quantized capsule", &quantized_capsule);
+        if (ImGui::Button("stream in capsule")) {
+            if (!capsule_model.valid() || capsule_model.failed()) {
+                capsule_model = assets.load_model(
+                    "models/capsule/capsule.obj",
+                    quantized_capsule ? VertexFormat::QUANTIZED : VertexFormat::FLOAT
+                );
+            }
+            // Placed once the model is ready
+            capsules.emplace_back();
+        }
+        if (capsule_model.valid()) {
+            ImGui::SameLine();
+            if (capsule_model.failed()) {
+                ImGui::Text("failed");
+            }
+            else if (capsule_model.ready()) {
+                ImGui::Text(
+                    "%zu placed, %zu bytes of vertices",
+                    capsules.size(),
+                    capsule_model.get().vertex_bytes()
+                );
+            }
+            else {
+                ImGui::Text("loading");
+            }
+        }
         ImGui::End();
     }
 }
 
-void App::cleanup() {
+void App::fixed_update() {
+    simulation_time += engine::fixed_delta_time;
+    for (size_t i = 0; i < capsules.size(); i++) {
+        Capsule& capsule = capsules[i];
+        if (!capsule.object) {
+            continue;
+        }
+        capsule.previous = capsule.current;
+        capsule.current.position.y = grass_field.ground_height + 2
+            + std::sin(simulation_time * 2 + i) * 0.5f;
+        capsule.current.rotation.yaw += 90 * engine::fixed_delta_time;
+    }
 }
 
-glm::mat4& App::create_grass_blade() {
-    grass_mats.emplace_back();
-    return grass_mats.back();
+void App::render(float alpha) {
+    for (Capsule& capsule : capsules) {
+        if (capsule.object) {
+            capsule.object->transform = Transform::lerp(capsule.previous, capsule.current, alpha);
+        }
+    }
 }
 
+void App::cleanup() {
+    clear_lamps();
+    clear_store_objects();
+    if (grid) {
+        toggle_grid();
+    }
+}
 
 void App::render_grass() {
+    grass_timer.begin();
+    grass_field.cull(camera);
+
     grass_shader.use();
-    renderer.send_light_data(grass_shader);
     grass_shader.set_mat4("projection", camera.get_perspective_matrix());
     grass_shader.set_mat4("view", camera.get_view_matrix());
     grass_shader.set_float("time", glfwGetTime());
     grass_shader.set_vec3("material.color", grass_color.clamped_vec3());
     grass_shader.set_float("material.shininess", 32);
-    renderer.render_mesh(grass_mesh);
+    grass_field.render(renderer, grass_shader);
+    grass_timer.end();
 }
 
-void App::create_random_grass() {
-    for (uint i = 0; i < ngrass; i++) {
-        auto& model = create_grass_blade();
-        Transform trans;
-        trans.position = random_point_on_ground();
-        trans.scale.x = 0.1f;
-        trans.rotation.yaw = utils::random_float(0, 10);
-        model = trans.get_mat4();
-        grass_mats.emplace_back(utils::inverse_model(model));
+void App::imgui_grass() {
+    GrassCuller& culler = grass_field.culler;
+    auto mb = [](size_t bytes) { return bytes / (1024.0f * 1024.0f); };
+
+    ImGui::Text(
+        "grass chunks: %u loaded, %u pending",
+        grass_field.loaded_chunk_count(),
+        grass_field.pending_chunk_count()
+    );
+    ImGui::Text(
+        "visible grass: %u / %zu",
+        culler.visible_count(),
+        grass_field.loaded_instance_count()
+    );
+    ImGui::Text("grass gpu time: %.3f ms", grass_timer.elapsed_ms());
+    ImGui::Text(
+        "grass instance memory: %.1f / %.1f MB (+ %.1f MB culling output)",
+        mb(grass_field.memory_used()),
+        mb(grass_field.memory_budget),
+        mb(culler.output_buffer_size())
+    );
+    // What the previous model + inverse model layout would use
+    ImGui::Text(
+        "mat4 instance memory: %.1f MB",
+        mb(grass_field.loaded_instance_count() * 2 * sizeof(glm::mat4))
+    );
+    // Changing the chunk size reloads every chunk
+    ImGui::DragFloat("chunk size", &grass_field.chunk_size, 1, 8, 128);
+    ImGui::DragFloat("view radius", &grass_field.view_radius, 1, 0, camera.far);
+    ImGui::DragFloat("density", &grass_field.density, 0.1f, 0.1f, 100);
+    for (uint i = 0; i < GrassCuller::max_lods; i++) {
+        std::string name = "lod " + std::to_string(i);
+        ImGui::DragFloat((name + " distance").c_str(), &culler.lods[i].max_distance);
+        ImGui::SameLine();
+        ImGui::Text("%u", culler.visible_count(i));
+    }
+
+    // NOTE: blocks for a few seconds, 16M blades need 256 MB
+    if (ImGui::Button("benchmark grass generation")) {
+        benchmark_grass_generation();
+    }
+    for (const auto& result : grass_benchmarks) {
+        ImGui::Text(
+            "%zuM blades: %.1f ms serial, %.1f ms on %u threads (%.1fx)%s",
+            result.count / 1000000,
+            result.serial_ms,
+            result.parallel_ms,
+            result.thread_count,
+            result.serial_ms / result.parallel_ms,
+            result.identical ? "" : " MISMATCH"
+        );
     }
 }
 
-void App::init_instance_vbo() {
-    glBindVertexArray(grass_mesh.vao());
-    
-    glGenBuffers(1, &instance_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
-    // * 2 here because there are two matricies per blade
-    glBufferData(GL_ARRAY_BUFFER, 2 * ngrass * sizeof(glm::mat4), &grass_mats[0], GL_STATIC_DRAW);
+void App::benchmark_grass_generation() {
+    static constexpr size_t counts[] = { 1000000, 4000000, 16000000 };
+    static constexpr uint64_t seed = 1234;
+
+    GrassField::Region region;
+    region.min = glm::vec2(-500);
+    region.size = glm::vec2(1000);
+    region.height = grass_field.ground_height;
+    region.blade_scale = grass_field.blade_scale;
+    region.max_yaw = grass_field.max_yaw;
+
+    ThreadPool pool;
+    grass_benchmarks.clear();
+    for (size_t count : counts) {
+        GrassBenchmark result;
+        result.count = count;
+        result.thread_count = pool.thread_count() + 1;
+
+        // Allocated up front so only generation is timed
+        std::vector<GrassInstance> serial(count);
+        std::vector<GrassInstance> parallel(count);
 
-    auto v4s = sizeof(glm::vec4);
+        double start = glfwGetTime();
+        GrassField::generate(region, seed, serial.data(), count);
+        result.serial_ms = (glfwGetTime() - start) * 1000.0;
 
-    // Model - binds to 3, 4, 5, 6
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 8*v4s, (void*)0);
-    glEnableVertexAttribArray(4);
-    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, 8*v4s, (void*)(1*v4s));
-    glEnableVertexAttribArray(5);
-    glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, 8*v4s, (void*)(2*v4s));
-    glEnableVertexAttribArray(6);
-    glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, 8*v4s, (void*)(3*v4s));
+        start = glfwGetTime();
+        GrassField::generate(region, seed, parallel.data(), count, &pool);
+        result.parallel_ms = (glfwGetTime() - start) * 1000.0;
+
+        result.identical = std::memcmp(
+            serial.data(),
+            parallel.data(),
+            count * sizeof(GrassInstance)
+        ) == 0;
+        LOG(
+            "%zu blades: %.1f ms serial, %.1f ms parallel, identical: %d",
+            count,
+            result.serial_ms,
+            result.parallel_ms,
+            result.identical
+        );
+        grass_benchmarks.push_back(result);
+    }
+}
 
-    glVertexAttribDivisor(3, 1);
-    glVertexAttribDivisor(4, 1);
-    glVertexAttribDivisor(5, 1);
-    glVertexAttribDivisor(6, 1);
+void App::spawn_lamps() {
+    clear_lamps();
 
-    // Inverse - binds to 7, 8, 9, 10
-    glEnableVertexAttribArray(7);
-    glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, 8*v4s, (void*)(4*v4s));
-    glEnableVertexAttribArray(8);
-    glVertexAttribPointer(8, 4, GL_FLOAT, GL_FALSE, 8*v4s, (void*)(5*v4s));
-    glEnableVertexAttribArray(9);
-    glVertexAttribPointer(9, 4, GL_FLOAT, GL_FALSE, 8*v4s, (void*)(6*v4s));
-    glEnableVertexAttribArray(10);
-    glVertexAttribPointer(10, 4, GL_FLOAT, GL_FALSE, 8*v4s, (void*)(7*v4s));
+    // Scattered over the visible part of the field, so most of them end up
+    // in the view frustum at once
+    glm::vec3 center = camera.transform.position;
+    float radius = grass_field.view_radius;
+    CounterRng rng(42);
+    for (int i = 0; i < lamp_count; i++) {
+        PointLight& lamp = scene.create_point_light();
+        lamp.position = {
+            center.x + rng.next_float(-radius, radius),
+            grass_field.ground_height + rng.next_float(0.5f, 3.0f),
+            center.z + rng.next_float(-radius, radius)
+        };
+        glm::vec3 color = {
+            rng.next_float(0.2f, 1.0f),
+            rng.next_float(0.2f, 1.0f),
+            rng.next_float(0.2f, 1.0f)
+        };
+        lamp.ambient = Color(0.0f);
+        lamp.diffuse = color;
+        lamp.specular = color * 0.5f;
+        // NOTE: fades out after about 14 units, which keeps the clusters small
+        lamp.constant = 1;
+        lamp.linear = 0;
+        lamp.quadratic = 2;
+        lamp.hidden = true;
+        lamps.push_back(&lamp);
+    }
+    LOG("Spawned %zu lamps", lamps.size());
+}
 
-    glVertexAttribDivisor(7, 1);
-    glVertexAttribDivisor(8, 1);
-    glVertexAttribDivisor(9, 1);
-    glVertexAttribDivisor(10, 1);
+void App::clear_lamps() {
+    for (PointLight* lamp : lamps) {
+        scene.delete_point_light(lamp);
+    }
+    lamps.clear();
+}
 
-    glBindVertexArray(0);
+void App::toggle_grid() {
+    if (grid) {
+        grid->delete_cells();
+        grid.reset();
+        return;
+    }
+    // Every cell is its own game object sharing the rect vao and
+    // basic_mesh, so they all end up in one instanced draw
+    grid = std::make_unique<Grid>();
+    grid->boundary.transform.position = { 0, grass_field.ground_height + 0.05f, 0 };
+    grid->boundary.transform.rotation.pitch = -90;
+    grid->boundary.transform.scale = { 200, 200, 200 };
+    grid->create_cells(grid_cell_count);
+    grid->add_to_scene();
+    LOG("Created a grid with %zu cells", grid->cell_count());
 }
 
-glm::vec3 App::random_point_on_ground() {
-    glm::vec3 p;
-    float start_x = ground.transform.position.x - (ground.transform.scale.x / 2);
-    float start_z = ground.transform.position.z + (ground.transform.scale.z / 2);
+void App::spawn_store_objects() {
+    clear_store_objects();
+
+    CounterRng rng(7);
+    if (!store_object_meshes) {
+        // Shared by every object, the store keeps them around
+        Mesh cube;
+        cube.set_vao(renderer.cube_vao());
+        cube.draw_command = Cube::cube_draw_command;
+        cube.set_bounds(AABB(glm::vec3(-0.5f), glm::vec3(0.5f)));
+        cube.occluder = cube.bounds;
+        store_object_meshes = scene.objects.add_meshes({ cube });
+        for (uint i = 0; i < 8; i++) {
+            store_object_materials.push_back(scene.objects.add_material(Material(Color(glm::vec3(
+                rng.next_float(0.2f, 1.0f),
+                rng.next_float(0.2f, 1.0f),
+                rng.next_float(0.2f, 1.0f)
+            )))));
+        }
+    }
+
+    // A square of cubes centered on the origin, two units apart
+    constexpr float spacing = 2.0f;
+    uint side = std::ceil(std::sqrt((float)store_object_count));
+    store_objects.reserve(store_object_count);
+    for (int i = 0; i < store_object_count; i++) {
+        Transform transform;
+        transform.position = {
+            (i % side - side * 0.5f) * spacing,
+            grass_field.ground_height + 0.5f,
+            (i / side - side * 0.5f) * spacing
+        };
+        transform.scale = glm::vec3(0.5f);
+        transform.rotation.yaw = rng.next_float(0, 90);
+        const Material* material = store_object_materials[rng.next_u32() % store_object_materials.size()];
+        store_objects.push_back(scene.objects.create(transform, store_object_meshes, material));
+    }
+    LOG("Spawned %zu store objects", store_objects.size());
+}
 
-    float end_x = ground.transform.position.x + (ground.transform.scale.x / 2);
-    float end_z = ground.transform.position.z - (ground.transform.scale.z / 2);
+void App::clear_store_objects() {
+    for (ObjectHandle handle : store_objects) {
+        scene.objects.destroy(handle);
+    }
+    store_objects.clear();
+}
 
-    static constexpr float constraint = 1;
+void App::spawn_lod_objects() {
+    clear_lod_objects();
 
-    start_x /= constraint;
-    end_x /= constraint;
-    start_z /= constraint;
-    end_z /= constraint;
+    if (!lod_model.loaded()) {
+        lod_model.load("models/capsule/capsule.obj");
+        lod_object_meshes = scene.objects.add_meshes(lod_model.meshes);
+        lod_object_material = scene.objects.add_material(Material(Color(glm::vec3(0.8f, 0.5f, 0.3f))));
+    }
 
-    p.x = utils::random_float(start_x, end_x);
-    p.y = 1;
-    p.z = utils::random_float(start_z, end_z);
+    // A square centered on the origin, wide enough that most of it is past
+    // the distance where the capsule is a few pixels tall
+    constexpr float spacing = 3.0f;
+    uint side = std::ceil(std::sqrt((float)lod_object_count));
+    CounterRng rng(11);
+    lod_objects.reserve(lod_object_count);
+    for (int i = 0; i < lod_object_count; i++) {
+        Transform transform;
+        transform.position = {
+            (i % side - side * 0.5f) * spacing,
+            grass_field.ground_height + 1.0f,
+            (i / side - side * 0.5f) * spacing
+        };
+        transform.rotation.yaw = rng.next_float(0, 360);
+        lod_objects.push_back(scene.objects.create(transform, lod_object_meshes, lod_object_material));
+    }
+    LOG("Spawned %zu lod capsules", lod_objects.size());
+}
 
-    return p;
+void App::clear_lod_objects() {
+    for (ObjectHandle handle : lod_objects) {
+        scene.objects.destroy(handle);
+    }
+    lod_objects.clear();
 }
 
+void App::update_capsules() {
+    if (!capsule_model.ready()) {
+        return;
+    }
+    for (size_t i = 0; i < capsules.size(); i++) {
+        Capsule& capsule = capsules[i];
+        if (capsule.object) {
+            continue;
+        }
+        Transform transform;
+        transform.position = { i * 3.0f, grass_field.ground_height + 2, -10 };
+        capsule.object = &scene.create_game_object(transform);
+        capsule.object->load_model_data(capsule_model.get());
+        capsule.previous = transform;
+        capsule.current = transform;
+    }
+}
@@ -1,18 +1,17 @@
 #include "engine.hpp"
+#include "gpu_timer.hpp"
+#include "grass_field.hpp"
+#include "grid.hpp"
 
 class App : public Application {
 public:
     void init() override;
+    void fixed_update() override;
     void update() override;
+    void render(float alpha) override;
     void cleanup() override;
 
     Mesh grass_mesh;
-    uint instance_vbo = 0;
-    // TODO: make this an array
-
-    static constexpr uint ngrass = 1000000;
-    std::vector<glm::mat4> grass_mats;
-    uint current_grass = 0;
 
     Color grass_color = Color(0, 255, 141);
 
@@ -22,11 +21,66 @@ public:
     float mult = 0.0220f;
 
     Shader grass_shader;
-    
-    glm::mat4& create_grass_blade();
+    GrassField grass_field;
+    GpuTimer grass_timer;
+
+    struct GrassBenchmark {
+        size_t count = 0;
+        uint thread_count = 0;
+        double serial_ms = 0;
+        double parallel_ms = 0;
+        // Parallel output matches the serial one byte for byte
+        bool identical = false;
+    };
+    std::vector<GrassBenchmark> grass_benchmarks;
+
+    // Stress test for the clustered lighting
+    std::vector<PointLight*> lamps;
+    int lamp_count = 2000;
+
+    // Stress test for the automatic instancing
+    std::unique_ptr<Grid> grid;
+    int grid_cell_count = 10000;
+
+    // Stress test for the object store, cubes created in it directly
+    // instead of as game objects
+    std::vector<ObjectHandle> store_objects;
+    const std::vector<Mesh>* store_object_meshes = nullptr;
+    std::vector<const Material*> store_object_materials;
+    int store_object_count = 100000;
+
+    // Lod benchmark, a field of capsules that gets coarser into the
+    // distance. Compare the game object triangles and lit pass gpu time in
+    // Settings > Renderer with lods on and off
+    Model lod_model;
+    std::vector<ObjectHandle> lod_objects;
+    const std::vector<Mesh>* lod_object_meshes = nullptr;
+    const Material* lod_object_material = nullptr;
+    int lod_object_count = 10000;
+
+    // Streamed in while the game is running. They bob and spin in
+    // fixed_update and get blended between the last two steps in render
+    struct Capsule {
+        GameObject* object = nullptr;
+        Transform previous;
+        Transform current;
+    };
+    AssetHandle<Model> capsule_model;
+    // Decides the format the capsule model gets loaded in the first time
+    bool quantized_capsule = true;
+    std::vector<Capsule> capsules;
+    double simulation_time = 0;
+
     void render_grass();
-    void create_random_grass();
-    void init_instance_vbo();
-    glm::vec3 random_point_on_ground();
+    void imgui_grass();
+    void benchmark_grass_generation();
+    void spawn_lamps();
+    void clear_lamps();
+    void toggle_grid();
+    void spawn_store_objects();
+    void clear_store_objects();
+    void spawn_lod_objects();
+    void clear_lod_objects();
+    void update_capsules();
 };
 
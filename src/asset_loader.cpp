@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "asset_loader.hpp"
+
+AssetLoader::AssetLoader(TextureCache& textures, uint thread_count)
+    : _textures(textures),
+      _pool(thread_count ? thread_count : std::max(1u, std::thread::hardware_concurrency() / 2)) {
+}
+
+AssetLoader::~AssetLoader() {
+    // Queued loads finish right away, their handles stay FAILED or LOADING
+    _stopping = true;
+}
+
+AssetHandle<TextureHandle> AssetLoader::load_texture(const std::string& path, bool default_texture_sampling) {
+    return load<TextureHandle, Texture2D::Image>(
+        path,
+        [this, path](TextureHandle&, Texture2D::Image& image) {
+            if (_textures.contains(path)) {
+                return true;
+            }
+            return Texture2D::decode(path, image);
+        },
+        [this, path, default_texture_sampling](TextureHandle& texture, Texture2D::Image& image) {
+            if (image.pixels) {
+                texture = _textures.upload(path, image, default_texture_sampling);
+            }
+            else {
+                // Normally a cache hit, unless it was freed since the decode
+                texture = _textures.load(path, default_texture_sampling);
+            }
+        }
+    );
+}
+
+AssetHandle<Skybox> AssetLoader::load_skybox(const std::array<std::string, 6>& face_textures) {
+    return load<Skybox, Skybox::Faces>(
+        face_textures[0],
+        [face_textures](Skybox& skybox, Skybox::Faces& faces) {
+            skybox.face_textures = face_textures;
+            return Skybox::decode(face_textures, faces);
+        },
+        [](Skybox& skybox, Skybox::Faces& faces) {
+            skybox.load(faces);
+        }
+    );
+}
+
+AssetHandle<Model> AssetLoader::load_model(const std::string& path, VertexFormat format) {
+    // The model keeps what it decoded until upload, so there's no payload
+    struct Empty {};
+    return load<Model, Empty>(
+        path,
+        [path, format](Model& model, Empty&) {
+            return model.decode(path, format);
+        },
+        [](Model& model, Empty&) {
+            model.upload();
+        }
+    );
+}
+
+void AssetLoader::update() {
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed_ms = [start]() {
+        return std::chrono::duration<float, std::milli>(
+            std::chrono::steady_clock::now() - start
+        ).count();
+    };
+
+    _stats.uploads = 0;
+    std::function<void()> upload;
+    while ((_stats.uploads == 0 || elapsed_ms() < upload_budget_ms) && _uploads.pop(upload)) {
+        upload();
+        _stats.uploads++;
+    }
+    _stats.upload_ms = elapsed_ms();
+    _stats.in_flight = _in_flight;
+}
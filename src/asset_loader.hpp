@@ -0,0 +1,158 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include "common.hpp"
+#include "debug.hpp"
+#include "model.hpp"
+#include "mpmc_queue.hpp"
+#include "skybox.hpp"
+#include "texture2d.hpp"
+#include "texture_cache.hpp"
+#include "thread_pool.hpp"
+
+enum class AssetStatus {
+    LOADING,
+    READY,
+    FAILED,
+};
+
+namespace detail {
+    // Shared between a handle and the loader
+    template<typename T>
+    struct AssetState {
+        std::atomic<AssetStatus> status{AssetStatus::LOADING};
+        std::string name;
+        T asset;
+    };
+}
+
+// Refers to an asset that's loading in the background. Copies share the
+// same asset, and it can only be used once it's ready
+template<typename T>
+class AssetHandle {
+public:
+    AssetHandle() {}
+
+    // False for a default constructed handle
+    bool valid() const { return _state != nullptr; }
+    AssetStatus status() const {
+        ASSERT(valid(), "Asset handle doesn't refer to an asset");
+        return _state->status.load(std::memory_order_acquire);
+    }
+    bool ready() const { return valid() && status() == AssetStatus::READY; }
+    bool failed() const { return valid() && status() == AssetStatus::FAILED; }
+    const std::string& name() const { return _state->name; }
+
+    T& get() const {
+        ASSERT(ready(), "Asset %s used before it was ready", valid() ? name().c_str() : "(null)");
+        return _state->asset;
+    }
+
+private:
+    friend class AssetLoader;
+    std::shared_ptr<detail::AssetState<T>> _state;
+};
+
+// Loads assets without blocking the gl thread. Reading and decoding happen
+// on worker threads, and what they produce goes into a lock free queue of
+// uploads. update() runs those on the gl thread, as many as fit in
+// upload_budget_ms every frame, so a burst of finished assets doesn't
+// cause a hitch.
+//
+// NOTE: at least one upload runs every update, so a single big one (like a
+// 4k texture) can still go over the budget
+class AssetLoader {
+public:
+    struct Stats {
+        // Still being decoded or waiting for their upload
+        uint in_flight = 0;
+        // Last update
+        uint uploads = 0;
+        float upload_ms = 0;
+    };
+
+    float upload_budget_ms = 2.0f;
+
+    // Textures are uploaded into textures. 0 threads uses half the
+    // hardware threads, the rest are left for the game
+    AssetLoader(TextureCache& textures, uint thread_count = 0);
+    ~AssetLoader();
+
+    AssetLoader(const AssetLoader&) = delete;
+    AssetLoader& operator=(const AssetLoader&) = delete;
+
+    // Skips decoding if the texture cache already has it
+    AssetHandle<TextureHandle> load_texture(const std::string& path, bool default_texture_sampling = true);
+    // Provide the faces in the order Skybox::face_textures wants
+    AssetHandle<Skybox> load_skybox(const std::array<std::string, 6>& face_textures);
+    AssetHandle<Model> load_model(const std::string& path, VertexFormat format = VertexFormat::FLOAT);
+
+    // Runs finished uploads, has to be called on the gl thread
+    void update();
+
+    uint thread_count() const { return _pool.thread_count(); }
+    const Stats& stats() const { return _stats; }
+
+private:
+    // Workers wait for a free slot if this many uploads are pending
+    static constexpr size_t upload_capacity = 256;
+
+    MpmcQueue<std::function<void()>> _uploads{upload_capacity};
+    std::atomic<uint> _in_flight{0};
+    std::atomic<bool> _stopping{false};
+    Stats _stats;
+    TextureCache& _textures;
+    // Last so it's destroyed first, the workers use everything above
+    ThreadPool _pool;
+
+    // decode(payload) runs on a worker and returns false if the asset can't
+    // be loaded, upload(asset, payload) runs on the gl thread after it
+    template<typename T, typename Payload>
+    AssetHandle<T> load(
+        const std::string& name,
+        std::function<bool(T&, Payload&)> decode,
+        std::function<void(T&, Payload&)> upload
+    );
+};
+
+template<typename T, typename Payload>
+AssetHandle<T> AssetLoader::load(
+    const std::string& name,
+    std::function<bool(T&, Payload&)> decode,
+    std::function<void(T&, Payload&)> upload) {
+
+    AssetHandle<T> handle;
+    handle._state = std::make_shared<detail::AssetState<T>>();
+    handle._state->name = name;
+    _in_flight++;
+
+    auto state = handle._state;
+    _pool.submit([this, state, decode, upload]() {
+        auto payload = std::make_shared<Payload>();
+        if (_stopping || !decode(state->asset, *payload)) {
+            LOG("WARNING: failed to load asset %s", state->name.c_str());
+            state->status.store(AssetStatus::FAILED, std::memory_order_release);
+            _in_flight--;
+            return;
+        }
+
+        std::function<void()> task = [this, state, payload, upload]() {
+            upload(state->asset, *payload);
+            state->status.store(AssetStatus::READY, std::memory_order_release);
+            _in_flight--;
+        };
+        // Only full if the gl thread is far behind, so just wait it out
+        while (!_uploads.push(std::move(task))) {
+            if (_stopping) {
+                return;
+            }
+            std::this_thread::yield();
+        }
+    });
+    return handle;
+}
@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <cmath>
+#include "bounds.hpp"
+#include "vertex.hpp"
+
+float AABB::surface_area() const {
+    if (!valid()) {
+        return 0;
+    }
+    glm::vec3 size = max - min;
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+void AABB::expand(const glm::vec3& point) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+}
+
+void AABB::expand(const AABB& box) {
+    min = glm::min(min, box.min);
+    max = glm::max(max, box.max);
+}
+
+bool AABB::contains(const glm::vec3& point) const {
+    return point.x >= min.x && point.x <= max.x
+        && point.y >= min.y && point.y <= max.y
+        && point.z >= min.z && point.z <= max.z;
+}
+
+bool AABB::contains(const AABB& box) const {
+    return box.min.x >= min.x && box.max.x <= max.x
+        && box.min.y >= min.y && box.max.y <= max.y
+        && box.min.z >= min.z && box.max.z <= max.z;
+}
+
+bool AABB::intersects(const AABB& box) const {
+    return box.min.x <= max.x && box.max.x >= min.x
+        && box.min.y <= max.y && box.max.y >= min.y
+        && box.min.z <= max.z && box.max.z >= min.z;
+}
+
+AABB AABB::transformed(const glm::mat4& matrix) const {
+    if (!valid()) {
+        return *this;
+    }
+    // Arvo's method. The new extent along each axis is the extent projected
+    // onto it through the absolute value of the rotation and scale
+    glm::vec3 new_center = glm::vec3(matrix * glm::vec4(center(), 1.0f));
+    glm::vec3 e = extent();
+    glm::vec3 new_extent =
+        glm::abs(glm::vec3(matrix[0])) * e.x
+      + glm::abs(glm::vec3(matrix[1])) * e.y
+      + glm::abs(glm::vec3(matrix[2])) * e.z;
+    return AABB(new_center - new_extent, new_center + new_extent);
+}
+
+AABB AABB::merge(const AABB& a, const AABB& b) {
+    return AABB(glm::min(a.min, b.min), glm::max(a.max, b.max));
+}
+
+AABB bounds::compute_aabb(const Vertex* vertices, size_t vertex_count) {
+    AABB box;
+    for (size_t i = 0; i < vertex_count; i++) {
+        box.expand(vertices[i].position);
+    }
+    return box;
+}
+
+BoundingSphere bounds::compute_sphere(const Vertex* vertices, size_t vertex_count, const AABB& box) {
+    BoundingSphere sphere;
+    if (!box.valid()) {
+        return sphere;
+    }
+    sphere.center = box.center();
+    float radius_squared = 0;
+    for (size_t i = 0; i < vertex_count; i++) {
+        glm::vec3 offset = vertices[i].position - sphere.center;
+        radius_squared = std::max(radius_squared, glm::dot(offset, offset));
+    }
+    sphere.radius = std::sqrt(radius_squared);
+    return sphere;
+}
+
+BoundingSphere bounds::sphere_around(const AABB& box) {
+    BoundingSphere sphere;
+    if (box.valid()) {
+        sphere.center = box.center();
+        sphere.radius = glm::length(box.extent());
+    }
+    return sphere;
+}
+
+bool bounds::sphere_intersects_aabb(const glm::vec3& center, float radius, const AABB& box) {
+    glm::vec3 closest = glm::clamp(center, box.min, box.max);
+    glm::vec3 offset = closest - center;
+    return glm::dot(offset, offset) <= radius * radius;
+}
+
+bool bounds::ray_intersects_aabb(
+    const glm::vec3& origin,
+    const glm::vec3& inverse_direction,
+    const AABB& box,
+    float max_distance,
+    float& distance) {
+
+    glm::vec3 t0 = (box.min - origin) * inverse_direction;
+    glm::vec3 t1 = (box.max - origin) * inverse_direction;
+    glm::vec3 t_near = glm::min(t0, t1);
+    glm::vec3 t_far = glm::max(t0, t1);
+    float enter = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, 0.0f));
+    float exit = std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, max_distance));
+    if (enter > exit) {
+        return false;
+    }
+    distance = enter;
+    return true;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cfloat>
+#include <cstddef>
+#include <glm/glm.hpp>
+
+struct Vertex;
+
+// Axis aligned bounding box. A default constructed box is empty (min above
+// max), expanding it by anything gives a box around just that
+struct AABB {
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+
+    AABB() = default;
+    AABB(const glm::vec3& min, const glm::vec3& max) : min(min), max(max) {}
+
+    bool valid() const {
+        return min.x <= max.x && min.y <= max.y && min.z <= max.z;
+    }
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+    // Half the size along each axis
+    glm::vec3 extent() const { return (max - min) * 0.5f; }
+    float surface_area() const;
+
+    void expand(const glm::vec3& point);
+    void expand(const AABB& box);
+    // Same box pushed out by margin on every side
+    AABB grown(const glm::vec3& margin) const { return AABB(min - margin, max + margin); }
+
+    bool contains(const glm::vec3& point) const;
+    bool contains(const AABB& box) const;
+    bool intersects(const AABB& box) const;
+
+    // Smallest box around this one after it's been transformed
+    AABB transformed(const glm::mat4& matrix) const;
+
+    static AABB merge(const AABB& a, const AABB& b);
+};
+
+inline bool operator==(const AABB& a, const AABB& b) {
+    return a.min == b.min && a.max == b.max;
+}
+inline bool operator!=(const AABB& a, const AABB& b) {
+    return !(a == b);
+}
+
+struct BoundingSphere {
+    glm::vec3 center = glm::vec3(0);
+    // Negative if there's nothing to bound
+    float radius = -1;
+
+    bool valid() const { return radius >= 0; }
+};
+
+namespace bounds {
+
+AABB compute_aabb(const Vertex* vertices, size_t vertex_count);
+// Centered on box, reaches the vertex furthest from the center. Tighter than
+// the sphere around the box for anything round
+BoundingSphere compute_sphere(const Vertex* vertices, size_t vertex_count, const AABB& box);
+BoundingSphere sphere_around(const AABB& box);
+
+bool sphere_intersects_aabb(const glm::vec3& center, float radius, const AABB& box);
+// Slab test. inverse_direction is 1 / direction per component, distance is
+// where the ray enters the box (0 if it starts inside)
+bool ray_intersects_aabb(
+    const glm::vec3& origin,
+    const glm::vec3& inverse_direction,
+    const AABB& box,
+    float max_distance,
+    float& distance
+);
+
+}
@@ -0,0 +1,627 @@
+#include <algorithm>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "bvh.hpp"
+#include "cpu_timer.hpp"
+#include "debug.hpp"
+#include "random.hpp"
+
+// Parent of a node on the free list
+static constexpr int free_parent = -3;
+
+// Planes of the frustum box can still be outside of, one bit each. A box
+// fully inside a plane clears its bit, nothing below it has to test that
+// plane again
+static constexpr uint all_planes = (1u << 6) - 1;
+
+enum class PlaneTest {
+    OUTSIDE,
+    INSIDE,
+    INTERSECTS,
+};
+
+static PlaneTest test_planes(const Frustum& frustum, const AABB& box, uint& mask) {
+    glm::vec3 center = box.center();
+    glm::vec3 extent = box.extent();
+    for (uint i = 0; i < 6; i++) {
+        uint bit = 1u << i;
+        if (!(mask & bit)) {
+            continue;
+        }
+        const glm::vec4& plane = frustum.planes[i];
+        glm::vec3 normal(plane);
+        float distance = glm::dot(normal, center) + plane.w;
+        float radius = glm::dot(glm::abs(normal), extent);
+        if (distance + radius < 0) {
+            return PlaneTest::OUTSIDE;
+        }
+        if (distance - radius >= 0) {
+            mask &= ~bit;
+        }
+    }
+    return mask == 0 ? PlaneTest::INSIDE : PlaneTest::INTERSECTS;
+}
+
+int Bvh::allocate_node() {
+    if (_free_nodes.empty()) {
+        _nodes.emplace_back();
+        return _nodes.size() - 1;
+    }
+    int node = _free_nodes.back();
+    _free_nodes.pop_back();
+    _nodes[node] = Node();
+    return node;
+}
+
+void Bvh::free_node(int node) {
+    _nodes[node].parent = free_parent;
+    _nodes[node].left = null_node;
+    _free_nodes.push_back(node);
+}
+
+AABB Bvh::fatten(const AABB& box) const {
+    return box.grown(glm::vec3(fat_margin) + (box.max - box.min) * fat_scale);
+}
+
+int Bvh::insert(const AABB& box, uint user_data) {
+    ASSERT(box.valid(), "Bvh leaves need a valid box");
+    int proxy;
+    if (!_free_proxies.empty()) {
+        proxy = _free_proxies.back();
+        _free_proxies.pop_back();
+    }
+    else {
+        proxy = _proxies.size();
+        _proxies.emplace_back();
+    }
+    _proxies[proxy].node = null_node;
+    _proxies[proxy].pending = _pending.size();
+    _pending.push_back({ box, user_data, proxy });
+    _leaf_count++;
+    return proxy;
+}
+
+void Bvh::remove(int proxy) {
+    ASSERT(
+        proxy >= 0 && proxy < (int)_proxies.size()
+            && (_proxies[proxy].node != null_node || _proxies[proxy].pending != null_node),
+        "Bvh proxy %d doesn't exist",
+        proxy
+    );
+    Proxy& p = _proxies[proxy];
+    if (p.pending != null_node) {
+        _pending[p.pending] = _pending.back();
+        _proxies[_pending[p.pending].proxy].pending = p.pending;
+        _pending.pop_back();
+    }
+    else {
+        unlink_leaf(p.node);
+        free_node(p.node);
+        _changes++;
+    }
+    p.node = null_node;
+    p.pending = null_node;
+    _free_proxies.push_back(proxy);
+    _leaf_count--;
+}
+
+bool Bvh::update(int proxy, const AABB& box) {
+    ASSERT(box.valid(), "Bvh leaves need a valid box");
+    const Proxy& p = _proxies[proxy];
+    if (p.pending != null_node) {
+        _pending[p.pending].box = box;
+        return false;
+    }
+    Node& node = _nodes[p.node];
+    node.tight = box;
+    if (node.bounds.contains(box)) {
+        return false;
+    }
+    node.bounds = fatten(box);
+    refit_from(node.parent);
+    _changes++;
+    return true;
+}
+
+uint Bvh::user_data(int proxy) const {
+    const Proxy& p = _proxies[proxy];
+    if (p.pending != null_node) {
+        return _pending[p.pending].user_data;
+    }
+    return _nodes[p.node].user_data;
+}
+
+const AABB& Bvh::bounds(int proxy) const {
+    const Proxy& p = _proxies[proxy];
+    if (p.pending != null_node) {
+        return _pending[p.pending].box;
+    }
+    return _nodes[p.node].tight;
+}
+
+void Bvh::clear() {
+    _nodes.clear();
+    _free_nodes.clear();
+    _proxies.clear();
+    _free_proxies.clear();
+    _pending.clear();
+    _root = null_node;
+    _leaf_count = 0;
+    _changes = 0;
+    _built_cost = 0;
+}
+
+void Bvh::commit() {
+    if (!_pending.empty()) {
+        // Each insert walks down the tree on its own and the order they come
+        // in decides the shape, building it all at once is faster and better
+        if (_pending.size() > 64 && _pending.size() * 4 > _leaf_count) {
+            rebuild();
+            return;
+        }
+        for (const Pending& pending : _pending) {
+            int leaf = allocate_node();
+            Node& node = _nodes[leaf];
+            node.tight = pending.box;
+            node.bounds = fatten(pending.box);
+            node.right = pending.proxy;
+            node.user_data = pending.user_data;
+            _proxies[pending.proxy].node = leaf;
+            _proxies[pending.proxy].pending = null_node;
+            link_leaf(leaf);
+        }
+        _changes += _pending.size();
+        _pending.clear();
+    }
+    if (_changes >= 32 && _changes * 8 > _leaf_count) {
+        if (cost() > _built_cost * 1.25f) {
+            rebuild();
+        }
+        _changes = 0;
+    }
+}
+
+void Bvh::rebuild() {
+    std::vector<Node> leaves;
+    leaves.reserve(_leaf_count);
+    for (const Node& node : _nodes) {
+        if (node.parent != free_parent && node.leaf()) {
+            leaves.push_back(node);
+        }
+    }
+    for (const Pending& pending : _pending) {
+        Node& node = leaves.emplace_back();
+        node.tight = pending.box;
+        node.bounds = fatten(pending.box);
+        node.right = pending.proxy;
+        node.user_data = pending.user_data;
+        _proxies[pending.proxy].pending = null_node;
+    }
+    _pending.clear();
+
+    std::vector<BuildItem> items(leaves.size());
+    for (size_t i = 0; i < leaves.size(); i++) {
+        items[i].center = leaves[i].bounds.center();
+        items[i].leaf = i;
+    }
+    _nodes.clear();
+    _free_nodes.clear();
+    _nodes.reserve(leaves.empty() ? 0 : leaves.size() * 2 - 1);
+    _root = leaves.empty() ? null_node : build_range(items.data(), items.size(), leaves);
+    if (_root != null_node) {
+        _nodes[_root].parent = null_node;
+    }
+    _changes = 0;
+    _built_cost = cost();
+}
+
+int Bvh::build_range(BuildItem* items, size_t count, const std::vector<Node>& leaves) {
+    int node = allocate_node();
+    if (count == 1) {
+        _nodes[node] = leaves[items[0].leaf];
+        _proxies[_nodes[node].right].node = node;
+        return node;
+    }
+    // Median split along the axis the centers are spread out the most on
+    AABB center_bounds;
+    for (size_t i = 0; i < count; i++) {
+        center_bounds.expand(items[i].center);
+    }
+    glm::vec3 size = center_bounds.max - center_bounds.min;
+    int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+    size_t half = count / 2;
+    std::nth_element(items, items + half, items + count, [axis](const BuildItem& a, const BuildItem& b) {
+        return a.center[axis] < b.center[axis];
+    });
+
+    int left = build_range(items, half, leaves);
+    int right = build_range(items + half, count - half, leaves);
+    _nodes[node].left = left;
+    _nodes[node].right = right;
+    _nodes[node].bounds = AABB::merge(_nodes[left].bounds, _nodes[right].bounds);
+    _nodes[left].parent = node;
+    _nodes[right].parent = node;
+    return node;
+}
+
+void Bvh::link_leaf(int leaf) {
+    if (_root == null_node) {
+        _root = leaf;
+        _nodes[leaf].parent = null_node;
+        return;
+    }
+
+    // Walk down to the cheapest sibling by surface area, stopping once going
+    // further down can't beat pairing up with the current node
+    AABB leaf_box = _nodes[leaf].bounds;
+    int index = _root;
+    while (!_nodes[index].leaf()) {
+        const Node& node = _nodes[index];
+        float area = node.bounds.surface_area();
+        float combined_area = AABB::merge(node.bounds, leaf_box).surface_area();
+        // A new parent for this node and the leaf
+        float cost = 2 * combined_area;
+        // Every node above the new parent grows by at least this much
+        float inherited_cost = 2 * (combined_area - area);
+
+        auto child_cost = [&](int child) {
+            const Node& c = _nodes[child];
+            float merged = AABB::merge(c.bounds, leaf_box).surface_area();
+            if (c.leaf()) {
+                return merged + inherited_cost;
+            }
+            return merged - c.bounds.surface_area() + inherited_cost;
+        };
+        float left_cost = child_cost(node.left);
+        float right_cost = child_cost(node.right);
+        if (cost < left_cost && cost < right_cost) {
+            break;
+        }
+        index = left_cost < right_cost ? node.left : node.right;
+    }
+
+    int sibling = index;
+    int old_parent = _nodes[sibling].parent;
+    int new_parent = allocate_node();
+    _nodes[new_parent].parent = old_parent;
+    _nodes[new_parent].left = sibling;
+    _nodes[new_parent].right = leaf;
+    _nodes[new_parent].bounds = AABB::merge(_nodes[sibling].bounds, leaf_box);
+    _nodes[sibling].parent = new_parent;
+    _nodes[leaf].parent = new_parent;
+
+    if (old_parent == null_node) {
+        _root = new_parent;
+        return;
+    }
+    if (_nodes[old_parent].left == sibling) {
+        _nodes[old_parent].left = new_parent;
+    }
+    else {
+        _nodes[old_parent].right = new_parent;
+    }
+    refit_from(old_parent);
+}
+
+void Bvh::unlink_leaf(int leaf) {
+    if (leaf == _root) {
+        _root = null_node;
+        return;
+    }
+    int parent = _nodes[leaf].parent;
+    int grandparent = _nodes[parent].parent;
+    int sibling = _nodes[parent].left == leaf ? _nodes[parent].right : _nodes[parent].left;
+
+    // The sibling takes the parent's place
+    _nodes[sibling].parent = grandparent;
+    if (grandparent == null_node) {
+        _root = sibling;
+    }
+    else {
+        if (_nodes[grandparent].left == parent) {
+            _nodes[grandparent].left = sibling;
+        }
+        else {
+            _nodes[grandparent].right = sibling;
+        }
+        refit_from(grandparent);
+    }
+    free_node(parent);
+    _nodes[leaf].parent = null_node;
+}
+
+void Bvh::refit_from(int node) {
+    while (node != null_node) {
+        Node& n = _nodes[node];
+        AABB bounds = AABB::merge(_nodes[n.left].bounds, _nodes[n.right].bounds);
+        // Nothing above can change either
+        if (bounds == n.bounds) {
+            return;
+        }
+        n.bounds = bounds;
+        node = n.parent;
+    }
+}
+
+uint Bvh::height() const {
+    if (_root == null_node) {
+        return 0;
+    }
+    uint height = 0;
+    std::vector<std::pair<int, uint>> stack = { { _root, 1 } };
+    while (!stack.empty()) {
+        auto [node, depth] = stack.back();
+        stack.pop_back();
+        height = std::max(height, depth);
+        if (!_nodes[node].leaf()) {
+            stack.push_back({ _nodes[node].left, depth + 1 });
+            stack.push_back({ _nodes[node].right, depth + 1 });
+        }
+    }
+    return height;
+}
+
+float Bvh::cost() const {
+    if (_root == null_node) {
+        return 0;
+    }
+    float root_area = _nodes[_root].bounds.surface_area();
+    if (root_area <= 0) {
+        return 0;
+    }
+    float area = 0;
+    for (size_t i = 0; i < _nodes.size(); i++) {
+        const Node& node = _nodes[i];
+        if (node.parent != free_parent && !node.leaf()) {
+            area += node.bounds.surface_area();
+        }
+    }
+    return area / root_area;
+}
+
+void Bvh::collect_leaves(int root, std::vector<uint>& results) const {
+    int stack[64];
+    int top = 0;
+    stack[top++] = root;
+    while (top > 0) {
+        const Node& node = _nodes[stack[--top]];
+        if (node.leaf()) {
+            results.push_back(node.user_data);
+        }
+        else if (top + 2 <= 64) {
+            // Left on top, it's the next node in memory after a rebuild
+            stack[top++] = node.right;
+            stack[top++] = node.left;
+        }
+        else {
+            // Only a badly unbalanced tree gets this deep
+            collect_leaves(node.left, results);
+            collect_leaves(node.right, results);
+        }
+    }
+}
+
+void Bvh::query_frustum(const Frustum& frustum, std::vector<uint>& results) const {
+    if (_root == null_node) {
+        return;
+    }
+    struct Entry {
+        int node;
+        uint mask;
+    };
+    std::vector<Entry> stack;
+    stack.reserve(64);
+    stack.push_back({ _root, all_planes });
+    while (!stack.empty()) {
+        Entry entry = stack.back();
+        stack.pop_back();
+        const Node& node = _nodes[entry.node];
+        uint mask = entry.mask;
+        const AABB& box = node.leaf() ? node.tight : node.bounds;
+        PlaneTest test = test_planes(frustum, box, mask);
+        if (test == PlaneTest::OUTSIDE) {
+            continue;
+        }
+        if (node.leaf()) {
+            results.push_back(node.user_data);
+        }
+        else if (test == PlaneTest::INSIDE) {
+            collect_leaves(entry.node, results);
+        }
+        else {
+            stack.push_back({ node.right, mask });
+            stack.push_back({ node.left, mask });
+        }
+    }
+}
+
+void Bvh::query_aabb(const AABB& box, std::vector<uint>& results) const {
+    if (_root == null_node) {
+        return;
+    }
+    std::vector<int> stack;
+    stack.reserve(64);
+    stack.push_back(_root);
+    while (!stack.empty()) {
+        const Node& node = _nodes[stack.back()];
+        stack.pop_back();
+        if (node.leaf()) {
+            if (node.tight.intersects(box)) {
+                results.push_back(node.user_data);
+            }
+        }
+        else if (node.bounds.intersects(box)) {
+            stack.push_back(node.right);
+            stack.push_back(node.left);
+        }
+    }
+}
+
+void Bvh::query_sphere(const glm::vec3& center, float radius, std::vector<uint>& results) const {
+    if (_root == null_node) {
+        return;
+    }
+    std::vector<int> stack;
+    stack.reserve(64);
+    stack.push_back(_root);
+    while (!stack.empty()) {
+        const Node& node = _nodes[stack.back()];
+        stack.pop_back();
+        if (node.leaf()) {
+            if (bounds::sphere_intersects_aabb(center, radius, node.tight)) {
+                results.push_back(node.user_data);
+            }
+        }
+        else if (bounds::sphere_intersects_aabb(center, radius, node.bounds)) {
+            stack.push_back(node.right);
+            stack.push_back(node.left);
+        }
+    }
+}
+
+std::optional<Bvh::RayHit> Bvh::raycast(
+    const glm::vec3& origin,
+    const glm::vec3& direction,
+    float max_distance) const {
+
+    if (_root == null_node) {
+        return {};
+    }
+    glm::vec3 inverse_direction = 1.0f / direction;
+    std::optional<RayHit> hit;
+    float closest = max_distance;
+
+    std::vector<std::pair<int, float>> stack;
+    stack.reserve(64);
+    float distance;
+    if (!bounds::ray_intersects_aabb(origin, inverse_direction, _nodes[_root].bounds, closest, distance)) {
+        return {};
+    }
+    stack.push_back({ _root, distance });
+    while (!stack.empty()) {
+        auto [index, entry] = stack.back();
+        stack.pop_back();
+        // Something closer was hit since this was pushed
+        if (entry > closest) {
+            continue;
+        }
+        const Node& node = _nodes[index];
+        if (node.leaf()) {
+            if (bounds::ray_intersects_aabb(origin, inverse_direction, node.tight, closest, distance)) {
+                closest = distance;
+                hit = RayHit{ node.user_data, distance };
+            }
+            continue;
+        }
+        float left_distance, right_distance;
+        bool left = bounds::ray_intersects_aabb(
+            origin, inverse_direction, _nodes[node.left].bounds, closest, left_distance);
+        bool right = bounds::ray_intersects_aabb(
+            origin, inverse_direction, _nodes[node.right].bounds, closest, right_distance);
+        // Nearer child goes on top so it's visited first
+        if (left && right) {
+            if (left_distance < right_distance) {
+                stack.push_back({ node.right, right_distance });
+                stack.push_back({ node.left, left_distance });
+            }
+            else {
+                stack.push_back({ node.left, left_distance });
+                stack.push_back({ node.right, right_distance });
+            }
+        }
+        else if (left) {
+            stack.push_back({ node.left, left_distance });
+        }
+        else if (right) {
+            stack.push_back({ node.right, right_distance });
+        }
+    }
+    return hit;
+}
+
+Bvh::BenchmarkResult Bvh::benchmark(size_t count) {
+    CounterRng rng(42);
+    std::vector<AABB> boxes(count);
+    for (auto& box : boxes) {
+        glm::vec3 center(rng.next_float(-500, 500), rng.next_float(0, 20), rng.next_float(-500, 500));
+        glm::vec3 half_size(rng.next_float(0.25f, 2), rng.next_float(0.25f, 2), rng.next_float(0.25f, 2));
+        box = AABB(center - half_size, center + half_size);
+    }
+
+    BenchmarkResult result;
+    result.count = count;
+
+    Bvh bvh;
+    CpuTimer timer;
+    for (size_t i = 0; i < count; i++) {
+        bvh.insert(boxes[i], i);
+    }
+    bvh.commit();
+    result.build_ms = timer.elapsed_ms();
+    result.height = bvh.height();
+
+    constexpr int directions = 16;
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 500.0f);
+    std::vector<Frustum> frustums;
+    for (int i = 0; i < directions; i++) {
+        float angle = glm::two_pi<float>() * i / directions;
+        glm::vec3 eye(0, 10, 0);
+        glm::vec3 forward(std::cos(angle), -0.1f, std::sin(angle));
+        frustums.emplace_back(projection * glm::lookAt(eye, eye + forward, glm::vec3(0, 1, 0)));
+    }
+
+    std::vector<uint> visible;
+    visible.reserve(count);
+    timer.restart();
+    for (const Frustum& frustum : frustums) {
+        visible.clear();
+        bvh.query_frustum(frustum, visible);
+        result.visible += visible.size();
+    }
+    result.frustum_ms = timer.elapsed_ms() / directions;
+    result.visible /= directions;
+
+    // Every box against every frustum, what the renderer would have to do
+    // without the tree
+    timer.restart();
+    for (const Frustum& frustum : frustums) {
+        visible.clear();
+        for (size_t i = 0; i < count; i++) {
+            if (frustum.intersects_aabb(boxes[i].min, boxes[i].max)) {
+                visible.push_back(i);
+            }
+        }
+    }
+    result.brute_force_ms = timer.elapsed_ms() / directions;
+
+    constexpr int queries = 1000;
+    timer.restart();
+    for (int i = 0; i < queries; i++) {
+        glm::vec3 origin(rng.next_float(-500, 500), 10, rng.next_float(-500, 500));
+        float angle = rng.next_float(0, glm::two_pi<float>());
+        bvh.raycast(origin, glm::vec3(std::cos(angle), -0.05f, std::sin(angle)));
+    }
+    result.raycast_us = timer.elapsed_ms() * 1000 / queries;
+
+    timer.restart();
+    for (int i = 0; i < queries; i++) {
+        visible.clear();
+        glm::vec3 center(rng.next_float(-500, 500), 10, rng.next_float(-500, 500));
+        bvh.query_sphere(center, 10, visible);
+    }
+    result.sphere_us = timer.elapsed_ms() * 1000 / queries;
+
+    LOG(
+        "bvh %zu boxes: build %.3f ms, height %u, frustum %.3f ms (%zu visible), "
+        "brute force %.3f ms, raycast %.2f us, sphere %.2f us",
+        count,
+        result.build_ms,
+        result.height,
+        result.frustum_ms,
+        result.visible,
+        result.brute_force_ms,
+        result.raycast_us,
+        result.sphere_us
+    );
+    return result;
+}
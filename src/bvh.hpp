@@ -0,0 +1,139 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+#include "bounds.hpp"
+#include "frustum.hpp"
+#include "types.hpp"
+
+// Dynamic bounding volume hierarchy, a binary tree of boxes where every
+// leaf is one object and every other node bounds its two children.
+//
+// Leaves keep two boxes. The tight one is what queries test against, the
+// fat one is grown by a margin and is what the tree is built from, so an
+// object can move around inside it without touching the tree at all. Once
+// it leaves its fat box the leaf gets a new one and the nodes above it are
+// refit. Refitting never changes the shape of the tree, so commit rebuilds
+// it from scratch once the refits have made it noticeably worse.
+//
+// Leaves are referred to by proxy ids, which stay the same for as long as
+// the leaf exists (rebuilds included). Each leaf carries a uint of user data
+// which is what queries return
+class Bvh {
+public:
+    static constexpr int null_node = -1;
+
+    // The fat box is bigger than the tight one by fat_margin plus
+    // fat_scale times its size on every side
+    float fat_margin = 0.1f;
+    float fat_scale = 0.05f;
+
+    // Inserted leaves aren't in the tree until the next commit
+    int insert(const AABB& box, uint user_data);
+    void remove(int proxy);
+    // Returns true if the leaf left its fat box and the tree was refit
+    bool update(int proxy, const AABB& box);
+    void clear();
+    // Links in the leaves inserted since the last commit, one at a time if
+    // there are a few, with a rebuild if there are a lot. Rebuilds if the
+    // tree got too much worse than it was after the last rebuild
+    void commit();
+    // Top down build over every leaf
+    void rebuild();
+
+    uint user_data(int proxy) const;
+    const AABB& bounds(int proxy) const;
+
+    size_t leaf_count() const { return _leaf_count; }
+    size_t node_count() const { return _nodes.size() - _free_nodes.size(); }
+    // Longest path from the root to a leaf, 1 for a single leaf
+    uint height() const;
+    // Surface area of every internal node over the root's, roughly how many
+    // nodes a random ray has to visit. Lower is better
+    float cost() const;
+
+    // Queries append the user data of every leaf whose tight box hits the
+    // shape. None of them see leaves that haven't been committed yet
+    void query_frustum(const Frustum& frustum, std::vector<uint>& results) const;
+    void query_aabb(const AABB& box, std::vector<uint>& results) const;
+    void query_sphere(const glm::vec3& center, float radius, std::vector<uint>& results) const;
+
+    struct RayHit {
+        uint user_data = 0;
+        // Along direction, in units of its length
+        float distance = 0;
+    };
+    // Closest leaf whose tight box the ray hits
+    std::optional<RayHit> raycast(
+        const glm::vec3& origin,
+        const glm::vec3& direction,
+        float max_distance = FLT_MAX
+    ) const;
+
+    struct BenchmarkResult {
+        size_t count = 0;
+        double build_ms = 0;
+        // Per query, averaged over a camera turning around in place
+        double frustum_ms = 0;
+        double brute_force_ms = 0;
+        size_t visible = 0;
+        double raycast_us = 0;
+        double sphere_us = 0;
+        uint height = 0;
+    };
+    // Random boxes spread over a 1km square, viewed from the middle
+    static BenchmarkResult benchmark(size_t count);
+
+private:
+    // One cache line. A node is a leaf if left is null_node
+    struct Node {
+        // Fat box for leaves
+        AABB bounds;
+        AABB tight;
+        int parent = null_node;
+        int left = null_node;
+        // Proxy id for leaves
+        int right = null_node;
+        uint user_data = 0;
+
+        bool leaf() const { return left == null_node; }
+    };
+    // Where a leaf is. Rebuilds move nodes around, proxy ids stay put
+    struct Proxy {
+        int node = null_node;
+        // Index into _pending until the leaf is committed
+        int pending = null_node;
+    };
+    struct Pending {
+        AABB box;
+        uint user_data = 0;
+        int proxy = null_node;
+    };
+    struct BuildItem {
+        glm::vec3 center;
+        int leaf;
+    };
+
+    std::vector<Node> _nodes;
+    std::vector<int> _free_nodes;
+    std::vector<Proxy> _proxies;
+    std::vector<int> _free_proxies;
+    std::vector<Pending> _pending;
+    int _root = null_node;
+    size_t _leaf_count = 0;
+
+    // Inserts, removes and refits since the tree was last rebuilt or checked
+    size_t _changes = 0;
+    float _built_cost = 0;
+
+    int allocate_node();
+    void free_node(int node);
+    AABB fatten(const AABB& box) const;
+    void link_leaf(int leaf);
+    void unlink_leaf(int leaf);
+    // Recomputes the boxes from node up to the root
+    void refit_from(int node);
+    // Lays the nodes out depth first, a node's left child is right after it
+    int build_range(BuildItem* items, size_t count, const std::vector<Node>& leaves);
+    void collect_leaves(int node, std::vector<uint>& results) const;
+};
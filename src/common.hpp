@@ -1,7 +1,6 @@
 #pragma once
 
-using uint = unsigned int;
-using u8 = unsigned char;
+#include "types.hpp"
 
 #include "transform.hpp"
 #include "vertex.hpp"
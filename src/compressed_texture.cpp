@@ -0,0 +1,366 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include "compressed_texture.hpp"
+
+namespace {
+    constexpr char magic[8] = "BEBETEX";
+    constexpr uint32_t flipped_flag = 1;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t format;
+        uint32_t width;
+        uint32_t height;
+        uint32_t level_count;
+        uint32_t flags;
+        uint64_t data_size;
+    };
+
+    struct LevelEntry {
+        uint32_t width;
+        uint32_t height;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct Rgba {
+        u8 r, g, b, a;
+    };
+    using Block = std::array<Rgba, 16>;
+
+    // Rounds and expands back so the palette matches what the gpu decodes
+    uint16_t to_565(int r, int g, int b) {
+        return (uint16_t)(((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | ((b * 31 + 127) / 255));
+    }
+
+    Rgba from_565(uint16_t color) {
+        int r = (color >> 11) & 31;
+        int g = (color >> 5) & 63;
+        int b = color & 31;
+        return { (u8)(r << 3 | r >> 2), (u8)(g << 2 | g >> 4), (u8)(b << 3 | b >> 2), 255 };
+    }
+
+    int distance(const Rgba& a, const Rgba& b) {
+        int r = a.r - b.r;
+        int g = a.g - b.g;
+        int bl = a.b - b.b;
+        return r * r + g * g + bl * bl;
+    }
+
+    // Endpoints from the bounding box of the block, along the diagonal the
+    // colors actually spread on, pulled in a little so the interpolated
+    // colors land on more of the pixels
+    void color_endpoints(const Block& block, int max[3], int min[3]) {
+        int mean[3] = {};
+        for (int c = 0; c < 3; c++) {
+            max[c] = 0;
+            min[c] = 255;
+        }
+        for (const Rgba& pixel : block) {
+            const u8 channels[3] = { pixel.r, pixel.g, pixel.b };
+            for (int c = 0; c < 3; c++) {
+                max[c] = std::max<int>(max[c], channels[c]);
+                min[c] = std::min<int>(min[c], channels[c]);
+                mean[c] += channels[c];
+            }
+        }
+        int widest = 0;
+        for (int c = 0; c < 3; c++) {
+            mean[c] /= 16;
+            if (max[c] - min[c] > max[widest] - min[widest]) {
+                widest = c;
+            }
+        }
+        for (int c = 0; c < 3; c++) {
+            if (c == widest) {
+                continue;
+            }
+            int covariance = 0;
+            for (const Rgba& pixel : block) {
+                const u8 channels[3] = { pixel.r, pixel.g, pixel.b };
+                covariance += (channels[c] - mean[c]) * (channels[widest] - mean[widest]);
+            }
+            if (covariance < 0) {
+                std::swap(max[c], min[c]);
+            }
+        }
+        for (int c = 0; c < 3; c++) {
+            int inset = (max[c] - min[c]) / 16;
+            max[c] -= inset;
+            min[c] += inset;
+        }
+    }
+
+    void encode_color_block(const Block& block, u8* out) {
+        int max[3], min[3];
+        color_endpoints(block, max, min);
+        uint16_t color0 = to_565(max[0], max[1], max[2]);
+        uint16_t color1 = to_565(min[0], min[1], min[2]);
+        // color0 > color1 picks the 4 color mode in BC1
+        if (color0 < color1) {
+            std::swap(color0, color1);
+        }
+
+        uint32_t indices = 0;
+        if (color0 != color1) {
+            Rgba palette[4];
+            palette[0] = from_565(color0);
+            palette[1] = from_565(color1);
+            palette[2] = {
+                (u8)((2 * palette[0].r + palette[1].r) / 3),
+                (u8)((2 * palette[0].g + palette[1].g) / 3),
+                (u8)((2 * palette[0].b + palette[1].b) / 3),
+                255
+            };
+            palette[3] = {
+                (u8)((palette[0].r + 2 * palette[1].r) / 3),
+                (u8)((palette[0].g + 2 * palette[1].g) / 3),
+                (u8)((palette[0].b + 2 * palette[1].b) / 3),
+                255
+            };
+            for (int i = 0; i < 16; i++) {
+                uint32_t best = 0;
+                int best_distance = distance(block[i], palette[0]);
+                for (uint32_t p = 1; p < 4; p++) {
+                    int d = distance(block[i], palette[p]);
+                    if (d < best_distance) {
+                        best = p;
+                        best_distance = d;
+                    }
+                }
+                indices |= best << (i * 2);
+            }
+        }
+
+        out[0] = color0 & 0xff;
+        out[1] = color0 >> 8;
+        out[2] = color1 & 0xff;
+        out[3] = color1 >> 8;
+        std::memcpy(out + 4, &indices, 4);
+    }
+
+    void encode_alpha_block(const Block& block, u8* out) {
+        int alpha0 = 0;
+        int alpha1 = 255;
+        for (const Rgba& pixel : block) {
+            alpha0 = std::max<int>(alpha0, pixel.a);
+            alpha1 = std::min<int>(alpha1, pixel.a);
+        }
+
+        uint64_t indices = 0;
+        if (alpha0 != alpha1) {
+            // alpha0 > alpha1 picks the 8 alpha mode
+            int palette[8] = { alpha0, alpha1 };
+            for (int i = 1; i < 7; i++) {
+                palette[i + 1] = ((7 - i) * alpha0 + i * alpha1) / 7;
+            }
+            for (int i = 0; i < 16; i++) {
+                uint64_t best = 0;
+                int best_distance = 256;
+                for (uint64_t p = 0; p < 8; p++) {
+                    int d = std::abs(block[i].a - palette[p]);
+                    if (d < best_distance) {
+                        best = p;
+                        best_distance = d;
+                    }
+                }
+                indices |= best << (i * 3);
+            }
+        }
+
+        out[0] = alpha0;
+        out[1] = alpha1;
+        for (int i = 0; i < 6; i++) {
+            out[2 + i] = (indices >> (i * 8)) & 0xff;
+        }
+    }
+
+    // Every mip is made from the previous one with a box filter
+    std::vector<Rgba> downsample(const std::vector<Rgba>& pixels, uint width, uint height) {
+        uint half_width = std::max(1u, width / 2);
+        uint half_height = std::max(1u, height / 2);
+        std::vector<Rgba> result(half_width * half_height);
+        for (uint y = 0; y < half_height; y++) {
+            for (uint x = 0; x < half_width; x++) {
+                uint x0 = std::min(x * 2, width - 1);
+                uint x1 = std::min(x * 2 + 1, width - 1);
+                uint y0 = std::min(y * 2, height - 1);
+                uint y1 = std::min(y * 2 + 1, height - 1);
+                const Rgba* samples[4] = {
+                    &pixels[y0 * width + x0],
+                    &pixels[y0 * width + x1],
+                    &pixels[y1 * width + x0],
+                    &pixels[y1 * width + x1],
+                };
+                int sum[4] = {};
+                for (const Rgba* sample : samples) {
+                    sum[0] += sample->r;
+                    sum[1] += sample->g;
+                    sum[2] += sample->b;
+                    sum[3] += sample->a;
+                }
+                result[y * half_width + x] = {
+                    (u8)((sum[0] + 2) / 4),
+                    (u8)((sum[1] + 2) / 4),
+                    (u8)((sum[2] + 2) / 4),
+                    (u8)((sum[3] + 2) / 4)
+                };
+            }
+        }
+        return result;
+    }
+}
+
+size_t CompressedTexture::block_size(CompressedFormat format) {
+    return format == CompressedFormat::BC1 ? 8 : 16;
+}
+
+CompressedTexture CompressedTexture::encode(
+    const u8* pixels,
+    uint width,
+    uint height,
+    uint channels,
+    CompressedFormat format,
+    bool flip_vertically) {
+
+    CompressedTexture texture;
+    texture.format = format;
+    texture.width = width;
+    texture.height = height;
+    texture.flipped = flip_vertically;
+
+    std::vector<Rgba> level(width * height);
+    for (uint y = 0; y < height; y++) {
+        uint source_y = flip_vertically ? height - 1 - y : y;
+        for (uint x = 0; x < width; x++) {
+            const u8* pixel = pixels + (source_y * width + x) * channels;
+            level[y * width + x] = {
+                pixel[0],
+                pixel[1],
+                pixel[2],
+                channels == 4 ? pixel[3] : (u8)255
+            };
+        }
+    }
+
+    size_t block_bytes = block_size(format);
+    uint level_width = width;
+    uint level_height = height;
+    while (true) {
+        uint blocks_x = (level_width + 3) / 4;
+        uint blocks_y = (level_height + 3) / 4;
+        Level entry;
+        entry.width = level_width;
+        entry.height = level_height;
+        entry.offset = texture.data.size();
+        entry.size = blocks_x * blocks_y * block_bytes;
+        texture.data.resize(entry.offset + entry.size);
+
+        u8* out = texture.data.data() + entry.offset;
+        for (uint by = 0; by < blocks_y; by++) {
+            for (uint bx = 0; bx < blocks_x; bx++) {
+                // Blocks hanging off the edge repeat the last row and column
+                Block block;
+                for (uint i = 0; i < 16; i++) {
+                    uint x = std::min(bx * 4 + i % 4, level_width - 1);
+                    uint y = std::min(by * 4 + i / 4, level_height - 1);
+                    block[i] = level[y * level_width + x];
+                }
+                if (format == CompressedFormat::BC3) {
+                    encode_alpha_block(block, out);
+                    out += 8;
+                }
+                encode_color_block(block, out);
+                out += 8;
+            }
+        }
+        texture.levels.push_back(entry);
+
+        if (level_width == 1 && level_height == 1) {
+            break;
+        }
+        level = downsample(level, level_width, level_height);
+        level_width = std::max(1u, level_width / 2);
+        level_height = std::max(1u, level_height / 2);
+    }
+    return texture;
+}
+
+bool CompressedTexture::read(const std::string& path) {
+    *this = CompressedTexture();
+
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return false;
+    }
+    size_t file_size = file.tellg();
+    file.seekg(0);
+    Header header;
+    if (file_size < sizeof(Header) || !file.read(reinterpret_cast<char*>(&header), sizeof(Header))) {
+        return false;
+    }
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0
+        || header.version != version
+        || (header.format != (uint32_t)CompressedFormat::BC1 && header.format != (uint32_t)CompressedFormat::BC3)
+        || header.level_count == 0
+        || header.level_count > 32) {
+        return false;
+    }
+    size_t data_start = sizeof(Header) + header.level_count * sizeof(LevelEntry);
+    if (file_size < data_start || file_size - data_start != header.data_size) {
+        return false;
+    }
+
+    std::vector<LevelEntry> entries(header.level_count);
+    file.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(LevelEntry));
+    data.resize(header.data_size);
+    file.read(reinterpret_cast<char*>(data.data()), data.size());
+    if (!file) {
+        *this = CompressedTexture();
+        return false;
+    }
+
+    format = static_cast<CompressedFormat>(header.format);
+    width = header.width;
+    height = header.height;
+    flipped = header.flags & flipped_flag;
+    for (const LevelEntry& entry : entries) {
+        if (entry.offset > data.size() || entry.size > data.size() - entry.offset) {
+            *this = CompressedTexture();
+            return false;
+        }
+        levels.push_back({ entry.width, entry.height, entry.offset, entry.size });
+    }
+    return true;
+}
+
+bool CompressedTexture::write(const std::string& path) const {
+    Header header = {};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.format = static_cast<uint32_t>(format);
+    header.width = width;
+    header.height = height;
+    header.level_count = levels.size();
+    header.flags = flipped ? flipped_flag : 0;
+    header.data_size = data.size();
+
+    std::vector<LevelEntry> entries;
+    for (const Level& level : levels) {
+        entries.push_back({ level.width, level.height, level.offset, level.size });
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+    file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(LevelEntry));
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    return (bool)file;
+}
+
+std::string CompressedTexture::container_path(const std::string& source_path) {
+    return std::filesystem::path(source_path).replace_extension(".btex").string();
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "types.hpp"
+
+enum class CompressedFormat : uint32_t {
+    // 8 bytes per 4x4 block, rgb
+    BC1 = 1,
+    // 16 bytes per 4x4 block, rgb + interpolated alpha
+    BC3 = 3,
+};
+
+// A block compressed texture with its whole mip chain, made offline by
+// tools/texconv so the runtime only has to copy it to the gpu. The file
+// sits next to its source with a .btex extension, see container_path.
+class CompressedTexture {
+public:
+    // Bump when the layout of the file changes
+    static constexpr uint32_t version = 1;
+
+    struct Level {
+        uint width = 0;
+        uint height = 0;
+        // Into data
+        size_t offset = 0;
+        size_t size = 0;
+    };
+
+    CompressedFormat format = CompressedFormat::BC1;
+    uint width = 0;
+    uint height = 0;
+    // Rows were flipped like stbi_set_flip_vertically_on_load does
+    bool flipped = false;
+    std::vector<Level> levels;
+    std::vector<u8> data;
+
+    bool valid() const { return !levels.empty(); }
+    const u8* level_data(uint level) const { return data.data() + levels[level].offset; }
+    // Same as the gpu memory it takes
+    size_t size() const { return data.size(); }
+
+    // Returns false if the file is missing or corrupt
+    bool read(const std::string& path);
+    bool write(const std::string& path) const;
+
+    // Builds the mip chain of an 8 bit rgb or rgba image and compresses
+    // every level. The pixels are expected top row first
+    static CompressedTexture encode(
+        const u8* pixels,
+        uint width,
+        uint height,
+        uint channels,
+        CompressedFormat format,
+        bool flip_vertically
+    );
+
+    // textures/wall.jpg -> textures/wall.btex
+    static std::string container_path(const std::string& source_path);
+    static size_t block_size(CompressedFormat format);
+};
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <chrono>
+
+// Wall clock time on the cpu, for the benchmarks. Starts when it's made
+class CpuTimer {
+public:
+    CpuTimer() : _start(Clock::now()) {}
+
+    void restart() { _start = Clock::now(); }
+    double elapsed_ms() const {
+        return std::chrono::duration<double, std::milli>(Clock::now() - _start).count();
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point _start;
+};
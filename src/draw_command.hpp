@@ -9,6 +9,8 @@ enum class DrawCommandType {
     DRAW_ELEMENTS,
     DRAW_ARRAYS_INSTANCED,
     DRAW_ELEMENTS_INSTANCED,
+    // Reads a DrawElementsIndirectCommand from DrawCommand::indirect_buffer
+    DRAW_ELEMENTS_INDIRECT,
 };
 
 enum class DrawCommandMode {
@@ -32,6 +34,21 @@ struct DrawCommand {
     DrawCommandType type;
     DrawCommandMode mode;
     size_t vertex_count = 0;
+    // Where DRAW_ELEMENTS starts reading the index buffer, in indices
+    size_t first_index = 0;
     uint instance_count = 0;
+    // Only used by DRAW_ELEMENTS_INDIRECT
+    uint indirect_buffer = 0;
+    size_t indirect_offset = 0;
+};
+
+// Layout expected by glDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+    uint count;
+    uint instance_count;
+    uint first_index;
+    uint base_vertex;
+    // Must be 0 before GL 4.2
+    uint base_instance;
 };
 
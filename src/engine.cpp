@@ -1,4 +1,6 @@
 #include <cstdlib>
+#include <chrono>
+#include <thread>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
@@ -9,17 +11,19 @@
 #include "engine.hpp"
 #include "fs.hpp"
 #include "input.hpp"
+#include "profiler.hpp"
 #include "debug.hpp"
 #include "renderer.hpp"
+#include "transform_batch.hpp"
 #include "utils.hpp"
 
 void engine::run(Application& app) {
     _app = &app;
 
     _app->init();
-    while (!_window->should_close()) {
+    while (_headless ? !_headless->done() : !_window->should_close()) {
         // Don't update outside of focus if true
-        if (!update_outside_focus) {
+        if (!update_outside_focus && !_headless) {
             if (!_window->in_focus()) {
                 ImGui_ImplGlfw_Sleep(10);
                 continue;
@@ -27,6 +31,9 @@ void engine::run(Application& app) {
         }
         update();
     }
+    if (_headless) {
+        _headless->write_results();
+    }
     cleanup();
 }
 
@@ -34,6 +41,10 @@ float& engine::get_delta_time() {
     return _delta_time;
 }
 
+float engine::get_interpolation_alpha() {
+    return _interpolation_alpha;
+}
+
 Window& engine::get_window() {
     return *_window;
 }
@@ -50,8 +61,38 @@ Scene& engine::get_scene() {
     return _scene;
 }
 
-void engine::init_glfw() {
-    glfwInit();
+AssetLoader& engine::get_assets() {
+    return *_assets;
+}
+
+ThreadPool& engine::get_jobs() {
+    return *_jobs;
+}
+
+TextureCache& engine::get_textures() {
+    return *_textures;
+}
+
+void engine::init_glfw(bool headless) {
+    // Without a display there's nothing to open a window on, so use the null
+    // platform with an OSMesa context, like Mesa's llvmpipe. With one (Xvfb
+    // in CI, or a desktop) the window is just never shown
+    bool no_display = !std::getenv("DISPLAY") && !std::getenv("WAYLAND_DISPLAY");
+    #ifdef __APPLE__
+        no_display = false;
+    #endif
+    if (headless && no_display) {
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+    }
+    bool glfw_initialized = glfwInit();
+    ASSERT(glfw_initialized, "Bad glfw initialization");
+    (void) glfw_initialized;
+    if (headless) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        if (no_display) {
+            glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+        }
+    }
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
@@ -124,13 +165,15 @@ void engine::init(const EngineInitInfo& cinfo) {
 
     utils::init();
     fs::init("shaders", "models");
-    init_glfw();
+    init_glfw(cinfo.headless);
 
     ASSERT(
        cinfo.window_width != -1 && cinfo.window_height != -1,
        "Window width and height not provided in EngineCreateInfo"
     );
     init_window(cinfo.window_width, cinfo.window_height, cinfo.window_title);
+    Texture2D::detect_compression_support();
+    profiler::init();
 
     // init member variables
     imgui_enabled = cinfo.imgui_enabled;
@@ -139,11 +182,18 @@ void engine::init(const EngineInitInfo& cinfo) {
     update_outside_focus = cinfo.update_outside_focus;
     render_after_user_update = cinfo.render_after_user_update;
     clear_color = cinfo.clear_color;
+    fixed_delta_time = cinfo.fixed_delta_time;
+    max_fixed_steps = cinfo.max_fixed_steps;
+    max_frame_rate = cinfo.max_frame_rate;
+    if (cinfo.headless) {
+        imgui_enabled = false;
+        cursor_enabled = false;
+    }
 
     if (cinfo.set_input_handler_callbacks) {
         init_input_handler_callbacks();
     }
-    if (cinfo.vsync_enabled) {
+    if (cinfo.vsync_enabled && !cinfo.headless) {
         glfwSwapInterval(1);
     }
     else {
@@ -153,7 +203,23 @@ void engine::init(const EngineInitInfo& cinfo) {
         init_imgui();
     }
 
+    // Before the renderer since it loads models
+    _textures = std::make_unique<TextureCache>();
+    uint job_threads = cinfo.job_threads;
+    if (job_threads == 0) {
+        job_threads = std::max(2u, std::thread::hardware_concurrency()) - 1;
+    }
+    _jobs = std::make_unique<ThreadPool>(job_threads);
     _renderer = std::make_unique<Renderer>(_camera, _scene);
+    _renderer->jobs = _jobs.get();
+    _assets = std::make_unique<AssetLoader>(*_textures);
+    if (cinfo.headless) {
+        _headless = std::make_unique<HeadlessBenchmark>(
+            cinfo.headless_info,
+            cinfo.window_width,
+            cinfo.window_height
+        );
+    }
 }
 
 void engine::poll_input() {
@@ -179,6 +245,132 @@ void engine::show_default_imgui_window() {
         ImGui::Begin("Settings", &_show_default_imgui_window);
         if (ImGui::TreeNode("Renderer")) {
             ImGui::Checkbox("depth view", &_renderer->depth_view_enabled);
+            ImGui::Text(
+                "uniform sets: %u, name lookups: %u",
+                Shader::last_frame_stats.sets,
+                Shader::last_frame_stats.lookups
+            );
+            const auto& light_stats = _renderer->light_stats();
+            ImGui::Text(
+                "lights: %u point, %u spot",
+                light_stats.point_lights,
+                light_stats.spot_lights
+            );
+            ImGui::Text(
+                "light clusters: %.3f ms build, %u indices, %u max per cluster",
+                light_stats.build_ms,
+                light_stats.light_indices,
+                light_stats.max_lights_per_cluster
+            );
+            if (light_stats.dropped_indices > 0) {
+                ImGui::Text("dropped light indices: %u", light_stats.dropped_indices);
+            }
+            ImGui::Text("lit pass gpu time: %.3f ms", _renderer->game_objects_gpu_ms());
+            RenderQueue& queue = _renderer->render_queue();
+            const RenderQueue::Stats& queue_stats = queue.stats();
+            ImGui::Checkbox("sort render queue", &queue.sort_enabled);
+            ImGui::Text(
+                "draws: %u, shader changes: %u, vao changes: %u, texture binds: %u",
+                queue_stats.draw_calls,
+                queue_stats.shader_changes,
+                queue_stats.vao_changes,
+                queue_stats.texture_binds
+            );
+            ImGui::Text("redundant binds skipped: %u", queue_stats.redundant_skipped);
+            const StreamBuffer& stream = _renderer->stream_buffer();
+            const StreamBuffer::Stats& stream_stats = stream.stats();
+            ImGui::Checkbox("stream debug draw", &_renderer->stream_buffer_enabled);
+            ImGui::Text(
+                "stream buffer: %.1f / %.1f MB a frame, %s",
+                stream_stats.bytes_written / (1024.0f * 1024.0f),
+                stream.frame_size() / (1024.0f * 1024.0f),
+                stream.persistent() ? "persistent" : "unsynchronized"
+            );
+            ImGui::Text(
+                "fence waits: %u (%.3f ms), grows: %u",
+                stream_stats.fence_waits,
+                stream_stats.wait_ms,
+                stream_stats.grows
+            );
+            ImGui::Text(
+                "debug draw: %.3f ms upload, %.3f ms gpu",
+                _renderer->dynamic_upload_ms(),
+                _renderer->debug_draw_gpu_ms()
+            );
+            ImGui::Checkbox("instancing", &_renderer->instancing_enabled);
+            ImGui::Text(
+                "instanced draws: %u, instances: %u",
+                queue_stats.instanced_draws,
+                queue_stats.instances
+            );
+            ImGui::Checkbox("lods", &_renderer->lod_enabled);
+            ImGui::SameLine();
+            ImGui::Checkbox("cross fade", &_renderer->lod_cross_fade);
+            ImGui::SliderFloat("lod error (px)", &_renderer->lod_error_pixels, 0.25f, 16.0f);
+            ImGui::SliderFloat("lod fade band", &_renderer->lod_fade_band, 0.0f, 0.9f);
+            const Renderer::LodStats& lod_stats = _renderer->lod_stats();
+            ImGui::Text("objects per lod:");
+            for (uint count : lod_stats.objects) {
+                ImGui::SameLine();
+                ImGui::Text("%u", count);
+            }
+            ImGui::Text("fading: %u", lod_stats.fading);
+            ImGui::Text("game object triangles: %zu", lod_stats.triangles);
+            ImGui::Checkbox("frustum culling", &_renderer->frustum_culling_enabled);
+            ImGui::SameLine();
+            ImGui::Checkbox("occlusion culling", &_renderer->occlusion_culling_enabled);
+            ImGui::SliderFloat("min occluder size (px)", &_renderer->occluder_min_pixels, 256.0f, 65536.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+            ImGui::SliderInt("max occluders", &_renderer->max_occluders, 0, 128);
+            const Renderer::CullStats& cull_stats = _renderer->cull_stats();
+            ImGui::Text(
+                "culling: %u tested, %u outside frustum, %u occluded, %u drawn",
+                cull_stats.tested,
+                cull_stats.frustum_culled,
+                cull_stats.occlusion_culled,
+                cull_stats.drawn
+            );
+            ImGui::Text(
+                "occluder boxes: %u, frustum kernel: %s",
+                cull_stats.occluders,
+                Frustum::kernel_name()
+            );
+            ImGui::Checkbox("parallel frame building", &_renderer->parallel_enabled);
+            ImGui::Text(
+                "job threads: %u + main, steals: %zu",
+                _jobs->thread_count(),
+                _jobs->steal_count()
+            );
+            ImGui::Spacing();
+            ImGui::TreePop();
+        }
+        if (ImGui::TreeNode("Assets")) {
+            const AssetLoader::Stats& asset_stats = _assets->stats();
+            ImGui::Text(
+                "in flight: %u, loader threads: %u",
+                asset_stats.in_flight,
+                _assets->thread_count()
+            );
+            ImGui::Text(
+                "last frame: %u uploads in %.3f ms",
+                asset_stats.uploads,
+                asset_stats.upload_ms
+            );
+            ImGui::DragFloat("upload budget ms", &_assets->upload_budget_ms, 0.1f, 0.1f, 16.0f);
+            if (Texture2D::compression_supported) {
+                // Only affects textures loaded after changing it
+                ImGui::Checkbox("compressed textures", &Texture2D::use_compressed_textures);
+            }
+            TextureCache::Stats texture_stats = _textures->stats();
+            ImGui::Text(
+                "textures: %u resident, %.1f MB",
+                texture_stats.textures,
+                texture_stats.resident_bytes / (1024.0f * 1024.0f)
+            );
+            ImGui::Text(
+                "texture cache: %u hits, %u misses",
+                texture_stats.hits,
+                texture_stats.misses
+            );
             ImGui::Spacing();
             ImGui::TreePop();
         }
@@ -192,12 +384,130 @@ void engine::show_default_imgui_window() {
             ImGui::Spacing();
             ImGui::TreePop();
         }
+        if (ImGui::TreeNode("Benchmarks")) {
+            static transform_batch::BenchmarkResult transform_result;
+            if (ImGui::Button("transform batch")) {
+                transform_result = transform_batch::benchmark(100000);
+            }
+            if (transform_result.count > 0) {
+                ImGui::Text(
+                    "%zu transforms: glm %.3f ms, %s %.3f ms (%.1fx)",
+                    transform_result.count,
+                    transform_result.glm_ms,
+                    transform_batch::kernel_name(),
+                    transform_result.batch_ms,
+                    transform_result.glm_ms / transform_result.batch_ms
+                );
+                ImGui::Text("max error: %g", transform_result.max_error);
+            }
+            // Upload timings are under Renderer
+            ImGui::Checkbox("1M debug lines", &_debug_line_benchmark);
+
+            static ObjectStore::BenchmarkResult store_result;
+            if (ImGui::Button("object store iteration")) {
+                store_result = ObjectStore::benchmark(100000);
+            }
+            if (store_result.count > 0) {
+                ImGui::Text(
+                    "%zu objects: game objects %.3f ms, object store %.3f ms (%.1fx)",
+                    store_result.count,
+                    store_result.game_object_ms,
+                    store_result.store_ms,
+                    store_result.game_object_ms / store_result.store_ms
+                );
+            }
+
+            static Bvh::BenchmarkResult bvh_result;
+            if (ImGui::Button("bvh queries")) {
+                bvh_result = Bvh::benchmark(100000);
+            }
+            if (bvh_result.count > 0) {
+                ImGui::Text(
+                    "%zu boxes: build %.3f ms, height %u",
+                    bvh_result.count,
+                    bvh_result.build_ms,
+                    bvh_result.height
+                );
+                ImGui::Text(
+                    "frustum %.3f ms (%zu visible), brute force %.3f ms (%.1fx)",
+                    bvh_result.frustum_ms,
+                    bvh_result.visible,
+                    bvh_result.brute_force_ms,
+                    bvh_result.brute_force_ms / bvh_result.frustum_ms
+                );
+                ImGui::Text(
+                    "raycast %.2f us, sphere %.2f us",
+                    bvh_result.raycast_us,
+                    bvh_result.sphere_us
+                );
+            }
+            const Bvh& scene_bvh = _scene.objects.bvh();
+            ImGui::Text(
+                "scene bvh: %zu objects, %zu nodes, cost %.1f",
+                scene_bvh.leaf_count(),
+                scene_bvh.node_count(),
+                scene_bvh.cost()
+            );
+
+            // Runs on whatever is in the scene, a 100k cell grid works well
+            static std::vector<Renderer::FrameBuildTiming> frame_build_timings;
+            if (ImGui::Button("frame building scaling")) {
+                frame_build_timings = _renderer->benchmark_frame_building();
+            }
+            for (const auto& timing : frame_build_timings) {
+                ImGui::Text(
+                    "%zu objects, %u threads: %.3f ms (%.1fx)",
+                    timing.game_objects,
+                    timing.threads,
+                    timing.ms,
+                    frame_build_timings.front().ms / timing.ms
+                );
+            }
+            ImGui::Spacing();
+            ImGui::TreePop();
+        }
+        if (ImGui::TreeNode("Timestep")) {
+            float simulation_rate = 1.0f / fixed_delta_time;
+            if (ImGui::DragFloat("simulation hz", &simulation_rate, 1, 1, 1000)) {
+                fixed_delta_time = 1.0f / std::max(simulation_rate, 1.0f);
+            }
+            ImGui::DragFloat("max frame rate (0 = uncapped)", &max_frame_rate, 1, 0, 1000);
+            ImGui::Text(
+                "fixed steps this frame: %u, alpha: %.2f, dropped steps: %u",
+                _fixed_steps,
+                _interpolation_alpha,
+                _dropped_fixed_steps
+            );
+            ImGui::Spacing();
+            ImGui::TreePop();
+        }
+        ImGui::Checkbox("profiler", &_show_profiler);
         utils::imgui_color_edit4("clear color", clear_color);
         utils::imgui_fps_text();
         ImGui::End();
     }
 }
 
+void engine::draw_benchmark_lines() {
+    // 1000 x 1000 short lines on a 200 x 200 square around the origin
+    constexpr uint side = 1000;
+    constexpr float spacing = 0.2f;
+    for (uint z = 0; z < side; z++) {
+        for (uint x = 0; x < side; x++) {
+            glm::vec3 start = {
+                x * spacing - side * spacing * 0.5f,
+                2.0f,
+                z * spacing - side * spacing * 0.5f
+            };
+            glm::vec4 color = { (float)x / side, (float)z / side, 1.0f, 1.0f };
+            _renderer->draw_line(
+                Point(start, color),
+                Point(start + glm::vec3(0.1f, 0.2f, 0.1f), color)
+            );
+        }
+    }
+}
+
 void engine::clear_screen() {
     auto clamped_color = clear_color.clamped_vec3();
     glClearColor(clamped_color.r, clamped_color.g, clamped_color.b, 1.0f);
@@ -206,17 +516,65 @@ void engine::clear_screen() {
 }
 
 void engine::update_delta_time() {
-    float current_frame = glfwGetTime();
+    if (_headless) {
+        _delta_time = _headless->delta_time();
+        return;
+    }
+    double current_frame = glfwGetTime();
     _delta_time = current_frame - _last_frame_time;
     _last_frame_time = current_frame;
 }
 
+void engine::run_fixed_updates() {
+    PROFILE_SCOPE("fixed_update");
+    _accumulator += _delta_time;
+    _fixed_steps = 0;
+    while (_accumulator >= fixed_delta_time && _fixed_steps < max_fixed_steps) {
+        _app->fixed_update();
+        _accumulator -= fixed_delta_time;
+        _fixed_steps++;
+    }
+    // NOTE: the simulation slows down instead of trying to catch up, which
+    // would only make the next frame longer
+    if (_accumulator >= fixed_delta_time) {
+        uint dropped = _accumulator / fixed_delta_time;
+        _dropped_fixed_steps += dropped;
+        _accumulator -= dropped * (double)fixed_delta_time;
+    }
+    _interpolation_alpha = _accumulator / fixed_delta_time;
+}
+
+void engine::limit_frame_rate() {
+    if (max_frame_rate <= 0 || _headless) {
+        return;
+    }
+    PROFILE_SCOPE("limit_frame_rate");
+    double frame_end = _last_frame_time + 1.0 / max_frame_rate;
+    // Sleeps can overshoot by a millisecond or so, the rest is spun
+    for (double remaining = frame_end - glfwGetTime(); remaining > 0; remaining = frame_end - glfwGetTime()) {
+        if (remaining > 0.002) {
+            std::this_thread::sleep_for(std::chrono::duration<double>(remaining - 0.002));
+        }
+        else {
+            std::this_thread::yield();
+        }
+    }
+}
+
 void engine::update() {
+    profiler::begin_frame();
     update_delta_time();
-    poll_input();
+    Shader::reset_frame_stats();
+    {
+        PROFILE_SCOPE("poll_input");
+        poll_input();
+    }
     if (imgui_enabled) {
         imgui_new_frame();
     }
+    if (_headless) {
+        _headless->begin_frame(_camera);
+    }
     clear_screen();
 
 
@@ -227,28 +585,78 @@ void engine::update() {
         _window->disable_cursor();
     }
 
+    // Uploaded before the user update so lights are available to
+    // anything the app draws itself. Lights added during the
+    // update show up next frame
+    {
+        PROFILE_GPU_SCOPE("upload_lights");
+        _renderer->upload_lights();
+    }
+
+    // Before the user update so assets that finished loading can be used
+    // this frame
+    {
+        PROFILE_SCOPE("assets");
+        _assets->update();
+    }
+
+    if (_debug_line_benchmark) {
+        draw_benchmark_lines();
+    }
+
+    run_fixed_updates();
+
     // user update
-    _app->update();
+    {
+        PROFILE_GPU_SCOPE("App::update");
+        _app->update();
+    }
+    {
+        PROFILE_GPU_SCOPE("App::render");
+        _app->render(_interpolation_alpha);
+    }
 
     if (render_after_user_update) {
+        PROFILE_GPU_SCOPE("render");
         _renderer->render();
     }
 
     if (imgui_enabled && !hide_imgui_windows) {
+        PROFILE_GPU_SCOPE("imgui");
         show_default_imgui_window();
+        if (_show_profiler && cursor_enabled) {
+            profiler::show_imgui_window(&_show_profiler);
+        }
         imgui_render();
     }
 
-    glfwSwapBuffers(_window->data());
+    if (_headless) {
+        _headless->end_frame();
+    }
+    else {
+        PROFILE_SCOPE("swap");
+        glfwSwapBuffers(_window->data());
+    }
+    limit_frame_rate();
+    profiler::end_frame();
 }
 
 void engine::cleanup() {
     _app->cleanup();
+    // Stops the workers while the gl context is still around
+    _assets.reset();
+    _headless.reset();
+    _renderer->jobs = nullptr;
+    _jobs.reset();
+    profiler::shutdown();
     // _scene.clear_game_objects();
 
-    ImGui_ImplOpenGL3_Shutdown();
-    ImGui_ImplGlfw_Shutdown();
-    ImGui::DestroyContext();
+    // Headless runs never set imgui up
+    if (imgui_enabled) {
+        ImGui_ImplOpenGL3_Shutdown();
+        ImGui_ImplGlfw_Shutdown();
+        ImGui::DestroyContext();
+    }
     glfwTerminate();
     LOG("TERMINATED");
 }
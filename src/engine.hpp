@@ -1,5 +1,7 @@
 #pragma once
 
+#include "asset_loader.hpp"
+#include "headless.hpp"
 #include "input.hpp"
 #include "renderer.hpp"
 #include "scene.hpp"
@@ -20,6 +22,23 @@ struct EngineInitInfo {
     bool update_outside_focus = true;
     bool render_after_user_update = true;
     Color clear_color = Color(0, 0, 0);
+
+    // Application::fixed_update runs at this rate no matter the frame rate
+    float fixed_delta_time = 1.0f / 60.0f;
+    // Fixed steps per frame before the rest of the backlog is dropped, so a
+    // slow frame can't make the next one slower
+    uint max_fixed_steps = 8;
+    // Frames per second the render loop sleeps down to, 0 is uncapped
+    float max_frame_rate = 0;
+    // Workers of the frame job system, 0 uses one less than the hardware
+    // threads since the main thread works on jobs too
+    uint job_threads = 0;
+
+    // Renders headless_info.frame_count frames offscreen and exits, for
+    // benchmarks on machines without a display. Turns off imgui and the
+    // cursor
+    bool headless = false;
+    HeadlessInfo headless_info;
 };
 
 namespace engine {
@@ -32,29 +51,49 @@ inline bool cursor_enabled;
 inline bool update_outside_focus;
 inline bool render_after_user_update;
 inline Color clear_color;
+inline float fixed_delta_time;
+inline uint max_fixed_steps;
+inline float max_frame_rate;
 
 void init(const EngineInitInfo& cinfo);
 void run(Application& app);
 
 float& get_delta_time();
+// How far between the last two fixed updates this frame is, 0 to 1
+float get_interpolation_alpha();
 Window& get_window();
 Renderer& get_renderer();
 Camera& get_camera();
 Scene& get_scene();
+AssetLoader& get_assets();
+TextureCache& get_textures();
+ThreadPool& get_jobs();
 
 // ** PRIVATE **
 
 inline std::unique_ptr<Window> _window;
+// Before the renderer so it outlives it
+inline std::unique_ptr<ThreadPool> _jobs;
 inline std::unique_ptr<Renderer> _renderer;
+inline std::unique_ptr<AssetLoader> _assets;
+inline std::unique_ptr<TextureCache> _textures;
+inline std::unique_ptr<HeadlessBenchmark> _headless;
 inline Application* _app;
 inline Camera _camera;
 inline Scene _scene;
 
 inline float _delta_time = 0;
-inline float _last_frame_time = 0;
+inline double _last_frame_time = 0;
+// Time not yet simulated by fixed updates
+inline double _accumulator = 0;
+inline float _interpolation_alpha = 0;
+inline uint _fixed_steps = 0;
+inline uint _dropped_fixed_steps = 0;
 inline bool _show_default_imgui_window = true;
+inline bool _debug_line_benchmark = false;
+inline bool _show_profiler = false;
 
-void init_glfw();
+void init_glfw(bool headless);
 void init_window(uint width, uint height, const std::string& title);
 void init_imgui();
 void init_input_handler_callbacks();
@@ -62,10 +101,13 @@ void default_key_callback(GLFWwindow *window, int key, int scancode, int action,
 
 void poll_input();
 void show_default_imgui_window();
+void draw_benchmark_lines();
 void imgui_new_frame();
 void imgui_render();
 void clear_screen();
 void update_delta_time();
+void run_fixed_updates();
+void limit_frame_rate();
 
 void init();
 void update();
@@ -80,12 +122,24 @@ public:
     float& delta_time = engine::get_delta_time();
     Camera& camera = engine::get_camera();
     Scene& scene = engine::get_scene();
+    AssetLoader& assets = engine::get_assets();
+    TextureCache& textures = engine::get_textures();
+    ThreadPool& jobs = engine::get_jobs();
 
     Application() {}
     ~Application() {}
 
     virtual void init() {}
+    // Runs zero or more times a frame, every engine::fixed_delta_time
+    // seconds of simulated time. Put anything that should behave the same
+    // at any frame rate here
+    virtual void fixed_update() {}
+    // Runs once a frame after the fixed updates, with delta_time
     virtual void update() {}
+    // Runs once a frame after update, before the renderer. alpha is how
+    // far the frame is between the previous and the latest fixed update,
+    // for blending simulated state with Transform::lerp
+    virtual void render(float /*alpha*/) {}
     // NOTE: unload any textures you allocate here
     virtual void cleanup() {}
 };
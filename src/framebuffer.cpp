@@ -1,8 +1,8 @@
 #include <glad/glad.h>
 #include "framebuffer.hpp"
 
-Framebuffer::Framebuffer(uint width, uint height)
-    : _width(width), _height(height) {
+Framebuffer::Framebuffer(uint width, uint height, uint scale)
+    : _width(width), _height(height), _scale(scale) {
     create_framebuffer();
 }
 
@@ -33,6 +33,10 @@ uint Framebuffer::height() const {
     return _height;
 }
 
+uint Framebuffer::scale() const {
+    return _scale;
+}
+
 uint Framebuffer::id() {
     return _id;
 }
@@ -64,7 +68,7 @@ void Framebuffer::create_color_attachment(const ColorAttachmentCreateInfo& cinfo
     // Read comments on learnopengl.com for more info
     glTexImage2D(
         GL_TEXTURE_2D, 0, cinfo.format,
-        _width * 2, _height * 2,
+        _width * _scale, _height * _scale,
         0, cinfo.format,
         cinfo.type, NULL
     );
@@ -94,7 +98,7 @@ void Framebuffer::create_render_buffer_attachment(const RenderbufferAttachmentCr
     // HACK: Comment in create_color_attachment applies here as well
     glRenderbufferStorage(
         GL_RENDERBUFFER, cinfo.format,
-        _width * 2, _height * 2
+        _width * _scale, _height * _scale
     );
     glBindRenderbuffer(GL_RENDERBUFFER, 0);
 
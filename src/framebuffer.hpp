@@ -13,7 +13,7 @@
 #define MAX_RENDERBUFFER_ATTACHMENTS 7
 
 // NOTE: just provide width / height
-// Automatically multiplied by 2 because of macos
+// Automatically multiplied by 2 because of macos, see Framebuffer::scale
 struct ColorAttachmentCreateInfo {
     int format;
     int type = GL_UNSIGNED_BYTE;
@@ -27,7 +27,9 @@ struct RenderbufferAttachmentCreateInfo {
 
 class Framebuffer {
 public:
-    Framebuffer(uint width, uint height);
+    // Attachments are scale times the size. 2 matches a retina window,
+    // use 1 for offscreen rendering
+    Framebuffer(uint width, uint height, uint scale = 2);
     ~Framebuffer();
 
     void bind(int target = GL_FRAMEBUFFER);
@@ -35,6 +37,7 @@ public:
 
     uint width() const;
     uint height() const;
+    uint scale() const;
     uint id();
 
     const std::array<uint, MAX_COLOR_ATTACHMENTS>& color_attachments();
@@ -49,13 +52,14 @@ public:
 private:
     uint _width;
     uint _height;
+    uint _scale;
     uint _id;
     int _target = GL_FRAMEBUFFER;
 
-    std::array<uint, MAX_COLOR_ATTACHMENTS> _color_attachments;
+    std::array<uint, MAX_COLOR_ATTACHMENTS> _color_attachments = {};
     uint _n_color_attachments = 0;
 
-    std::array<uint, MAX_RENDERBUFFER_ATTACHMENTS> _render_buffer_attachments;
+    std::array<uint, MAX_RENDERBUFFER_ATTACHMENTS> _render_buffer_attachments = {};
     uint _n_renderbuffer_attachments= 0;
 
     void create_framebuffer();
@@ -0,0 +1,113 @@
+#include "frustum.hpp"
+#include "simd_lanes.hpp"
+
+// The kernel reads boxes as 6 floats apart
+static_assert(sizeof(AABB) == sizeof(float) * 6, "AABB has to be tightly packed");
+
+Frustum::Frustum(const glm::mat4& view_projection) {
+    // Gribb / Hartmann plane extraction. glm is column major
+    // so row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+    const glm::mat4& m = view_projection;
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    planes[LEFT]   = row3 + row0;
+    planes[RIGHT]  = row3 - row0;
+    planes[BOTTOM] = row3 + row1;
+    planes[TOP]    = row3 - row1;
+    planes[NEAR]   = row3 + row2;
+    planes[FAR]    = row3 - row2;
+
+    for (auto& plane : planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+}
+
+bool Frustum::intersects_sphere(const glm::vec3& center, float radius) const {
+    for (const auto& plane : planes) {
+        if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Frustum::intersects_aabb(const glm::vec3& min, const glm::vec3& max) const {
+    for (const auto& plane : planes) {
+        // corner of the box furthest along the plane normal
+        glm::vec3 p(
+            plane.x >= 0 ? max.x : min.x,
+            plane.y >= 0 ? max.y : min.y,
+            plane.z >= 0 ? max.z : min.z
+        );
+        if (glm::dot(glm::vec3(plane), p) + plane.w < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+namespace {
+
+// Tests boxes [begin, end) in steps of L::width and returns where it stopped
+template<typename L>
+size_t intersects_aabbs_range(
+    const Frustum& frustum,
+    const AABB* boxes,
+    size_t begin,
+    size_t end,
+    u8* visible) {
+
+    using V = typename L::V;
+    const V half = L::set(0.5f);
+
+    size_t i = begin;
+    for (; i + L::width <= end; i += L::width) {
+        const float* p = &boxes[i].min.x;
+        V min_x = L::load_strided(p, 6);
+        V min_y = L::load_strided(p + 1, 6);
+        V min_z = L::load_strided(p + 2, 6);
+        V max_x = L::load_strided(p + 3, 6);
+        V max_y = L::load_strided(p + 4, 6);
+        V max_z = L::load_strided(p + 5, 6);
+        V center_x = L::mul(L::add(min_x, max_x), half);
+        V center_y = L::mul(L::add(min_y, max_y), half);
+        V center_z = L::mul(L::add(min_z, max_z), half);
+        V extent_x = L::mul(L::sub(max_x, min_x), half);
+        V extent_y = L::mul(L::sub(max_y, min_y), half);
+        V extent_z = L::mul(L::sub(max_z, min_z), half);
+
+        // How far the box reaches in front of the plane it's the furthest
+        // behind, negative means it's fully outside that one
+        V reach = L::set(FLT_MAX);
+        for (const glm::vec4& plane : frustum.planes) {
+            V distance = L::mul_add(L::set(plane.x), center_x,
+                L::mul_add(L::set(plane.y), center_y,
+                L::mul_add(L::set(plane.z), center_z, L::set(plane.w))));
+            V radius = L::mul_add(L::set(std::abs(plane.x)), extent_x,
+                L::mul_add(L::set(std::abs(plane.y)), extent_y,
+                L::mul(L::set(std::abs(plane.z)), extent_z)));
+            reach = L::min(reach, L::add(distance, radius));
+        }
+        // Invalid boxes are inside out, their extent is negative
+        uint outside = L::sign_mask(reach) & ~L::sign_mask(extent_x);
+        for (uint lane = 0; lane < L::width; lane++) {
+            visible[i + lane] = !((outside >> lane) & 1);
+        }
+    }
+    return i;
+}
+
+}
+
+void Frustum::intersects_aabbs(const AABB* boxes, size_t begin, size_t end, u8* visible) const {
+    size_t done = intersects_aabbs_range<SimdLanes>(*this, boxes, begin, end, visible);
+    // Leftovers that don't fill a whole register
+    intersects_aabbs_range<ScalarLanes>(*this, boxes, done, end, visible);
+}
+
+const char* Frustum::kernel_name() {
+    return SimdLanes::name;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <glm/glm.hpp>
+#include "bounds.hpp"
+#include "types.hpp"
+
+// View frustum stored as six normalized planes (a, b, c, d) with their
+// normals pointing inwards. A point p is inside a plane if dot(n, p) + d >= 0
+struct Frustum {
+    enum Plane {
+        LEFT = 0,
+        RIGHT,
+        BOTTOM,
+        TOP,
+        NEAR,
+        FAR,
+    };
+
+    std::array<glm::vec4, 6> planes;
+
+    Frustum() = default;
+    // view_projection is projection * view
+    Frustum(const glm::mat4& view_projection);
+
+    bool intersects_sphere(const glm::vec3& center, float radius) const;
+    bool intersects_aabb(const glm::vec3& min, const glm::vec3& max) const;
+    // intersects_aabb for boxes [begin, end), several at a time with simd.
+    // visible[i] is 1 if boxes[i] might be inside, invalid boxes always are.
+    // Nothing outside the range is touched, so threads can split an array
+    void intersects_aabbs(const AABB* boxes, size_t begin, size_t end, u8* visible) const;
+    // Name of the kernel intersects_aabbs uses
+    static const char* kernel_name();
+};
@@ -1,15 +1,22 @@
 #include <filesystem>
 #include "fs.hpp"
 
-void fs::init(const std::string& shader_dir, const std::string& model_dir) {
+void fs::init(
+    const std::string& shader_dir,
+    const std::string& model_dir,
+    const std::string& cache_dir) {
     _shader_dir = shader_dir;
     _model_dir = model_dir;
+    _cache_dir = cache_dir;
     if (_shader_dir.back() != '/') {
         _shader_dir = _shader_dir + "/";
     }
     if (_model_dir.back() != '/') {
         _model_dir = _model_dir + "/";
     }
+    if (_cache_dir.back() != '/') {
+        _cache_dir = _cache_dir + "/";
+    }
 }
 
 std::string fs::shader_path(const std::string& name) {
@@ -20,3 +27,7 @@ std::string fs::model_path(const std::string& name) {
     return _model_dir + name;
 }
 
+
+std::string fs::cache_path(const std::string& name) {
+    return _cache_dir + name;
+}
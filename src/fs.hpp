@@ -6,8 +6,13 @@ namespace fs {
 
 inline std::string _shader_dir;
 inline std::string _model_dir;
+inline std::string _cache_dir;
 
-void init(const std::string& shader_dir, const std::string& model_dir);
+void init(
+    const std::string& shader_dir,
+    const std::string& model_dir,
+    const std::string& cache_dir = "cache"
+);
 
 // just provide the name of the shader with an extension
 // to load shaders/circle.vert just provide circle.vert as an argument
@@ -19,5 +24,8 @@ std::string shader_path(const std::string& name);
 // FIXME: figure out a better way to do this
 std::string model_path(const std::string& name);
 
-}
+// Files generated from the assets, like compiled meshes. Nothing in
+// here has to be kept, it all gets rebuilt when missing
+std::string cache_path(const std::string& name);
 
+}
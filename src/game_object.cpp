@@ -3,8 +3,7 @@
 void GameObject::load_mesh_data(const std::vector<Mesh>& meshes) {
     for (const Mesh& m: meshes) {
         Mesh& mesh = create_mesh();
-        mesh.set_vao(m.vao());
-        mesh.draw_command = m.draw_command;
+        mesh.share(m);
     }
 }
 
@@ -4,6 +4,7 @@
 #include "transform.hpp"
 #include "material.hpp"
 #include "mesh.hpp"
+#include "object_store.hpp"
 
 class GameObject {
 public:
@@ -17,6 +18,7 @@ public:
         : transform(transform), material(material) {}
 
     Mesh& create_mesh() {
+        _meshes_changed = true;
         meshes.emplace_back();
         return meshes.back();
     }
@@ -38,6 +40,25 @@ public:
     uint get_id() const {
         return _id;
     }
+    // Anything that edits meshes directly instead of through create_mesh
+    // has to call this, or the scene keeps the object's old bounds
+    void mark_meshes_changed() {
+        _meshes_changed = true;
+    }
+    // Returns whether the meshes changed since the last call
+    bool take_meshes_changed() {
+        bool changed = _meshes_changed;
+        _meshes_changed = false;
+        return changed;
+    }
+
+    // Where the scene mirrors this object in its ObjectStore
+    void set_handle(ObjectHandle handle) {
+        _handle = handle;
+    }
+    ObjectHandle get_handle() const {
+        return _handle;
+    }
 
     // NOTE: Be carefull when using this
     // It just checks the value of the ids against each other, nothing else
@@ -47,6 +68,8 @@ public:
 
 private:
     int _id = -1;
+    ObjectHandle _handle;
+    bool _meshes_changed = false;
 };
 
 inline bool operator==(const GameObject& g1, const GameObject& g2) {
@@ -0,0 +1,32 @@
+#include <glad/glad.h>
+#include "gpu_timer.hpp"
+#include "debug.hpp"
+
+GpuTimer::~GpuTimer() {
+    if (_initialized) {
+        glDeleteQueries(query_count, _queries.data());
+    }
+}
+
+void GpuTimer::begin() {
+    if (!_initialized) {
+        glGenQueries(query_count, _queries.data());
+        _initialized = true;
+    }
+    _current = (_current + 1) % query_count;
+
+    // Oldest query gets reused, collect its result first
+    if (_pending[_current]) {
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(_queries[_current], GL_QUERY_RESULT, &ns);
+        _elapsed_ms = ns / 1e6f;
+        _pending[_current] = false;
+    }
+    glBeginQuery(GL_TIME_ELAPSED, _queries[_current]);
+}
+
+void GpuTimer::end() {
+    ASSERT(_initialized, "GpuTimer::end called before GpuTimer::begin");
+    glEndQuery(GL_TIME_ELAPSED);
+    _pending[_current] = true;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <array>
+#include "types.hpp"
+
+// Measures gpu time between begin and end with GL_TIME_ELAPSED queries.
+// Results are read a few frames late so reading them never stalls.
+// NOTE: GL_TIME_ELAPSED queries can't be nested
+class GpuTimer {
+public:
+    GpuTimer() {}
+    ~GpuTimer();
+
+    void begin();
+    void end();
+
+    // Most recent finished measurement in milliseconds
+    float elapsed_ms() const { return _elapsed_ms; }
+
+private:
+    static constexpr uint query_count = 3;
+
+    std::array<uint, query_count> _queries = {};
+    std::array<bool, query_count> _pending = {};
+    uint _current = 0;
+    float _elapsed_ms = 0;
+    bool _initialized = false;
+};
@@ -0,0 +1,243 @@
+#include <glad/glad.h>
+#include "grass_culler.hpp"
+#include "debug.hpp"
+#include "frustum.hpp"
+#include "fs.hpp"
+
+GrassCuller::~GrassCuller() {
+    if (!_initialized) {
+        return;
+    }
+    for (auto& frame : _frames) {
+        glDeleteTransformFeedbacks(1, &frame.transform_feedback);
+        glDeleteBuffers(max_lods, frame.buffers.data());
+        glDeleteQueries(max_lods, frame.queries.data());
+        glDeleteVertexArrays(max_lods, frame.vaos.data());
+    }
+    glDeleteBuffers(1, &_indirect_buffer);
+}
+
+void GrassCuller::init(Mesh& mesh, uint max_instances) {
+    ASSERT(!_initialized, "GrassCuller already initialized");
+    ASSERT(mesh.buffers_created(), "GrassCuller needs a mesh with its own buffers");
+    _max_instances = max_instances;
+
+    init_cull_shader();
+
+    glGenBuffers(1, &_indirect_buffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _indirect_buffer);
+    glBufferData(
+        GL_DRAW_INDIRECT_BUFFER,
+        max_lods * sizeof(DrawElementsIndirectCommand),
+        NULL,
+        GL_DYNAMIC_DRAW
+    );
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    for (auto& frame : _frames) {
+        init_frame(frame, mesh);
+    }
+    _initialized = true;
+}
+
+void GrassCuller::init_cull_shader() {
+    _cull_shader.set_transform_feedback_varyings({
+        "lod0_position",
+        "lod0_packed",
+        "gl_NextBuffer",
+        "lod1_position",
+        "lod1_packed",
+        "gl_NextBuffer",
+        "lod2_position",
+        "lod2_packed",
+    });
+    _cull_shader.load(
+        fs::shader_path("grass_cull.vert"),
+        fs::shader_path("grass_cull.geom"),
+        ""
+    );
+    _uniforms.frustum_planes = Uniform(_cull_shader, "frustum_planes");
+    _uniforms.camera_pos = Uniform(_cull_shader, "camera_pos");
+    _uniforms.cull_radius = Uniform(_cull_shader, "cull_radius");
+    _uniforms.lod_distances = Uniform(_cull_shader, "lod_distances");
+    _uniforms.far_lod_density = Uniform(_cull_shader, "far_lod_density");
+}
+
+void GrassCuller::init_frame(Frame& frame, Mesh& mesh) {
+    glGenBuffers(max_lods, frame.buffers.data());
+    glGenQueries(max_lods, frame.queries.data());
+    glGenVertexArrays(max_lods, frame.vaos.data());
+    glGenTransformFeedbacks(1, &frame.transform_feedback);
+
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, frame.transform_feedback);
+    for (uint i = 0; i < max_lods; i++) {
+        glBindBuffer(GL_ARRAY_BUFFER, frame.buffers[i]);
+        glBufferData(GL_ARRAY_BUFFER, lod_capacity(i) * sizeof(GrassInstance), NULL, GL_DYNAMIC_COPY);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, i, frame.buffers[i]);
+    }
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+
+    for (uint i = 0; i < max_lods; i++) {
+        glBindVertexArray(frame.vaos[i]);
+
+        // Same layout as Mesh::create_buffers
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo());
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo());
+        Vertex::layout().apply();
+
+        // GrassInstance - position binds to 3, yaw, scale and seed to 4
+        glBindBuffer(GL_ARRAY_BUFFER, frame.buffers[i]);
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(GrassInstance), (void*)0);
+        glVertexAttribDivisor(3, 1);
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(GrassInstance), (void*)offsetof(GrassInstance, yaw));
+        glVertexAttribDivisor(4, 1);
+
+        Mesh& lod_mesh = frame.meshes[i];
+        lod_mesh.set_vao(frame.vaos[i]);
+        lod_mesh.draw_command.type = DrawCommandType::DRAW_ELEMENTS_INDIRECT;
+        lod_mesh.draw_command.mode = DrawCommandMode::TRIANGLES;
+        lod_mesh.draw_command.vertex_count = lods[i].index_count;
+        lod_mesh.draw_command.indirect_buffer = _indirect_buffer;
+        lod_mesh.draw_command.indirect_offset = i * sizeof(DrawElementsIndirectCommand);
+    }
+    glBindVertexArray(0);
+}
+
+uint GrassCuller::create_instance_vao(uint instance_vbo) {
+    // Every blade is a single point in the culling pass
+    uint vao = 0;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GrassInstance), (void*)0);
+    // yaw, scale and seed are only passed through so read them as one uint
+    glEnableVertexAttribArray(1);
+    glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(GrassInstance), (void*)offsetof(GrassInstance, yaw));
+    glBindVertexArray(0);
+    return vao;
+}
+
+void GrassCuller::begin(Camera& camera) {
+    ASSERT(_initialized, "GrassCuller used before GrassCuller::init");
+    ASSERT(!_culling, "GrassCuller::begin called twice without GrassCuller::end");
+
+    _frame = (_frame + 1) % _frames.size();
+    Frame& frame = _frames[_frame];
+
+    Frustum frustum(camera.get_perspective_matrix() * camera.get_view_matrix());
+
+    _cull_shader.use();
+    _cull_shader.set_vec4_array(_uniforms.frustum_planes, frustum.planes.data(), frustum.planes.size());
+    _cull_shader.set_vec3(_uniforms.camera_pos, camera.transform.position);
+    // Culling results are drawn a frame late so give the frustum some slack
+    _cull_shader.set_float(_uniforms.cull_radius, cull_radius + camera.velocity * 0.05f);
+    _cull_shader.set_vec3(
+        _uniforms.lod_distances,
+        lods[0].max_distance,
+        lods[1].max_distance,
+        glm::min(lods[2].max_distance, camera.far)
+    );
+    _cull_shader.set_uint(_uniforms.far_lod_density, glm::max(far_lod_density, 1u));
+
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, frame.transform_feedback);
+
+    for (uint i = 0; i < max_lods; i++) {
+        glBeginQueryIndexed(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, i, frame.queries[i]);
+    }
+    // Every draw until end appends to the output buffers
+    glBeginTransformFeedback(GL_POINTS);
+    _culling = true;
+}
+
+void GrassCuller::cull_instances(uint instance_vao, uint instance_count) {
+    ASSERT(_culling, "GrassCuller::cull_instances called outside of begin / end");
+    glBindVertexArray(instance_vao);
+    glDrawArrays(GL_POINTS, 0, instance_count);
+}
+
+void GrassCuller::end() {
+    ASSERT(_culling, "GrassCuller::end called without GrassCuller::begin");
+    Frame& frame = _frames[_frame];
+
+    glEndTransformFeedback();
+    for (uint i = 0; i < max_lods; i++) {
+        glEndQueryIndexed(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, i);
+    }
+
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+    glBindVertexArray(0);
+    glDisable(GL_RASTERIZER_DISCARD);
+    frame.culled = true;
+    _culling = false;
+
+    // The other frame was culled last frame so its queries should be done by now
+    read_visible_counts(_frames[(_frame + 1) % _frames.size()]);
+}
+
+void GrassCuller::read_visible_counts(Frame& frame) {
+    if (!frame.culled) {
+        _visible.fill(0);
+    }
+    else {
+        for (uint i = 0; i < max_lods; i++) {
+            glGetQueryObjectuiv(frame.queries[i], GL_QUERY_RESULT, &_visible[i]);
+        }
+    }
+
+    std::array<DrawElementsIndirectCommand, max_lods> commands;
+    for (uint i = 0; i < max_lods; i++) {
+        commands[i] = {
+            lods[i].index_count,
+            _visible[i],
+            lods[i].first_index,
+            0,
+            0
+        };
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _indirect_buffer);
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(commands), commands.data());
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void GrassCuller::render(Renderer& renderer, Shader& shader) {
+    ASSERT(_initialized, "GrassCuller used before GrassCuller::init");
+
+    Frame& frame = _frames[(_frame + 1) % _frames.size()];
+    for (uint i = 0; i < max_lods; i++) {
+        if (_visible[i] == 0) {
+            continue;
+        }
+        // Widen the thinned out last lod so the field doesn't look bald
+        shader.set_float("lod_width_scale", i == max_lods - 1 ? far_lod_width_scale : 1.0f);
+        renderer.render_mesh(frame.meshes[i]);
+    }
+}
+
+uint GrassCuller::visible_count(uint lod) const {
+    ASSERT(lod < max_lods, "lod %u out of range", lod);
+    return _visible[lod];
+}
+
+size_t GrassCuller::output_buffer_size() const {
+    size_t size = 0;
+    for (uint i = 0; i < max_lods; i++) {
+        size += lod_capacity(i) * sizeof(GrassInstance);
+    }
+    return size * _frames.size();
+}
+
+uint GrassCuller::lod_capacity(uint lod) const {
+    return _max_instances * lods[lod].capacity;
+}
+
+uint GrassCuller::visible_count() const {
+    uint count = 0;
+    for (uint visible : _visible) {
+        count += visible;
+    }
+    return count;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <array>
+#include "camera.hpp"
+#include "grass_instance.hpp"
+#include "mesh.hpp"
+#include "renderer.hpp"
+#include "shader.hpp"
+
+// Culls grass instances against the camera frustum on the gpu and sorts the
+// survivors into distance based lod buckets using transform feedback. Any
+// number of instance buffers can be culled into the same buckets. Every
+// bucket is then drawn with a single glDrawElementsIndirect.
+//
+// NOTE: GL 4.1 can't write draw counts on the gpu so the counts come from
+// transform feedback queries. Those are read one frame late to avoid
+// stalling, which is why all output buffers are double buffered.
+class GrassCuller {
+public:
+    // Limited by GL_MAX_VERTEX_STREAMS which is at least 4
+    static constexpr uint max_lods = 3;
+
+    struct Lod {
+        // Blades further away than this fall into the next lod
+        float max_distance = 0;
+        // Range of the mesh's index buffer drawn for this lod
+        uint first_index = 0;
+        uint index_count = 0;
+        // Fraction of max_instances reserved for this lod's output buffer
+        // anything past that gets dropped by transform feedback
+        float capacity = 1;
+    };
+
+    std::array<Lod, max_lods> lods;
+    // Bounding sphere radius of a single blade in world space
+    float cull_radius = 1.0f;
+    // Only 1 in far_lod_density blades are kept in the last lod
+    uint far_lod_density = 4;
+    float far_lod_width_scale = 2.0f;
+
+    GrassCuller() {}
+    ~GrassCuller();
+
+    // max_instances is the most instances that get culled in a single frame
+    // lods have to be set before calling this
+    void init(Mesh& mesh, uint max_instances);
+    bool initialized() const { return _initialized; }
+
+    // Creates a vao that reads an instance buffer of GrassInstances
+    // for cull_instances. Owned by the caller
+    static uint create_instance_vao(uint instance_vbo);
+
+    // Culling pass for this frame. Call cull_instances
+    // for every instance buffer between begin and end
+    void begin(Camera& camera);
+    void cull_instances(uint instance_vao, uint instance_count);
+    void end();
+    // Draws the result of the previous frame's cull.
+    // assumes shader is in use, sets its lod_width_scale uniform
+    void render(Renderer& renderer, Shader& shader);
+
+    uint visible_count(uint lod) const;
+    uint visible_count() const;
+    // Bytes of gpu memory used for the culling output
+    size_t output_buffer_size() const;
+
+private:
+    struct Frame {
+        uint transform_feedback = 0;
+        std::array<uint, max_lods> buffers = {};
+        std::array<uint, max_lods> queries = {};
+        std::array<uint, max_lods> vaos = {};
+        std::array<Mesh, max_lods> meshes;
+        bool culled = false;
+    };
+
+    Shader _cull_shader;
+    struct {
+        Uniform frustum_planes;
+        Uniform camera_pos;
+        Uniform cull_radius;
+        Uniform lod_distances;
+        Uniform far_lod_density;
+    } _uniforms;
+    std::array<Frame, 2> _frames;
+    uint _frame = 0;
+
+    uint _indirect_buffer = 0;
+    uint _max_instances = 0;
+    bool _culling = false;
+    std::array<uint, max_lods> _visible = {};
+    bool _initialized = false;
+
+    uint lod_capacity(uint lod) const;
+    void init_cull_shader();
+    void init_frame(Frame& frame, Mesh& mesh);
+    void read_visible_counts(Frame& frame);
+};
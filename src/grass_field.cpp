@@ -0,0 +1,276 @@
+#include <algorithm>
+#include <glad/glad.h>
+#include "grass_field.hpp"
+#include "debug.hpp"
+#include "frustum.hpp"
+#include "random.hpp"
+
+GrassField::~GrassField() {
+    unload_all();
+}
+
+void GrassField::init(Mesh& mesh) {
+    culler.init(mesh, memory_budget / sizeof(GrassInstance));
+    _loaded_chunk_size = chunk_size;
+}
+
+void GrassField::update(const Camera& camera) {
+    ASSERT(culler.initialized(), "GrassField used before GrassField::init");
+    // Every chunk is in the wrong place if the size changed
+    if (chunk_size != _loaded_chunk_size) {
+        unload_all();
+        _loaded_chunk_size = chunk_size;
+    }
+    evict_chunks(camera);
+    upload_chunks();
+    request_chunks(camera);
+}
+
+void GrassField::cull(Camera& camera) {
+    Frustum frustum(camera.get_perspective_matrix() * camera.get_view_matrix());
+    float blade_height = blade_scale.y * 2;
+
+    culler.begin(camera);
+    for (auto& [key, chunk] : _chunks) {
+        if (!chunk.loaded()) {
+            continue;
+        }
+        glm::vec3 min(
+            chunk.coord.x * chunk_size,
+            ground_height - blade_height,
+            chunk.coord.y * chunk_size
+        );
+        glm::vec3 max = min + glm::vec3(chunk_size, blade_height * 2, chunk_size);
+        if (!frustum.intersects_aabb(min - culler.cull_radius, max + culler.cull_radius)) {
+            continue;
+        }
+        culler.cull_instances(chunk.vao, chunk.instance_count);
+    }
+    culler.end();
+}
+
+void GrassField::render(Renderer& renderer, Shader& shader) {
+    culler.render(renderer, shader);
+}
+
+uint GrassField::loaded_chunk_count() const {
+    uint count = 0;
+    for (const auto& [key, chunk] : _chunks) {
+        if (chunk.loaded()) {
+            count++;
+        }
+    }
+    return count;
+}
+
+uint GrassField::pending_chunk_count() const {
+    return _chunks.size() - loaded_chunk_count();
+}
+
+size_t GrassField::loaded_instance_count() const {
+    size_t count = 0;
+    for (const auto& [key, chunk] : _chunks) {
+        if (chunk.loaded()) {
+            count += chunk.instance_count;
+        }
+    }
+    return count;
+}
+
+uint GrassField::instances_per_chunk() const {
+    return density * chunk_size * chunk_size;
+}
+
+uint64_t GrassField::chunk_key(glm::ivec2 coord) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(coord.x)) << 32)
+         | static_cast<uint32_t>(coord.y);
+}
+
+glm::vec2 GrassField::chunk_center(glm::ivec2 coord) const {
+    return (glm::vec2(coord) + 0.5f) * chunk_size;
+}
+
+float GrassField::distance_to_chunk(const Camera& camera, glm::ivec2 coord) const {
+    glm::vec2 camera_xz(camera.transform.position.x, camera.transform.position.z);
+    return glm::distance(camera_xz, chunk_center(coord));
+}
+
+void GrassField::request_chunks(const Camera& camera) {
+    glm::vec2 camera_xz(camera.transform.position.x, camera.transform.position.z);
+    glm::ivec2 center = glm::floor(camera_xz / chunk_size);
+    int radius = glm::ceil(view_radius / chunk_size);
+
+    std::vector<glm::ivec2> wanted;
+    for (int z = -radius; z <= radius; z++) {
+        for (int x = -radius; x <= radius; x++) {
+            glm::ivec2 coord = center + glm::ivec2(x, z);
+            if (distance_to_chunk(camera, coord) > view_radius) {
+                continue;
+            }
+            if (_chunks.count(chunk_key(coord)) == 0) {
+                wanted.push_back(coord);
+            }
+        }
+    }
+    // Closest chunks first so the budget goes to what's visible up close
+    std::sort(wanted.begin(), wanted.end(), [&](glm::ivec2 a, glm::ivec2 b) {
+        return distance_to_chunk(camera, a) < distance_to_chunk(camera, b);
+    });
+
+    uint count = instances_per_chunk();
+    // Nothing to put in them, and an empty buffer can't be mapped
+    if (count == 0) {
+        return;
+    }
+    size_t chunk_bytes = count * sizeof(GrassInstance);
+    uint pending = pending_chunk_count();
+
+    for (glm::ivec2 coord : wanted) {
+        if (pending >= max_pending_chunks || _memory_used + chunk_bytes > memory_budget) {
+            break;
+        }
+        Chunk& chunk = _chunks[chunk_key(coord)];
+        chunk.coord = coord;
+        chunk.instance_count = count;
+
+        // Workers write straight into the buffer, it's unmapped once they're done
+        glGenBuffers(1, &chunk.vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, chunk.vbo);
+        glBufferData(GL_ARRAY_BUFFER, chunk_bytes, nullptr, GL_STATIC_DRAW);
+        auto* out = static_cast<GrassInstance*>(glMapBufferRange(
+            GL_ARRAY_BUFFER,
+            0,
+            chunk_bytes,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+        ));
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        ASSERT(out, "Failed to map grass chunk buffer");
+        _memory_used += chunk_bytes;
+
+        Region region;
+        region.min = glm::vec2(coord) * chunk_size;
+        region.size = glm::vec2(chunk_size);
+        region.height = ground_height;
+        region.blade_scale = blade_scale;
+        region.max_yaw = max_yaw;
+        chunk.pending = _pool.submit([this, region, coord, out, count]() {
+            generate(region, chunk_key(coord), out, count, &_pool);
+        });
+        pending++;
+    }
+}
+
+void GrassField::upload_chunks() {
+    uint uploads = 0;
+    for (auto& [key, chunk] : _chunks) {
+        if (uploads >= max_uploads_per_frame) {
+            break;
+        }
+        if (chunk.loaded() || !chunk.pending.valid()) {
+            continue;
+        }
+        if (chunk.pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            continue;
+        }
+        chunk.pending.get();
+
+        glBindBuffer(GL_ARRAY_BUFFER, chunk.vbo);
+        bool intact = glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE;
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        if (!intact) {
+            // The driver can throw away mapped memory (e.g. on a display mode
+            // change). Dropping the chunk gets it requested again next frame
+            LOG("Grass chunk (%d, %d) was corrupted while mapped", chunk.coord.x, chunk.coord.y);
+            unload_chunk(chunk);
+            continue;
+        }
+        chunk.vao = GrassCuller::create_instance_vao(chunk.vbo);
+        uploads++;
+    }
+    // Corrupted chunks are left empty
+    for (auto it = _chunks.begin(); it != _chunks.end();) {
+        it = it->second.vbo == 0 ? _chunks.erase(it) : std::next(it);
+    }
+}
+
+void GrassField::evict_chunks(const Camera& camera) {
+    // A chunk's worth of slack so chunks on the edge don't get
+    // loaded and unloaded every frame
+    float evict_distance = view_radius + chunk_size;
+    for (auto it = _chunks.begin(); it != _chunks.end();) {
+        Chunk& chunk = it->second;
+        if (distance_to_chunk(camera, chunk.coord) <= evict_distance) {
+            ++it;
+            continue;
+        }
+        // Can't cancel a running generation, let it finish first
+        if (!chunk.loaded()
+            && chunk.pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            ++it;
+            continue;
+        }
+        unload_chunk(chunk);
+        it = _chunks.erase(it);
+    }
+}
+
+void GrassField::unload_chunk(Chunk& chunk) {
+    // Workers might still be writing into the mapped buffer
+    if (chunk.pending.valid()) {
+        chunk.pending.wait();
+    }
+    if (chunk.vao != 0) {
+        glDeleteVertexArrays(1, &chunk.vao);
+        chunk.vao = 0;
+    }
+    if (chunk.vbo != 0) {
+        // NOTE: deleting a mapped buffer unmaps it
+        glDeleteBuffers(1, &chunk.vbo);
+        _memory_used -= chunk.instance_count * sizeof(GrassInstance);
+        chunk.vbo = 0;
+        chunk.instance_count = 0;
+    }
+}
+
+void GrassField::unload_all() {
+    for (auto& [key, chunk] : _chunks) {
+        unload_chunk(chunk);
+    }
+    _chunks.clear();
+}
+
+void GrassField::generate(
+    const Region& region,
+    uint64_t seed,
+    GrassInstance* out,
+    size_t count,
+    ThreadPool* pool) {
+
+    auto generate_range = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            // 4 values per blade, blade i always starts at counter i * 4
+            CounterRng rng(seed, i * 4);
+            float x = rng.next_float();
+            float z = rng.next_float();
+            float yaw = rng.next_float() * region.max_yaw;
+            u8 blade_seed = rng.next_u32() >> 24;
+            out[i] = GrassInstance(
+                glm::vec3(
+                    region.min.x + x * region.size.x,
+                    region.height,
+                    region.min.y + z * region.size.y
+                ),
+                yaw,
+                region.blade_scale,
+                blade_seed
+            );
+        }
+    };
+
+    static constexpr size_t batch_size = 4096;
+    if (pool) {
+        pool->parallel_for(count, batch_size, generate_range);
+    } else {
+        generate_range(0, count);
+    }
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <future>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+#include "camera.hpp"
+#include "grass_culler.hpp"
+#include "grass_instance.hpp"
+#include "mesh.hpp"
+#include "renderer.hpp"
+#include "shader.hpp"
+#include "thread_pool.hpp"
+
+// Grass split into square chunks on the xz plane. Chunks around the camera are
+// generated on worker threads straight into their own mapped instance buffer
+// and evicted again once the camera moves away, so the field has no fixed size.
+class GrassField {
+public:
+    // Area blades get scattered over
+    struct Region {
+        glm::vec2 min = glm::vec2(0);
+        glm::vec2 size = glm::vec2(1);
+        float height = 0;
+        glm::vec2 blade_scale = glm::vec2(1);
+        // Blades get a random yaw in [0, max_yaw] degrees
+        float max_yaw = 0;
+    };
+
+    // Fills out[0, count) with blades. Blade i only depends on seed and i so
+    // the result is identical for any pool size, or without a pool at all
+    static void generate(
+        const Region& region,
+        uint64_t seed,
+        GrassInstance* out,
+        size_t count,
+        ThreadPool* pool = nullptr
+    );
+
+    // NOTE: memory_budget sizes the culling buffers so it
+    // can't be changed after init. Everything else can
+    float chunk_size = 32.0f;
+    // Chunks with a center within this distance of the camera are loaded
+    float view_radius = 128.0f;
+    // Max bytes of chunk instance buffers allocated at once
+    size_t memory_budget = 48 * 1024 * 1024;
+    // Blades per square unit
+    float density = 25.0f;
+    float ground_height = 1.0f;
+    glm::vec2 blade_scale = glm::vec2(0.1f, 1.0f);
+    float max_yaw = 10.0f;
+    // Limits how much gets uploaded in a single frame
+    uint max_uploads_per_frame = 4;
+    // Chunks generated in parallel
+    uint max_pending_chunks = 8;
+
+    GrassCuller culler;
+
+    GrassField() {}
+    ~GrassField();
+
+    // culler.lods have to be set before calling this
+    void init(Mesh& mesh);
+
+    // Requests, uploads and evicts chunks around the camera
+    void update(const Camera& camera);
+    // Culls every loaded chunk that intersects the camera frustum
+    void cull(Camera& camera);
+    // assumes shader is in use
+    void render(Renderer& renderer, Shader& shader);
+
+    uint loaded_chunk_count() const;
+    uint pending_chunk_count() const;
+    size_t loaded_instance_count() const;
+    // Bytes allocated for chunk instance buffers, pending ones included
+    size_t memory_used() const { return _memory_used; }
+    // Largest amount of blades a single chunk can have
+    uint instances_per_chunk() const;
+
+private:
+    struct Chunk {
+        glm::ivec2 coord = glm::ivec2(0);
+        uint vbo = 0;
+        uint vao = 0;
+        uint instance_count = 0;
+        // vbo is mapped and being written to until this is ready
+        std::future<void> pending;
+        bool loaded() const { return vao != 0; }
+    };
+
+    // NOTE: declared first so it outlives everything its tasks touch
+    ThreadPool _pool;
+
+    std::unordered_map<uint64_t, Chunk> _chunks;
+    size_t _memory_used = 0;
+    // Cached because chunk sizes can change at runtime
+    float _loaded_chunk_size = 0;
+
+    static uint64_t chunk_key(glm::ivec2 coord);
+    glm::vec2 chunk_center(glm::ivec2 coord) const;
+    float distance_to_chunk(const Camera& camera, glm::ivec2 coord) const;
+
+    void request_chunks(const Camera& camera);
+    void upload_chunks();
+    void evict_chunks(const Camera& camera);
+    void unload_chunk(Chunk& chunk);
+    void unload_all();
+};
@@ -0,0 +1,19 @@
+#include <cmath>
+#include "grass_instance.hpp"
+
+static u8 pack_unorm8(float value) {
+    return static_cast<u8>(glm::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+GrassInstance::GrassInstance(const glm::vec3& position, float yaw, const glm::vec2& scale, u8 seed)
+    : position(position), seed(seed) {
+    float wrapped = std::fmod(yaw, 360.0f);
+    if (wrapped < 0) {
+        wrapped += 360.0f;
+    }
+    // 256 steps so 360 and 0 are the same byte, grass.vert undoes the
+    // normalization by 255 that the attribute gets. Rounded, 256 wraps to 0
+    this->yaw = static_cast<u8>(static_cast<int>(std::round(wrapped / 360.0f * 256.0f)) & 255);
+    scale_x = pack_unorm8(scale.x / max_scale);
+    scale_y = pack_unorm8(scale.y / max_scale);
+}
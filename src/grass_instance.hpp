@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "types.hpp"
+
+// Packed per blade instance data. Replaces the model matrix and its inverse
+// (128 bytes) that used to be uploaded for every blade.
+// NOTE: decoded in grass.vert and passed through grass_cull.vert, keep them in sync
+struct GrassInstance {
+    // Has to match MAX_SCALE in grass.vert
+    static constexpr float max_scale = 4.0f;
+
+    glm::vec3 position = glm::vec3(0);
+    // Normalized, yaw covers [0, 360) degrees and scale [0, max_scale]
+    u8 yaw = 0;
+    u8 scale_x = 0;
+    u8 scale_y = 0;
+    // Random per blade value used to vary the animation
+    u8 seed = 0;
+
+    GrassInstance() = default;
+    // yaw in degrees
+    GrassInstance(const glm::vec3& position, float yaw, const glm::vec2& scale, u8 seed);
+};
+
+static_assert(sizeof(GrassInstance) == 16, "GrassInstance is expected to be 16 bytes");
@@ -214,12 +214,34 @@ std::vector<uint> Grid::get_neighbours(Cell* cell) {
 }
 
 std::optional<Cell*> Grid::find_cell(const glm::vec3& position) {
-    for (auto c : cells) {
-        if (utils::point_in_rect(
-            *c,
-            glm::vec2(position.x, position.z)
-        )) {
-            return c;
+    if (cells.empty()) {
+        return {};
+    }
+    // Cells are laid out row by row from the top left, all the same size,
+    // so the cell is just the offset from the first one in cell sizes
+    const Transform& first = cells.front()->transform;
+    float left = first.position.x - first.scale.x / 2;
+    float top = first.position.z + first.scale.z / 2;
+    int col = std::floor((position.x - left) / first.scale.x);
+    int row = std::floor((top - position.z) / first.scale.z);
+
+    // point_in_rect has the final say so points on an edge between cells
+    // still don't belong to either. Rounding can put a point that's right
+    // next to an edge one cell off, so the neighbours get a look too
+    glm::vec2 p(position.x, position.z);
+    bool in_grid = row >= 0 && col >= 0 && row < (int)_rows && col < (int)_cols;
+    if (in_grid && utils::point_in_rect(*cells[row * _cols + col], p)) {
+        return cells[row * _cols + col];
+    }
+    for (int r = row - 1; r <= row + 1; r++) {
+        for (int c = col - 1; c <= col + 1; c++) {
+            if (r < 0 || c < 0 || r >= (int)_rows || c >= (int)_cols) {
+                continue;
+            }
+            Cell* cell = cells[r * _cols + c];
+            if (utils::point_in_rect(*cell, p)) {
+                return cell;
+            }
         }
     }
     return {};
@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <numeric>
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glm/gtc/constants.hpp>
+#include "headless.hpp"
+#include "debug.hpp"
+#include "utils.hpp"
+
+namespace {
+    struct Summary {
+        float mean = 0;
+        float min = 0;
+        float max = 0;
+        float p50 = 0;
+        float p95 = 0;
+        float p99 = 0;
+    };
+
+    Summary summarize(std::vector<float> values) {
+        Summary summary;
+        if (values.empty()) {
+            return summary;
+        }
+        std::sort(values.begin(), values.end());
+        auto percentile = [&values](float p) {
+            return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+        };
+        summary.mean = std::accumulate(values.begin(), values.end(), 0.0f) / values.size();
+        summary.min = values.front();
+        summary.max = values.back();
+        summary.p50 = percentile(0.50f);
+        summary.p95 = percentile(0.95f);
+        summary.p99 = percentile(0.99f);
+        return summary;
+    }
+
+    void write_array(FILE* file, const char* name, const std::vector<float>& values) {
+        std::fprintf(file, "  \"%s\": [", name);
+        for (size_t i = 0; i < values.size(); i++) {
+            std::fprintf(file, "%s%.4f", i > 0 ? ", " : "", values[i]);
+        }
+        std::fprintf(file, "],\n");
+    }
+
+    void write_summary(FILE* file, const char* name, const Summary& summary, bool last) {
+        std::fprintf(
+            file,
+            "    \"%s\": { \"mean\": %.4f, \"min\": %.4f, \"max\": %.4f, "
+            "\"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f }%s\n",
+            name,
+            summary.mean,
+            summary.min,
+            summary.max,
+            summary.p50,
+            summary.p95,
+            summary.p99,
+            last ? "" : ","
+        );
+    }
+
+    const char* gl_string(GLenum name) {
+        const char* string = (const char*)glGetString(name);
+        return string ? string : "unknown";
+    }
+}
+
+HeadlessBenchmark::HeadlessBenchmark(const HeadlessInfo& info, uint width, uint height)
+    : _info(info), _width(width), _height(height) {
+    if (!_info.camera_path) {
+        _info.camera_path = orbit;
+    }
+    _framebuffer = std::make_unique<Framebuffer>(width, height, 1);
+    _framebuffer->create_color_attachment({ GL_RGB });
+    _framebuffer->create_render_buffer_attachment({});
+    _framebuffer->bind();
+    ASSERT(_framebuffer->is_complete(), "Headless framebuffer is incomplete");
+    _framebuffer->unbind();
+
+    _cpu_ms.reserve(_info.frame_count);
+    _captured.reserve(_info.frame_count);
+    _queries.resize(_info.frame_count * 2);
+    glGenQueries(_queries.size(), _queries.data());
+
+    std::error_code error;
+    std::filesystem::create_directories(_info.output_dir, error);
+    LOG(
+        "Headless benchmark: %u frames at %ux%u on %s",
+        _info.frame_count,
+        width,
+        height,
+        gl_string(GL_RENDERER)
+    );
+}
+
+HeadlessBenchmark::~HeadlessBenchmark() {
+    glDeleteQueries(_queries.size(), _queries.data());
+}
+
+void HeadlessBenchmark::begin_frame(Camera& camera) {
+    ASSERT(!done(), "Headless benchmark already finished");
+    if (_frame == 0) {
+        _run_start = std::chrono::steady_clock::now();
+    }
+    // Anything animated off glfwGetTime sees the same times every run
+    glfwSetTime(_frame * _info.delta_time);
+    _info.camera_path(camera, (float)_frame / _info.frame_count);
+
+    _framebuffer->bind();
+    glViewport(0, 0, _width, _height);
+    _frame_start = std::chrono::steady_clock::now();
+    glQueryCounter(_queries[_frame * 2], GL_TIMESTAMP);
+}
+
+void HeadlessBenchmark::end_frame() {
+    glQueryCounter(_queries[_frame * 2 + 1], GL_TIMESTAMP);
+    _cpu_ms.push_back(std::chrono::duration<float, std::milli>(
+        std::chrono::steady_clock::now() - _frame_start
+    ).count());
+
+    bool captured = _info.capture_interval > 0 && _frame % _info.capture_interval == 0;
+    if (captured) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "frame_%05u.jpg", _frame);
+        capture(_info.output_dir + "/" + name);
+    }
+    _captured.push_back(captured);
+    _framebuffer->unbind();
+    _frame++;
+}
+
+void HeadlessBenchmark::capture(const std::string& path) {
+    std::vector<u8> pixels(_width * _height * 3);
+    std::vector<u8> flipped(pixels.size());
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, _width, _height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+    // gl gives the bottom row first, jpegs start at the top
+    size_t row_size = _width * 3;
+    for (uint y = 0; y < _height; y++) {
+        std::copy_n(
+            pixels.data() + (_height - 1 - y) * row_size,
+            row_size,
+            flipped.data() + y * row_size
+        );
+    }
+    utils::write_jpeg(path.c_str(), flipped.data(), _width, _height);
+}
+
+bool HeadlessBenchmark::write_results() {
+    float wall_ms = std::chrono::duration<float, std::milli>(
+        std::chrono::steady_clock::now() - _run_start
+    ).count();
+
+    // Blocks until every frame is done on the gpu
+    std::vector<float> gpu_ms(_frame);
+    for (uint i = 0; i < _frame; i++) {
+        GLuint64 begin = 0;
+        GLuint64 end = 0;
+        glGetQueryObjectui64v(_queries[i * 2], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(_queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+        gpu_ms[i] = (end - begin) / 1000000.0f;
+    }
+
+    // Captures stall on the readback, so they're left out of the summary
+    std::vector<float> cpu_uncaptured;
+    std::vector<float> gpu_uncaptured;
+    for (uint i = 0; i < _frame; i++) {
+        if (!_captured[i]) {
+            cpu_uncaptured.push_back(_cpu_ms[i]);
+            gpu_uncaptured.push_back(gpu_ms[i]);
+        }
+    }
+    Summary cpu = summarize(cpu_uncaptured);
+    Summary gpu = summarize(gpu_uncaptured);
+
+    std::string path = _info.output_dir + "/timings.json";
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (!file) {
+        LOG("WARNING: couldn't write %s", path.c_str());
+        return false;
+    }
+    std::fprintf(file, "{\n");
+    std::fprintf(file, "  \"renderer\": \"%s\",\n", gl_string(GL_RENDERER));
+    std::fprintf(file, "  \"version\": \"%s\",\n", gl_string(GL_VERSION));
+    std::fprintf(file, "  \"width\": %u,\n", _width);
+    std::fprintf(file, "  \"height\": %u,\n", _height);
+    std::fprintf(file, "  \"frames\": %u,\n", _frame);
+    std::fprintf(file, "  \"delta_time\": %.6f,\n", _info.delta_time);
+    std::fprintf(file, "  \"wall_ms\": %.3f,\n", wall_ms);
+    std::fprintf(file, "  \"captured\": [");
+    bool first = true;
+    for (uint i = 0; i < _frame; i++) {
+        if (_captured[i]) {
+            std::fprintf(file, "%s%u", first ? "" : ", ", i);
+            first = false;
+        }
+    }
+    std::fprintf(file, "],\n");
+    write_array(file, "cpu_ms", _cpu_ms);
+    write_array(file, "gpu_ms", gpu_ms);
+    std::fprintf(file, "  \"summary\": {\n");
+    write_summary(file, "cpu_ms", cpu, false);
+    write_summary(file, "gpu_ms", gpu, true);
+    std::fprintf(file, "  }\n");
+    std::fprintf(file, "}\n");
+    std::fclose(file);
+
+    LOG(
+        "%u frames in %.1f ms, cpu %.3f ms mean / %.3f ms p99, gpu %.3f ms mean / %.3f ms p99, wrote %s",
+        _frame,
+        wall_ms,
+        cpu.mean,
+        cpu.p99,
+        gpu.mean,
+        gpu.p99,
+        path.c_str()
+    );
+    return true;
+}
+
+void HeadlessBenchmark::orbit(Camera& camera, float progress) {
+    // One lap around the origin, looking slightly down at it
+    constexpr float radius = 40.0f;
+    constexpr float height = 8.0f;
+    float angle = progress * glm::two_pi<float>();
+    glm::vec3 position = { std::cos(angle) * radius, height, std::sin(angle) * radius };
+    glm::vec3 direction = glm::normalize(-position);
+
+    camera.transform.position = position;
+    camera.set_rotation(
+        glm::degrees(std::atan2(direction.z, direction.x)),
+        glm::degrees(std::asin(direction.y))
+    );
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "camera.hpp"
+#include "framebuffer.hpp"
+
+struct HeadlessInfo {
+    uint frame_count = 600;
+    // Every frame pretends this much time passed, glfwGetTime included, so
+    // runs are repeatable
+    float delta_time = 1.0f / 60.0f;
+    // timings.json and the captured frames go here
+    std::string output_dir = "benchmark";
+    // Saves every nth frame as a jpeg, 0 saves none
+    uint capture_interval = 0;
+    // Places the camera for a point in the run, progress goes from 0 to 1.
+    // Orbits the origin if not set
+    std::function<void(Camera&, float progress)> camera_path;
+};
+
+// Runs a fixed number of frames without a visible window, rendering into a
+// Framebuffer instead of the window, and records how long each one took
+// on the cpu and the gpu.
+//
+// NOTE: captured frames read the framebuffer back, so their cpu time
+// includes waiting for the gpu. They're marked in the output
+class HeadlessBenchmark {
+public:
+    HeadlessBenchmark(const HeadlessInfo& info, uint width, uint height);
+    ~HeadlessBenchmark();
+
+    bool done() const { return _frame >= _info.frame_count; }
+    float delta_time() const { return _info.delta_time; }
+
+    // Moves the camera along the path and binds the framebuffer
+    void begin_frame(Camera& camera);
+    void end_frame();
+
+    // Waits for the gpu and writes timings.json, returns false if it
+    // couldn't be written
+    bool write_results();
+
+    static void orbit(Camera& camera, float progress);
+
+private:
+    HeadlessInfo _info;
+    uint _width;
+    uint _height;
+    std::unique_ptr<Framebuffer> _framebuffer;
+
+    uint _frame = 0;
+    std::chrono::steady_clock::time_point _frame_start;
+    std::chrono::steady_clock::time_point _run_start;
+    std::vector<float> _cpu_ms;
+    std::vector<bool> _captured;
+    // GL_TIMESTAMP queries at the start and end of every frame, only read
+    // once the run is over so they never stall it
+    std::vector<uint> _queries;
+
+    void capture(const std::string& path);
+};
@@ -34,3 +34,39 @@ void DirLight::send_to_shader(const std::string& name, Shader& shader) {
     shader.set_vec3(name + ".direction", direction);
 }
 
+
+PointLight::GpuData PointLight::gpu_data() const {
+    GpuData data = {};
+    data.position = position;
+    data.constant = constant;
+    data.ambient = ambient.clamped_vec3();
+    data.linear = linear;
+    data.diffuse = diffuse.clamped_vec3();
+    data.quadratic = quadratic;
+    data.specular = specular.clamped_vec3();
+    return data;
+}
+
+SpotLight::GpuData SpotLight::gpu_data() const {
+    GpuData data = {};
+    data.position = position;
+    data.constant = constant;
+    data.direction = direction;
+    data.linear = linear;
+    data.ambient = ambient.clamped_vec3();
+    data.quadratic = quadratic;
+    data.diffuse = diffuse.clamped_vec3();
+    data.inner_cutoff = glm::cos(glm::radians(inner_cutoff));
+    data.specular = specular.clamped_vec3();
+    data.outer_cutoff = glm::cos(glm::radians(outer_cutoff));
+    return data;
+}
+
+DirLight::GpuData DirLight::gpu_data() const {
+    GpuData data = {};
+    data.direction = direction;
+    data.ambient = ambient.clamped_vec3();
+    data.diffuse = diffuse.clamped_vec3();
+    data.specular = specular.clamped_vec3();
+    return data;
+}
@@ -14,8 +14,22 @@ public:
     void send_to_shader(const std::string& name, Shader& shader);
 };
 
+// NOTE: the GpuData structs follow std140 and have to match the
+// light structs in the Lights uniform block of the lit shaders
+
 class PointLight : public Light {
 public:
+    struct GpuData {
+        glm::vec3 position;
+        float constant;
+        glm::vec3 ambient;
+        float linear;
+        glm::vec3 diffuse;
+        float quadratic;
+        glm::vec3 specular;
+        float padding;
+    };
+
     glm::vec3 position = glm::vec3(0);
 
     float constant = 1;
@@ -27,10 +41,25 @@ public:
     PointLight() = default;
 
     void send_to_shader(const std::string& name, Shader& shader);
+    GpuData gpu_data() const;
 };
 
 class SpotLight : public Light {
 public:
+    struct GpuData {
+        glm::vec3 position;
+        float constant;
+        glm::vec3 direction;
+        float linear;
+        glm::vec3 ambient;
+        float quadratic;
+        glm::vec3 diffuse;
+        // cos of the cutoff angles
+        float inner_cutoff;
+        glm::vec3 specular;
+        float outer_cutoff;
+    };
+
     glm::vec3 position = glm::vec3(0);
     glm::vec3 direction = glm::vec3(0);
 
@@ -45,14 +74,31 @@ public:
     SpotLight() = default;
 
     void send_to_shader(const std::string& name, Shader& shader);
+    GpuData gpu_data() const;
 };
 
 class DirLight : public Light {
 public:
+    struct GpuData {
+        glm::vec3 direction;
+        float padding0;
+        glm::vec3 ambient;
+        float padding1;
+        glm::vec3 diffuse;
+        float padding2;
+        glm::vec3 specular;
+        float padding3;
+    };
+
     glm::vec3 direction = glm::vec3(0);
 
     DirLight() = default;
 
     void send_to_shader(const std::string& name, Shader& shader);
+    GpuData gpu_data() const;
 };
 
+
+static_assert(sizeof(PointLight::GpuData) == 64, "PointLight::GpuData doesn't match std140");
+static_assert(sizeof(SpotLight::GpuData) == 80, "SpotLight::GpuData doesn't match std140");
+static_assert(sizeof(DirLight::GpuData) == 64, "DirLight::GpuData doesn't match std140");
@@ -0,0 +1,310 @@
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <glad/glad.h>
+#include "light_clusters.hpp"
+#include "debug.hpp"
+
+LightClusters::~LightClusters() {
+    for (TextureBuffer* texture_buffer : { &_point_lights, &_spot_lights, &_grid, &_light_indices }) {
+        glDeleteTextures(1, &texture_buffer->texture);
+        glDeleteBuffers(1, &texture_buffer->buffer);
+    }
+}
+
+void LightClusters::init() {
+    // Every light is a few rgba texels, see the GpuData structs
+    _point_lights = create_texture_buffer(GL_RGBA32F);
+    _spot_lights = create_texture_buffer(GL_RGBA32F);
+    _grid = create_texture_buffer(GL_RG32UI);
+    _light_indices = create_texture_buffer(GL_R32UI);
+
+    int max_texels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+    _max_light_indices = std::min(max_texels, 1 << 20);
+    ASSERT(MAX_POINT_LIGHTS * sizeof(PointLight::GpuData) / sizeof(glm::vec4) <= static_cast<size_t>(max_texels),
+           "MAX_POINT_LIGHTS doesn't fit in a texture buffer of %d texels", max_texels);
+    ASSERT(MAX_SPOT_LIGHTS * sizeof(SpotLight::GpuData) / sizeof(glm::vec4) <= static_cast<size_t>(max_texels),
+           "MAX_SPOT_LIGHTS doesn't fit in a texture buffer of %d texels", max_texels);
+
+    _grid_data.resize(cluster_count);
+    _point_counts.resize(cluster_count);
+    _spot_counts.resize(cluster_count);
+    _cluster_min.resize(cluster_count);
+    _cluster_max.resize(cluster_count);
+    _initialized = true;
+}
+
+void LightClusters::build(const Scene& scene, Camera& camera, const glm::mat4& view, glm::uvec2 viewport) {
+    ASSERT(_initialized, "LightClusters used before LightClusters::init");
+    auto start = std::chrono::steady_clock::now();
+
+    update_cluster_bounds(camera);
+    float log_depth_range = glm::log(camera.far / camera.near);
+    _params.z_scale = grid_z / log_depth_range;
+    _params.z_bias = -(grid_z * glm::log(camera.near)) / log_depth_range;
+    _params.tile_scale = glm::vec2(grid_x, grid_y) / glm::max(glm::vec2(viewport), glm::vec2(1));
+
+    std::fill(_point_counts.begin(), _point_counts.end(), 0);
+    std::fill(_spot_counts.begin(), _spot_counts.end(), 0);
+    _point_hits.clear();
+    _spot_hits.clear();
+    _point_data.clear();
+    _spot_data.clear();
+
+    for (const PointLight* light : scene.point_lights) {
+        uint index = _point_data.size();
+        _point_data.push_back(light->gpu_data());
+        float radius = light_radius(*light, light->constant, light->linear, light->quadratic);
+        glm::vec3 center = view * glm::vec4(light->position, 1);
+        bin_sphere(center, radius, index, _point_hits, _point_counts);
+    }
+    // NOTE: spot lights are binned by the sphere around their whole range,
+    // not their cone. Conservative but they're rarely the majority
+    for (const SpotLight* light : scene.spot_lights) {
+        uint index = _spot_data.size();
+        _spot_data.push_back(light->gpu_data());
+        float radius = light_radius(*light, light->constant, light->linear, light->quadratic);
+        glm::vec3 center = view * glm::vec4(light->position, 1);
+        bin_sphere(center, radius, index, _spot_hits, _spot_counts);
+    }
+
+    // Lay out every cluster's list as its point lights followed by its spot lights
+    _stats.dropped_indices = 0;
+    _stats.max_lights_per_cluster = 0;
+    uint offset = 0;
+    for (uint c = 0; c < cluster_count; c++) {
+        // Counts are packed into 16 bits each
+        uint n_point = std::min(_point_counts[c], 0xFFFFu);
+        uint n_spot = std::min(_spot_counts[c], 0xFFFFu);
+        uint available = _max_light_indices - offset;
+        if (n_point > available) {
+            n_point = available;
+        }
+        if (n_spot > available - n_point) {
+            n_spot = available - n_point;
+        }
+        _stats.dropped_indices += _point_counts[c] + _spot_counts[c] - n_point - n_spot;
+        _stats.max_lights_per_cluster = std::max(_stats.max_lights_per_cluster, n_point + n_spot);
+
+        _grid_data[c] = glm::uvec2(offset, n_point | (n_spot << 16));
+        offset += n_point + n_spot;
+    }
+    _index_data.resize(offset);
+
+    // Counts get reused as how many lights were written to each cluster
+    std::fill(_point_counts.begin(), _point_counts.end(), 0);
+    std::fill(_spot_counts.begin(), _spot_counts.end(), 0);
+    for (glm::uvec2 hit : _point_hits) {
+        glm::uvec2 cell = _grid_data[hit.x];
+        uint n_point = cell.y & 0xFFFF;
+        uint& written = _point_counts[hit.x];
+        if (written < n_point) {
+            _index_data[cell.x + written++] = hit.y;
+        }
+    }
+    for (glm::uvec2 hit : _spot_hits) {
+        glm::uvec2 cell = _grid_data[hit.x];
+        uint n_point = cell.y & 0xFFFF;
+        uint n_spot = cell.y >> 16;
+        uint& written = _spot_counts[hit.x];
+        if (written < n_spot) {
+            _index_data[cell.x + n_point + written++] = hit.y;
+        }
+    }
+
+    upload(_point_lights, _point_data.data(), _point_data.size() * sizeof(PointLight::GpuData));
+    upload(_spot_lights, _spot_data.data(), _spot_data.size() * sizeof(SpotLight::GpuData));
+    upload(_grid, _grid_data.data(), _grid_data.size() * sizeof(glm::uvec2));
+    upload(_light_indices, _index_data.data(), _index_data.size() * sizeof(uint));
+
+    _stats.point_lights = _point_data.size();
+    _stats.spot_lights = _spot_data.size();
+    _stats.light_indices = _index_data.size();
+    _stats.build_ms = std::chrono::duration<float, std::milli>(
+        std::chrono::steady_clock::now() - start
+    ).count();
+}
+
+void LightClusters::bind_textures() const {
+    const std::pair<uint, const TextureBuffer*> bindings[] = {
+        { point_light_unit, &_point_lights },
+        { spot_light_unit, &_spot_lights },
+        { grid_unit, &_grid },
+        { light_index_unit, &_light_indices },
+    };
+    for (auto [unit, texture_buffer] : bindings) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_BUFFER, texture_buffer->texture);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void LightClusters::set_samplers(Shader& shader) {
+    shader.use();
+    shader.set_int("point_light_data", point_light_unit);
+    shader.set_int("spot_light_data", spot_light_unit);
+    shader.set_int("cluster_grid", grid_unit);
+    shader.set_int("cluster_light_indices", light_index_unit);
+}
+
+void LightClusters::update_cluster_bounds(const Camera& camera) {
+    if (camera.fov == _fov
+        && camera.aspect_ratio == _aspect_ratio
+        && camera.near == _near
+        && camera.far == _far) {
+        return;
+    }
+    _fov = camera.fov;
+    _aspect_ratio = camera.aspect_ratio;
+    _near = camera.near;
+    _far = camera.far;
+
+    // View space extent of the frustum at a depth of 1
+    float half_height = glm::tan(glm::radians(_fov) / 2);
+    float half_width = half_height * _aspect_ratio;
+
+    for (uint z = 0; z < grid_z; z++) {
+        float near_depth = _near * glm::pow(_far / _near, static_cast<float>(z) / grid_z);
+        float far_depth = _near * glm::pow(_far / _near, static_cast<float>(z + 1) / grid_z);
+        for (uint y = 0; y < grid_y; y++) {
+            float y0 = (-1 + 2.0f * y / grid_y) * half_height;
+            float y1 = (-1 + 2.0f * (y + 1) / grid_y) * half_height;
+            for (uint x = 0; x < grid_x; x++) {
+                float x0 = (-1 + 2.0f * x / grid_x) * half_width;
+                float x1 = (-1 + 2.0f * (x + 1) / grid_x) * half_width;
+
+                uint c = x + grid_x * (y + grid_y * z);
+                // Tiles widen with depth so the extremes are at either end
+                _cluster_min[c] = glm::vec3(
+                    std::min(x0 * near_depth, x0 * far_depth),
+                    std::min(y0 * near_depth, y0 * far_depth),
+                    -far_depth
+                );
+                _cluster_max[c] = glm::vec3(
+                    std::max(x1 * near_depth, x1 * far_depth),
+                    std::max(y1 * near_depth, y1 * far_depth),
+                    -near_depth
+                );
+            }
+        }
+    }
+}
+
+void LightClusters::bin_sphere(
+    glm::vec3 center,
+    float radius,
+    uint light,
+    std::vector<glm::uvec2>& hits,
+    std::vector<uint>& counts) {
+
+    // View space looks down -z
+    float min_depth = -center.z - radius;
+    float max_depth = -center.z + radius;
+    if (max_depth < _near || min_depth > _far) {
+        return;
+    }
+
+    auto slice = [&](float depth) {
+        float s = glm::log(std::max(depth, _near)) * _params.z_scale + _params.z_bias;
+        return static_cast<uint>(glm::clamp(s, 0.0f, grid_z - 1.0f));
+    };
+    uint z0 = slice(min_depth);
+    uint z1 = slice(std::min(max_depth, _far));
+
+    // Project the sphere's bounding box to find the tiles it can touch.
+    // Anything crossing the near plane could cover the whole screen
+    uint x0 = 0, x1 = grid_x - 1;
+    uint y0 = 0, y1 = grid_y - 1;
+    if (min_depth > _near) {
+        float half_height = glm::tan(glm::radians(_fov) / 2);
+        float half_width = half_height * _aspect_ratio;
+        glm::vec2 ndc_min(FLT_MAX);
+        glm::vec2 ndc_max(-FLT_MAX);
+        for (float depth : { min_depth, max_depth }) {
+            for (float x : { center.x - radius, center.x + radius }) {
+                float ndc = x / (depth * half_width);
+                ndc_min.x = std::min(ndc_min.x, ndc);
+                ndc_max.x = std::max(ndc_max.x, ndc);
+            }
+            for (float y : { center.y - radius, center.y + radius }) {
+                float ndc = y / (depth * half_height);
+                ndc_min.y = std::min(ndc_min.y, ndc);
+                ndc_max.y = std::max(ndc_max.y, ndc);
+            }
+        }
+        if (ndc_max.x < -1 || ndc_min.x > 1 || ndc_max.y < -1 || ndc_min.y > 1) {
+            return;
+        }
+        auto tile = [](float ndc, uint size) {
+            return static_cast<uint>(glm::clamp((ndc + 1) * 0.5f * size, 0.0f, size - 1.0f));
+        };
+        x0 = tile(ndc_min.x, grid_x);
+        x1 = tile(ndc_max.x, grid_x);
+        y0 = tile(ndc_min.y, grid_y);
+        y1 = tile(ndc_max.y, grid_y);
+    }
+
+    float radius2 = radius * radius;
+    for (uint z = z0; z <= z1; z++) {
+        for (uint y = y0; y <= y1; y++) {
+            for (uint x = x0; x <= x1; x++) {
+                uint c = x + grid_x * (y + grid_y * z);
+                glm::vec3 closest = glm::clamp(center, _cluster_min[c], _cluster_max[c]);
+                glm::vec3 d = closest - center;
+                if (glm::dot(d, d) > radius2) {
+                    continue;
+                }
+                hits.push_back(glm::uvec2(c, light));
+                counts[c]++;
+            }
+        }
+    }
+}
+
+float LightClusters::light_radius(const Light& light, float constant, float linear, float quadratic) const {
+    // Distance where the brightest channel falls below intensity_cutoff,
+    // solves constant + linear * d + quadratic * d^2 = intensity / cutoff
+    glm::vec3 color = light.ambient.clamped_vec3()
+                    + light.diffuse.clamped_vec3()
+                    + light.specular.clamped_vec3();
+    float intensity = std::max(color.r, std::max(color.g, color.b));
+    float target = intensity / intensity_cutoff;
+    if (target <= constant) {
+        return 0;
+    }
+    if (quadratic > 0) {
+        float discriminant = linear * linear - 4 * quadratic * (constant - target);
+        return (-linear + glm::sqrt(discriminant)) / (2 * quadratic);
+    }
+    if (linear > 0) {
+        return (target - constant) / linear;
+    }
+    // Never falls off
+    return FLT_MAX;
+}
+
+LightClusters::TextureBuffer LightClusters::create_texture_buffer(uint format) {
+    TextureBuffer texture_buffer;
+    glGenBuffers(1, &texture_buffer.buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, texture_buffer.buffer);
+    // Never left empty so the texture always has storage
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glGenTextures(1, &texture_buffer.texture);
+    glBindTexture(GL_TEXTURE_BUFFER, texture_buffer.texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, texture_buffer.buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    return texture_buffer;
+}
+
+void LightClusters::upload(const TextureBuffer& texture_buffer, const void* data, size_t size) {
+    glBindBuffer(GL_TEXTURE_BUFFER, texture_buffer.buffer);
+    // Orphans last frame's storage so this doesn't wait on the gpu
+    glBufferData(GL_TEXTURE_BUFFER, std::max(size, sizeof(glm::vec4)), nullptr, GL_STREAM_DRAW);
+    if (size > 0) {
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "camera.hpp"
+#include "light.hpp"
+#include "scene.hpp"
+#include "shader.hpp"
+
+// Clustered forward lighting. The view frustum is split into a grid of
+// clusters, screen tiles in x and y and exponential depth slices in z. Every
+// frame the point and spot lights are binned on the cpu into the clusters
+// their range touches, so a fragment only has to loop over the lights in its
+// own cluster instead of every light in the scene.
+//
+// NOTE: GL 4.1 has no storage buffers so the light data, the grid and the
+// light index lists are all texture buffers bound to fixed texture units
+class LightClusters {
+public:
+    static constexpr uint grid_x = 16;
+    static constexpr uint grid_y = 9;
+    static constexpr uint grid_z = 24;
+    static constexpr uint cluster_count = grid_x * grid_y * grid_z;
+
+    // Past the units materials bind their textures to
+    static constexpr uint point_light_unit = 12;
+    static constexpr uint spot_light_unit = 13;
+    static constexpr uint grid_unit = 14;
+    static constexpr uint light_index_unit = 15;
+
+    // Lights are cut off once their attenuated intensity drops below this
+    float intensity_cutoff = 1.0f / 256.0f;
+
+    struct Stats {
+        float build_ms = 0;
+        uint point_lights = 0;
+        uint spot_lights = 0;
+        // Total entries in the light index lists
+        uint light_indices = 0;
+        uint max_lights_per_cluster = 0;
+        // Lights that didn't fit in the index lists
+        uint dropped_indices = 0;
+    };
+
+    // Uniforms the lit shaders need to find their cluster,
+    // sent through the Lights uniform block
+    struct ShaderParams {
+        // Maps log(view depth) to a slice
+        float z_scale = 0;
+        float z_bias = 0;
+        // Maps gl_FragCoord.xy to a tile
+        glm::vec2 tile_scale = glm::vec2(0);
+    };
+
+    LightClusters() {}
+    ~LightClusters();
+
+    void init();
+    // Bins every light in scene and uploads the result. viewport is the
+    // size of the framebuffer in pixels
+    void build(const Scene& scene, Camera& camera, const glm::mat4& view, glm::uvec2 viewport);
+    // Binds the texture buffers to their units
+    void bind_textures() const;
+    // Points the shader's light samplers at the texture units
+    static void set_samplers(Shader& shader);
+
+    const ShaderParams& shader_params() const { return _params; }
+    const Stats& stats() const { return _stats; }
+
+private:
+    struct TextureBuffer {
+        uint buffer = 0;
+        uint texture = 0;
+    };
+
+    TextureBuffer _point_lights;
+    TextureBuffer _spot_lights;
+    TextureBuffer _grid;
+    TextureBuffer _light_indices;
+    uint _max_light_indices = 0;
+
+    // View space bounds of every cluster, rebuilt when the projection changes
+    std::vector<glm::vec3> _cluster_min;
+    std::vector<glm::vec3> _cluster_max;
+    float _fov = 0;
+    float _aspect_ratio = 0;
+    float _near = 0;
+    float _far = 0;
+
+    // Kept around so they don't get reallocated every frame
+    std::vector<PointLight::GpuData> _point_data;
+    std::vector<SpotLight::GpuData> _spot_data;
+    // (offset, point count | spot count << 16) per cluster
+    std::vector<glm::uvec2> _grid_data;
+    std::vector<uint> _point_counts;
+    std::vector<uint> _spot_counts;
+    // (cluster, light) pairs found while binning
+    std::vector<glm::uvec2> _point_hits;
+    std::vector<glm::uvec2> _spot_hits;
+    std::vector<uint> _index_data;
+
+    ShaderParams _params;
+    Stats _stats;
+    bool _initialized = false;
+
+    void update_cluster_bounds(const Camera& camera);
+    // Appends a (cluster, light) pair for every cluster the sphere touches
+    void bin_sphere(glm::vec3 center, float radius, uint light, std::vector<glm::uvec2>& hits, std::vector<uint>& counts);
+    float light_radius(const Light& light, float constant, float linear, float quadratic) const;
+
+    static TextureBuffer create_texture_buffer(uint format);
+    static void upload(const TextureBuffer& texture_buffer, const void* data, size_t size);
+};
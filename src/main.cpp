@@ -1,13 +1,39 @@
+#include <cstdlib>
+#include <cstring>
 #include "engine.hpp"
 #include "app.hpp"
 
-int main() {
+// --headless [--frames n] [--capture n] [--out dir]
+// runs the benchmark in HeadlessInfo instead of opening a window
+static void parse_args(int argc, char** argv, EngineInitInfo& cinfo) {
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--headless") == 0) {
+            cinfo.headless = true;
+        }
+        else if (std::strcmp(argv[i], "--frames") == 0 && has_value) {
+            cinfo.headless_info.frame_count = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--capture") == 0 && has_value) {
+            cinfo.headless_info.capture_interval = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--out") == 0 && has_value) {
+            cinfo.headless_info.output_dir = argv[++i];
+        }
+        else {
+            LOG("Ignoring unknown argument %s", argv[i]);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
     EngineInitInfo cinfo;
     cinfo.window_width = 1280;
     cinfo.window_height = 720;
     cinfo.window_title = "App";
     cinfo.clear_color = Color(glm::vec3(0.1, 0.1, 0.1));
     cinfo.cursor_enabled = false;
+    parse_args(argc, argv, cinfo);
 
     // Call init before creating an Application instance
     engine::init(cinfo);
@@ -16,4 +42,3 @@ int main() {
 
     return 0;
 }
-
@@ -9,11 +9,17 @@ Mesh::Mesh(std::vector<Vertex> vertices, std::vector<uint> indices)
 
 Mesh::Mesh(const Mesh& mesh)
     : draw_command(mesh.draw_command),
+      position_transform(mesh.position_transform),
+      lods(mesh.lods),
+      bounds(mesh.bounds),
+      bounding_sphere(mesh.bounding_sphere),
+      occluder(mesh.occluder),
       _vao(mesh._vao),
       _buffers_created(mesh._buffers_created),
       _vao_ready(mesh._vao_ready),
       vertices(mesh.vertices),
-      indices(mesh.indices) {}
+      indices(mesh.indices),
+      _lod_draw_commands(mesh._lod_draw_commands) {}
 
 Mesh::~Mesh() {
     if (_buffers_created) {
@@ -41,6 +47,23 @@ bool Mesh::custom_vao_set() const {
 }
 
 void Mesh::create_buffers() {
+    create_buffers(vertices.data(), vertices.size(), indices.data(), indices.size());
+}
+
+void Mesh::create_buffers(const Vertex* vertices, size_t vertex_count, const uint* indices, size_t index_count) {
+    if (!bounds.valid()) {
+        compute_bounds(vertices, vertex_count);
+    }
+    create_buffers(vertices, vertex_count, Vertex::layout(), indices, index_count);
+}
+
+void Mesh::create_buffers(
+    const void* vertices,
+    size_t vertex_count,
+    const VertexLayout& layout,
+    const uint* indices,
+    size_t index_count) {
+
     ASSERT(!_vao_ready, "Trying to create custom buffers when a separate VAO is set. Call reset_vao before calling this");
     glGenVertexArrays(1, &_vao);
     glGenBuffers(1, &_vbo);
@@ -49,39 +72,75 @@ void Mesh::create_buffers() {
     glBindVertexArray(_vao);
 
     glBindBuffer(GL_ARRAY_BUFFER, _vbo);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, vertex_count * layout.stride, vertices, GL_STATIC_DRAW);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint), indices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * sizeof(uint), indices, GL_STATIC_DRAW);
 
-    // positions
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-
-    // normals
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
-
-    // Tex coords
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, tex_coords));
+    layout.apply();
 
     glBindVertexArray(0);
 
     // Should probably be done in the constructor
     draw_command.type = DrawCommandType::DRAW_ELEMENTS;
     draw_command.mode = DrawCommandMode::TRIANGLES;
-    draw_command.vertex_count = indices.size();
+    // The index buffer also holds the lower lods after the full mesh
+    draw_command.vertex_count = lods.empty() ? index_count : lods[0].index_count;
+    create_lod_draw_commands();
 
     _buffers_created = true;
 }
 
+void Mesh::create_lod_draw_commands() {
+    _lod_draw_commands.clear();
+    for (const MeshLod& lod : lods) {
+        DrawCommand& command = _lod_draw_commands.emplace_back(draw_command);
+        command.first_index = lod.first_index;
+        command.vertex_count = lod.index_count;
+    }
+}
+
+const DrawCommand& Mesh::lod_draw_command(uint lod) const {
+    if (_lod_draw_commands.empty()) {
+        return draw_command;
+    }
+    return _lod_draw_commands[std::min<size_t>(lod, _lod_draw_commands.size() - 1)];
+}
+
+float Mesh::lod_error(uint lod) const {
+    if (lods.empty()) {
+        return 0;
+    }
+    return lods[std::min<size_t>(lod, lods.size() - 1)].error;
+}
+
+void Mesh::set_bounds(const AABB& box) {
+    bounds = box;
+    bounding_sphere = bounds::sphere_around(box);
+}
+
+void Mesh::compute_bounds(const Vertex* vertices, size_t vertex_count) {
+    bounds = bounds::compute_aabb(vertices, vertex_count);
+    bounding_sphere = bounds::compute_sphere(vertices, vertex_count, bounds);
+}
+
 void Mesh::set_vao(uint vao) {
     ASSERT(!_buffers_created, "Mesh's own buffers already created. Trying to set a custom VAO. ");
     _vao = vao;
     _vao_ready = true;
 }
 
+void Mesh::share(const Mesh& other) {
+    set_vao(other.vao());
+    draw_command = other.draw_command;
+    position_transform = other.position_transform;
+    lods = other.lods;
+    bounds = other.bounds;
+    bounding_sphere = other.bounding_sphere;
+    occluder = other.occluder;
+    _lod_draw_commands = other._lod_draw_commands;
+}
+
 void Mesh::reset_vao() {
     ASSERT(!_buffers_created, "Trying to reset the VAO of mesh's own buffers. Call delete_buffers instead");
     _vao = 0;
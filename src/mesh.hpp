@@ -1,16 +1,43 @@
 #pragma once
 
+#include <algorithm>
 #include <vector>
+#include "bounds.hpp"
 #include "shader.hpp"
 #include "texture2d.hpp"
 #include "vertex.hpp"
 #include "draw_command.hpp"
 
+// Original mesh and up to four simplified ones
+constexpr uint max_mesh_lods = 5;
+
+// A level of detail of a mesh, a range of its index buffer
+struct MeshLod {
+    uint first_index = 0;
+    uint index_count = 0;
+    // How far the surface is from the original mesh, in model units
+    float error = 0;
+};
+
 class Mesh {
 public:
     std::vector<Vertex> vertices;
     std::vector<uint> indices;
     DrawCommand draw_command;
+    // Maps the positions in the vertex buffer to model space. Identity
+    // unless the buffer holds QuantizedVertex, the renderer applies it on
+    // top of the model matrix. Copy it along with the vao
+    glm::mat4 position_transform = glm::mat4(1);
+    // Filled by mesh_simplifier::build_lods, lods[0] is the whole mesh.
+    // Empty if the mesh has no lower detail versions
+    std::vector<MeshLod> lods;
+    // Model space. create_buffers fills them in from the vertices if
+    // they're not set yet, meshes drawn with set_vao need set_bounds
+    AABB bounds;
+    BoundingSphere bounding_sphere;
+    // Model space box that's completely inside the mesh, for the renderer's
+    // occlusion culling. Empty unless the mesh is known to be solid
+    AABB occluder;
 
     Mesh() {}
     Mesh(std::vector<Vertex> vertices, std::vector<uint> indices);
@@ -26,10 +53,31 @@ public:
     bool buffers_created() const;
     bool custom_vao_set() const;
 
+    uint lod_count() const { return std::max<uint>(lods.size(), 1); }
+    // Clamped to the last level
+    const DrawCommand& lod_draw_command(uint lod) const;
+    float lod_error(uint lod) const;
+
     void create_buffers();
+    // Uploads the data straight from the pointers, vertices and indices
+    // stay empty
+    void create_buffers(const Vertex* vertices, size_t vertex_count, const uint* indices, size_t index_count);
+    // Any vertex type, layout says how to read it
+    void create_buffers(
+        const void* vertices,
+        size_t vertex_count,
+        const VertexLayout& layout,
+        const uint* indices,
+        size_t index_count
+    );
     void delete_buffers();
+    // The sphere is the one around the box
+    void set_bounds(const AABB& box);
+    void compute_bounds(const Vertex* vertices, size_t vertex_count);
     // NOTE: Only call this if using a custom VAO
     void set_vao(uint vao);
+    // Draws with other's buffers, other has to outlive this
+    void share(const Mesh& other);
     // NOTE: unsets the vao set using set_vao
     void reset_vao();
 
@@ -41,5 +89,9 @@ private:
     bool _vao_ready = false;
     // true if create_buffers is called
     bool _buffers_created = false;
+    // One per lod, made by create_buffers
+    std::vector<DrawCommand> _lod_draw_commands;
+
+    void create_lod_draw_commands();
 };
 
@@ -0,0 +1,441 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mesh_cache.hpp"
+#include "debug.hpp"
+#include "fs.hpp"
+
+struct MeshCache::Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t import_flags;
+    // Catch Vertex changing without the version being bumped
+    uint32_t vertex_size;
+    uint32_t index_size;
+
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint64_t source_hash;
+
+    uint32_t mesh_count;
+    uint32_t texture_count;
+    uint32_t source_path_length;
+    uint32_t dependency_count;
+    uint64_t source_path_offset;
+    uint64_t meshes_offset;
+    uint64_t textures_offset;
+    uint64_t dependencies_offset;
+};
+
+struct MeshCache::MeshEntry {
+    uint64_t vertex_offset;
+    uint64_t vertex_count;
+    uint64_t index_offset;
+    uint64_t index_count;
+    // MeshLods, ranges of the indices above
+    uint64_t lod_offset;
+    uint64_t lod_count;
+};
+
+namespace {
+    constexpr char magic[8] = "BEBEMSH";
+    // Blobs start at multiples of this so they're aligned in the mapping
+    constexpr size_t blob_alignment = 16;
+
+    struct TextureEntry {
+        uint32_t type;
+        uint32_t path_length;
+        uint64_t path_offset;
+    };
+
+    // Another file the import read, like an obj's material library
+    struct DependencyEntry {
+        uint64_t size;
+        int64_t mtime;
+        uint32_t path_length;
+        uint32_t padding;
+        uint64_t path_offset;
+    };
+
+    // FNV-1a
+    uint64_t hash_bytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    bool map_file(const std::string& path, const char*& data, size_t& size) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == -1 || info.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // The mapping keeps the file alive
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        data = static_cast<const char*>(mapped);
+        size = info.st_size;
+        return true;
+    }
+
+    bool hash_file(const std::string& path, uint64_t& hash) {
+        const char* data = nullptr;
+        size_t size = 0;
+        if (!map_file(path, data, size)) {
+            return false;
+        }
+        hash = hash_bytes(data, size);
+        munmap(const_cast<char*>(data), size);
+        return true;
+    }
+
+    bool source_info(const std::string& path, uint64_t& size, int64_t& mtime) {
+        std::error_code error;
+        size = std::filesystem::file_size(path, error);
+        if (error) {
+            return false;
+        }
+        mtime = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+        return !error;
+    }
+
+    // Files named by the obj's mtllib lines, relative to its directory.
+    // Other formats don't get their side files tracked
+    std::vector<std::string> material_libraries(const std::string& source_path) {
+        std::vector<std::string> libraries;
+        if (std::filesystem::path(source_path).extension() != ".obj") {
+            return libraries;
+        }
+        std::ifstream file(source_path);
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.compare(0, 7, "mtllib ") != 0) {
+                continue;
+            }
+            std::istringstream names(line.substr(7));
+            std::string name;
+            while (names >> name) {
+                libraries.push_back(name);
+            }
+        }
+        return libraries;
+    }
+
+    std::string cache_file_path(const std::string& source_path) {
+        char name[32];
+        std::snprintf(
+            name,
+            sizeof(name),
+            "%016llx.mesh",
+            (unsigned long long)hash_bytes(source_path.data(), source_path.size())
+        );
+        return fs::cache_path("meshes/") + name;
+    }
+
+    size_t align(size_t offset) {
+        return (offset + blob_alignment - 1) / blob_alignment * blob_alignment;
+    }
+
+    // Appends size bytes at an aligned offset and returns the offset
+    size_t append(std::vector<char>& buffer, const void* data, size_t size) {
+        size_t offset = align(buffer.size());
+        buffer.resize(offset + size);
+        if (size > 0) {
+            std::memcpy(buffer.data() + offset, data, size);
+        }
+        return offset;
+    }
+}
+
+MeshCache::~MeshCache() {
+    close();
+}
+
+bool MeshCache::open(const std::string& source_path, uint32_t import_flags) {
+    close();
+
+    uint64_t source_size = 0;
+    int64_t source_mtime = 0;
+    if (!source_info(source_path, source_size, source_mtime)) {
+        return false;
+    }
+    std::string cache_path = cache_file_path(source_path);
+    if (!map_file(cache_path, _data, _size)) {
+        return false;
+    }
+    // Older versions are just stale, anything else that doesn't add up is corrupt
+    if (_size >= sizeof(Header)
+        && std::memcmp(_data, magic, sizeof(magic)) == 0
+        && header().version != version) {
+        close();
+        return false;
+    }
+    if (!validate()) {
+        LOG("WARNING: ignoring corrupt mesh cache %s", cache_path.c_str());
+        close();
+        return false;
+    }
+
+    const Header& h = header();
+    std::string cached_source(_data + h.source_path_offset, h.source_path_length);
+    if (h.import_flags != import_flags
+        || h.vertex_size != sizeof(Vertex)
+        || h.index_size != sizeof(uint)
+        || cached_source != source_path
+        || h.source_size != source_size) {
+        close();
+        return false;
+    }
+    // Material libraries only go by size and mtime, they're small and
+    // rarely touched without being changed
+    std::filesystem::path directory = std::filesystem::path(source_path).parent_path();
+    const DependencyEntry* dependencies =
+        reinterpret_cast<const DependencyEntry*>(_data + h.dependencies_offset);
+    for (uint i = 0; i < h.dependency_count; i++) {
+        std::string name(_data + dependencies[i].path_offset, dependencies[i].path_length);
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        if (!source_info((directory / name).string(), size, mtime)
+            || size != dependencies[i].size
+            || mtime != dependencies[i].mtime) {
+            close();
+            return false;
+        }
+    }
+    if (h.source_mtime != source_mtime) {
+        // Touched but maybe not changed, like after a checkout
+        uint64_t source_hash = 0;
+        if (!hash_file(source_path, source_hash) || source_hash != h.source_hash) {
+            close();
+            return false;
+        }
+        // So next time doesn't have to hash again
+        std::fstream file(cache_path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(offsetof(Header, source_mtime));
+        file.write(reinterpret_cast<const char*>(&source_mtime), sizeof(source_mtime));
+    }
+
+    const TextureEntry* textures =
+        reinterpret_cast<const TextureEntry*>(_data + h.textures_offset);
+    for (uint i = 0; i < h.texture_count; i++) {
+        _texture_requests.push_back({
+            static_cast<TextureType>(textures[i].type),
+            std::string(_data + textures[i].path_offset, textures[i].path_length)
+        });
+    }
+    return true;
+}
+
+void MeshCache::close() {
+    if (_data) {
+        munmap(const_cast<char*>(_data), _size);
+    }
+    _data = nullptr;
+    _size = 0;
+    _texture_requests.clear();
+}
+
+bool MeshCache::validate() const {
+    auto in_file = [this](uint64_t offset, uint64_t count, uint64_t element_size) {
+        return offset <= _size && count <= (_size - offset) / element_size;
+    };
+
+    if (_size < sizeof(Header) || std::memcmp(_data, magic, sizeof(magic)) != 0) {
+        return false;
+    }
+    const Header& h = header();
+    if (h.vertex_size == 0 || h.index_size == 0) {
+        return false;
+    }
+    if (!in_file(h.source_path_offset, h.source_path_length, 1)
+        || !in_file(h.meshes_offset, h.mesh_count, sizeof(MeshEntry))
+        || !in_file(h.textures_offset, h.texture_count, sizeof(TextureEntry))
+        || !in_file(h.dependencies_offset, h.dependency_count, sizeof(DependencyEntry))) {
+        return false;
+    }
+    for (uint i = 0; i < h.mesh_count; i++) {
+        const MeshEntry& entry = mesh_entry(i);
+        if (!in_file(entry.vertex_offset, entry.vertex_count, h.vertex_size)
+            || !in_file(entry.index_offset, entry.index_count, h.index_size)
+            || !in_file(entry.lod_offset, entry.lod_count, sizeof(MeshLod))) {
+            return false;
+        }
+        const MeshLod* lods = reinterpret_cast<const MeshLod*>(_data + entry.lod_offset);
+        for (uint lod = 0; lod < entry.lod_count; lod++) {
+            if (lods[lod].first_index > entry.index_count
+                || lods[lod].index_count > entry.index_count - lods[lod].first_index) {
+                return false;
+            }
+        }
+    }
+    const TextureEntry* textures =
+        reinterpret_cast<const TextureEntry*>(_data + h.textures_offset);
+    for (uint i = 0; i < h.texture_count; i++) {
+        if (!in_file(textures[i].path_offset, textures[i].path_length, 1)) {
+            return false;
+        }
+    }
+    const DependencyEntry* dependencies =
+        reinterpret_cast<const DependencyEntry*>(_data + h.dependencies_offset);
+    for (uint i = 0; i < h.dependency_count; i++) {
+        if (!in_file(dependencies[i].path_offset, dependencies[i].path_length, 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const MeshCache::Header& MeshCache::header() const {
+    ASSERT(_data != nullptr, "Mesh cache is not open");
+    return *reinterpret_cast<const Header*>(_data);
+}
+
+const MeshCache::MeshEntry& MeshCache::mesh_entry(uint mesh) const {
+    const MeshEntry* entries = reinterpret_cast<const MeshEntry*>(_data + header().meshes_offset);
+    return entries[mesh];
+}
+
+uint MeshCache::mesh_count() const {
+    return header().mesh_count;
+}
+
+const Vertex* MeshCache::vertices(uint mesh) const {
+    ASSERT(mesh < mesh_count(), "Mesh %u out of range", mesh);
+    return reinterpret_cast<const Vertex*>(_data + mesh_entry(mesh).vertex_offset);
+}
+
+size_t MeshCache::vertex_count(uint mesh) const {
+    ASSERT(mesh < mesh_count(), "Mesh %u out of range", mesh);
+    return mesh_entry(mesh).vertex_count;
+}
+
+const uint* MeshCache::indices(uint mesh) const {
+    ASSERT(mesh < mesh_count(), "Mesh %u out of range", mesh);
+    return reinterpret_cast<const uint*>(_data + mesh_entry(mesh).index_offset);
+}
+
+size_t MeshCache::index_count(uint mesh) const {
+    ASSERT(mesh < mesh_count(), "Mesh %u out of range", mesh);
+    return mesh_entry(mesh).index_count;
+}
+
+std::vector<MeshLod> MeshCache::lods(uint mesh) const {
+    ASSERT(mesh < mesh_count(), "Mesh %u out of range", mesh);
+    const MeshEntry& entry = mesh_entry(mesh);
+    const MeshLod* lods = reinterpret_cast<const MeshLod*>(_data + entry.lod_offset);
+    return std::vector<MeshLod>(lods, lods + entry.lod_count);
+}
+
+bool MeshCache::write(
+    const std::string& source_path,
+    uint32_t import_flags,
+    const std::vector<Mesh>& meshes,
+    const std::vector<TextureRequest>& texture_requests) {
+
+    Header h = {};
+    std::memcpy(h.magic, magic, sizeof(magic));
+    h.version = version;
+    h.import_flags = import_flags;
+    h.vertex_size = sizeof(Vertex);
+    h.index_size = sizeof(uint);
+    if (!source_info(source_path, h.source_size, h.source_mtime)
+        || !hash_file(source_path, h.source_hash)) {
+        return false;
+    }
+    h.mesh_count = meshes.size();
+    h.texture_count = texture_requests.size();
+
+    // Header and the tables get filled in once the blobs are placed
+    std::vector<char> buffer(sizeof(Header));
+    h.source_path_length = source_path.size();
+    h.source_path_offset = append(buffer, source_path.data(), source_path.size());
+
+    std::vector<MeshEntry> mesh_entries(meshes.size());
+    for (size_t i = 0; i < meshes.size(); i++) {
+        const Mesh& mesh = meshes[i];
+        MeshEntry& entry = mesh_entries[i];
+        entry.vertex_count = mesh.vertices.size();
+        entry.vertex_offset = append(buffer, mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+        entry.index_count = mesh.indices.size();
+        entry.index_offset = append(buffer, mesh.indices.data(), mesh.indices.size() * sizeof(uint));
+        entry.lod_count = mesh.lods.size();
+        entry.lod_offset = append(buffer, mesh.lods.data(), mesh.lods.size() * sizeof(MeshLod));
+    }
+    h.meshes_offset = append(buffer, mesh_entries.data(), mesh_entries.size() * sizeof(MeshEntry));
+
+    std::vector<TextureEntry> texture_entries(texture_requests.size());
+    for (size_t i = 0; i < texture_requests.size(); i++) {
+        const TextureRequest& request = texture_requests[i];
+        texture_entries[i].type = static_cast<uint32_t>(request.type);
+        texture_entries[i].path_length = request.path.size();
+        texture_entries[i].path_offset = append(buffer, request.path.data(), request.path.size());
+    }
+    h.textures_offset = append(buffer, texture_entries.data(), texture_entries.size() * sizeof(TextureEntry));
+
+    // A missing material library isn't recorded, so creating it later
+    // doesn't invalidate the cache. Assimp imports fine without it either way
+    std::filesystem::path directory = std::filesystem::path(source_path).parent_path();
+    std::vector<DependencyEntry> dependency_entries;
+    for (const std::string& name : material_libraries(source_path)) {
+        DependencyEntry entry = {};
+        if (!source_info((directory / name).string(), entry.size, entry.mtime)) {
+            continue;
+        }
+        entry.path_length = name.size();
+        entry.path_offset = append(buffer, name.data(), name.size());
+        dependency_entries.push_back(entry);
+    }
+    h.dependency_count = dependency_entries.size();
+    h.dependencies_offset = append(
+        buffer,
+        dependency_entries.data(),
+        dependency_entries.size() * sizeof(DependencyEntry)
+    );
+    std::memcpy(buffer.data(), &h, sizeof(Header));
+
+    // Written next to it first so a crash never leaves half a cache behind.
+    // The temp name is unique per process and thread, loads of the same model
+    // running at once each write their own and the last rename wins
+    std::string path = cache_file_path(source_path);
+    std::string temp_path = path + "."
+        + std::to_string(getpid()) + "."
+        + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()))
+        + ".tmp";
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        file.write(buffer.data(), buffer.size());
+        if (!file) {
+            LOG("WARNING: failed to write mesh cache %s", temp_path.c_str());
+            return false;
+        }
+    }
+    std::filesystem::rename(temp_path, path, error);
+    if (error) {
+        std::error_code remove_error;
+        std::filesystem::remove(temp_path, remove_error);
+        LOG("WARNING: failed to write mesh cache %s: %s", path.c_str(), error.message().c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "mesh.hpp"
+#include "texture2d.hpp"
+#include "vertex.hpp"
+
+// Compiled copy of a model's meshes so loading it skips assimp. The file is
+// memory mapped and its vertex and index blobs are laid out exactly like
+// Vertex and uint arrays, so they go straight into the gl buffers.
+//
+// Caches live in fs::cache_path("meshes"), named after a hash of the source
+// path. A cache is used while the source's size and mtime match. If only the
+// mtime changed the source gets hashed, and the cache is kept if the hash
+// still matches. An obj's material libraries are tracked by size and mtime
+// too, since the texture list comes from them.
+class MeshCache {
+public:
+    // Bump when the layout of the file changes, or what goes into it.
+    // 2: meshes are welded and reordered by mesh_optimizer
+    // 3: lods from mesh_simplifier after each mesh's indices
+    // 4: size and mtime of the obj's material libraries
+    static constexpr uint32_t version = 4;
+
+    // Texture loads the model did, in order, so they can be replayed
+    struct TextureRequest {
+        TextureType type;
+        // Relative to the model's directory
+        std::string path;
+    };
+
+    MeshCache() {}
+    ~MeshCache();
+    MeshCache(const MeshCache&) = delete;
+    MeshCache& operator=(const MeshCache&) = delete;
+
+    // Maps the cache of source_path. Returns false if there is none or it
+    // is stale, import_flags are the assimp flags the model was loaded with
+    bool open(const std::string& source_path, uint32_t import_flags);
+    void close();
+
+    uint mesh_count() const;
+    const Vertex* vertices(uint mesh) const;
+    size_t vertex_count(uint mesh) const;
+    const uint* indices(uint mesh) const;
+    // Includes every lod's indices
+    size_t index_count(uint mesh) const;
+    std::vector<MeshLod> lods(uint mesh) const;
+    const std::vector<TextureRequest>& texture_requests() const { return _texture_requests; }
+
+    // Writes the cache of source_path, meshes need their vertices and indices
+    static bool write(
+        const std::string& source_path,
+        uint32_t import_flags,
+        const std::vector<Mesh>& meshes,
+        const std::vector<TextureRequest>& texture_requests
+    );
+
+private:
+    struct Header;
+    struct MeshEntry;
+
+    const char* _data = nullptr;
+    size_t _size = 0;
+    std::vector<TextureRequest> _texture_requests;
+
+    const Header& header() const;
+    const MeshEntry& mesh_entry(uint mesh) const;
+    // Checks that every offset in the file is inside of it
+    bool validate() const;
+};
@@ -0,0 +1,369 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+#include "mesh_optimizer.hpp"
+#include "debug.hpp"
+
+namespace {
+    // Forsyth's constants, tuned for a 32 entry LRU cache
+    constexpr uint forsyth_cache_size = 32;
+    constexpr float cache_decay_power = 1.5f;
+    constexpr float last_triangle_score = 0.75f;
+    constexpr float valence_boost_scale = 2.0f;
+    constexpr float valence_boost_power = 0.5f;
+
+    // Runs shorter than this aren't worth splitting off for overdraw
+    constexpr size_t min_cluster_triangles = 16;
+
+    static_assert(sizeof(Vertex) == 8 * sizeof(float), "Vertex has padding, welding compares raw bytes");
+
+    float vertex_score(int cache_position, uint remaining_triangles) {
+        if (remaining_triangles == 0) {
+            // Nothing left to draw with it
+            return -1.0f;
+        }
+        float score = 0;
+        if (cache_position >= 0) {
+            if (cache_position < 3) {
+                // Used by the last triangle, so it's fixed no matter what comes
+                // next. Slightly lower than the rest of the cache so the
+                // triangles around it win
+                score = last_triangle_score;
+            }
+            else {
+                float scale = 1.0f / (forsyth_cache_size - 3);
+                score = std::pow(1.0f - (cache_position - 3) * scale, cache_decay_power);
+            }
+        }
+        // Vertices with few triangles left get finished first so they don't
+        // end up stranded
+        score += valence_boost_scale * std::pow((float)remaining_triangles, -valence_boost_power);
+        return score;
+    }
+
+    // Simulated FIFO cache, the same thing analyze_vertex_cache uses
+    struct FifoCache {
+        std::vector<uint> timestamps;
+        uint time;
+        uint size;
+
+        FifoCache(size_t vertex_count, uint size)
+            : timestamps(vertex_count, 0), time(size + 1), size(size) {}
+
+        // Returns true on a miss
+        bool access(uint vertex) {
+            if (time - timestamps[vertex] > size) {
+                timestamps[vertex] = time++;
+                return true;
+            }
+            return false;
+        }
+
+        void reset() {
+            // Everything already accessed falls out at once
+            time += size + 1;
+        }
+    };
+
+    struct VertexHash {
+        size_t operator()(const Vertex* vertex) const {
+            uint32_t words[8];
+            std::memcpy(words, vertex, sizeof(words));
+            size_t hash = 0;
+            for (uint32_t word : words) {
+                hash = (hash ^ word) * 0x100000001b3ull;
+            }
+            return hash;
+        }
+    };
+
+    struct VertexEqual {
+        bool operator()(const Vertex* a, const Vertex* b) const {
+            return std::memcmp(a, b, sizeof(Vertex)) == 0;
+        }
+    };
+}
+
+mesh_optimizer::CacheStats mesh_optimizer::analyze_vertex_cache(
+    const uint* indices,
+    size_t index_count,
+    size_t vertex_count,
+    uint cache_size) {
+
+    CacheStats stats;
+    if (index_count == 0 || vertex_count == 0) {
+        return stats;
+    }
+    FifoCache cache(vertex_count, cache_size);
+    size_t misses = 0;
+    for (size_t i = 0; i < index_count; i++) {
+        misses += cache.access(indices[i]);
+    }
+    stats.acmr = (float)misses / (index_count / 3);
+    stats.atvr = (float)misses / vertex_count;
+    return stats;
+}
+
+size_t mesh_optimizer::weld(std::vector<Vertex>& vertices, std::vector<uint>& indices) {
+    std::unordered_map<const Vertex*, uint, VertexHash, VertexEqual> unique;
+    unique.reserve(vertices.size());
+    std::vector<uint> remap(vertices.size());
+    std::vector<Vertex> welded;
+    welded.reserve(vertices.size());
+
+    // The keys point into vertices, which isn't touched until the end
+    for (size_t i = 0; i < vertices.size(); i++) {
+        auto [it, inserted] = unique.try_emplace(&vertices[i], welded.size());
+        if (inserted) {
+            welded.push_back(vertices[i]);
+        }
+        remap[i] = it->second;
+    }
+    for (uint& index : indices) {
+        index = remap[index];
+    }
+    vertices.swap(welded);
+    return vertices.size();
+}
+
+void mesh_optimizer::optimize_vertex_cache(uint* indices, size_t index_count, size_t vertex_count) {
+    ASSERT(index_count % 3 == 0, "Index count %zu isn't a triangle list", index_count);
+    size_t triangle_count = index_count / 3;
+    if (triangle_count == 0) {
+        return;
+    }
+
+    // Triangles of every vertex, the first remaining[v] are still to be drawn
+    std::vector<uint> remaining(vertex_count, 0);
+    for (size_t i = 0; i < index_count; i++) {
+        remaining[indices[i]]++;
+    }
+    std::vector<uint> offsets(vertex_count + 1, 0);
+    std::partial_sum(remaining.begin(), remaining.end(), offsets.begin() + 1);
+    std::vector<uint> adjacency(index_count);
+    {
+        std::vector<uint> cursor(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < index_count; i++) {
+            adjacency[cursor[indices[i]]++] = i / 3;
+        }
+    }
+
+    std::vector<int> cache_position(vertex_count, -1);
+    std::vector<float> scores(vertex_count);
+    for (size_t v = 0; v < vertex_count; v++) {
+        scores[v] = vertex_score(-1, remaining[v]);
+    }
+    std::vector<float> triangle_scores(triangle_count);
+    for (size_t t = 0; t < triangle_count; t++) {
+        triangle_scores[t] = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] + scores[indices[t * 3 + 2]];
+    }
+    std::vector<bool> emitted(triangle_count, false);
+    std::vector<uint> output;
+    output.reserve(index_count);
+
+    std::vector<uint> cache;
+    std::vector<uint> next_cache;
+    cache.reserve(forsyth_cache_size + 3);
+    next_cache.reserve(forsyth_cache_size + 3);
+
+    int best = std::max_element(triangle_scores.begin(), triangle_scores.end()) - triangle_scores.begin();
+    size_t next_unemitted = 0;
+    while (output.size() < index_count) {
+        if (best < 0) {
+            // Nothing in the cache has triangles left, start somewhere else
+            while (emitted[next_unemitted]) {
+                next_unemitted++;
+            }
+            best = next_unemitted;
+        }
+        const uint* triangle = indices + best * 3;
+        emitted[best] = true;
+        for (uint corner = 0; corner < 3; corner++) {
+            uint v = triangle[corner];
+            output.push_back(v);
+            // Swap the triangle out of the vertex's remaining ones
+            uint* first = adjacency.data() + offsets[v];
+            uint* last = first + remaining[v] - 1;
+            uint* found = std::find(first, last + 1, (uint)best);
+            std::swap(*found, *last);
+            remaining[v]--;
+        }
+
+        // The triangle's vertices go to the front, the rest shift back
+        next_cache.assign(triangle, triangle + 3);
+        for (uint v : cache) {
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+                next_cache.push_back(v);
+            }
+        }
+        for (size_t i = 0; i < next_cache.size(); i++) {
+            uint v = next_cache[i];
+            cache_position[v] = i < forsyth_cache_size ? i : -1;
+            scores[v] = vertex_score(cache_position[v], remaining[v]);
+        }
+
+        // Only triangles touching the cache changed score
+        best = -1;
+        float best_score = -1;
+        for (uint v : next_cache) {
+            for (uint i = offsets[v]; i < offsets[v] + remaining[v]; i++) {
+                uint t = adjacency[i];
+                float score = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] + scores[indices[t * 3 + 2]];
+                triangle_scores[t] = score;
+                if (score > best_score) {
+                    best_score = score;
+                    best = t;
+                }
+            }
+        }
+        if (next_cache.size() > forsyth_cache_size) {
+            next_cache.resize(forsyth_cache_size);
+        }
+        cache.swap(next_cache);
+    }
+    std::copy(output.begin(), output.end(), indices);
+}
+
+void mesh_optimizer::optimize_overdraw(
+    uint* indices,
+    size_t index_count,
+    const Vertex* vertices,
+    size_t vertex_count,
+    float threshold) {
+
+    size_t triangle_count = index_count / 3;
+    if (triangle_count < min_cluster_triangles * 2) {
+        return;
+    }
+
+    // Hard boundaries, where the cache order starts over anyway because
+    // a triangle shares nothing with what came before it
+    std::vector<size_t> hard;
+    {
+        FifoCache cache(vertex_count, analysis_cache_size);
+        for (size_t t = 0; t < triangle_count; t++) {
+            uint misses = cache.access(indices[t * 3])
+                + cache.access(indices[t * 3 + 1])
+                + cache.access(indices[t * 3 + 2]);
+            if (misses == 3) {
+                hard.push_back(t);
+            }
+        }
+        hard.push_back(triangle_count);
+    }
+
+    // Soft boundaries, splitting a run where the part so far is already
+    // about as cache friendly as the whole run
+    std::vector<size_t> clusters;
+    {
+        FifoCache cache(vertex_count, analysis_cache_size);
+        for (size_t h = 0; h + 1 < hard.size(); h++) {
+            size_t begin = hard[h];
+            size_t end = hard[h + 1];
+            cache.reset();
+            size_t misses = 0;
+            for (size_t i = begin * 3; i < end * 3; i++) {
+                misses += cache.access(indices[i]);
+            }
+            float target = (float)misses / (end - begin) * threshold;
+
+            cache.reset();
+            size_t start = begin;
+            misses = 0;
+            clusters.push_back(begin);
+            for (size_t t = begin; t < end; t++) {
+                misses += cache.access(indices[t * 3])
+                    + cache.access(indices[t * 3 + 1])
+                    + cache.access(indices[t * 3 + 2]);
+                size_t count = t + 1 - start;
+                if (count >= min_cluster_triangles && t + 1 < end && (float)misses / count <= target) {
+                    clusters.push_back(t + 1);
+                    start = t + 1;
+                    misses = 0;
+                    cache.reset();
+                }
+            }
+        }
+        clusters.push_back(triangle_count);
+    }
+
+    // Clusters far out from the middle and facing away from it are the
+    // ones most likely to be in front of the rest
+    glm::vec3 mesh_center(0);
+    float mesh_area = 0;
+    std::vector<glm::vec3> centers(clusters.size() - 1, glm::vec3(0));
+    std::vector<glm::vec3> normals(clusters.size() - 1, glm::vec3(0));
+    std::vector<float> areas(clusters.size() - 1, 0);
+    for (size_t c = 0; c + 1 < clusters.size(); c++) {
+        for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+            glm::vec3 a = vertices[indices[t * 3]].position;
+            glm::vec3 b = vertices[indices[t * 3 + 1]].position;
+            glm::vec3 d = vertices[indices[t * 3 + 2]].position;
+            glm::vec3 normal = glm::cross(b - a, d - a);
+            float area = glm::length(normal);
+            centers[c] += (a + b + d) * (area / 3.0f);
+            normals[c] += normal;
+            areas[c] += area;
+        }
+        mesh_center += centers[c];
+        mesh_area += areas[c];
+    }
+    if (mesh_area <= 0) {
+        return;
+    }
+    mesh_center /= mesh_area;
+
+    std::vector<float> keys(clusters.size() - 1, 0);
+    for (size_t c = 0; c < keys.size(); c++) {
+        float normal_length = glm::length(normals[c]);
+        if (areas[c] > 0 && normal_length > 0) {
+            glm::vec3 center = centers[c] / areas[c];
+            keys[c] = glm::dot(center - mesh_center, normals[c] / normal_length);
+        }
+    }
+    std::vector<uint> order(keys.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&keys](uint a, uint b) {
+        return keys[a] > keys[b];
+    });
+
+    std::vector<uint> sorted;
+    sorted.reserve(index_count);
+    for (uint c : order) {
+        sorted.insert(sorted.end(), indices + clusters[c] * 3, indices + clusters[c + 1] * 3);
+    }
+    std::copy(sorted.begin(), sorted.end(), indices);
+}
+
+size_t mesh_optimizer::optimize_vertex_fetch(std::vector<Vertex>& vertices, std::vector<uint>& indices) {
+    constexpr uint unused = ~0u;
+    std::vector<uint> remap(vertices.size(), unused);
+    std::vector<Vertex> ordered;
+    ordered.reserve(vertices.size());
+    for (uint& index : indices) {
+        if (remap[index] == unused) {
+            remap[index] = ordered.size();
+            ordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(ordered);
+    return vertices.size();
+}
+
+mesh_optimizer::Report mesh_optimizer::optimize(std::vector<Vertex>& vertices, std::vector<uint>& indices) {
+    Report report;
+    report.vertices_before = vertices.size();
+    report.before = analyze_vertex_cache(indices.data(), indices.size(), vertices.size());
+
+    weld(vertices, indices);
+    optimize_vertex_cache(indices.data(), indices.size(), vertices.size());
+    optimize_overdraw(indices.data(), indices.size(), vertices.data(), vertices.size());
+    optimize_vertex_fetch(vertices, indices);
+
+    report.vertices_after = vertices.size();
+    report.after = analyze_vertex_cache(indices.data(), indices.size(), vertices.size());
+    return report;
+}
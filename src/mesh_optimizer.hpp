@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "types.hpp"
+#include "vertex.hpp"
+
+// Reorders indexed triangle meshes so the gpu does less work drawing them,
+// without changing what gets drawn. Model runs it on everything it imports
+// before writing the mesh cache, so it only costs anything once per model.
+//
+// The steps, in the order optimize runs them:
+//   weld                   merges vertices that are identical bit for bit
+//   optimize_vertex_cache  orders triangles so recently transformed
+//                          vertices get reused (Forsyth's linear-speed
+//                          vertex cache optimisation)
+//   optimize_overdraw      splits that order into runs the cache doesn't
+//                          care about and puts the outward facing ones first,
+//                          so they occlude the rest (Sander et al.)
+//   optimize_vertex_fetch  puts vertices in the order they're first used
+namespace mesh_optimizer {
+
+// Vertex cache efficiency of an index buffer on a simulated FIFO cache
+struct CacheStats {
+    // Average cache miss ratio, transformed vertices per triangle. 0.5 is
+    // the best a large regular grid can do, 3 is no reuse at all
+    float acmr = 0;
+    // Average transform to vertex ratio, 1 means every vertex is
+    // transformed exactly once
+    float atvr = 0;
+};
+
+struct Report {
+    size_t vertices_before = 0;
+    size_t vertices_after = 0;
+    CacheStats before;
+    CacheStats after;
+};
+
+// Cache size the stats are simulated with, what most gpus get close to
+constexpr uint analysis_cache_size = 16;
+
+CacheStats analyze_vertex_cache(
+    const uint* indices,
+    size_t index_count,
+    size_t vertex_count,
+    uint cache_size = analysis_cache_size
+);
+
+// Returns the new vertex count
+size_t weld(std::vector<Vertex>& vertices, std::vector<uint>& indices);
+void optimize_vertex_cache(uint* indices, size_t index_count, size_t vertex_count);
+// threshold is how much worse than the cache order a run's ACMR can get
+// before it can't be moved around on its own anymore
+void optimize_overdraw(
+    uint* indices,
+    size_t index_count,
+    const Vertex* vertices,
+    size_t vertex_count,
+    float threshold = 1.05f
+);
+// Drops vertices no index uses, returns the new vertex count
+size_t optimize_vertex_fetch(std::vector<Vertex>& vertices, std::vector<uint>& indices);
+
+// All of the above, indices have to be a triangle list
+Report optimize(std::vector<Vertex>& vertices, std::vector<uint>& indices);
+
+}
@@ -0,0 +1,362 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include "mesh_simplifier.hpp"
+#include "debug.hpp"
+#include "mesh_optimizer.hpp"
+
+namespace {
+    // Levels of detail with fewer triangles than this aren't worth a switch
+    constexpr size_t min_lod_indices = 3 * 32;
+    // A level has to get at least this much smaller than the last one
+    constexpr float min_lod_reduction = 0.85f;
+    // Collapses that turn a triangle further than this are rejected,
+    // cos(75°)
+    constexpr float max_normal_change = 0.25f;
+
+    // Sum of squared distances to a set of planes, each weighted by the
+    // area of the triangle it came from. Doubles because the terms cancel
+    // out a lot near the planes
+    struct Quadric {
+        // Upper half of the symmetric 4x4 matrix
+        double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+        double a11 = 0, a12 = 0, a13 = 0;
+        double a22 = 0, a23 = 0;
+        double a33 = 0;
+        double weight = 0;
+
+        void add_plane(glm::dvec3 normal, double distance, double plane_weight) {
+            a00 += plane_weight * normal.x * normal.x;
+            a01 += plane_weight * normal.x * normal.y;
+            a02 += plane_weight * normal.x * normal.z;
+            a03 += plane_weight * normal.x * distance;
+            a11 += plane_weight * normal.y * normal.y;
+            a12 += plane_weight * normal.y * normal.z;
+            a13 += plane_weight * normal.y * distance;
+            a22 += plane_weight * normal.z * normal.z;
+            a23 += plane_weight * normal.z * distance;
+            a33 += plane_weight * distance * distance;
+            weight += plane_weight;
+        }
+
+        Quadric& operator+=(const Quadric& q) {
+            a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+            a11 += q.a11; a12 += q.a12; a13 += q.a13;
+            a22 += q.a22; a23 += q.a23;
+            a33 += q.a33;
+            weight += q.weight;
+            return *this;
+        }
+
+        // Weighted sum of squared distances from p to the planes
+        double evaluate(glm::dvec3 p) const {
+            double x = p.x, y = p.y, z = p.z;
+            double result = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+                + a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+                + a22 * z * z + 2 * a23 * z
+                + a33;
+            // Rounding can take it just under 0
+            return std::max(result, 0.0);
+        }
+    };
+
+    struct Collapse {
+        uint from;
+        uint to;
+        // Mean squared distance the surface moves by
+        float cost;
+    };
+
+    struct PositionHash {
+        size_t operator()(const glm::vec3& p) const {
+            uint32_t words[3];
+            std::memcpy(words, &p, sizeof(words));
+            return (words[0] * 73856093u) ^ (words[1] * 19349663u) ^ (words[2] * 83492791u);
+        }
+    };
+
+    uint64_t edge_key(uint a, uint b) {
+        return (uint64_t)a << 32 | b;
+    }
+
+    glm::vec3 triangle_normal(glm::vec3 a, glm::vec3 b, glm::vec3 c) {
+        return glm::cross(b - a, c - a);
+    }
+
+    // Marks vertices that can't be moved: ones that share their position
+    // with another vertex (a seam) and ones on an edge only one triangle
+    // uses (a border) or more than two use
+    std::vector<bool> find_locked_vertices(
+        const uint* indices,
+        size_t index_count,
+        const Vertex* vertices,
+        size_t vertex_count) {
+
+        std::vector<bool> locked(vertex_count, false);
+        // Every vertex with the same position gets the same id, so edges
+        // along a seam still find their other side
+        std::vector<uint> position_ids(vertex_count);
+        std::unordered_map<glm::vec3, uint, PositionHash> first_at_position;
+        first_at_position.reserve(vertex_count);
+        std::vector<uint> at_position(vertex_count, 0);
+        for (uint i = 0; i < vertex_count; i++) {
+            auto [it, inserted] = first_at_position.emplace(vertices[i].position, i);
+            position_ids[i] = it->second;
+            at_position[it->second]++;
+        }
+        for (uint i = 0; i < vertex_count; i++) {
+            if (at_position[position_ids[i]] > 1) {
+                locked[i] = true;
+            }
+        }
+
+        std::unordered_map<uint64_t, uint> edge_uses;
+        edge_uses.reserve(index_count);
+        for (size_t i = 0; i < index_count; i += 3) {
+            for (uint e = 0; e < 3; e++) {
+                uint a = position_ids[indices[i + e]];
+                uint b = position_ids[indices[i + (e + 1) % 3]];
+                edge_uses[edge_key(a, b)]++;
+            }
+        }
+        for (size_t i = 0; i < index_count; i += 3) {
+            for (uint e = 0; e < 3; e++) {
+                uint v0 = indices[i + e];
+                uint v1 = indices[i + (e + 1) % 3];
+                uint a = position_ids[v0];
+                uint b = position_ids[v1];
+                auto reverse = edge_uses.find(edge_key(b, a));
+                if (edge_uses[edge_key(a, b)] != 1
+                    || reverse == edge_uses.end()
+                    || reverse->second != 1) {
+                    locked[v0] = true;
+                    locked[v1] = true;
+                }
+            }
+        }
+        return locked;
+    }
+
+    // Triangles around every vertex, offsets[v] to offsets[v + 1] in triangles
+    void build_adjacency(
+        const std::vector<uint>& indices,
+        size_t vertex_count,
+        std::vector<uint>& offsets,
+        std::vector<uint>& triangles) {
+
+        offsets.assign(vertex_count + 1, 0);
+        for (uint index : indices) {
+            offsets[index + 1]++;
+        }
+        for (size_t i = 0; i < vertex_count; i++) {
+            offsets[i + 1] += offsets[i];
+        }
+        triangles.resize(indices.size());
+        std::vector<uint> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++) {
+            triangles[fill[indices[i]]++] = i / 3;
+        }
+    }
+
+    // Whether moving from onto to turns any of from's triangles over
+    bool collapse_flips(
+        const Collapse& collapse,
+        const std::vector<uint>& indices,
+        const Vertex* vertices,
+        const std::vector<uint>& offsets,
+        const std::vector<uint>& triangles) {
+
+        glm::vec3 target = vertices[collapse.to].position;
+        for (uint t = offsets[collapse.from]; t < offsets[collapse.from + 1]; t++) {
+            const uint* triangle = &indices[triangles[t] * 3];
+            if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to) {
+                // Disappears
+                continue;
+            }
+            glm::vec3 corners[3];
+            glm::vec3 moved[3];
+            for (uint i = 0; i < 3; i++) {
+                corners[i] = vertices[triangle[i]].position;
+                moved[i] = triangle[i] == collapse.from ? target : corners[i];
+            }
+            glm::vec3 before = triangle_normal(corners[0], corners[1], corners[2]);
+            glm::vec3 after = triangle_normal(moved[0], moved[1], moved[2]);
+            float lengths = glm::length(before) * glm::length(after);
+            if (glm::dot(before, after) <= max_normal_change * lengths) {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+float mesh_simplifier::simplify(
+    const uint* source_indices,
+    size_t index_count,
+    const Vertex* vertices,
+    size_t vertex_count,
+    size_t target_index_count,
+    float max_error,
+    std::vector<uint>& result) {
+
+    ASSERT(index_count % 3 == 0, "Simplify needs a triangle list");
+    result.assign(source_indices, source_indices + index_count);
+    if (index_count <= target_index_count) {
+        return 0;
+    }
+
+    std::vector<bool> locked = find_locked_vertices(source_indices, index_count, vertices, vertex_count);
+
+    std::vector<Quadric> quadrics(vertex_count);
+    for (size_t i = 0; i < index_count; i += 3) {
+        glm::dvec3 a = vertices[source_indices[i]].position;
+        glm::dvec3 b = vertices[source_indices[i + 1]].position;
+        glm::dvec3 c = vertices[source_indices[i + 2]].position;
+        glm::dvec3 normal = glm::cross(b - a, c - a);
+        double length = glm::length(normal);
+        if (length == 0) {
+            continue;
+        }
+        normal /= length;
+        Quadric plane;
+        // Half the cross product is the area
+        plane.add_plane(normal, -glm::dot(normal, a), length * 0.5);
+        quadrics[source_indices[i]] += plane;
+        quadrics[source_indices[i + 1]] += plane;
+        quadrics[source_indices[i + 2]] += plane;
+    }
+
+    double max_cost = (double)max_error * max_error;
+    double result_cost = 0;
+    std::vector<uint> offsets;
+    std::vector<uint> triangles;
+    std::vector<Collapse> collapses;
+    std::vector<bool> touched(vertex_count);
+
+    while (result.size() > target_index_count) {
+        build_adjacency(result, vertex_count, offsets, triangles);
+
+        collapses.clear();
+        for (size_t i = 0; i < result.size(); i += 3) {
+            for (uint e = 0; e < 3; e++) {
+                uint a = result[i + e];
+                uint b = result[i + (e + 1) % 3];
+                // Every edge is seen from both of its triangles, so each
+                // direction only gets added from one of them
+                if (a > b) {
+                    continue;
+                }
+                for (auto [from, to] : { std::pair(a, b), std::pair(b, a) }) {
+                    if (locked[from]) {
+                        continue;
+                    }
+                    Quadric quadric = quadrics[from];
+                    quadric += quadrics[to];
+                    double cost = quadric.weight > 0
+                        ? quadric.evaluate(vertices[to].position) / quadric.weight
+                        : 0;
+                    collapses.push_back({ from, to, (float)cost });
+                }
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) {
+            return a.cost < b.cost;
+        });
+
+        // Each collapse takes about two triangles with it
+        size_t triangles_left = result.size() / 3;
+        size_t target_triangles = target_index_count / 3;
+        std::fill(touched.begin(), touched.end(), false);
+        size_t applied = 0;
+        for (const Collapse& collapse : collapses) {
+            if (triangles_left <= target_triangles || collapse.cost > max_cost) {
+                break;
+            }
+            // Everything around a collapse changed, the costs and flip
+            // checks of its neighbours are stale until the next pass
+            if (touched[collapse.from] || touched[collapse.to]) {
+                continue;
+            }
+            if (collapse_flips(collapse, result, vertices, offsets, triangles)) {
+                continue;
+            }
+            for (uint t = offsets[collapse.from]; t < offsets[collapse.from + 1]; t++) {
+                uint* triangle = &result[triangles[t] * 3];
+                bool removed = false;
+                for (uint i = 0; i < 3; i++) {
+                    touched[triangle[i]] = true;
+                    removed |= triangle[i] == collapse.to;
+                }
+                for (uint i = 0; i < 3; i++) {
+                    if (triangle[i] == collapse.from) {
+                        triangle[i] = collapse.to;
+                    }
+                }
+                triangles_left -= removed;
+            }
+            quadrics[collapse.to] += quadrics[collapse.from];
+            result_cost = std::max(result_cost, (double)collapse.cost);
+            applied++;
+        }
+
+        // Drop the triangles that collapsed into lines
+        size_t write = 0;
+        for (size_t i = 0; i < result.size(); i += 3) {
+            uint a = result[i], b = result[i + 1], c = result[i + 2];
+            if (a != b && b != c && c != a) {
+                result[write++] = a;
+                result[write++] = b;
+                result[write++] = c;
+            }
+        }
+        result.resize(write);
+
+        if (applied == 0) {
+            break;
+        }
+    }
+    return std::sqrt(result_cost);
+}
+
+void mesh_simplifier::build_lods(
+    const std::vector<Vertex>& vertices,
+    std::vector<uint>& indices,
+    std::vector<MeshLod>& lods) {
+
+    size_t index_count = indices.size();
+    lods.clear();
+    lods.push_back({ 0, (uint)index_count, 0 });
+
+    std::vector<uint> lod;
+    size_t target = index_count;
+    for (uint level = 1; level < max_mesh_lods; level++) {
+        target = target / 6 * 3;
+        if (target < min_lod_indices) {
+            break;
+        }
+        // Every level starts from the full mesh so its error is measured
+        // against what's actually being replaced
+        float error = simplify(
+            indices.data(),
+            index_count,
+            vertices.data(),
+            vertices.size(),
+            target,
+            INFINITY,
+            lod
+        );
+        if (lod.size() > lods.back().index_count * min_lod_reduction) {
+            break;
+        }
+        mesh_optimizer::optimize_vertex_cache(lod.data(), lod.size(), vertices.size());
+
+        MeshLod& next = lods.emplace_back();
+        next.first_index = indices.size();
+        next.index_count = lod.size();
+        // Selection assumes coarser levels never look better
+        next.error = std::max(error, lods[lods.size() - 2].error);
+        indices.insert(indices.end(), lod.begin(), lod.end());
+        target = lod.size();
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "mesh.hpp"
+#include "types.hpp"
+#include "vertex.hpp"
+
+// Builds the lower detail versions of meshes that Renderer switches to
+// when an object is far enough away that nobody can tell.
+//
+// Simplification collapses edges by moving one vertex onto another, picking
+// the collapses that move the surface the least first (Garland and
+// Heckbert's quadric error metric). Vertices are never moved or added, so
+// every level of detail indexes the original vertex buffer and only needs
+// its own range of the index buffer.
+//
+// Vertices on open borders or attribute seams (a uv seam, a hard edge) are
+// kept where they are, moving them would tear the mesh open or smear the
+// attributes across the seam
+namespace mesh_simplifier {
+
+// Removes triangles until there are target_index_count indices left, or
+// the next collapse would move the surface further than max_error. Returns
+// how far the surface moved, in the same units as the positions
+float simplify(
+    const uint* indices,
+    size_t index_count,
+    const Vertex* vertices,
+    size_t vertex_count,
+    size_t target_index_count,
+    float max_error,
+    std::vector<uint>& result
+);
+
+// Appends up to max_mesh_lods - 1 simplified index buffers to indices, each
+// with about half the triangles of the one before. lods[0] is the original
+// mesh. Stops early once the mesh doesn't get any smaller
+void build_lods(
+    const std::vector<Vertex>& vertices,
+    std::vector<uint>& indices,
+    std::vector<MeshLod>& lods
+);
+
+}
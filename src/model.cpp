@@ -1,21 +1,28 @@
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <algorithm>
+#include <chrono>
 #include <cstddef>
 #include <sstream>
 #include "model.hpp"
 #include "debug.hpp"
 #include "engine.hpp"
+#include "mesh_optimizer.hpp"
+#include "mesh_simplifier.hpp"
 #include "vertex.hpp"
 
+namespace {
+    // SortByPType splits meshes that mix points and lines in with triangles,
+    // so the triangle ones can be optimized
+    constexpr uint32_t import_flags = aiProcess_Triangulate | aiProcess_SortByPType | aiProcess_FlipUVs;
+}
+
 Model::Model(const char* path) {
     load(path);
 }
 
 Model::~Model() {
-    for (auto& texture : _loaded_textures) {
-        texture.unload();
-    }
 }
 
 void Model::draw(Shader& shader) {
@@ -25,25 +32,150 @@ void Model::draw(Shader& shader) {
     }
 }
 
-void Model::load(const std::string& path) {
+void Model::load(const std::string& path, VertexFormat format) {
+    auto start = std::chrono::steady_clock::now();
+    if (!decode(path, format)) {
+        ERROR("Model Loading Error: couldn't load %s", path.c_str());
+    }
+    bool cached = _cache != nullptr;
+    upload();
+
+    float ms = std::chrono::duration<float, std::milli>(
+        std::chrono::steady_clock::now() - start
+    ).count();
+    LOG(
+        "Loaded %s %s in %.1f ms, %zu KiB of %s vertices",
+        path.c_str(),
+        cached ? "from the mesh cache" : "with assimp",
+        ms,
+        _vertex_bytes / 1024,
+        _vertex_format == VertexFormat::QUANTIZED ? "quantized" : "float"
+    );
+}
+
+bool Model::decode(const std::string& path, VertexFormat format) {
     ASSERT(!_loaded, "Can't load a model after it has already been loaded");
-    Assimp::Importer importer;
-    const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+    _dir = path.substr(0, path.find_last_of('/'));
+    _vertex_format = format;
 
-    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
-        std::stringstream ss;
-        ss << "Model Loading Error: " << importer.GetErrorString() << '\n';
-        ERROR("%s", ss.str().c_str());
+    auto cache = std::make_unique<MeshCache>();
+    if (cache->open(path, import_flags)) {
+        _texture_requests = cache->texture_requests();
+        _cache = std::move(cache);
+    }
+    else {
+        if (!import(path)) {
+            return false;
+        }
+        if (!MeshCache::write(path, import_flags, meshes, _texture_requests)) {
+            LOG("WARNING: couldn't write the mesh cache for %s", path.c_str());
+        }
     }
-    _dir = path.substr(0, path.find_last_of('/'));
 
-    process_node(scene->mRootNode, scene);
-    for (auto& mesh : meshes) {
-        mesh.create_buffers();
+    // The cache holds float vertices, bounds and quantizing are cheap
+    // enough to redo
+    uint mesh_count = _cache ? _cache->mesh_count() : meshes.size();
+    _mesh_bounds.resize(mesh_count);
+    _mesh_spheres.resize(mesh_count);
+    for (uint i = 0; i < mesh_count; i++) {
+        const Vertex* vertices = _cache ? _cache->vertices(i) : meshes[i].vertices.data();
+        size_t vertex_count = _cache ? _cache->vertex_count(i) : meshes[i].vertices.size();
+        _mesh_bounds[i] = bounds::compute_aabb(vertices, vertex_count);
+        _mesh_spheres[i] = bounds::compute_sphere(vertices, vertex_count, _mesh_bounds[i]);
+    }
+    if (format == VertexFormat::QUANTIZED) {
+        _quantized_vertices.resize(mesh_count);
+        _position_transforms.resize(mesh_count);
+        for (uint i = 0; i < mesh_count; i++) {
+            const Vertex* vertices = _cache ? _cache->vertices(i) : meshes[i].vertices.data();
+            size_t vertex_count = _cache ? _cache->vertex_count(i) : meshes[i].vertices.size();
+            _quantized_vertices[i].resize(vertex_count);
+            _position_transforms[i] = vertex_quantization::quantize(
+                vertices,
+                vertex_count,
+                _quantized_vertices[i].data()
+            );
+        }
+    }
+
+    TextureCache& texture_cache = engine::get_textures();
+    for (const auto& request : _texture_requests) {
+        std::string full_path = _dir + "/" + request.path;
+        // Another model might have it already
+        if (_images.count(full_path) || texture_cache.contains(full_path)) {
+            continue;
+        }
+        if (!Texture2D::decode(full_path, _images[full_path])) {
+            LOG("Bad texture load at path: %s", full_path.c_str());
+            return false;
+        }
     }
+    return true;
+}
+
+void Model::upload() {
+    ASSERT(!_loaded, "Can't load a model after it has already been loaded");
+    if (_cache) {
+        // Resized up front, a reallocation would copy meshes that own buffers
+        meshes.resize(_cache->mesh_count());
+    }
+    _vertex_bytes = 0;
+    for (uint i = 0; i < meshes.size(); i++) {
+        Mesh& mesh = meshes[i];
+        const uint* indices = _cache ? _cache->indices(i) : mesh.indices.data();
+        size_t index_count = _cache ? _cache->index_count(i) : mesh.indices.size();
+        if (_cache) {
+            mesh.lods = _cache->lods(i);
+        }
+        mesh.bounds = _mesh_bounds[i];
+        mesh.bounding_sphere = _mesh_spheres[i];
+
+        if (_vertex_format == VertexFormat::QUANTIZED) {
+            const auto& vertices = _quantized_vertices[i];
+            mesh.create_buffers(
+                vertices.data(),
+                vertices.size(),
+                QuantizedVertex::layout(),
+                indices,
+                index_count
+            );
+            mesh.position_transform = _position_transforms[i];
+            _vertex_bytes += vertices.size() * sizeof(QuantizedVertex);
+        }
+        else if (_cache) {
+            mesh.create_buffers(_cache->vertices(i), _cache->vertex_count(i), indices, index_count);
+            _vertex_bytes += _cache->vertex_count(i) * sizeof(Vertex);
+        }
+        else {
+            mesh.create_buffers();
+            _vertex_bytes += mesh.vertices.size() * sizeof(Vertex);
+        }
+    }
+    for (const auto& request : _texture_requests) {
+        load_texture(request.path, request.type, textures);
+    }
+
+    _cache.reset();
+    _images.clear();
+    _quantized_vertices.clear();
+    _position_transforms.clear();
+    _mesh_bounds.clear();
+    _mesh_spheres.clear();
     _loaded = true;
 }
 
+bool Model::import(const std::string& path) {
+    Assimp::Importer importer;
+    const aiScene* scene = importer.ReadFile(path, import_flags);
+
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
+        LOG("Model Loading Error: %s", importer.GetErrorString());
+        return false;
+    }
+    process_node(scene->mRootNode, scene);
+    return true;
+}
+
 bool Model::loaded() const {
     return _loaded;
 }
@@ -80,31 +212,51 @@ Mesh Model::process_mesh(aiMesh* mesh, const aiScene* scene) {
         }
     }
     if (mesh->mMaterialIndex >= 0) {
+        // Only recorded here, the textures get loaded in upload
         aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
-        std::vector<Texture2D> diffuse_maps =
-            load_material_textures(
-                material,
-                aiTextureType_DIFFUSE,
-                TextureType::DIFFUSE
-            );
-        textures.insert(textures.end(), diffuse_maps.begin(), diffuse_maps.end());
+        record_material_textures(material, aiTextureType_DIFFUSE, TextureType::DIFFUSE);
+        record_material_textures(material, aiTextureType_SPECULAR, TextureType::SPECULAR);
+    }
 
-        std::vector<Texture2D> specular_maps =
-            load_material_textures(
-                material,
-                aiTextureType_SPECULAR,
-                TextureType::SPECULAR
-            );
-        textures.insert(textures.end(), specular_maps.begin(), specular_maps.end());
+    // Points and lines are kept as they are, the optimizer and simplifier
+    // only work on triangles
+    if (mesh->mPrimitiveTypes != aiPrimitiveType_TRIANGLE) {
+        return Mesh(vertices, indices);
     }
 
+    // Written to the mesh cache like this, so it only happens once
+    mesh_optimizer::Report report = mesh_optimizer::optimize(vertices, indices);
+    LOG(
+        "Optimized %s mesh '%s': %zu -> %zu vertices, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f",
+        _dir.c_str(),
+        mesh->mName.C_Str(),
+        report.vertices_before,
+        report.vertices_after,
+        report.before.acmr,
+        report.after.acmr,
+        report.before.atvr,
+        report.after.atvr
+    );
+    std::vector<MeshLod> lods;
+    mesh_simplifier::build_lods(vertices, indices, lods);
+    LOG(
+        "%s mesh '%s' has %zu lods, %u triangles down to %u",
+        _dir.c_str(),
+        mesh->mName.C_Str(),
+        lods.size(),
+        lods[0].index_count / 3,
+        lods.back().index_count / 3
+    );
+
     // FIXME: memory leak - loading texture twice - once when assign diffuse / specular map
     // and once again when passing in textures and creating a mesh instance
     //
     // might be fixed idk because of passing in as texture id
     //
     // TODO: implement textures
-    return Mesh(vertices, indices);
+    Mesh result(vertices, indices);
+    result.lods = std::move(lods);
+    return result;
     /*switch (textures.size()) {*/
     /*    case 0:*/
     /*        return Mesh(vertices, indices, {});*/
@@ -117,31 +269,40 @@ Mesh Model::process_mesh(aiMesh* mesh, const aiScene* scene) {
     /*}*/
 }
 
-std::vector<Texture2D> Model::load_material_textures(
+void Model::record_material_textures(
     aiMaterial* mat,
     aiTextureType type,
     TextureType texture_type) {
 
     // NOTE: Assumes that textures are in the same directory as the model
-    std::vector<Texture2D> textures;
-
     for (size_t i = 0; i < mat->GetTextureCount(type); i++) {
         aiString path;
         mat->GetTexture(type, i, &path);
-        bool skip = false;
-        for (auto& tex : _loaded_textures) {
-            if (std::strcmp(tex.path().data(), path.C_Str())) {
-                textures.push_back(tex);
-                skip = true;
-                break;
-            }
-        }
-        if (skip) continue;
+        _texture_requests.push_back({ texture_type, path.C_Str() });
+    }
+}
+
+void Model::load_texture(const std::string& path, TextureType type, std::vector<Texture2D>& textures) {
+    TextureCache& texture_cache = engine::get_textures();
+    std::string full_path = _dir + "/" + path;
 
-        textures.emplace_back(_dir + "/" + path.C_Str(), texture_type);
-        _loaded_textures.emplace_back(_dir + "/" + path.C_Str(), texture_type);
+    TextureHandle handle = texture_cache.find(full_path);
+    if (!handle.valid()) {
+        auto image = _images.find(full_path);
+        if (image != _images.end()) {
+            handle = texture_cache.upload(full_path, image->second);
+        }
+        else {
+            // Was in the cache during decode but freed since
+            handle = texture_cache.load(full_path);
+        }
     }
+    ASSERT(handle.valid(), "Bad texture load at path: %s", full_path.c_str());
 
-    return textures;
+    // Meshes often share textures, one handle per texture is enough
+    auto same_texture = [&handle](const TextureHandle& owned) { return owned.id() == handle.id(); };
+    if (std::none_of(_texture_handles.begin(), _texture_handles.end(), same_texture)) {
+        _texture_handles.push_back(handle);
+    }
+    textures.push_back(handle.texture(type));
 }
-
@@ -1,13 +1,17 @@
 #pragma once
 
 #include <assimp/scene.h>
+#include <memory>
+#include <unordered_map>
 #include "mesh.hpp"
+#include "mesh_cache.hpp"
 #include "shader.hpp"
+#include "texture_cache.hpp"
 
 class Model {
 public:
     std::vector<Mesh> meshes;
-    // TODO: why can't this just be _loaded_textures
+    // Every texture each mesh uses, owned by _texture_handles
     std::vector<Texture2D> textures;
 
     Model() {}
@@ -18,20 +22,52 @@ public:
     void draw(Shader& shader);
     // TODO: store textures here
 
-    void load(const std::string& path);
+    // Uses the compiled mesh cache if it's up to date, otherwise imports
+    // with assimp and writes the cache for next time. QUANTIZED meshes take
+    // half the memory and bandwidth but only the renderer's mesh shaders
+    // understand them, see QuantizedVertex
+    void load(const std::string& path, VertexFormat format = VertexFormat::FLOAT);
     bool loaded() const;
+    VertexFormat vertex_format() const { return _vertex_format; }
+    // Size of every mesh's vertex buffer together
+    size_t vertex_bytes() const { return _vertex_bytes; }
+
+    // load split in two so the slow part can happen on a worker thread.
+    // decode reads the mesh cache or imports the model and decodes its
+    // textures without touching gl, returns false if the model couldn't be
+    // read. upload creates the gl buffers and textures on the gl thread
+    bool decode(const std::string& path, VertexFormat format = VertexFormat::FLOAT);
+    void upload();
 
 private:
-    std::vector<Texture2D> _loaded_textures;
+    // Keeps this model's textures in the texture cache alive
+    std::vector<TextureHandle> _texture_handles;
     std::string _dir;
     bool _loaded = false;
+    VertexFormat _vertex_format = VertexFormat::FLOAT;
+    size_t _vertex_bytes = 0;
+    // Every texture load in order, saved in the mesh cache
+    std::vector<MeshCache::TextureRequest> _texture_requests;
+    // Between decode and upload, mapped if the model came from the cache
+    std::unique_ptr<MeshCache> _cache;
+    // Between decode and upload, keyed by the full path
+    std::unordered_map<std::string, Texture2D::Image> _images;
+    // Between decode and upload, one per mesh if the format is QUANTIZED
+    std::vector<std::vector<QuantizedVertex>> _quantized_vertices;
+    std::vector<glm::mat4> _position_transforms;
+    // Between decode and upload, one per mesh
+    std::vector<AABB> _mesh_bounds;
+    std::vector<BoundingSphere> _mesh_spheres;
 
+    bool import(const std::string& path);
     void process_node(aiNode* node, const aiScene* scene);
     Mesh process_mesh(aiMesh* mesh, const aiScene* scene);
-    std::vector<Texture2D> load_material_textures(
+    void record_material_textures(
         aiMaterial* mat,
         aiTextureType type,
         TextureType texture_type
     );
+    // path is relative to the model's directory
+    void load_texture(const std::string& path, TextureType type, std::vector<Texture2D>& textures);
 };
 
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include "debug.hpp"
+
+// Bounded lock free queue any number of threads can push to and pop from,
+// after Dmitry Vyukov's bounded MPMC queue. Every cell has a sequence number
+// saying whether it's free to write or holds a value ready to read, so
+// producers and consumers only contend on their own position counter.
+template<typename T>
+class MpmcQueue {
+public:
+    // capacity has to be a power of 2
+    explicit MpmcQueue(size_t capacity)
+        : _cells(new Cell[capacity]), _mask(capacity - 1) {
+        ASSERT(capacity >= 2 && (capacity & (capacity - 1)) == 0,
+               "MpmcQueue capacity has to be a power of 2, got %zu", capacity);
+        for (size_t i = 0; i < capacity; i++) {
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpmcQueue(const MpmcQueue&) = delete;
+    MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+    // Returns false if the queue is full, value is left untouched then
+    bool push(T&& value) {
+        Cell* cell;
+        size_t position = _enqueue_position.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &_cells[position & _mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+            if (difference == 0) {
+                if (_enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (difference < 0) {
+                return false;
+            }
+            else {
+                position = _enqueue_position.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(value);
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Returns false if the queue is empty
+    bool pop(T& value) {
+        Cell* cell;
+        size_t position = _dequeue_position.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &_cells[position & _mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+            if (difference == 0) {
+                if (_dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (difference < 0) {
+                return false;
+            }
+            else {
+                position = _dequeue_position.load(std::memory_order_relaxed);
+            }
+        }
+        value = std::move(cell->value);
+        cell->sequence.store(position + _mask + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> _cells;
+    size_t _mask;
+
+    // Kept on separate cache lines so producers and consumers don't fight over one
+    alignas(64) std::atomic<size_t> _enqueue_position{0};
+    alignas(64) std::atomic<size_t> _dequeue_position{0};
+};
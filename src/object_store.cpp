@@ -0,0 +1,274 @@
+#include <algorithm>
+#include <memory>
+#include <random>
+#include "object_store.hpp"
+#include "cpu_timer.hpp"
+#include "debug.hpp"
+#include "game_object.hpp"
+#include "random.hpp"
+#include "thread_pool.hpp"
+
+ObjectHandle ObjectStore::create(
+    const Transform& transform,
+    const std::vector<Mesh>* object_meshes,
+    const Material* material) {
+
+    ASSERT(object_meshes != nullptr, "Object needs a mesh list");
+    ASSERT(material != nullptr, "Object needs a material");
+
+    uint slot;
+    if (!_free_slots.empty()) {
+        slot = _free_slots.back();
+        _free_slots.pop_back();
+    }
+    else {
+        slot = _slots.size();
+        _slots.emplace_back();
+    }
+    _slots[slot].dense = _dense_slots.size();
+    _dense_slots.push_back(slot);
+
+    transforms.push_back(transform);
+    hidden.push_back(false);
+    meshes.push_back(object_meshes);
+    materials.push_back(material);
+    bounds.emplace_back();
+    _moved.push_back(1);
+    _proxies.push_back(Bvh::null_node);
+
+    ObjectHandle handle;
+    handle.index = slot;
+    handle.generation = _slots[slot].generation;
+    return handle;
+}
+
+void ObjectStore::destroy(ObjectHandle handle) {
+    uint dense = index(handle);
+    uint last = _dense_slots.size() - 1;
+    if (_proxies[dense] != Bvh::null_node) {
+        _bvh.remove(_proxies[dense]);
+    }
+
+    // Fill the hole with the last object so the arrays stay packed
+    if (dense != last) {
+        transforms.set(dense, transforms.get(last));
+        hidden[dense] = hidden[last];
+        meshes[dense] = meshes[last];
+        materials[dense] = materials[last];
+        bounds[dense] = bounds[last];
+        _moved[dense] = _moved[last];
+        _proxies[dense] = _proxies[last];
+        _dense_slots[dense] = _dense_slots[last];
+        _slots[_dense_slots[dense]].dense = dense;
+    }
+    transforms.pop_back();
+    hidden.pop_back();
+    meshes.pop_back();
+    materials.pop_back();
+    bounds.pop_back();
+    _moved.pop_back();
+    _proxies.pop_back();
+    _dense_slots.pop_back();
+
+    _slots[handle.index].generation++;
+    _free_slots.push_back(handle.index);
+}
+
+void ObjectStore::clear() {
+    for (uint slot : _dense_slots) {
+        _slots[slot].generation++;
+        _free_slots.push_back(slot);
+    }
+    transforms.clear();
+    hidden.clear();
+    meshes.clear();
+    materials.clear();
+    bounds.clear();
+    _moved.clear();
+    _proxies.clear();
+    _dense_slots.clear();
+    _bvh.clear();
+}
+
+bool ObjectStore::alive(ObjectHandle handle) const {
+    return handle.index < _slots.size()
+        && _slots[handle.index].generation == handle.generation
+        && _slots[handle.index].dense < _dense_slots.size()
+        && _dense_slots[_slots[handle.index].dense] == handle.index;
+}
+
+uint ObjectStore::index(ObjectHandle handle) const {
+    ASSERT(alive(handle), "Object handle %u refers to a destroyed object", handle.index);
+    return _slots[handle.index].dense;
+}
+
+ObjectHandle ObjectStore::handle(uint index) const {
+    ASSERT(index < _dense_slots.size(), "Object index %u is out of range", index);
+    ObjectHandle handle;
+    handle.index = _dense_slots[index];
+    handle.generation = _slots[handle.index].generation;
+    return handle;
+}
+
+Transform ObjectStore::transform(ObjectHandle handle) const {
+    return transforms.get(index(handle));
+}
+
+void ObjectStore::set_transform(ObjectHandle handle, const Transform& transform) {
+    uint i = index(handle);
+    transforms.set(i, transform);
+    _moved[i] = 1;
+}
+
+void ObjectStore::set_hidden(ObjectHandle handle, bool is_hidden) {
+    hidden[index(handle)] = is_hidden;
+}
+
+void ObjectStore::update_bounds(ThreadPool* pool) {
+    auto compute = [this](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            if (!_moved[i]) {
+                continue;
+            }
+            AABB local;
+            for (const Mesh& mesh : *meshes[i]) {
+                if (mesh.bounds.valid()) {
+                    local.expand(mesh.bounds);
+                }
+            }
+            if (!local.valid()) {
+                bounds[i] = AABB();
+                continue;
+            }
+            bounds[i] = local.transformed(transforms.get(i).get_mat4());
+        }
+    };
+    if (pool) {
+        pool->parallel_for(size(), 4096, compute);
+    }
+    else {
+        compute(0, size());
+    }
+
+    // The tree isn't thread safe, and most moves stay inside their fat box
+    // and don't touch it anyway
+    for (size_t i = 0; i < size(); i++) {
+        if (!_moved[i]) {
+            continue;
+        }
+        _moved[i] = 0;
+        int& proxy = _proxies[i];
+        if (!bounds[i].valid()) {
+            if (proxy != Bvh::null_node) {
+                _bvh.remove(proxy);
+                proxy = Bvh::null_node;
+            }
+        }
+        else if (proxy == Bvh::null_node) {
+            proxy = _bvh.insert(bounds[i], _dense_slots[i]);
+        }
+        else {
+            _bvh.update(proxy, bounds[i]);
+        }
+    }
+    _bvh.commit();
+}
+
+void ObjectStore::query_frustum(const Frustum& frustum, std::vector<ObjectHandle>& results) const {
+    std::vector<uint> slots;
+    _bvh.query_frustum(frustum, slots);
+    for (uint slot : slots) {
+        results.push_back({ slot, _slots[slot].generation });
+    }
+}
+
+void ObjectStore::query_aabb(const AABB& box, std::vector<ObjectHandle>& results) const {
+    std::vector<uint> slots;
+    _bvh.query_aabb(box, slots);
+    for (uint slot : slots) {
+        results.push_back({ slot, _slots[slot].generation });
+    }
+}
+
+void ObjectStore::query_sphere(const glm::vec3& center, float radius, std::vector<ObjectHandle>& results) const {
+    std::vector<uint> slots;
+    _bvh.query_sphere(center, radius, slots);
+    for (uint slot : slots) {
+        results.push_back({ slot, _slots[slot].generation });
+    }
+}
+
+std::optional<ObjectStore::RayHit> ObjectStore::raycast(
+    const glm::vec3& origin,
+    const glm::vec3& direction,
+    float max_distance) const {
+
+    auto hit = _bvh.raycast(origin, direction, max_distance);
+    if (!hit) {
+        return {};
+    }
+    RayHit result;
+    result.handle = { hit->user_data, _slots[hit->user_data].generation };
+    result.distance = hit->distance;
+    return result;
+}
+
+const std::vector<Mesh>* ObjectStore::add_meshes(const std::vector<Mesh>& source) {
+    std::vector<Mesh>& shared = _shared_meshes.emplace_back();
+    shared.reserve(source.size());
+    for (const Mesh& m : source) {
+        Mesh& mesh = shared.emplace_back();
+        mesh.share(m);
+    }
+    return &shared;
+}
+
+const Material* ObjectStore::add_material(const Material& material) {
+    return &_shared_materials.emplace_back(material);
+}
+
+ObjectStore::BenchmarkResult ObjectStore::benchmark(size_t count) {
+    std::vector<Mesh> no_meshes;
+    Material material;
+    ObjectStore store;
+    std::vector<std::unique_ptr<GameObject>> game_objects;
+    game_objects.reserve(count);
+    CounterRng rng(42);
+    for (size_t i = 0; i < count; i++) {
+        Transform transform(
+            glm::vec3(rng.next_float(-100, 100), rng.next_float(-100, 100), rng.next_float(-100, 100)),
+            glm::vec3(rng.next_float(0.1f, 10))
+        );
+        store.create(transform, &no_meshes, &material);
+        game_objects.push_back(std::make_unique<GameObject>(transform));
+    }
+    // A scene that has had objects added and removed for a while doesn't
+    // have them next to each other in memory anymore
+    std::shuffle(game_objects.begin(), game_objects.end(), std::mt19937(42));
+
+    std::vector<glm::mat4> models(count);
+    std::vector<glm::mat3> normals(count);
+    BenchmarkResult result;
+    result.count = count;
+
+    TransformSoA gathered;
+    gathered.reserve(count);
+    CpuTimer timer;
+    for (const auto& obj : game_objects) {
+        gathered.push_back(obj->transform);
+    }
+    transform_batch::build(gathered, models.data(), normals.data());
+    result.game_object_ms = timer.elapsed_ms();
+
+    timer.restart();
+    transform_batch::build(store.transforms, models.data(), normals.data());
+    result.store_ms = timer.elapsed_ms();
+
+    LOG(
+        "%zu objects: game objects %.3f ms, object store %.3f ms",
+        count,
+        result.game_object_ms,
+        result.store_ms
+    );
+    return result;
+}
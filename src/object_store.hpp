@@ -0,0 +1,131 @@
+#pragma once
+
+#include <deque>
+#include <optional>
+#include <vector>
+#include "bvh.hpp"
+#include "material.hpp"
+#include "mesh.hpp"
+#include "transform_batch.hpp"
+#include "types.hpp"
+
+class ThreadPool;
+
+// Refers to an object in an ObjectStore. The generation goes up every time
+// a slot is reused, so handles to destroyed objects stop resolving instead
+// of pointing at whatever took their place
+struct ObjectHandle {
+    static constexpr uint invalid_index = ~0u;
+
+    uint index = invalid_index;
+    uint generation = 0;
+
+    bool valid() const { return index != invalid_index; }
+
+    friend bool operator==(const ObjectHandle& a, const ObjectHandle& b) {
+        return a.index == b.index && a.generation == b.generation;
+    }
+    friend bool operator!=(const ObjectHandle& a, const ObjectHandle& b) {
+        return !(a == b);
+    }
+};
+
+// Renderable objects kept as one array per field, so walking all of them
+// reads memory front to back instead of following a pointer per object.
+//
+// Index i of every array belongs to the same object. Destroying an object
+// moves the last one into its place, so indices aren't stable, handles are.
+// Meshes and materials are referred to by pointer and usually shared, the
+// store can own shared ones (add_meshes, add_material) or they can live
+// somewhere else as long as they outlive the objects using them.
+//
+// The store also keeps a box around every object in world space and a Bvh
+// over those boxes for culling and spatial queries. Both are only updated
+// by update_bounds
+class ObjectStore {
+public:
+    TransformSoA transforms;
+    // Not vector<bool> so threads can write neighbouring objects
+    std::vector<u8> hidden;
+    std::vector<const std::vector<Mesh>*> meshes;
+    std::vector<const Material*> materials;
+    // World space box around the object's meshes, invalid if none of its
+    // meshes have bounds
+    std::vector<AABB> bounds;
+
+    ObjectHandle create(
+        const Transform& transform,
+        const std::vector<Mesh>* meshes,
+        const Material* material
+    );
+    void destroy(ObjectHandle handle);
+    void clear();
+    bool alive(ObjectHandle handle) const;
+
+    size_t size() const { return _dense_slots.size(); }
+    // Where the object currently is in the arrays
+    uint index(ObjectHandle handle) const;
+    ObjectHandle handle(uint index) const;
+
+    Transform transform(ObjectHandle handle) const;
+    void set_transform(ObjectHandle handle, const Transform& transform);
+    void set_hidden(ObjectHandle handle, bool hidden);
+    // set_transform does this, anything writing to transforms directly or
+    // changing an object's meshes has to call it for bounds to catch up
+    void mark_moved(uint index) { _moved[index] = 1; }
+
+    // Recomputes bounds of every object created or moved since the last call
+    // and refits the bvh around them
+    void update_bounds(ThreadPool* pool = nullptr);
+    const Bvh& bvh() const { return _bvh; }
+
+    // These see the objects as of the last update_bounds. Objects without
+    // bounds aren't in the bvh, nothing returns them
+    void query_frustum(const Frustum& frustum, std::vector<ObjectHandle>& results) const;
+    void query_aabb(const AABB& box, std::vector<ObjectHandle>& results) const;
+    void query_sphere(const glm::vec3& center, float radius, std::vector<ObjectHandle>& results) const;
+    struct RayHit {
+        ObjectHandle handle;
+        float distance = 0;
+    };
+    // Closest object whose box the ray hits
+    std::optional<RayHit> raycast(
+        const glm::vec3& origin,
+        const glm::vec3& direction,
+        float max_distance = FLT_MAX
+    ) const;
+
+    // Kept until the store is destroyed, addresses never change.
+    // NOTE: the meshes are shared with Mesh::share, same as
+    // GameObject::load_mesh_data, so the originals have to stay around
+    const std::vector<Mesh>* add_meshes(const std::vector<Mesh>& meshes);
+    const Material* add_material(const Material& material);
+
+    struct BenchmarkResult {
+        size_t count = 0;
+        // Gathering transforms from heap GameObjects and building their
+        // matrices, what the renderer did before the store
+        double game_object_ms = 0;
+        // Building the same matrices straight from the store
+        double store_ms = 0;
+    };
+    static BenchmarkResult benchmark(size_t count);
+
+private:
+    struct Slot {
+        uint dense = 0;
+        uint generation = 0;
+    };
+    std::vector<Slot> _slots;
+    std::vector<uint> _free_slots;
+    // Slot of every object, in array order
+    std::vector<uint> _dense_slots;
+    // In array order like the public arrays
+    std::vector<u8> _moved;
+    std::vector<int> _proxies;
+    // Leaves hold slots, they don't move when objects do
+    Bvh _bvh;
+
+    std::deque<std::vector<Mesh>> _shared_meshes;
+    std::deque<Material> _shared_materials;
+};
@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <cmath>
+#include "occlusion_buffer.hpp"
+
+// Corner c of a box is (c & 1 ? max.x : min.x, c & 2 ? max.y : min.y,
+// c & 4 ? max.z : min.z). Faces are counter clockwise seen from outside
+static constexpr uint box_faces[6][4] = {
+    { 0, 4, 6, 2 }, // -x
+    { 1, 3, 7, 5 }, // +x
+    { 0, 1, 5, 4 }, // -y
+    { 2, 6, 7, 3 }, // +y
+    { 0, 2, 3, 1 }, // -z
+    { 4, 5, 7, 6 }, // +z
+};
+
+static glm::vec3 box_corner(const AABB& box, uint corner) {
+    return glm::vec3(
+        corner & 1 ? box.max.x : box.min.x,
+        corner & 2 ? box.max.y : box.min.y,
+        corner & 4 ? box.max.z : box.min.z
+    );
+}
+
+void OcclusionBuffer::begin(const glm::mat4& view_projection) {
+    _view_projection = view_projection;
+    _occluders = 0;
+    if (_levels.empty()) {
+        for (uint w = width, h = height; w > 0 && h > 0; w /= 2, h /= 2) {
+            _levels.emplace_back(w * h);
+        }
+    }
+    std::fill(_levels[0].begin(), _levels[0].end(), 0.0f);
+}
+
+void OcclusionBuffer::draw_box(const glm::mat4& model, const AABB& box) {
+    if (!box.valid()) {
+        return;
+    }
+    glm::mat4 mvp = _view_projection * model;
+    glm::vec4 corners[8];
+    for (uint c = 0; c < 8; c++) {
+        corners[c] = mvp * glm::vec4(box_corner(box, c), 1.0f);
+    }
+    // A mirroring model matrix turns the box inside out
+    bool mirrored = glm::determinant(glm::mat3(model)) < 0;
+
+    for (const auto& face : box_faces) {
+        glm::vec4 quad[4];
+        for (uint k = 0; k < 4; k++) {
+            quad[k] = corners[face[mirrored ? 3 - k : k]];
+        }
+
+        // Clip against the near plane (z >= -w), everything left is in
+        // front of the camera. A quad gains at most one corner
+        glm::vec4 clipped[5];
+        uint count = 0;
+        for (uint k = 0; k < 4; k++) {
+            const glm::vec4& a = quad[k];
+            const glm::vec4& b = quad[(k + 1) % 4];
+            float da = a.z + a.w;
+            float db = b.z + b.w;
+            if (da >= 0) {
+                clipped[count++] = a;
+            }
+            if ((da >= 0) != (db >= 0)) {
+                clipped[count++] = a + (b - a) * (da / (da - db));
+            }
+        }
+        if (count < 3) {
+            continue;
+        }
+
+        glm::vec3 points[5];
+        for (uint k = 0; k < count; k++) {
+            float inv_w = 1.0f / std::max(clipped[k].w, 1e-6f);
+            points[k] = glm::vec3(
+                (clipped[k].x * inv_w * 0.5f + 0.5f) * width,
+                (clipped[k].y * inv_w * 0.5f + 0.5f) * height,
+                inv_w
+            );
+        }
+        // Back faces are behind the front ones anyway
+        float area = 0;
+        for (uint k = 0; k < count; k++) {
+            const glm::vec3& a = points[k];
+            const glm::vec3& b = points[(k + 1) % count];
+            area += a.x * b.y - b.x * a.y;
+        }
+        if (area > 0) {
+            draw_polygon(points, count);
+        }
+    }
+    _occluders++;
+}
+
+void OcclusionBuffer::draw_polygon(const glm::vec3* points, uint count) {
+    float min_x = points[0].x, max_x = points[0].x;
+    float min_y = points[0].y, max_y = points[0].y;
+    for (uint k = 1; k < count; k++) {
+        min_x = std::min(min_x, points[k].x);
+        max_x = std::max(max_x, points[k].x);
+        min_y = std::min(min_y, points[k].y);
+        max_y = std::max(max_y, points[k].y);
+    }
+    int x0 = std::max((int)std::floor(min_x), 0);
+    int x1 = std::min((int)std::ceil(max_x), (int)width - 1);
+    int y0 = std::max((int)std::floor(min_y), 0);
+    int y1 = std::min((int)std::ceil(max_y), (int)height - 1);
+    if (x0 > x1 || y0 > y1) {
+        return;
+    }
+
+    // 1 / w over the face, z = a * x + b * y + c. From the biggest triangle
+    // of the fan so a sliver doesn't throw it off
+    uint best = 1;
+    float best_area = 0;
+    for (uint k = 1; k + 1 < count; k++) {
+        glm::vec3 e1 = points[k] - points[0];
+        glm::vec3 e2 = points[k + 1] - points[0];
+        float area = e1.x * e2.y - e1.y * e2.x;
+        if (area > best_area) {
+            best_area = area;
+            best = k;
+        }
+    }
+    if (best_area <= 0) {
+        return;
+    }
+    glm::vec3 e1 = points[best] - points[0];
+    glm::vec3 e2 = points[best + 1] - points[0];
+    float a = (e1.z * e2.y - e2.z * e1.y) / best_area;
+    float b = (e2.z * e1.x - e1.z * e2.x) / best_area;
+    float c = points[0].z - a * points[0].x - b * points[0].y;
+    // Furthest the face gets from the pixel center anywhere in the pixel
+    float depth_slack = 0.5f * (std::abs(a) + std::abs(b));
+
+    // Edge functions, positive on the inside. Pushed in by half a pixel's
+    // reach so they only pass pixels that are covered completely
+    struct Edge {
+        float dx, dy, offset;
+    };
+    Edge edges[5];
+    for (uint k = 0; k < count; k++) {
+        const glm::vec3& p = points[k];
+        const glm::vec3& q = points[(k + 1) % count];
+        Edge& edge = edges[k];
+        edge.dx = -(q.y - p.y);
+        edge.dy = q.x - p.x;
+        edge.offset = -(edge.dx * p.x + edge.dy * p.y)
+                    - 0.5f * (std::abs(edge.dx) + std::abs(edge.dy));
+    }
+
+    std::vector<float>& depth = _levels[0];
+    for (int y = y0; y <= y1; y++) {
+        float center_y = y + 0.5f;
+        float* row = &depth[y * width];
+        for (int x = x0; x <= x1; x++) {
+            float center_x = x + 0.5f;
+            bool inside = true;
+            for (uint k = 0; k < count && inside; k++) {
+                inside = edges[k].dx * center_x + edges[k].dy * center_y + edges[k].offset >= 0;
+            }
+            if (!inside) {
+                continue;
+            }
+            float z = a * center_x + b * center_y + c - depth_slack;
+            row[x] = std::max(row[x], z);
+        }
+    }
+}
+
+void OcclusionBuffer::finish() {
+    for (size_t level = 1; level < _levels.size(); level++) {
+        const std::vector<float>& fine = _levels[level - 1];
+        std::vector<float>& coarse = _levels[level];
+        uint fine_width = width >> (level - 1);
+        uint coarse_width = width >> level;
+        uint coarse_height = height >> level;
+        for (uint y = 0; y < coarse_height; y++) {
+            const float* row0 = &fine[(y * 2) * fine_width];
+            const float* row1 = row0 + fine_width;
+            for (uint x = 0; x < coarse_width; x++) {
+                coarse[y * coarse_width + x] = std::min(
+                    std::min(row0[x * 2], row0[x * 2 + 1]),
+                    std::min(row1[x * 2], row1[x * 2 + 1])
+                );
+            }
+        }
+    }
+}
+
+bool OcclusionBuffer::occluded(const AABB& box) const {
+    if (!box.valid() || _occluders == 0) {
+        return false;
+    }
+    float min_x = FLT_MAX, max_x = -FLT_MAX;
+    float min_y = FLT_MAX, max_y = -FLT_MAX;
+    float nearest = 0;
+    for (uint c = 0; c < 8; c++) {
+        glm::vec4 clip = _view_projection * glm::vec4(box_corner(box, c), 1.0f);
+        // Reaches past the near plane, there's nothing in front of it
+        if (clip.z < -clip.w || clip.w <= 0) {
+            return false;
+        }
+        float inv_w = 1.0f / clip.w;
+        float x = (clip.x * inv_w * 0.5f + 0.5f) * width;
+        float y = (clip.y * inv_w * 0.5f + 0.5f) * height;
+        min_x = std::min(min_x, x);
+        max_x = std::max(max_x, x);
+        min_y = std::min(min_y, y);
+        max_y = std::max(max_y, y);
+        nearest = std::max(nearest, inv_w);
+    }
+    int x0 = std::max((int)std::floor(min_x), 0);
+    int x1 = std::min((int)std::floor(max_x), (int)width - 1);
+    int y0 = std::max((int)std::floor(min_y), 0);
+    int y1 = std::min((int)std::floor(max_y), (int)height - 1);
+    if (x0 > x1 || y0 > y1) {
+        return false;
+    }
+
+    // Start at the coarsest level where the box spans at most 2x2 texels
+    uint level = 0;
+    while (level + 1 < _levels.size()
+        && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1)) {
+        level++;
+    }
+    // A little margin, an occluder box that is its object's bounds can't
+    // hide the object
+    float behind = nearest * 1.001f;
+    for (int y = y0 >> level; y <= (y1 >> level); y++) {
+        for (int x = x0 >> level; x <= (x1 >> level); x++) {
+            if (!texel_occludes(level, x, y, x0, y0, x1, y1, behind)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool OcclusionBuffer::texel_occludes(
+    uint level, int x, int y,
+    int x0, int y0, int x1, int y1,
+    float behind) const {
+
+    if (behind < _levels[level][y * (width >> level) + x]) {
+        return true;
+    }
+    if (level == 0) {
+        return false;
+    }
+    // The texel's furthest depth is too far, but it also covers pixels
+    // outside the box. Only the children inside it matter
+    level--;
+    for (int child_y = y * 2; child_y <= y * 2 + 1; child_y++) {
+        if (child_y < (y0 >> level) || child_y > (y1 >> level)) {
+            continue;
+        }
+        for (int child_x = x * 2; child_x <= x * 2 + 1; child_x++) {
+            if (child_x < (x0 >> level) || child_x > (x1 >> level)) {
+                continue;
+            }
+            if (!texel_occludes(level, child_x, child_y, x0, y0, x1, y1, behind)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "bounds.hpp"
+#include "types.hpp"
+
+// Small depth buffer drawn on the cpu with a handful of big occluders, so
+// objects completely hidden behind them can be skipped before they're
+// queued. After the occluders are in, finish builds a hierarchy where every
+// level halves the resolution and keeps the furthest depth of the four
+// texels under it, so testing a box starts from a couple of texels no
+// matter how much of the screen it covers, and only goes to finer levels
+// where those aren't conclusive.
+//
+// Occluders are boxes that have to be inside the geometry they stand in for.
+// Pixels only count as covered if the whole pixel is inside a box face, and
+// take the furthest depth the face has anywhere in the pixel, so the buffer
+// never hides anything the gpu would have drawn.
+//
+// Depth is stored as 1 / w, the inverse view depth. It's linear across a
+// face on screen and 0 means nothing was drawn there, bigger is closer
+class OcclusionBuffer {
+public:
+    static constexpr uint width = 256;
+    static constexpr uint height = 128;
+
+    // Clears the buffer for a frame seen through view_projection
+    void begin(const glm::mat4& view_projection);
+    // box is in model space
+    void draw_box(const glm::mat4& model, const AABB& box);
+    // Builds the hierarchy. Call after the occluders and before testing
+    void finish();
+
+    // box is in world space. True if every pixel it covers has an occluder
+    // in front of it. Safe to call from several threads after finish
+    bool occluded(const AABB& box) const;
+
+    uint occluders() const { return _occluders; }
+
+private:
+    glm::mat4 _view_projection = glm::mat4(1);
+    // levels[0] is width x height, row 0 at the bottom of the screen
+    std::vector<std::vector<float>> _levels;
+    uint _occluders = 0;
+
+    // Convex polygon in screen space, counter clockwise, z is 1 / w
+    void draw_polygon(const glm::vec3* points, uint count);
+    // Whether the texel, or the part of it inside the pixel rect x0..x1,
+    // y0..y1, is closer than behind. Goes down a level where it isn't
+    bool texel_occludes(uint level, int x, int y, int x0, int y0, int x1, int y1, float behind) const;
+};
@@ -0,0 +1,423 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <glad/glad.h>
+#include <imgui.h>
+#include "profiler.hpp"
+#include "debug.hpp"
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    // About 4 seconds at 60 fps
+    constexpr size_t history_size = 240;
+    // Chrome trace thread id of the gpu lane
+    constexpr uint gpu_thread = 1000;
+    constexpr uint no_thread = ~0u;
+
+    struct PendingGpuEvent {
+        const char* name;
+        uint depth;
+        uint begin_query;
+        uint end_query;
+    };
+
+    // Queries of one frame, reused every latency frames
+    struct GpuFrame {
+        std::vector<uint> queries;
+        uint used = 0;
+        std::vector<PendingGpuEvent> events;
+        uint64_t frame = 0;
+        // Added to gpu timestamps to put them on the cpu clock
+        double offset_us = 0;
+        bool active = false;
+    };
+
+    bool initialized = false;
+    Clock::time_point start_time;
+
+    // Guards current, cpu scopes can end on any thread
+    std::mutex mutex;
+    profiler::Frame current;
+    std::atomic<uint64_t> current_index{0};
+    uint64_t frame_counter = 0;
+    std::deque<profiler::Frame> history;
+
+    std::array<GpuFrame, profiler::latency> gpu_frames;
+    uint gpu_depth = 0;
+    uint dropped_gpu_frames = 0;
+
+    std::atomic<uint> next_thread{1};
+    thread_local uint cpu_depth = 0;
+    thread_local uint thread_index = no_thread;
+
+    // Imgui window state
+    bool paused = false;
+    profiler::Frame shown;
+    std::string export_message;
+
+    double now_us() {
+        return std::chrono::duration<double, std::micro>(Clock::now() - start_time).count();
+    }
+
+    uint this_thread() {
+        if (thread_index == no_thread) {
+            thread_index = next_thread++;
+        }
+        return thread_index;
+    }
+
+    uint allocate_query(GpuFrame& frame) {
+        if (frame.used == frame.queries.size()) {
+            size_t old_size = frame.queries.size();
+            frame.queries.resize(old_size + 64);
+            glGenQueries(64, frame.queries.data() + old_size);
+        }
+        return frame.queries[frame.used++];
+    }
+
+    // Moves the results into the frame's history entry if they're ready
+    void resolve(GpuFrame& frame) {
+        auto entry = std::find_if(history.rbegin(), history.rend(), [&frame](const profiler::Frame& f) {
+            return f.index == frame.frame;
+        });
+        if (entry == history.rend()) {
+            return;
+        }
+        if (frame.used > 0) {
+            // Queries finish in order, so the last one being done means all are
+            GLuint available = 0;
+            glGetQueryObjectuiv(frame.queries[frame.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                dropped_gpu_frames++;
+                return;
+            }
+        }
+        entry->gpu.clear();
+        for (const PendingGpuEvent& pending : frame.events) {
+            if (pending.end_query == 0) {
+                continue;
+            }
+            GLuint64 begin = 0;
+            GLuint64 end = 0;
+            glGetQueryObjectui64v(pending.begin_query, GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(pending.end_query, GL_QUERY_RESULT, &end);
+            profiler::Event event;
+            event.name = pending.name;
+            event.start_us = begin / 1000.0 + frame.offset_us;
+            event.duration_us = (end - begin) / 1000.0;
+            event.depth = pending.depth;
+            event.thread = gpu_thread;
+            entry->gpu.push_back(event);
+        }
+        entry->gpu_ready = true;
+    }
+
+    ImU32 event_color(const char* name) {
+        // Same name, same color across frames
+        uint hash = 2166136261u;
+        for (const char* c = name; *c; c++) {
+            hash = (hash ^ (unsigned char)*c) * 16777619u;
+        }
+        return IM_COL32(120 + hash % 120, 120 + (hash >> 8) % 120, 120 + (hash >> 16) % 120, 255);
+    }
+
+    // One row per depth, scaled so begin_us..end_us fills the width
+    void draw_lane(const std::vector<profiler::Event>& events, uint thread, double begin_us, double end_us) {
+        ImDrawList* draw_list = ImGui::GetWindowDrawList();
+        ImVec2 origin = ImGui::GetCursorScreenPos();
+        float width = std::max(ImGui::GetContentRegionAvail().x, 1.0f);
+        float row_height = ImGui::GetTextLineHeightWithSpacing();
+        double scale = width / std::max(end_us - begin_us, 1.0);
+
+        uint rows = 1;
+        for (const profiler::Event& event : events) {
+            if (event.thread != thread) {
+                continue;
+            }
+            rows = std::max(rows, event.depth + 1);
+            ImVec2 min = {
+                origin.x + (float)((event.start_us - begin_us) * scale),
+                origin.y + event.depth * row_height
+            };
+            ImVec2 max = {
+                std::max(min.x + 1.0f, origin.x + (float)((event.start_us + event.duration_us - begin_us) * scale)),
+                min.y + row_height - 1
+            };
+            draw_list->AddRectFilled(min, max, event_color(event.name));
+            draw_list->PushClipRect(min, max, true);
+            draw_list->AddText({ min.x + 2, min.y }, IM_COL32(0, 0, 0, 255), event.name);
+            draw_list->PopClipRect();
+            if (ImGui::IsMouseHoveringRect(min, max)) {
+                ImGui::SetTooltip("%s: %.3f ms", event.name, event.duration_us / 1000.0);
+            }
+        }
+        ImGui::Dummy({ width, rows * row_height });
+    }
+}
+
+void profiler::init() {
+    ASSERT(!initialized, "Profiler already initialized");
+    start_time = Clock::now();
+    thread_index = 0;
+    initialized = true;
+}
+
+void profiler::shutdown() {
+    if (!initialized) {
+        return;
+    }
+    for (GpuFrame& frame : gpu_frames) {
+        glDeleteQueries(frame.queries.size(), frame.queries.data());
+        frame = GpuFrame();
+    }
+    initialized = false;
+}
+
+void profiler::begin_frame() {
+    if (!initialized) {
+        return;
+    }
+    uint64_t index = ++frame_counter;
+
+    GpuFrame& gpu_frame = gpu_frames[index % latency];
+    if (gpu_frame.active) {
+        resolve(gpu_frame);
+    }
+    gpu_frame.used = 0;
+    gpu_frame.events.clear();
+    gpu_frame.frame = index;
+    gpu_frame.active = enabled;
+    gpu_depth = 0;
+
+    GLint64 gpu_now = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+    double cpu_now = now_us();
+    gpu_frame.offset_us = cpu_now - gpu_now / 1000.0;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    current = Frame();
+    current.index = index;
+    current.start_us = cpu_now;
+    current_index = index;
+}
+
+void profiler::end_frame() {
+    if (!initialized) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    // Scopes still open on other threads get dropped
+    current_index = 0;
+    current.duration_us = now_us() - current.start_us;
+    history.push_back(std::move(current));
+    current = Frame();
+    if (history.size() > history_size) {
+        history.pop_front();
+    }
+}
+
+const profiler::Frame* profiler::last_complete_frame() {
+    for (auto it = history.rbegin(); it != history.rend(); it++) {
+        if (it->gpu_ready) {
+            return &*it;
+        }
+    }
+    return nullptr;
+}
+
+profiler::CpuScope::CpuScope(const char* name)
+    : _name(name), _start_us(0), _frame(0), _active(initialized && enabled) {
+    if (!_active) {
+        return;
+    }
+    _frame = current_index;
+    _start_us = now_us();
+    cpu_depth++;
+}
+
+profiler::CpuScope::~CpuScope() {
+    if (!_active) {
+        return;
+    }
+    cpu_depth--;
+    Event event;
+    event.name = _name;
+    event.start_us = _start_us;
+    event.duration_us = now_us() - _start_us;
+    event.depth = cpu_depth;
+    event.thread = this_thread();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (_frame != 0 && current.index == _frame) {
+        current.cpu.push_back(event);
+    }
+}
+
+profiler::GpuScope::GpuScope(const char* name)
+    : _event(0), _active(false) {
+    if (!initialized || !enabled) {
+        return;
+    }
+    GpuFrame& frame = gpu_frames[frame_counter % latency];
+    if (!frame.active || frame.frame != frame_counter) {
+        return;
+    }
+    uint query = allocate_query(frame);
+    glQueryCounter(query, GL_TIMESTAMP);
+    frame.events.push_back({ name, gpu_depth++, query, 0 });
+    _event = frame.events.size() - 1;
+    _active = true;
+}
+
+profiler::GpuScope::~GpuScope() {
+    if (!_active) {
+        return;
+    }
+    GpuFrame& frame = gpu_frames[frame_counter % latency];
+    gpu_depth--;
+    uint query = allocate_query(frame);
+    glQueryCounter(query, GL_TIMESTAMP);
+    frame.events[_event].end_query = query;
+}
+
+bool profiler::write_chrome_trace(const std::string& path) {
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (!file) {
+        LOG("WARNING: couldn't write %s", path.c_str());
+        return false;
+    }
+    std::fprintf(file, "{\"traceEvents\": [\n");
+    std::fprintf(
+        file,
+        "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": 0, \"args\": {\"name\": \"main\"}},\n"
+        "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %u, \"args\": {\"name\": \"gpu\"}}",
+        gpu_thread
+    );
+    auto write_event = [file](const char* name, const char* category, double start, double duration, uint thread) {
+        std::fprintf(
+            file,
+            ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 0, \"tid\": %u}",
+            name,
+            category,
+            start,
+            duration,
+            thread
+        );
+    };
+    for (const Frame& frame : history) {
+        write_event("frame", "frame", frame.start_us, frame.duration_us, 0);
+        for (const Event& event : frame.cpu) {
+            write_event(event.name, "cpu", event.start_us, event.duration_us, event.thread);
+        }
+        for (const Event& event : frame.gpu) {
+            write_event(event.name, "gpu", event.start_us, event.duration_us, gpu_thread);
+        }
+    }
+    std::fprintf(file, "\n]}\n");
+    std::fclose(file);
+    LOG("Wrote %zu frames to %s", history.size(), path.c_str());
+    return true;
+}
+
+void profiler::show_imgui_window(bool* open) {
+    if (!ImGui::Begin("Profiler", open)) {
+        ImGui::End();
+        return;
+    }
+    ImGui::Checkbox("enabled", &enabled);
+    ImGui::SameLine();
+    ImGui::Checkbox("pause", &paused);
+    ImGui::SameLine();
+    if (ImGui::Button("export chrome trace")) {
+        export_message = write_chrome_trace("profile.json")
+            ? "wrote profile.json"
+            : "couldn't write profile.json";
+    }
+    if (!export_message.empty()) {
+        ImGui::SameLine();
+        ImGui::Text("%s", export_message.c_str());
+    }
+
+    if (!paused) {
+        if (const Frame* frame = last_complete_frame()) {
+            shown = *frame;
+        }
+    }
+    if (shown.index == 0) {
+        ImGui::Text("waiting for the first frame");
+        ImGui::End();
+        return;
+    }
+
+    double gpu_us = 0;
+    double begin_us = shown.start_us;
+    double end_us = shown.start_us + shown.duration_us;
+    for (const Event& event : shown.gpu) {
+        if (event.depth == 0) {
+            gpu_us += event.duration_us;
+        }
+        begin_us = std::min(begin_us, event.start_us);
+        end_us = std::max(end_us, event.start_us + event.duration_us);
+    }
+    ImGui::Text(
+        "frame %llu: cpu %.3f ms, gpu %.3f ms, dropped gpu frames: %u",
+        (unsigned long long)shown.index,
+        shown.duration_us / 1000.0,
+        gpu_us / 1000.0,
+        dropped_gpu_frames
+    );
+
+    // Every lane shares the same scale, so the gpu lagging behind the cpu shows
+    std::vector<uint> threads;
+    for (const Event& event : shown.cpu) {
+        if (std::find(threads.begin(), threads.end(), event.thread) == threads.end()) {
+            threads.push_back(event.thread);
+        }
+    }
+    std::sort(threads.begin(), threads.end());
+    for (uint thread : threads) {
+        ImGui::Text(thread == 0 ? "cpu main" : "cpu worker %u", thread);
+        draw_lane(shown.cpu, thread, begin_us, end_us);
+    }
+    ImGui::Text("gpu");
+    draw_lane(shown.gpu, gpu_thread, begin_us, end_us);
+
+    if (ImGui::BeginTable("profiler scopes", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingStretchProp)) {
+        ImGui::TableSetupColumn("scope");
+        ImGui::TableSetupColumn("cpu ms");
+        ImGui::TableSetupColumn("gpu ms");
+        ImGui::TableHeadersRow();
+
+        std::vector<Event> main_events;
+        for (const Event& event : shown.cpu) {
+            if (event.thread == 0) {
+                main_events.push_back(event);
+            }
+        }
+        // Scopes are recorded when they end, children before their parent
+        std::sort(main_events.begin(), main_events.end(), [](const Event& a, const Event& b) {
+            return a.start_us < b.start_us || (a.start_us == b.start_us && a.depth < b.depth);
+        });
+        for (const Event& event : main_events) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text("%*s%s", event.depth * 2, "", event.name);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", event.duration_us / 1000.0);
+            ImGui::TableNextColumn();
+            auto gpu = std::find_if(shown.gpu.begin(), shown.gpu.end(), [&event](const Event& gpu_event) {
+                return gpu_event.name == event.name;
+            });
+            if (gpu != shown.gpu.end()) {
+                ImGui::Text("%.3f", gpu->duration_us / 1000.0);
+            }
+        }
+        ImGui::EndTable();
+    }
+    ImGui::End();
+}
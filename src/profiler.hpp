@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "types.hpp"
+
+// Hierarchical cpu and gpu timings of every frame.
+//
+// PROFILE_SCOPE("name") times the rest of the enclosing block on the cpu,
+// PROFILE_GPU_SCOPE("name") times it on both. Scopes nest, and the depth
+// they were opened at is kept so the timeline can show the hierarchy.
+//
+// Gpu scopes are GL_TIMESTAMP query pairs. Timestamps, unlike
+// GL_TIME_ELAPSED, can nest and overlap with GpuTimers. Results are
+// read latency frames later, and only if they're already available, so
+// the profiler never waits on the gpu.
+//
+// NOTE: names have to be string literals, only the pointer is stored.
+// Cpu scopes work on any thread, gpu scopes only on the gl thread
+namespace profiler {
+
+struct Event {
+    const char* name = nullptr;
+    // Microseconds since profiler::init, gpu events are moved onto the
+    // cpu clock
+    double start_us = 0;
+    double duration_us = 0;
+    uint depth = 0;
+    // 0 is the thread that called init
+    uint thread = 0;
+};
+
+struct Frame {
+    uint64_t index = 0;
+    double start_us = 0;
+    double duration_us = 0;
+    std::vector<Event> cpu;
+    std::vector<Event> gpu;
+    // The gpu results came back, they're dropped if they take too long
+    bool gpu_ready = false;
+};
+
+// Frames the gpu results are read after
+constexpr uint latency = 3;
+
+inline bool enabled = true;
+
+// Needs a gl context
+void init();
+void shutdown();
+void begin_frame();
+void end_frame();
+
+// Newest frame that has its gpu timings, null if there isn't one yet
+const Frame* last_complete_frame();
+// Writes the frames in the history as Chrome trace events, for
+// chrome://tracing or ui.perfetto.dev. Returns false if it couldn't
+bool write_chrome_trace(const std::string& path);
+
+void show_imgui_window(bool* open);
+
+class CpuScope {
+public:
+    CpuScope(const char* name);
+    ~CpuScope();
+    CpuScope(const CpuScope&) = delete;
+    CpuScope& operator=(const CpuScope&) = delete;
+
+private:
+    const char* _name;
+    double _start_us;
+    uint64_t _frame;
+    bool _active;
+};
+
+class GpuScope {
+public:
+    GpuScope(const char* name);
+    ~GpuScope();
+    GpuScope(const GpuScope&) = delete;
+    GpuScope& operator=(const GpuScope&) = delete;
+
+private:
+    size_t _event;
+    bool _active;
+};
+
+}
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) \
+    profiler::CpuScope PROFILE_CONCAT(_profile_cpu_scope_, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name) \
+    PROFILE_SCOPE(name); \
+    profiler::GpuScope PROFILE_CONCAT(_profile_gpu_scope_, __LINE__)(name)
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+
+// Counter based random numbers. Every value is a hash of (key, counter) so
+// any position in a stream can be computed directly without running through
+// the ones before it. Unlike rand() this gives the same results no matter
+// which thread or in which order the values are generated.
+struct CounterRng {
+    uint64_t key = 0;
+    uint64_t counter = 0;
+
+    CounterRng(uint64_t key, uint64_t counter = 0)
+        : key(key), counter(counter) {}
+
+    // splitmix64 finalizer
+    static constexpr uint64_t mix(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebull;
+        x ^= x >> 31;
+        return x;
+    }
+
+    static constexpr uint32_t at(uint64_t key, uint64_t counter) {
+        return mix(mix(key) + counter * 0x9e3779b97f4a7c15ull) >> 32;
+    }
+
+    uint32_t next_u32() {
+        return at(key, counter++);
+    }
+
+    // [0, 1), uses the top 24 bits so every value is exactly representable
+    float next_float() {
+        return (next_u32() >> 8) * (1.0f / 16777216.0f);
+    }
+
+    float next_float(float min, float max) {
+        return min + next_float() * (max - min);
+    }
+};
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <glad/glad.h>
+#include "render_queue.hpp"
+#include "debug.hpp"
+
+namespace {
+    constexpr uint pass_bits = 2;
+    constexpr uint shader_bits = 12;
+    constexpr uint material_bits = 16;
+    constexpr uint vao_bits = 14;
+    constexpr uint depth_bits = 20;
+
+    constexpr uint depth_shift = 0;
+    constexpr uint vao_shift = depth_shift + depth_bits;
+    constexpr uint material_shift = vao_shift + vao_bits;
+    constexpr uint shader_shift = material_shift + material_bits;
+    constexpr uint pass_shift = shader_shift + shader_bits;
+    static_assert(pass_shift + pass_bits == 64, "Sort key has to fill 64 bits");
+
+    constexpr uint64_t mask(uint bits) {
+        return (uint64_t(1) << bits) - 1;
+    }
+
+    uint material_id(const Material* material) {
+        if (!material) {
+            return 0;
+        }
+        uint diffuse = material->has_diffuse_textures() ? material->diffuse_textures[0].ID : 0;
+        uint specular = material->has_specular_textures() ? material->specular_textures[0].ID : 0;
+        return diffuse * 31 + specular;
+    }
+}
+
+void RenderQueue::begin(float near, float far) {
+    _items.clear();
+    _keys.clear();
+    _near = near;
+    _far = far;
+}
+
+void RenderQueue::push(Pass pass, const Item& item, float depth) {
+    set(allocate(1), pass, item, depth);
+}
+
+uint RenderQueue::allocate(uint count) {
+    uint first = _items.size();
+    _items.resize(first + count);
+    _keys.resize(first + count);
+    return first;
+}
+
+void RenderQueue::set(uint index, Pass pass, const Item& item, float depth) {
+    ASSERT(item.shader != nullptr, "Render queue item has no shader");
+    ASSERT(item.draw_command != nullptr, "Render queue item has no draw command");
+    _keys[index] = { make_key(pass, item, depth), index };
+    _items[index] = item;
+}
+
+const std::vector<std::pair<uint64_t, uint>>& RenderQueue::sort(ThreadPool* pool) {
+    if (!sort_enabled) {
+        return _keys;
+    }
+    // Below this the merges cost more than they save
+    constexpr size_t parallel_threshold = 16384;
+    if (!pool || _keys.size() < parallel_threshold) {
+        std::sort(_keys.begin(), _keys.end());
+        return _keys;
+    }
+
+    // One chunk per thread, then neighbouring chunks get merged in pairs
+    // until one is left
+    size_t count = _keys.size();
+    size_t chunks = pool->thread_count() + 1;
+    std::vector<size_t> bounds;
+    for (size_t i = 0; i < chunks; i++) {
+        bounds.push_back(i * count / chunks);
+    }
+    bounds.push_back(count);
+
+    auto keys = _keys.begin();
+    pool->parallel_for(chunks, 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            std::sort(keys + bounds[i], keys + bounds[i + 1]);
+        }
+    });
+    while (bounds.size() > 2) {
+        size_t pairs = (bounds.size() - 1) / 2;
+        pool->parallel_for(pairs, 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                std::inplace_merge(
+                    keys + bounds[i * 2],
+                    keys + bounds[i * 2 + 1],
+                    keys + bounds[i * 2 + 2]
+                );
+            }
+        });
+        std::vector<size_t> merged;
+        for (size_t i = 0; i < bounds.size(); i += 2) {
+            merged.push_back(bounds[i]);
+        }
+        if (merged.back() != count) {
+            merged.push_back(count);
+        }
+        bounds = std::move(merged);
+    }
+    return _keys;
+}
+
+RenderQueue::Pass RenderQueue::key_pass(uint64_t key) {
+    return Pass((key >> pass_shift) & mask(pass_bits));
+}
+
+uint64_t RenderQueue::make_key(Pass pass, const Item& item, float depth) const {
+    float range = std::max(_far - _near, 0.0001f);
+    float normalized = std::clamp((depth - _near) / range, 0.0f, 1.0f);
+    uint64_t quantized_depth = normalized * mask(depth_bits);
+
+    return ((uint64_t(pass) & mask(pass_bits)) << pass_shift)
+        | ((uint64_t(item.shader->ID) & mask(shader_bits)) << shader_shift)
+        | ((uint64_t(material_id(item.material)) & mask(material_bits)) << material_shift)
+        | ((uint64_t(item.vao) & mask(vao_bits)) << vao_shift)
+        | (quantized_depth << depth_shift);
+}
+
+void RenderQueue::reset_state() {
+    _shader = 0;
+    _vao = 0;
+    _active_unit = 0;
+    std::fill(std::begin(_textures), std::end(_textures), 0);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+bool RenderQueue::bind_shader(Shader& shader) {
+    if (_shader == shader.ID) {
+        _frame_stats.redundant_skipped++;
+        return false;
+    }
+    shader.use();
+    _shader = shader.ID;
+    _frame_stats.shader_changes++;
+    return true;
+}
+
+bool RenderQueue::bind_vao(uint vao) {
+    if (_vao == vao) {
+        _frame_stats.redundant_skipped++;
+        return false;
+    }
+    glBindVertexArray(vao);
+    _vao = vao;
+    _frame_stats.vao_changes++;
+    return true;
+}
+
+bool RenderQueue::bind_texture(uint unit, uint texture) {
+    ASSERT(unit < max_texture_units, "Texture unit %u is out of range", unit);
+    if (_textures[unit] == texture) {
+        _frame_stats.redundant_skipped++;
+        return false;
+    }
+    if (_active_unit != unit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        _active_unit = unit;
+    }
+    glBindTexture(GL_TEXTURE_2D, texture);
+    _textures[unit] = texture;
+    _frame_stats.texture_binds++;
+    return true;
+}
+
+void RenderQueue::end_frame() {
+    _stats = _frame_stats;
+    _frame_stats = Stats();
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+#include "draw_command.hpp"
+#include "material.hpp"
+#include "shader.hpp"
+#include "thread_pool.hpp"
+
+// Draws collected over a frame and submitted sorted by a 64 bit key, so
+// draws sharing a shader, textures and vao end up next to each other and
+// the state changes between them can be skipped.
+//
+// Key layout, most significant bits first:
+//   pass      2 bits
+//   shader   12 bits
+//   material 16 bits, first diffuse and specular texture
+//   vao      14 bits
+//   depth    20 bits, front to back
+//
+// NOTE: the ids are gl names folded into their field so two of them can
+// share a value. That only makes the order worse, the state tracking
+// compares the real names
+class RenderQueue {
+public:
+    enum class Pass : uint8_t {
+        OPAQUE,
+        // Light gizmos, drawn after the scene
+        LIGHTS,
+    };
+
+    struct Item {
+        Shader* shader = nullptr;
+        uint vao = 0;
+        const DrawCommand* draw_command = nullptr;
+        // Textures get bound if set, leave it null for untextured shaders
+        const Material* material = nullptr;
+        // Lit shaders also get the normal matrix and shininess
+        bool lit = false;
+
+        glm::mat4 model = glm::mat4(1);
+        glm::mat3 normal_matrix = glm::mat3(1);
+        glm::vec3 color = glm::vec3(1);
+        float shininess = 32.0f;
+        // Dithers the item out while two lods cross fade. 0 draws every
+        // pixel, positive draws that fraction, negative the rest of -fade
+        float lod_fade = 0;
+    };
+
+    // State changes of the last submitted frame
+    struct Stats {
+        uint draw_calls = 0;
+        // Draws that were batched into instanced ones, and their instances
+        uint instanced_draws = 0;
+        uint instances = 0;
+        uint shader_changes = 0;
+        uint vao_changes = 0;
+        uint texture_binds = 0;
+        // Binds that were skipped because the state was already set
+        uint redundant_skipped = 0;
+    };
+
+    // Units past this are used by the light clusters
+    static constexpr uint max_texture_units = 12;
+
+    // Off submits in insertion order, to compare the state change counts
+    bool sort_enabled = true;
+
+    // Clears the previous frame's items, depth is normalized to near..far
+    void begin(float near, float far);
+    // depth is the view space distance used for the front to back order
+    void push(Pass pass, const Item& item, float depth);
+    // Makes room for count items and returns the index of the first. They
+    // have to be filled in with set before sorting, which is safe to do
+    // from several threads as long as they set different indices
+    uint allocate(uint count);
+    void set(uint index, Pass pass, const Item& item, float depth);
+    // Sorts the items and returns them in submission order. With a pool,
+    // big queues are sorted in chunks on it and merged, which gives the
+    // same order since no two keys are equal
+    const std::vector<std::pair<uint64_t, uint>>& sort(ThreadPool* pool = nullptr);
+    const Item& item(uint index) const { return _items[index]; }
+    static Pass key_pass(uint64_t key);
+
+    // State tracking, each returns false if the state was already set.
+    // reset_state forgets everything, call it before submitting
+    void reset_state();
+    bool bind_shader(Shader& shader);
+    bool bind_vao(uint vao);
+    bool bind_texture(uint unit, uint texture);
+
+    Stats& frame_stats() { return _frame_stats; }
+    const Stats& stats() const { return _stats; }
+    // Makes the current frame's stats the ones reported by stats()
+    void end_frame();
+
+private:
+    std::vector<Item> _items;
+    std::vector<std::pair<uint64_t, uint>> _keys;
+
+    float _near = 0.1f;
+    float _far = 100.0f;
+
+    uint _shader = 0;
+    uint _vao = 0;
+    uint _active_unit = 0;
+    uint _textures[max_texture_units] = {};
+
+    Stats _frame_stats;
+    Stats _stats;
+
+    uint64_t make_key(Pass pass, const Item& item, float depth) const;
+};
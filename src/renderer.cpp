@@ -1,15 +1,21 @@
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstddef>
 #include <glad/glad.h>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <cmath>
 #include <iterator>
+#include <optional>
+#include <thread>
 #include "renderer.hpp"
+#include "cpu_timer.hpp"
 #include "debug.hpp"
 #include "draw_command.hpp"
 #include "engine.hpp"
 #include "fs.hpp"
+#include "profiler.hpp"
 #include "utils.hpp"
 
 Renderer::Renderer(Camera &main_camera, Scene &scene)
@@ -27,6 +33,8 @@ Renderer::~Renderer() {
     glDeleteBuffers(1, &_rects_vbo);
     glDeleteVertexArrays(1, &_points_vao);
     glDeleteVertexArrays(1, &_rects_vao);
+    glDeleteBuffers(1, &_matrices_ubo);
+    glDeleteBuffers(1, &_lights_ubo);
 }
 
 void Renderer::draw_point(const Point& point) {
@@ -51,9 +59,7 @@ void Renderer::draw_line(Point p1, Point p2) {
 
 void Renderer::add_shader(Shader& shader) {
     _user_shaders.push_back(&shader);
-
-    uint index = glGetUniformBlockIndex(shaders.point.ID, "Matrices");
-    glUniformBlockBinding(shaders.point.ID, index, 0);
+    bind_uniform_blocks(shader);
 }
 
 void Renderer::reload_shaders() {
@@ -74,12 +80,36 @@ void Renderer::reload_shaders() {
     shaders.basic_textured_mesh.reload();
     shaders.light_mesh.reload();
     shaders.light_textured_mesh.reload();
+    shaders.basic_mesh_instanced.reload();
+    shaders.light_mesh_instanced.reload();
+    shaders.basic_mesh_lod_fade.reload();
+    shaders.basic_textured_mesh_lod_fade.reload();
+    shaders.light_mesh_lod_fade.reload();
+    shaders.light_textured_mesh_lod_fade.reload();
     shaders.skybox.reload();
     shaders.depth.reload();
 
     for (Shader* shader : _user_shaders) {
         shader->reload();
     }
+
+    // Block bindings are part of the program so they're gone after a reload
+    bind_uniform_blocks(shaders.point);
+    bind_uniform_blocks(shaders.line);
+    bind_uniform_blocks(shaders.basic_mesh);
+    bind_uniform_blocks(shaders.basic_textured_mesh);
+    bind_uniform_blocks(shaders.light_mesh);
+    bind_uniform_blocks(shaders.light_textured_mesh);
+    bind_uniform_blocks(shaders.basic_mesh_instanced);
+    bind_uniform_blocks(shaders.light_mesh_instanced);
+    bind_uniform_blocks(shaders.basic_mesh_lod_fade);
+    bind_uniform_blocks(shaders.basic_textured_mesh_lod_fade);
+    bind_uniform_blocks(shaders.light_mesh_lod_fade);
+    bind_uniform_blocks(shaders.light_textured_mesh_lod_fade);
+    bind_uniform_blocks(shaders.depth);
+    for (Shader* shader : _user_shaders) {
+        bind_uniform_blocks(*shader);
+    }
 }
 
 void Renderer::set_matrices(const glm::mat4& view, const glm::mat4& projection) {
@@ -110,7 +140,11 @@ void Renderer::render() {
         );
     }
 
-    update_vbos();
+    _stream_buffer.begin_frame();
+    {
+        PROFILE_SCOPE("update_vbos");
+        update_vbos();
+    }
 
     if (depth_test_enabled) {
         glEnable(GL_DEPTH_TEST);
@@ -132,15 +166,26 @@ void Renderer::render() {
 
     // ** RENDER CALLS **
 
+    _debug_draw_timer.begin();
     render_points();
     render_lines();
-    render_game_objects();
-    render_lights();
+    _debug_draw_timer.end();
+
+    _render_queue.begin(main_camera->near, main_camera->far);
+    {
+        PROFILE_SCOPE("queue");
+        queue_game_objects();
+        queue_lights();
+    }
+    _game_objects_timer.begin();
+    render_queue_items();
+    _game_objects_timer.end();
 
     // Draw skybox AFTER everything else has been drawn
     if (main_scene->has_skybox()) {
         render_skybox(main_scene->get_skybox());
     }
+    _stream_buffer.end_frame();
 
     // Maybe use your own implementation of a dynamic array
     // clearing the array just sets the size to 0, capacity stays the same
@@ -169,13 +214,20 @@ const DrawCommand& Renderer::sphere_mesh_draw_command() {
     return _sphere_model.meshes.front().draw_command;
 }
 
+const AABB& Renderer::sphere_mesh_bounds() {
+    ASSERT(_sphere_model.loaded(), "Sphere model not loaded");
+    return _sphere_model.meshes.front().bounds;
+}
+
 void Renderer::render_points() {
+    PROFILE_GPU_SCOPE("render_points");
     shaders.point.use();
     glBindVertexArray(_points_vao);
-    glDrawArrays(GL_POINTS, 0, _points.size());
+    glDrawArrays(GL_POINTS, _points_first, _points.size());
 }
 
 void Renderer::render_lines() {
+    PROFILE_GPU_SCOPE("render_lines");
     Shader* shader;
     if (depth_view_enabled) {
         shader = &shaders.depth;
@@ -185,115 +237,290 @@ void Renderer::render_lines() {
     }
     shader->use();
     glBindVertexArray(_lines_vao);
-    glDrawArrays(GL_LINES, 0, _line_points.size());
+    glDrawArrays(GL_LINES, _line_points_first, _line_points.size());
 }
 
-void Renderer::render_game_objects() {
-    send_light_data(shaders.light_mesh);
-    send_light_data(shaders.light_textured_mesh);
+ThreadPool* Renderer::frame_jobs() {
+    return parallel_enabled ? jobs : nullptr;
+}
 
-    for (GameObject* obj : main_scene->game_objects) {
-        if (obj->hidden) {
-            continue;
+void Renderer::parallel_for(size_t count, size_t batch_size, const std::function<void(size_t, size_t)>& fn) {
+    ThreadPool* pool = frame_jobs();
+    if (pool && count > batch_size) {
+        pool->parallel_for(count, batch_size, fn);
+    }
+    else if (count > 0) {
+        fn(0, count);
+    }
+}
+
+void Renderer::queue_game_objects() {
+    main_scene->sync_game_objects(frame_jobs());
+    ObjectStore& objects = main_scene->objects;
+    size_t count = objects.size();
+
+    _object_models.resize(count);
+    _object_normal_matrices.resize(count);
+    _object_lods.resize(count);
+    _object_first_items.resize(count);
+    _object_cull.resize(count);
+    _object_occluder_pixels.resize(count);
+
+    glm::mat4 view = draw_as_hud ? glm::mat4(1) : main_camera->get_view_matrix();
+    glm::vec3 camera_position = main_camera->transform.position;
+    // Pixels a unit long thing covers one unit in front of the camera
+    int viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    float pixels_per_unit = viewport[3] / (2.0f * std::tan(glm::radians(main_camera->fov) * 0.5f));
+    bool select_lods = lod_enabled && !draw_as_hud;
+    // The hud has no camera to cull against. Wireframe shows what's behind
+    // the occluders
+    bool frustum_cull = frustum_culling_enabled && !draw_as_hud;
+    bool occlusion_cull = occlusion_culling_enabled && !draw_as_hud && !wireframe_enabled;
+    glm::mat4 view_projection = main_camera->get_perspective_matrix() * view;
+    Frustum frustum(view_projection);
+
+    // Matrices and the frustum test first. The store's bounds are already
+    // in world space so the test doesn't wait on the matrices
+    parallel_for(count, 1024, [&](size_t begin, size_t end) {
+        PROFILE_SCOPE("queue_game_objects transforms");
+        // Build every model and normal matrix in the range in one go
+        transform_batch::build(
+            objects.transforms,
+            begin,
+            end,
+            _object_models.data(),
+            _object_normal_matrices.data()
+        );
+        if (frustum_cull) {
+            frustum.intersects_aabbs(objects.bounds.data(), begin, end, _object_cull.data());
+        }
+        for (size_t i = begin; i < end; i++) {
+            bool inside = !frustum_cull || _object_cull[i];
+            _object_cull[i] = objects.hidden[i] ? HIDDEN : inside ? VISIBLE : OUTSIDE_FRUSTUM;
+            _object_occluder_pixels[i] = 0;
+            if (!occlusion_cull || _object_cull[i] != VISIBLE) {
+                continue;
+            }
+            bool has_occluder = false;
+            for (const Mesh& mesh : *objects.meshes[i]) {
+                has_occluder |= mesh.occluder.valid();
+            }
+            const AABB& box = objects.bounds[i];
+            if (has_occluder && box.valid()) {
+                float distance = glm::length(box.center() - camera_position);
+                float size = 2.0f * glm::length(box.extent()) * pixels_per_unit / std::max(distance, 0.001f);
+                _object_occluder_pixels[i] = size * size;
+            }
+        }
+    });
+
+    // The biggest objects on screen are the best occluders
+    if (occlusion_cull) {
+        PROFILE_SCOPE("queue_game_objects occluders");
+        _occluder_candidates.clear();
+        for (size_t i = 0; i < count; i++) {
+            if (_object_occluder_pixels[i] > 0 && _object_occluder_pixels[i] >= occluder_min_pixels) {
+                _occluder_candidates.push_back(i);
+            }
+        }
+        size_t occluders = std::min(_occluder_candidates.size(), (size_t)std::max(max_occluders, 0));
+        std::partial_sort(
+            _occluder_candidates.begin(),
+            _occluder_candidates.begin() + occluders,
+            _occluder_candidates.end(),
+            [&](uint a, uint b) { return _object_occluder_pixels[a] > _object_occluder_pixels[b]; }
+        );
+        _occlusion.begin(view_projection);
+        for (size_t k = 0; k < occluders; k++) {
+            uint i = _occluder_candidates[k];
+            for (const Mesh& mesh : *objects.meshes[i]) {
+                _occlusion.draw_box(_object_models[i], mesh.occluder);
+            }
+        }
+        _occlusion.finish();
+    }
+
+    // Occlusion and lods, an object that's fading between two lods needs
+    // twice the queue items
+    parallel_for(count, 1024, [&](size_t begin, size_t end) {
+        PROFILE_SCOPE("queue_game_objects lods");
+        for (size_t i = begin; i < end; i++) {
+            if (_object_cull[i] != VISIBLE) {
+                continue;
+            }
+            if (occlusion_cull && _occlusion.occluded(objects.bounds[i])) {
+                _object_cull[i] = OCCLUDED;
+                continue;
+            }
+            // Custom shaders and the depth view have no dithering variant
+            bool fade = lod_cross_fade && !depth_view_enabled && !objects.materials[i]->shader;
+            _object_lods[i] = select_lod(objects, i, select_lods, fade, camera_position, pixels_per_unit);
         }
-        Shader* shader = nullptr;
-        glm::mat4 model = obj->transform.get_mat4();
-        // TODO: FIX THIS NESTING
-        if (obj->material.shader) {
-            shader = obj->material.shader.value();
-            shader->use();
+    });
+
+    // Every mesh is a queue item, so each object's items start after the
+    // ones before it. That's what lets the rest run in any order
+    _lod_stats = LodStats();
+    _cull_stats = CullStats();
+    _cull_stats.occluders = occlusion_cull ? _occlusion.occluders() : 0;
+    uint item_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        _object_first_items[i] = item_count;
+        u8 cull = _object_cull[i];
+        _cull_stats.tested += cull != HIDDEN;
+        _cull_stats.frustum_culled += cull == OUTSIDE_FRUSTUM;
+        _cull_stats.occlusion_culled += cull == OCCLUDED;
+        if (cull != VISIBLE) {
+            continue;
         }
-        else {
-            // Depth
-            if (depth_view_enabled) {
-                shader = &shaders.depth;
-                shader->use();
+        _cull_stats.drawn++;
+        const ObjectLod& lod = _object_lods[i];
+        uint meshes = objects.meshes[i]->size();
+        item_count += lod.fade > 0 ? meshes * 2 : meshes;
+        _lod_stats.objects[lod.lod]++;
+        _lod_stats.fading += lod.fade > 0;
+        _lod_stats.triangles += lod.triangles;
+    }
+    uint first_item = _render_queue.allocate(item_count);
+
+    bool has_lights = main_scene->has_lights();
+    parallel_for(count, 1024, [&](size_t begin, size_t end) {
+        PROFILE_SCOPE("queue_game_objects batch");
+        for (size_t i = begin; i < end; i++) {
+            if (_object_cull[i] != VISIBLE) {
+                continue;
+            }
+            const Material& material = *objects.materials[i];
+            RenderQueue::Item item;
+            item.normal_matrix = _object_normal_matrices[i];
+            item.color = material.color.clamped_vec3();
+            item.shininess = material.shininess;
+
+            bool textured = material.has_diffuse_textures();
+            if (material.shader) {
+                item.shader = material.shader.value();
+            }
+            else if (depth_view_enabled) {
+                item.shader = &shaders.depth;
             }
-            // Textures
-            else if (obj->material.has_diffuse_textures()) {
             // TODO: this probably isn't right - should check for other textures?
-                if (!engine::get_scene().has_lights()) {
-                    shader = &shaders.basic_textured_mesh;
-                    shader->use();
-                }
-                // Only do lighting stuff if needed
-                // Still do texture stuff afterwards tho
-                else {
-                    shader = &shaders.light_textured_mesh;
-                    shader->use();
-
-                    shader->set_float("material.shininess", obj->material.shininess);
-                    shader->set_mat3(
-                        "inverse_model",
-                        utils::inverse_model(model)
-                        /*glm::transpose(*/
-                        /*    glm::inverse(*/
-                        /*        model*/
-                        /*    )*/
-                        /*)*/
-                    );
-                    /*send_light_data(*shader);*/
-                }
-                for (int i = 0; i < obj->material.diffuse_texture_count(); i++) {
-                    // TODO: is this GL_TEXTURE0 and GL_TEXTURE1 stuff right?
-                    // doesn't that just get overwritten on the iteration?
-                    glActiveTexture(GL_TEXTURE0 + i);
-                    shader->set_int(
-                        "material.diffuse_texture" + std::to_string(i + 1),
-                        GL_TEXTURE0 + i
-                    );
-                    obj->material.diffuse_textures[i].bind();
-                }
-                for (int i = 0; i < obj->material.specular_texture_count(); i++) {
-                    // is this okay?
-                    // loading both specular and diffuse textures with the same active texture
-                    glActiveTexture(GL_TEXTURE0 + i);
-                    shader->set_int(
-                        "material.specular_texture" + std::to_string(i + 1),
-                        GL_TEXTURE0 + i
-                    );
-                    obj->material.specular_textures[i].bind();
-                }
+            else if (textured) {
+                item.shader = has_lights ? &shaders.light_textured_mesh : &shaders.basic_textured_mesh;
+                item.lit = has_lights;
+                item.material = &material;
             }
-            // Textureless Lighting
             else {
-                if (!engine::get_scene().has_lights()) {
-                    shader = &shaders.basic_mesh;
-                    shader->use();
-                }
-                else {
-                    shader = &shaders.light_mesh;
-                    shader->use();
-
-                    shader->set_float("material.shininess", obj->material.shininess);
-                    shader->set_mat3(
-                        "inverse_model",
-                        utils::inverse_model(model)
-                        /*glm::transpose(*/
-                        /*    glm::inverse(*/
-                        /*        model*/
-                        /*    )*/
-                        /*)*/
-                    );
-                    /*send_light_data(*shader);*/
+                item.shader = has_lights ? &shaders.light_mesh : &shaders.basic_mesh;
+                item.lit = has_lights;
+            }
+
+            glm::vec3 position = {
+                objects.transforms.position_x[i],
+                objects.transforms.position_y[i],
+                objects.transforms.position_z[i]
+            };
+            float depth = -(view * glm::vec4(position, 1.0f)).z;
+            const ObjectLod& lod = _object_lods[i];
+            uint index = first_item + _object_first_items[i];
+            for (const Mesh& mesh : *objects.meshes[i]) {
+                // Quantized meshes unpack their positions through the model
+                // matrix, the normal matrix stays the object's
+                item.model = mesh.position_transform == glm::mat4(1)
+                    ? _object_models[i]
+                    : _object_models[i] * mesh.position_transform;
+                item.vao = mesh.vao();
+                item.draw_command = &mesh.lod_draw_command(lod.lod);
+                if (lod.fade == 0) {
+                    _render_queue.set(index++, RenderQueue::Pass::OPAQUE, item, depth);
+                    continue;
                 }
+
+                // The finer lod covers the pixels the coarser one leaves out
+                RenderQueue::Item faded = item;
+                faded.shader = lod_fade_variant(*item.shader);
+                faded.lod_fade = lod.fade;
+                ASSERT(faded.shader != nullptr, "Object is fading with a shader that can't");
+                _render_queue.set(index++, RenderQueue::Pass::OPAQUE, faded, depth);
+                faded.draw_command = &mesh.lod_draw_command(lod.lod - 1);
+                faded.lod_fade = -faded.lod_fade;
+                _render_queue.set(index++, RenderQueue::Pass::OPAQUE, faded, depth);
             }
         }
-        shader->set_mat4("model", model);
-        shader->set_vec3("material.color", obj->material.color.clamped_vec3());
-        for (auto& mesh : obj->meshes) {
-            render_mesh(mesh);
+    });
+}
+
+Renderer::ObjectLod Renderer::select_lod(
+    const ObjectStore& objects,
+    size_t index,
+    bool enabled,
+    bool fade,
+    glm::vec3 camera_position,
+    float pixels_per_unit) const {
+
+    const std::vector<Mesh>& meshes = *objects.meshes[index];
+    ObjectLod result;
+    uint lod_count = 1;
+    for (const Mesh& mesh : meshes) {
+        lod_count = std::max(lod_count, mesh.lod_count());
+    }
+
+    if (enabled && lod_count > 1) {
+        glm::vec3 position = {
+            objects.transforms.position_x[index],
+            objects.transforms.position_y[index],
+            objects.transforms.position_z[index]
+        };
+        float scale = std::max({
+            std::abs(objects.transforms.scale_x[index]),
+            std::abs(objects.transforms.scale_y[index]),
+            std::abs(objects.transforms.scale_z[index])
+        });
+        float distance = std::max(glm::length(position - camera_position), main_camera->near);
+        float pixels = scale * pixels_per_unit / distance;
+
+        // Every mesh switches together so the seams between them line up.
+        // The coarsest lod that's still within the allowed error wins
+        float lod_pixels = 0;
+        for (uint lod = 1; lod < lod_count; lod++) {
+            float error = 0;
+            for (const Mesh& mesh : meshes) {
+                error = std::max(error, mesh.lod_error(lod));
+            }
+            if (error * pixels > lod_error_pixels) {
+                break;
+            }
+            result.lod = lod;
+            lod_pixels = error * pixels;
+        }
+
+        // Just switched, still mostly showing the finer lod
+        float fade_start = lod_error_pixels * (1.0f - lod_fade_band);
+        if (fade && result.lod > 0 && lod_fade_band > 0 && lod_pixels > fade_start) {
+            result.fade = std::max((lod_error_pixels - lod_pixels) / (lod_error_pixels * lod_fade_band), 0.01f);
+        }
+    }
+
+    for (const Mesh& mesh : meshes) {
+        result.triangles += mesh.lod_draw_command(result.lod).vertex_count / 3;
+        if (result.fade > 0) {
+            result.triangles += mesh.lod_draw_command(result.lod - 1).vertex_count / 3;
         }
     }
+    return result;
 }
 
-void Renderer::render_lights() {
+void Renderer::queue_lights() {
     Scene& scene = engine::get_scene();
-    Shader& shader = depth_view_enabled ? shaders.depth : shaders.basic_mesh;
+    glm::mat4 view = main_camera->get_view_matrix();
+
+    RenderQueue::Item item;
+    item.shader = depth_view_enabled ? &shaders.depth : &shaders.basic_mesh;
+
     Transform sphere_transform;
     sphere_transform.scale = glm::vec3(0.1f);
-
-    shader.use();
+    item.vao = sphere_vao();
+    item.draw_command = &sphere_mesh_draw_command();
 
     // Point lights
     for (uint i = 0; i < scene.point_lights_used(); i++) {
@@ -302,25 +529,18 @@ void Renderer::render_lights() {
             continue;
         }
         sphere_transform.position = light.position;
-        glm::mat4 model = sphere_transform.get_mat4();
-        shader.set_mat4("model", model);
-        shader.set_vec3("material.color", light.diffuse.clamped_vec3());
-        render_mesh(_sphere_model.meshes.front());
+        item.model = sphere_transform.get_mat4();
+        item.color = light.diffuse.clamped_vec3();
+        float depth = -(view * glm::vec4(light.position, 1.0f)).z;
+        _render_queue.push(RenderQueue::Pass::LIGHTS, item, depth);
     }
 
     // Spot lights
-    Mesh square_pyramids_mesh;
-    square_pyramids_mesh.set_vao(_square_pyramids_vao);
-    square_pyramids_mesh.draw_command = {
-        DrawCommandType::DRAW_ELEMENTS,
-        DrawCommandMode::TRIANGLES,
-        18
-    };
-
     Transform square_pyramid_transform;
     square_pyramid_transform.scale = glm::vec3(0.2f);
-
     square_pyramid_transform.rotation.roll = 0;
+    item.vao = _square_pyramids_vao;
+    item.draw_command = &_square_pyramid_draw_command;
 
     for (uint i = 0; i < scene.spot_lights_used(); i++) {
         auto& light = *scene.spot_lights[i];
@@ -334,15 +554,283 @@ void Renderer::render_lights() {
         // HACK: -90 to make pitch look downward when direction is 0, -1, 0 and other stuff
         square_pyramid_transform.rotation.pitch = glm::degrees(glm::asin(-dir.y)) - 90;
 
-        glm::mat4 model = square_pyramid_transform.get_mat4();
-        shader.set_mat4("model", model);
-        shader.set_vec3("material.color", light.diffuse.clamped_vec3());
-        render_mesh(square_pyramids_mesh);
+        item.model = square_pyramid_transform.get_mat4();
+        item.color = light.diffuse.clamped_vec3();
+        float depth = -(view * glm::vec4(light.position, 1.0f)).z;
+        _render_queue.push(RenderQueue::Pass::LIGHTS, item, depth);
+    }
+}
+
+void Renderer::render_queue_items() {
+    // Optional so they can end early, the pass ones whenever the pass changes
+    std::optional<profiler::CpuScope> sort_scope;
+    std::optional<profiler::CpuScope> pass_cpu_scope;
+    std::optional<profiler::GpuScope> pass_gpu_scope;
+
+    sort_scope.emplace("sort");
+    const auto& sorted = _render_queue.sort(frame_jobs());
+    build_draw_batches(sorted);
+    sort_scope.reset();
+    if (!_instance_data.empty()) {
+        _instance_offset = _stream_buffer.write(
+            _instance_data.data(),
+            _instance_data.size() * sizeof(InstanceData)
+        );
+        _instance_buffer = _stream_buffer.id();
+    }
+
+    _render_queue.reset_state();
+    RenderQueue::Stats& stats = _render_queue.frame_stats();
+    const Material* material = nullptr;
+    int pass = -1;
+    for (const DrawBatch& batch : _draw_batches) {
+        const RenderQueue::Item& item = _render_queue.item(sorted[batch.begin].second);
+
+        RenderQueue::Pass batch_pass = RenderQueue::key_pass(sorted[batch.begin].first);
+        if ((int)batch_pass != pass) {
+            pass = (int)batch_pass;
+            const char* name = batch_pass == RenderQueue::Pass::LIGHTS
+                ? "render_lights"
+                : "render_game_objects";
+            pass_gpu_scope.reset();
+            pass_cpu_scope.emplace(name);
+            pass_gpu_scope.emplace(name);
+        }
+
+        if (batch.first_instance >= 0) {
+            Shader& shader = *instanced_variant(*item.shader);
+            ShaderUniforms& uniforms = shader_uniforms(shader);
+            _render_queue.bind_shader(shader);
+            _render_queue.bind_vao(item.vao);
+            if (item.lit) {
+                shader.set_float(uniforms.material_shininess, item.shininess);
+            }
+            enable_instance_attributes(batch.first_instance);
+            draw_instanced(*item.draw_command, batch.count);
+            disable_instance_attributes();
+            stats.draw_calls++;
+            stats.instanced_draws++;
+            stats.instances += batch.count;
+            continue;
+        }
+
+        Shader& shader = *item.shader;
+        ShaderUniforms& uniforms = shader_uniforms(shader);
+
+        bool shader_changed = _render_queue.bind_shader(shader);
+        _render_queue.bind_vao(item.vao);
+
+        // Sampler uniforms are part of the program, so they only need
+        // setting when either the program or the material changes
+        if (item.material && (shader_changed || item.material != material)) {
+            // Diffuse textures first, specular ones on the units after them
+            uint unit = 0;
+            for (uint i = 0; i < item.material->diffuse_texture_count(); i++, unit++) {
+                _render_queue.bind_texture(unit, item.material->diffuse_textures[i].ID);
+                shader.set_int(uniforms.diffuse_texture(i), unit);
+            }
+            for (uint i = 0; i < item.material->specular_texture_count(); i++) {
+                const Texture2D& texture = item.material->specular_textures[i];
+                if (texture.type == TextureType::NONE) {
+                    continue;
+                }
+                _render_queue.bind_texture(unit, texture.ID);
+                shader.set_int(uniforms.specular_texture(i), unit);
+                unit++;
+            }
+        }
+        material = item.material;
+
+        if (item.lit) {
+            shader.set_float(uniforms.material_shininess, item.shininess);
+            shader.set_mat3(uniforms.inverse_model, item.normal_matrix);
+        }
+        shader.set_mat4(uniforms.model, item.model);
+        shader.set_vec3(uniforms.material_color, item.color);
+        if (item.lod_fade != 0) {
+            shader.set_float(uniforms.lod_fade, item.lod_fade);
+        }
+        draw(*item.draw_command);
+        stats.draw_calls++;
+    }
+    glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE0);
+    _render_queue.end_frame();
+}
+
+std::vector<Renderer::FrameBuildTiming> Renderer::benchmark_frame_building(uint iterations) {
+    ThreadPool* frame_pool = jobs;
+    bool was_parallel = parallel_enabled;
+    parallel_enabled = true;
+
+    std::vector<FrameBuildTiming> timings;
+    uint max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (uint threads = 1; ; threads = std::min(threads * 2, max_threads)) {
+        // The calling thread works too, so one thread is no pool at all
+        std::unique_ptr<ThreadPool> pool;
+        if (threads > 1) {
+            pool = std::make_unique<ThreadPool>(threads - 1);
+        }
+        jobs = pool.get();
+
+        CpuTimer timer;
+        for (uint i = 0; i < iterations; i++) {
+            _render_queue.begin(main_camera->near, main_camera->far);
+            queue_game_objects();
+            build_draw_batches(_render_queue.sort(jobs));
+        }
+        FrameBuildTiming timing;
+        timing.threads = threads;
+        timing.game_objects = main_scene->objects.size();
+        timing.ms = timer.elapsed_ms() / iterations;
+        timings.push_back(timing);
+        LOG(
+            "Frame building, %zu game objects on %u threads: %.3f ms",
+            timing.game_objects,
+            threads,
+            timing.ms
+        );
+        if (threads == max_threads) {
+            break;
+        }
+    }
+
+    // Whatever was queued is thrown away by the next render
+    jobs = frame_pool;
+    parallel_enabled = was_parallel;
+    return timings;
+}
+
+void Renderer::build_draw_batches(const std::vector<std::pair<uint64_t, uint>>& sorted) {
+    _draw_batches.clear();
+    _instanced_items.clear();
+
+    // Items that can share a draw are next to each other after sorting,
+    // only the depth differs between them
+    uint begin = 0;
+    while (begin < sorted.size()) {
+        const RenderQueue::Item& first = _render_queue.item(sorted[begin].second);
+        uint end = begin + 1;
+        if (instancing_enabled && can_instance(first)) {
+            while (end < sorted.size()
+                   && same_instance_batch(first, _render_queue.item(sorted[end].second))) {
+                end++;
+            }
+        }
+
+        DrawBatch batch;
+        batch.begin = begin;
+        batch.count = end - begin;
+        if (batch.count > 1) {
+            batch.first_instance = _instanced_items.size();
+            for (uint i = begin; i < end; i++) {
+                _instanced_items.push_back(i);
+            }
+        }
+        _draw_batches.push_back(batch);
+        begin = end;
+    }
+
+    // Most of the copying is here, and every instance has its own slot
+    _instance_data.resize(_instanced_items.size());
+    parallel_for(_instanced_items.size(), 4096, [&](size_t begin, size_t end) {
+        PROFILE_SCOPE("instance data batch");
+        for (size_t i = begin; i < end; i++) {
+            const RenderQueue::Item& item = _render_queue.item(sorted[_instanced_items[i]].second);
+            _instance_data[i] = { item.model, item.normal_matrix, item.color };
+        }
+    });
+}
+
+Shader* Renderer::instanced_variant(const Shader& shader) {
+    if (&shader == &shaders.basic_mesh) {
+        return &shaders.basic_mesh_instanced;
+    }
+    if (&shader == &shaders.light_mesh) {
+        return &shaders.light_mesh_instanced;
+    }
+    return nullptr;
+}
+
+Shader* Renderer::lod_fade_variant(const Shader& shader) {
+    if (&shader == &shaders.basic_mesh) {
+        return &shaders.basic_mesh_lod_fade;
+    }
+    if (&shader == &shaders.basic_textured_mesh) {
+        return &shaders.basic_textured_mesh_lod_fade;
+    }
+    if (&shader == &shaders.light_mesh) {
+        return &shaders.light_mesh_lod_fade;
+    }
+    if (&shader == &shaders.light_textured_mesh) {
+        return &shaders.light_textured_mesh_lod_fade;
+    }
+    return nullptr;
+}
+
+bool Renderer::can_instance(const RenderQueue::Item& item) {
+    // Textured materials aren't batched, their textures would have to match
+    // too. Fading items don't have an instanced variant, there are few of them
+    if (item.material || item.lod_fade != 0 || !instanced_variant(*item.shader)) {
+        return false;
+    }
+    DrawCommandType type = item.draw_command->type;
+    return type == DrawCommandType::DRAW_ARRAYS || type == DrawCommandType::DRAW_ELEMENTS;
+}
+
+bool Renderer::same_instance_batch(const RenderQueue::Item& a, const RenderQueue::Item& b) {
+    const DrawCommand& a_command = *a.draw_command;
+    const DrawCommand& b_command = *b.draw_command;
+    return a.shader == b.shader
+        && a.vao == b.vao
+        && b.material == nullptr
+        && a.lit == b.lit
+        && (!a.lit || a.shininess == b.shininess)
+        && a_command.type == b_command.type
+        && a_command.mode == b_command.mode
+        && a_command.vertex_count == b_command.vertex_count
+        && a_command.first_index == b_command.first_index;
+}
+
+void Renderer::enable_instance_attributes(uint first_instance) {
+    // No base instance before GL 4.2, so the offset goes into the pointers
+    size_t base = _instance_offset + first_instance * sizeof(InstanceData);
+    size_t stride = sizeof(InstanceData);
+    glBindBuffer(GL_ARRAY_BUFFER, _instance_buffer);
+
+    // model, a column per location
+    for (uint i = 0; i < 4; i++) {
+        size_t offset = base + offsetof(InstanceData, model) + i * sizeof(glm::vec4);
+        glEnableVertexAttribArray(3 + i);
+        glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, stride, (void*)offset);
+        glVertexAttribDivisor(3 + i, 1);
+    }
+    // inverse model
+    for (uint i = 0; i < 3; i++) {
+        size_t offset = base + offsetof(InstanceData, inverse_model) + i * sizeof(glm::vec3);
+        glEnableVertexAttribArray(7 + i);
+        glVertexAttribPointer(7 + i, 3, GL_FLOAT, GL_FALSE, stride, (void*)offset);
+        glVertexAttribDivisor(7 + i, 1);
+    }
+    // color
+    size_t offset = base + offsetof(InstanceData, color);
+    glEnableVertexAttribArray(10);
+    glVertexAttribPointer(10, 3, GL_FLOAT, GL_FALSE, stride, (void*)offset);
+    glVertexAttribDivisor(10, 1);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void Renderer::disable_instance_attributes() {
+    for (uint location = 3; location <= 10; location++) {
+        glVertexAttribDivisor(location, 0);
+        glDisableVertexAttribArray(location);
     }
 }
 
 void Renderer::render_skybox(Skybox& skybox) {
     ASSERT(skybox.loaded(), "skybox not loaded");
+    PROFILE_GPU_SCOPE("render_skybox");
 
     if (wireframe_enabled) {
         glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
@@ -370,43 +858,77 @@ void Renderer::render_skybox(Skybox& skybox) {
 
 void Renderer::render_mesh(const Mesh& mesh) {
     glBindVertexArray(mesh.vao());
-    uint mode = draw_command_utils::draw_command_mode_to_gl_mode(mesh.draw_command.mode);
-    switch (mesh.draw_command.type) {
+    draw(mesh.draw_command);
+    glBindVertexArray(0);
+}
+
+void Renderer::draw(const DrawCommand& command) {
+    uint mode = draw_command_utils::draw_command_mode_to_gl_mode(command.mode);
+    switch (command.type) {
     case DrawCommandType::DRAW_ARRAYS:
-        glDrawArrays(mode, 0, mesh.draw_command.vertex_count);
+        glDrawArrays(mode, 0, command.vertex_count);
         break;
     case DrawCommandType::DRAW_ELEMENTS:
-        glDrawElements(mode, mesh.draw_command.vertex_count, GL_UNSIGNED_INT, 0);
+        glDrawElements(mode, command.vertex_count, GL_UNSIGNED_INT, (void*)(command.first_index * sizeof(uint)));
         break;
     case DrawCommandType::DRAW_ARRAYS_INSTANCED:
         glDrawArraysInstanced(
             mode,
             0,
-            mesh.draw_command.vertex_count,
-            mesh.draw_command.instance_count
+            command.vertex_count,
+            command.instance_count
         );
         break;
     case DrawCommandType::DRAW_ELEMENTS_INSTANCED:
         glDrawElementsInstanced(
             mode,
-            mesh.draw_command.vertex_count,
+            command.vertex_count,
             GL_UNSIGNED_INT,
-            0,
-            mesh.draw_command.instance_count
+            (void*)(command.first_index * sizeof(uint)),
+            command.instance_count
+        );
+        break;
+    case DrawCommandType::DRAW_ELEMENTS_INDIRECT:
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command.indirect_buffer);
+        glDrawElementsIndirect(
+            mode,
+            GL_UNSIGNED_INT,
+            (void*)command.indirect_offset
         );
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
         break;
     default:
         /*ERROR("Invalid draw command");*/
         break;
 
     }
-    /*if (mesh.draw_command.type == DrawCommandType::DRAW_ARRAYS) {*/
-    /*    glDrawArrays(mode, 0, mesh.draw_command.vertex_count);*/
+    /*if (command.type == DrawCommandType::DRAW_ARRAYS) {*/
+    /*    glDrawArrays(mode, 0, command.vertex_count);*/
     /*}*/
-    /*else if (mesh.draw_command.type == DrawCommandType::DRAW_ELEMENTS) {*/
-    /*    glDrawElements(mode, mesh.draw_command.vertex_count, GL_UNSIGNED_INT, 0);*/
+    /*else if (command.type == DrawCommandType::DRAW_ELEMENTS) {*/
+    /*    glDrawElements(mode, command.vertex_count, GL_UNSIGNED_INT, 0);*/
     /*}*/
-    glBindVertexArray(0);
+}
+
+void Renderer::draw_instanced(const DrawCommand& command, uint instance_count) {
+    uint mode = draw_command_utils::draw_command_mode_to_gl_mode(command.mode);
+    switch (command.type) {
+    case DrawCommandType::DRAW_ARRAYS:
+        glDrawArraysInstanced(mode, 0, command.vertex_count, instance_count);
+        break;
+    case DrawCommandType::DRAW_ELEMENTS:
+        glDrawElementsInstanced(
+            mode,
+            command.vertex_count,
+            GL_UNSIGNED_INT,
+            (void*)(command.first_index * sizeof(uint)),
+            instance_count
+        );
+        break;
+    default:
+        ERROR("Only plain draw commands can be instanced");
+        break;
+    }
 }
 
 void Renderer::init_models() {
@@ -423,6 +945,7 @@ void Renderer::init_vbos() {
     glGenBuffers(1, &_lines_vbo);
     glGenBuffers(1, &_cubes_vbo);
     glGenBuffers(1, &_square_pyramids_vbo);
+    _stream_buffer.init(4 * 1024 * 1024);
 }
 
 void Renderer::init_vaos() {
@@ -540,41 +1063,115 @@ void Renderer::init_ubos() {
     glBufferData(GL_UNIFORM_BUFFER, 2 * sizeof(glm::mat4), NULL, GL_STATIC_DRAW);
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
-    glBindBufferRange(GL_UNIFORM_BUFFER, 0, _matrices_ubo, 0, 2 * sizeof(glm::mat4));
-
-    // Bind shaders to _matrices_ubo
-    uint index = glGetUniformBlockIndex(shaders.point.ID, "Matrices");
-    glUniformBlockBinding(shaders.point.ID, index, 0);
-
-    index = glGetUniformBlockIndex(shaders.line.ID, "Matrices");
-    glUniformBlockBinding(shaders.line.ID, index, 0);
-
-    index = glGetUniformBlockIndex(shaders.basic_mesh.ID, "Matrices");
-    glUniformBlockBinding(shaders.basic_mesh.ID, index, 0);
+    glBindBufferRange(GL_UNIFORM_BUFFER, _matrices_binding, _matrices_ubo, 0, 2 * sizeof(glm::mat4));
 
-    index = glGetUniformBlockIndex(shaders.basic_textured_mesh.ID, "Matrices");
-    glUniformBlockBinding(shaders.basic_textured_mesh.ID, index, 0);
-
-    index = glGetUniformBlockIndex(shaders.light_mesh.ID, "Matrices");
-    glUniformBlockBinding(shaders.light_mesh.ID, index, 0);
+    glGenBuffers(1, &_lights_ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, _lights_ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(LightBlock), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
-    index = glGetUniformBlockIndex(shaders.light_textured_mesh.ID, "Matrices");
-    glUniformBlockBinding(shaders.light_textured_mesh.ID, index, 0);
+    glBindBufferRange(GL_UNIFORM_BUFFER, _lights_binding, _lights_ubo, 0, sizeof(LightBlock));
+    _light_clusters.init();
 
     // No skybox because it needs a specular view matrix
+    bind_uniform_blocks(shaders.point);
+    bind_uniform_blocks(shaders.line);
+    bind_uniform_blocks(shaders.basic_mesh);
+    bind_uniform_blocks(shaders.basic_textured_mesh);
+    bind_uniform_blocks(shaders.light_mesh);
+    bind_uniform_blocks(shaders.light_textured_mesh);
+    bind_uniform_blocks(shaders.basic_mesh_instanced);
+    bind_uniform_blocks(shaders.light_mesh_instanced);
+    bind_uniform_blocks(shaders.basic_mesh_lod_fade);
+    bind_uniform_blocks(shaders.basic_textured_mesh_lod_fade);
+    bind_uniform_blocks(shaders.light_mesh_lod_fade);
+    bind_uniform_blocks(shaders.light_textured_mesh_lod_fade);
+    bind_uniform_blocks(shaders.depth);
+}
+
+void Renderer::bind_uniform_blocks(Shader& shader) {
+    uint index = glGetUniformBlockIndex(shader.ID, "Matrices");
+    if (index != GL_INVALID_INDEX) {
+        glUniformBlockBinding(shader.ID, index, _matrices_binding);
+    }
+    index = glGetUniformBlockIndex(shader.ID, "Lights");
+    if (index != GL_INVALID_INDEX) {
+        glUniformBlockBinding(shader.ID, index, _lights_binding);
+        LightClusters::set_samplers(shader);
+    }
+}
 
-    index = glGetUniformBlockIndex(shaders.depth.ID, "Matrices");
-    glUniformBlockBinding(shaders.depth.ID, index, 0);
+void Renderer::upload_lights() {
+    Scene& scene = engine::get_scene();
+    glm::mat4 view = main_camera->get_view_matrix();
+
+    int viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    _light_clusters.build(scene, *main_camera, view, glm::uvec2(viewport[2], viewport[3]));
+    _light_clusters.bind_textures();
+
+    const LightClusters::ShaderParams& params = _light_clusters.shader_params();
+    _light_block.n_point_lights_used = scene.point_lights_used();
+    _light_block.n_spot_lights_used = scene.spot_lights_used();
+    _light_block.n_dir_lights_used = scene.dir_lights_used();
+    _light_block.view_pos = main_camera->transform.position;
+    for (size_t i = 0; i < scene.dir_lights_used(); i++) {
+        _light_block.dir_lights[i] = scene.directional_lights[i]->gpu_data();
+    }
+    _light_block.cluster_grid_size = glm::uvec3(
+        LightClusters::grid_x,
+        LightClusters::grid_y,
+        LightClusters::grid_z
+    );
+    _light_block.cluster_z_scale = params.z_scale;
+    _light_block.cluster_tile_scale = params.tile_scale;
+    _light_block.cluster_z_bias = params.z_bias;
+    _light_block.camera_near = main_camera->near;
+    _light_block.camera_far = main_camera->far;
+
+    glBindBuffer(GL_UNIFORM_BUFFER, _lights_ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(LightBlock), &_light_block);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
 void Renderer::update_vbos() {
-    glBindBuffer(GL_ARRAY_BUFFER, _lines_vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(Point) * _line_points.size(), _line_points.data(), GL_DYNAMIC_DRAW);
-    glBindVertexArray(_points_vao);
+    auto start = std::chrono::steady_clock::now();
+
+    if (stream_buffer_enabled) {
+        // Offsets are multiples of sizeof(Point) so they work as first vertex.
+        // The buffer can change between writes when it grows
+        size_t offset = _stream_buffer.write(_points.data(), sizeof(Point) * _points.size(), sizeof(Point));
+        _points_first = offset / sizeof(Point);
+        set_point_attributes(_points_vao, _stream_buffer.id());
+
+        offset = _stream_buffer.write(_line_points.data(), sizeof(Point) * _line_points.size(), sizeof(Point));
+        _line_points_first = offset / sizeof(Point);
+        set_point_attributes(_lines_vao, _stream_buffer.id());
+    }
+    else {
+        glBindBuffer(GL_ARRAY_BUFFER, _lines_vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(Point) * _line_points.size(), _line_points.data(), GL_DYNAMIC_DRAW);
+        _line_points_first = 0;
+        set_point_attributes(_lines_vao, _lines_vbo);
+
+        glBindBuffer(GL_ARRAY_BUFFER, _points_vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(Point) * _points.size(), _points.data(), GL_DYNAMIC_DRAW);
+        _points_first = 0;
+        set_point_attributes(_points_vao, _points_vbo);
+    }
 
-    glBindBuffer(GL_ARRAY_BUFFER, _points_vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(Point) * _points.size(), _points.data(), GL_DYNAMIC_DRAW);
+    _dynamic_upload_ms = std::chrono::duration<float, std::milli>(
+        std::chrono::steady_clock::now() - start
+    ).count();
+}
+
+void Renderer::set_point_attributes(uint vao, uint buffer) {
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glVertexAttribPointer(0, 3, GL_FLOAT, false, sizeof(Point), (void*)0);
+    glVertexAttribPointer(1, 4, GL_FLOAT, false, sizeof(Point), (void*)offsetof(Point, color));
     glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 void Renderer::init_shaders() {
@@ -602,6 +1199,40 @@ void Renderer::init_shaders() {
         fs::shader_path("light_textured_mesh.vert"),
         fs::shader_path("light_textured_mesh.frag")
     );
+    shaders.basic_mesh_instanced.set_defines({"INSTANCED"});
+    shaders.basic_mesh_instanced.load(
+        fs::shader_path("basic_mesh.vert"),
+        fs::shader_path("basic_mesh.frag")
+    );
+    shaders.light_mesh_instanced.set_defines({"INSTANCED"});
+    shaders.light_mesh_instanced.load(
+        fs::shader_path("light_mesh.vert"),
+        fs::shader_path("light_mesh.frag")
+    );
+    shaders.basic_mesh_lod_fade.set_defines({"LOD_FADE"});
+    shaders.basic_mesh_lod_fade.set_fragment_includes({ fs::shader_path("lod_fade.glsl") });
+    shaders.basic_mesh_lod_fade.load(
+        fs::shader_path("basic_mesh.vert"),
+        fs::shader_path("basic_mesh.frag")
+    );
+    shaders.basic_textured_mesh_lod_fade.set_defines({"LOD_FADE"});
+    shaders.basic_textured_mesh_lod_fade.set_fragment_includes({ fs::shader_path("lod_fade.glsl") });
+    shaders.basic_textured_mesh_lod_fade.load(
+        fs::shader_path("basic_textured_mesh.vert"),
+        fs::shader_path("basic_textured_mesh.frag")
+    );
+    shaders.light_mesh_lod_fade.set_defines({"LOD_FADE"});
+    shaders.light_mesh_lod_fade.set_fragment_includes({ fs::shader_path("lod_fade.glsl") });
+    shaders.light_mesh_lod_fade.load(
+        fs::shader_path("light_mesh.vert"),
+        fs::shader_path("light_mesh.frag")
+    );
+    shaders.light_textured_mesh_lod_fade.set_defines({"LOD_FADE"});
+    shaders.light_textured_mesh_lod_fade.set_fragment_includes({ fs::shader_path("lod_fade.glsl") });
+    shaders.light_textured_mesh_lod_fade.load(
+        fs::shader_path("light_textured_mesh.vert"),
+        fs::shader_path("light_textured_mesh.frag")
+    );
     shaders.skybox.load(
         fs::shader_path("skybox.vert"),
         fs::shader_path("skybox.frag")
@@ -609,30 +1240,36 @@ void Renderer::init_shaders() {
     shaders.depth.load(fs::shader_path("depth.vert"), fs::shader_path("depth.frag"));
 }
 
-void Renderer::send_light_data(Shader& shader) {
-    Scene& scene = engine::get_scene();
-    shader.use();
-
-    shader.set_uint("n_point_lights_used", scene.point_lights_used());
-    shader.set_uint("n_spot_lights_used", scene.spot_lights_used());
-    shader.set_uint("n_dir_lights_used", scene.dir_lights_used());
-    shader.set_vec3("view_pos", main_camera->transform.position);
-
-    for (size_t i = 0; i < scene.point_lights_used(); i++) {
-        auto& light = scene.point_lights[i];
-        std::string name = "point_lights[" + std::to_string(i) + "]";
-        light->send_to_shader(name, shader);
+Renderer::ShaderUniforms::ShaderUniforms(const Shader& shader)
+    : shader(&shader),
+      model(shader, "model"),
+      inverse_model(shader, "inverse_model"),
+      material_color(shader, "material.color"),
+      material_shininess(shader, "material.shininess"),
+      lod_fade(shader, "lod_fade") {}
+
+const Uniform& Renderer::ShaderUniforms::diffuse_texture(uint i) {
+    while (diffuse_textures.size() <= i) {
+        std::string index = std::to_string(diffuse_textures.size() + 1);
+        diffuse_textures.emplace_back(*shader, "material.texture_diffuse" + index);
     }
-    for (size_t i = 0; i < scene.spot_lights_used(); i++) {
-        auto& light = scene.spot_lights[i];
-        std::string name = "spot_lights[" + std::to_string(i) + "]";
-        light->send_to_shader(name, shader);
+    return diffuse_textures[i];
+}
+
+const Uniform& Renderer::ShaderUniforms::specular_texture(uint i) {
+    while (specular_textures.size() <= i) {
+        std::string index = std::to_string(specular_textures.size() + 1);
+        specular_textures.emplace_back(*shader, "material.texture_specular" + index);
     }
-    for (size_t i = 0; i < scene.dir_lights_used(); i++) {
-        auto& light = scene.directional_lights[i];
-        std::string name = "dir_lights[" + std::to_string(i) + "]";
-        light->send_to_shader(name, shader);
+    return specular_textures[i];
+}
+
+Renderer::ShaderUniforms& Renderer::shader_uniforms(const Shader& shader) {
+    auto it = _shader_uniforms.find(&shader);
+    if (it == _shader_uniforms.end()) {
+        it = _shader_uniforms.emplace(&shader, ShaderUniforms(shader)).first;
     }
+    return it->second;
 }
 
 void Renderer::generate_circle_vertices() {
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <unordered_map>
 #include <vector>
 
 #include <glm/glm.hpp>
@@ -7,10 +8,17 @@
 #include "camera.hpp"
 #include "common.hpp"
 #include "game_object.hpp"
+#include "gpu_timer.hpp"
+#include "light.hpp"
+#include "light_clusters.hpp"
 #include "model.hpp"
+#include "occlusion_buffer.hpp"
 #include "point.hpp"
+#include "render_queue.hpp"
 #include "scene.hpp"
 #include "shader.hpp"
+#include "stream_buffer.hpp"
+#include "transform_batch.hpp"
 
 enum class DrawMode {
     FILL,
@@ -31,6 +39,33 @@ public:
     bool stencil_test_enabled = false;
     bool wireframe_enabled = false;
     bool draw_as_hud = false;
+    // Batches queued objects that only differ in transform and color
+    // into a single instanced draw
+    bool instancing_enabled = true;
+    // Off goes back to reallocating the debug line and point buffers
+    // every frame, for comparing against the stream buffer
+    bool stream_buffer_enabled = true;
+    // Builds transforms, queue items, sort keys and instance data on jobs,
+    // the main thread only makes the gl calls
+    bool parallel_enabled = true;
+    // Set by the engine, null runs everything on the calling thread
+    ThreadPool* jobs = nullptr;
+    // Draws game objects with the coarsest lod whose error covers at most
+    // lod_error_pixels on screen
+    bool lod_enabled = true;
+    float lod_error_pixels = 1.0f;
+    // Dithers between two lods for the last lod_fade_band of the error
+    // before a switch, instead of popping
+    bool lod_cross_fade = true;
+    float lod_fade_band = 0.25f;
+    // Skips game objects whose bounds are outside the camera's frustum
+    bool frustum_culling_enabled = true;
+    // Draws the occluder boxes of the max_occluders biggest objects on screen
+    // that cover roughly occluder_min_pixels or more into an OcclusionBuffer
+    // and skips objects hidden behind them. Off with wireframe
+    bool occlusion_culling_enabled = false;
+    float occluder_min_pixels = 4096.0f;
+    int max_occluders = 32;
 
     struct Shaders {
         Shaders() = default;
@@ -41,6 +76,14 @@ public:
         Shader basic_textured_mesh;
         Shader light_mesh;
         Shader light_textured_mesh;
+        // Same sources as above built with INSTANCED, used for batches
+        Shader basic_mesh_instanced;
+        Shader light_mesh_instanced;
+        // Built with LOD_FADE, for objects between two lods
+        Shader basic_mesh_lod_fade;
+        Shader basic_textured_mesh_lod_fade;
+        Shader light_mesh_lod_fade;
+        Shader light_textured_mesh_lod_fade;
 
         Shader skybox;
         Shader depth;
@@ -82,8 +125,55 @@ public:
     uint cube_vao();
     uint sphere_vao();
     const DrawCommand& sphere_mesh_draw_command();
+    const AABB& sphere_mesh_bounds();
+
+    // Binds shader's Matrices and Lights uniform blocks to the renderer's
+    // buffers, and its light samplers if it has a Lights block. Has to be
+    // called again after the shader is reloaded, add_shader and
+    // reload_shaders take care of that
+    void bind_uniform_blocks(Shader& shader);
+    // Writes the scene lights into the Lights uniform block and bins them
+    // into clusters. Called once a frame by the engine before the user update
+    void upload_lights();
+    const LightClusters::Stats& light_stats() const { return _light_clusters.stats(); }
+    struct LodStats {
+        // Game objects drawn at each lod
+        uint objects[max_mesh_lods] = {};
+        // Objects drawn twice because they're between two lods
+        uint fading = 0;
+        size_t triangles = 0;
+    };
+    const LodStats& lod_stats() const { return _lod_stats; }
+    struct CullStats {
+        // Game objects that weren't hidden
+        uint tested = 0;
+        uint frustum_culled = 0;
+        uint occlusion_culled = 0;
+        uint drawn = 0;
+        uint occluders = 0;
+    };
+    const CullStats& cull_stats() const { return _cull_stats; }
+    // Gpu time of the last frame's game object pass, where the lit shaders run
+    float game_objects_gpu_ms() const { return _game_objects_timer.elapsed_ms(); }
+
+    // Game objects and light gizmos go through the queue
+    RenderQueue& render_queue() { return _render_queue; }
+
+    struct FrameBuildTiming {
+        uint threads = 0;
+        size_t game_objects = 0;
+        // Queueing, sorting and batching, averaged over the iterations
+        double ms = 0;
+    };
+    // Times building the current scene's queue with 1, 2, 4... threads up
+    // to the hardware thread count. Doesn't draw anything
+    std::vector<FrameBuildTiming> benchmark_frame_building(uint iterations = 20);
 
-    void send_light_data(Shader& shader);
+    // Points, lines and instance data share the stream buffer
+    const StreamBuffer& stream_buffer() const { return _stream_buffer; }
+    // Cpu time spent uploading the debug points and lines last frame
+    float dynamic_upload_ms() const { return _dynamic_upload_ms; }
+    float debug_draw_gpu_ms() const { return _debug_draw_timer.elapsed_ms(); }
 
 private:
     // NOTE: Everything here gets copied
@@ -94,6 +184,91 @@ private:
 
     std::vector<Shader*> _user_shaders;
 
+    // Uniforms set every frame, created the first time a shader is
+    // used so their names only get built once. Handles survive reloads
+    struct ShaderUniforms {
+        const Shader* shader;
+
+        Uniform model;
+        Uniform inverse_model;
+        Uniform material_color;
+        Uniform material_shininess;
+        Uniform lod_fade;
+
+        ShaderUniforms(const Shader& shader);
+
+        // Grow as more textures are used
+        const Uniform& diffuse_texture(uint i);
+        const Uniform& specular_texture(uint i);
+
+    private:
+        std::vector<Uniform> diffuse_textures;
+        std::vector<Uniform> specular_textures;
+    };
+    std::unordered_map<const Shader*, ShaderUniforms> _shader_uniforms;
+
+    ShaderUniforms& shader_uniforms(const Shader& shader);
+
+    // Reused every frame by queue_game_objects
+    std::vector<uint> _object_first_items;
+    std::vector<glm::mat4> _object_models;
+    std::vector<glm::mat3> _object_normal_matrices;
+
+    struct ObjectLod {
+        uint lod = 0;
+        // Above 0 while fading in from lod - 1, see RenderQueue::Item
+        float fade = 0;
+        uint triangles = 0;
+    };
+    std::vector<ObjectLod> _object_lods;
+    LodStats _lod_stats;
+
+    enum ObjectCull : u8 {
+        VISIBLE,
+        HIDDEN,
+        OUTSIDE_FRUSTUM,
+        OCCLUDED,
+    };
+    std::vector<u8> _object_cull;
+    // Rough screen area of objects with an occluder box, 0 for the rest
+    std::vector<float> _object_occluder_pixels;
+    std::vector<uint> _occluder_candidates;
+    OcclusionBuffer _occlusion;
+    CullStats _cull_stats;
+
+    RenderQueue _render_queue;
+
+    // Per instance attributes of the instanced shader variants,
+    // locations 3 to 10
+    struct InstanceData {
+        glm::mat4 model;
+        glm::mat3 inverse_model;
+        glm::vec3 color;
+    };
+
+    // A run of sorted queue items drawn with one draw call
+    struct DrawBatch {
+        uint begin;
+        uint count;
+        // Index of the first instance in _instance_data, -1 when the
+        // items are drawn one at a time
+        int first_instance = -1;
+    };
+    std::vector<DrawBatch> _draw_batches;
+    std::vector<InstanceData> _instance_data;
+    // Sorted index of every instance in _instance_data
+    std::vector<uint> _instanced_items;
+    // Where _instance_data was written to in the stream buffer this frame
+    uint _instance_buffer = 0;
+    size_t _instance_offset = 0;
+
+    StreamBuffer _stream_buffer;
+    // First vertex of this frame's points and lines in their buffer
+    uint _points_first = 0;
+    uint _line_points_first = 0;
+    float _dynamic_upload_ms = 0;
+    GpuTimer _debug_draw_timer;
+
     uint _points_vao;
     uint _points_vbo;
 
@@ -114,7 +289,39 @@ private:
     uint _square_pyramids_vbo;
     uint _square_pyramids_ebo;
 
+    static constexpr DrawCommand _square_pyramid_draw_command = {
+        DrawCommandType::DRAW_ELEMENTS,
+        DrawCommandMode::TRIANGLES,
+        18
+    };
+
+    static constexpr uint _matrices_binding = 0;
+    static constexpr uint _lights_binding = 1;
+
     uint _matrices_ubo;
+    uint _lights_ubo;
+
+    // std140 layout of the Lights uniform block
+    struct LightBlock {
+        uint n_point_lights_used;
+        uint n_spot_lights_used;
+        uint n_dir_lights_used;
+        uint padding0;
+        glm::vec3 view_pos;
+        float padding1;
+        std::array<DirLight::GpuData, MAX_DIR_LIGHTS> dir_lights;
+        glm::uvec3 cluster_grid_size;
+        float cluster_z_scale;
+        glm::vec2 cluster_tile_scale;
+        float cluster_z_bias;
+        float camera_near;
+        float camera_far;
+        // Blocks are rounded up to a multiple of 16 bytes
+        float padding2[3];
+    };
+    LightBlock _light_block;
+    LightClusters _light_clusters;
+    GpuTimer _game_objects_timer;
 
     static constexpr std::array<float, 32> _rect_vertices = {
         // positions              // normals           // texture coords
@@ -210,13 +417,47 @@ private:
     void init_vaos();
     void init_ubos();
     void update_vbos();
+    // Position and color attributes of the point and line vaos
+    void set_point_attributes(uint vao, uint buffer);
 
     void init_shaders();
 
     void render_points();
     void render_lines();
-    void render_game_objects();
-    void render_lights();
+    // jobs if parallel_enabled, otherwise null
+    ThreadPool* frame_jobs();
+    // fn over [0, count) in batches on frame_jobs, or in one go on this thread
+    void parallel_for(size_t count, size_t batch_size, const std::function<void(size_t, size_t)>& fn);
+    void queue_game_objects();
+    // pixels_per_unit is how many pixels something a unit long covers a
+    // unit away from the camera
+    ObjectLod select_lod(
+        const ObjectStore& objects,
+        size_t index,
+        bool enabled,
+        bool fade,
+        glm::vec3 camera_position,
+        float pixels_per_unit
+    ) const;
+    void queue_lights();
+    // Submits the sorted queue, only changing state between items that differ
+    void render_queue_items();
+    // Splits the sorted queue into batches and fills _instance_data
+    void build_draw_batches(const std::vector<std::pair<uint64_t, uint>>& sorted);
+    // nullptr if the shader has no instanced variant
+    Shader* instanced_variant(const Shader& shader);
+    // nullptr if the shader has no dithering variant
+    Shader* lod_fade_variant(const Shader& shader);
+    bool can_instance(const RenderQueue::Item& item);
+    bool same_instance_batch(const RenderQueue::Item& a, const RenderQueue::Item& b);
+    // Points the instance attributes of the bound vao at the instance
+    // buffer, starting at first_instance. Disabled again after the draw
+    // since the vaos are shared with the non instanced shaders
+    void enable_instance_attributes(uint first_instance);
+    void disable_instance_attributes();
+    // Issues the draw call, assumes the vao is bound
+    void draw(const DrawCommand& command);
+    void draw_instanced(const DrawCommand& command, uint instance_count);
     // NOTE: this function changes glDepthFunc every frame if a skybox
     // is set should probably just go back to the previous
     // depth function instead
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include "debug.hpp"
 #include "scene.hpp"
 #include "engine.hpp"
@@ -10,6 +11,7 @@ Scene::~Scene() {
 GameObject& Scene::create_game_object(Transform transform, Material material) {
     auto obj = game_objects.emplace_back(new GameObject(transform, material));
     obj->set_id(generate_id());
+    register_game_object(obj);
     return *obj;
 }
 
@@ -23,6 +25,7 @@ void Scene::add_game_object(GameObject* game_object) {
 
     game_object->set_id(generate_id());
     game_objects.emplace_back(game_object);
+    register_game_object(game_object);
 }
 void Scene::add_primitive(Cube* cube) {
     ASSERT(cube != nullptr, "passing in cube as a nullptr");
@@ -33,8 +36,11 @@ void Scene::add_primitive(Cube* cube) {
 
     /*ASSERT(cube->mesh_count() > 0, "Rect with ID: %u has no meshes", cube->get_id());*/
     cube->meshes.front().set_vao(engine::get_renderer().cube_vao());
+    cube->meshes.front().set_bounds(AABB(glm::vec3(-0.5f), glm::vec3(0.5f)));
+    cube->meshes.front().occluder = cube->meshes.front().bounds;
     cube->set_id(generate_id());
     game_objects.emplace_back(cube);
+    register_game_object(cube);
 }
 void Scene::add_primitive(Rect* rect) {
     ASSERT(rect != nullptr, "passing in rect as a nullptr");
@@ -44,8 +50,11 @@ void Scene::add_primitive(Rect* rect) {
     }
 
     rect->meshes.front().set_vao(engine::get_renderer().rect_vao());
+    // Flat on z = 0 before the transform
+    rect->meshes.front().set_bounds(AABB(glm::vec3(-0.5f, -0.5f, 0), glm::vec3(0.5f, 0.5f, 0)));
     rect->set_id(generate_id());
     game_objects.emplace_back(rect);
+    register_game_object(rect);
 }
 void Scene::add_primitive(Circle* circle) {
     ASSERT(circle != nullptr, "passing in circle as a nullptr");
@@ -56,8 +65,10 @@ void Scene::add_primitive(Circle* circle) {
     }
 
     circle->meshes.back().set_vao(engine::get_renderer().circle_vao());
+    circle->meshes.back().set_bounds(AABB(glm::vec3(-0.5f, -0.5f, 0), glm::vec3(0.5f, 0.5f, 0)));
     circle->set_id(generate_id());
     game_objects.emplace_back(circle);
+    register_game_object(circle);
 }
 void Scene::add_primitive(Sphere* sphere) {
     ASSERT(sphere != nullptr, "passing in sphere as a nullptr");
@@ -69,22 +80,27 @@ void Scene::add_primitive(Sphere* sphere) {
 
     sphere->meshes.back().set_vao(engine::get_renderer().sphere_vao());
     sphere->meshes.back().draw_command = engine::get_renderer().sphere_mesh_draw_command();
+    sphere->meshes.back().set_bounds(engine::get_renderer().sphere_mesh_bounds());
     sphere->set_id(generate_id());
     game_objects.emplace_back(sphere);
+    register_game_object(sphere);
 }
 
 PointLight& Scene::create_point_light() {
-    point_lights[_n_point_lights] = new PointLight();
-    return *point_lights[_n_point_lights++];
+    auto light = new PointLight();
+    add_point_light(light);
+    return *light;
 }
 
 SpotLight& Scene::create_spot_light() {
-    spot_lights[_n_spot_lights] = new SpotLight();
-    return *spot_lights[_n_spot_lights++];
+    auto light = new SpotLight();
+    add_spot_light(light);
+    return *light;
 }
 DirLight& Scene::create_dir_light() {
-    directional_lights[_n_dir_lights] = new DirLight();
-    return *directional_lights[_n_dir_lights++];
+    auto light = new DirLight();
+    add_directional_light(light);
+    return *light;
 }
 
 GameObject* Scene::delete_game_object(GameObject* gobj) {
@@ -95,6 +111,8 @@ GameObject* Scene::delete_game_object(GameObject* gobj) {
     int index = get_game_object_index(gobj->get_id());
     ASSERT(index != -1, "Game object with id %u does not exist in the current scene", gobj->get_id());
 
+    objects.destroy(gobj->get_handle());
+    _slot_game_objects[gobj->get_handle().index] = nullptr;
     delete game_objects[index];
     game_objects.erase(game_objects.begin() + index);
     return nullptr;
@@ -102,40 +120,108 @@ GameObject* Scene::delete_game_object(GameObject* gobj) {
 
 void Scene::add_point_light(PointLight* point_light) {
     ASSERT(point_light != nullptr, "passing in point_light as a nullptr");
-    point_lights[_n_point_lights] = point_light;
-    _n_point_lights++;
+    ASSERT(point_lights.size() < MAX_POINT_LIGHTS, "Can't add more than %d point lights", MAX_POINT_LIGHTS);
+    point_lights.push_back(point_light);
 }
 void Scene::add_spot_light(SpotLight* spot_light) {
     ASSERT(spot_light != nullptr, "passing in spot_light as a nullptr");
-    spot_lights[_n_spot_lights] = spot_light;
-    _n_spot_lights++;
+    ASSERT(spot_lights.size() < MAX_SPOT_LIGHTS, "Can't add more than %d spot lights", MAX_SPOT_LIGHTS);
+    spot_lights.push_back(spot_light);
 }
 void Scene::add_directional_light(DirLight* dir_light) {
     ASSERT(dir_light != nullptr, "passing in dir_light as a nullptr");
-    directional_lights[_n_dir_lights] = dir_light;
-    _n_dir_lights++;
+    ASSERT(directional_lights.size() < MAX_DIR_LIGHTS, "Can't add more than %d directional lights", MAX_DIR_LIGHTS);
+    directional_lights.push_back(dir_light);
+}
+
+void Scene::delete_point_light(PointLight* point_light) {
+    auto it = std::find(point_lights.begin(), point_lights.end(), point_light);
+    ASSERT(it != point_lights.end(), "Point light is not in the current scene");
+    delete *it;
+    point_lights.erase(it);
+}
+
+void Scene::delete_spot_light(SpotLight* spot_light) {
+    auto it = std::find(spot_lights.begin(), spot_lights.end(), spot_light);
+    ASSERT(it != spot_lights.end(), "Spot light is not in the current scene");
+    delete *it;
+    spot_lights.erase(it);
 }
 
 size_t Scene::point_lights_used() const {
-    return _n_point_lights;
+    return point_lights.size();
 }
 size_t Scene::spot_lights_used() const {
-    return _n_spot_lights;
+    return spot_lights.size();
 }
 size_t Scene::dir_lights_used() const {
-    return _n_dir_lights;
+    return directional_lights.size();
 }
 
 bool Scene::has_lights() const {
-    return _n_point_lights > 0
-        || _n_spot_lights > 0
-        || _n_dir_lights > 0;
+    return !point_lights.empty()
+        || !spot_lights.empty()
+        || !directional_lights.empty();
 }
 
 void Scene::clear_game_objects() {
     for (size_t i = 0; i < game_objects.size(); i++) {
+        objects.destroy(game_objects[i]->get_handle());
         delete game_objects[i];
     }
+    game_objects.clear();
+    _slot_game_objects.clear();
+}
+
+void Scene::sync_game_objects(ThreadPool* pool) {
+    auto sync = [this](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            GameObject& obj = *game_objects[i];
+            uint index = objects.index(obj.get_handle());
+            // Only objects that changed get their bounds redone
+            bool changed = obj.take_meshes_changed();
+            if (objects.transforms.get(index) != obj.transform) {
+                objects.transforms.set(index, obj.transform);
+                changed = true;
+            }
+            if (objects.hidden[index] != obj.hidden) {
+                objects.hidden[index] = obj.hidden;
+                changed = true;
+            }
+            if (changed) {
+                objects.mark_moved(index);
+            }
+        }
+    };
+    if (pool) {
+        pool->parallel_for(game_objects.size(), 1024, sync);
+    }
+    else {
+        sync(0, game_objects.size());
+    }
+    objects.update_bounds(pool);
+}
+
+GameObject* Scene::find_game_object(ObjectHandle handle) const {
+    if (!objects.alive(handle) || handle.index >= _slot_game_objects.size()) {
+        return nullptr;
+    }
+    return _slot_game_objects[handle.index];
+}
+
+void Scene::register_game_object(GameObject* game_object) {
+    // Meshes and material stay in the game object, the store just points
+    // at them
+    game_object->set_handle(objects.create(
+        game_object->transform,
+        &game_object->meshes,
+        &game_object->material
+    ));
+    uint slot = game_object->get_handle().index;
+    if (slot >= _slot_game_objects.size()) {
+        _slot_game_objects.resize(slot + 1, nullptr);
+    }
+    _slot_game_objects[slot] = game_object;
 }
 
 void Scene::clear_lights() {
@@ -148,6 +234,9 @@ void Scene::clear_lights() {
     for (size_t i  = 0; i < directional_lights.size(); i++) {
         delete directional_lights[i];
     }
+    point_lights.clear();
+    spot_lights.clear();
+    directional_lights.clear();
 }
 
 uint Scene::generate_id() {
@@ -172,5 +261,21 @@ void Scene::set_skybox(const std::array<std::string, 6>& skybox_textures) {
     }
     _skybox.face_textures = skybox_textures;
     _skybox.load();
+    _skybox_asset = AssetHandle<Skybox>();
+}
+
+void Scene::set_skybox(AssetHandle<Skybox> skybox) {
+    _skybox_asset = skybox;
+}
+
+Skybox& Scene::get_skybox() {
+    if (_skybox_asset.ready()) {
+        return _skybox_asset.get();
+    }
+    return _skybox;
+}
+
+bool Scene::has_skybox() const {
+    return _skybox_asset.ready() || _skybox.loaded();
 }
 
@@ -1,16 +1,22 @@
 #pragma once
 
 #include <vector>
+#include "asset_loader.hpp"
 #include "common.hpp"
 #include "game_object.hpp"
 #include "material.hpp"
+#include "object_store.hpp"
 #include "skybox.hpp"
+#include "thread_pool.hpp"
 #include "transform.hpp"
 #include "light.hpp"
 
-// NOTE: remember to update shaders as well when you do anything to this
-#define MAX_POINT_LIGHTS 4
-#define MAX_SPOT_LIGHTS  4
+// NOTE: remember to update shaders as well when you do anything to this.
+// Point and spot lights go through texture buffers (see LightClusters)
+// which GL guarantees at least 65536 texels. Directional lights are in
+// the Lights uniform block
+#define MAX_POINT_LIGHTS 4096
+#define MAX_SPOT_LIGHTS  1024
 #define MAX_DIR_LIGHTS   4
 
 class Scene {
@@ -19,9 +25,13 @@ public:
 
     // TODO: make this private
     std::vector<GameObject*> game_objects;
-    std::array<PointLight*, MAX_POINT_LIGHTS> point_lights;
-    std::array<SpotLight*, MAX_SPOT_LIGHTS> spot_lights;
-    std::array<DirLight*, MAX_DIR_LIGHTS> directional_lights;
+    // What the renderer draws. Game objects are mirrored in here and synced
+    // every frame, anything with a lot of objects should create them here
+    // directly instead
+    ObjectStore objects;
+    std::vector<PointLight*> point_lights;
+    std::vector<SpotLight*> spot_lights;
+    std::vector<DirLight*> directional_lights;
 
     // NOTE: make sure whenever you call add_x that whatever thats being added 
     // is heap allocated
@@ -53,28 +63,41 @@ public:
     void add_point_light(PointLight* point_light);
     void add_spot_light(SpotLight* spot_light);
     void add_directional_light(DirLight* dir_light);
+    // NOTE: these free the light, same as delete_game_object
+    void delete_point_light(PointLight* point_light);
+    void delete_spot_light(SpotLight* spot_light);
     size_t point_lights_used() const;
     size_t spot_lights_used() const;
     size_t dir_lights_used() const;
     bool has_lights() const;
 
     void set_skybox(const std::array<std::string, 6>& skybox_textures);
-    Skybox& get_skybox() { return _skybox; };
-    bool has_skybox() const { return _skybox.loaded(); }
+    // Shows up once it has loaded, the previous skybox is kept until then
+    void set_skybox(AssetHandle<Skybox> skybox);
+    Skybox& get_skybox();
+    bool has_skybox() const;
 
     void clear_game_objects();
     void clear_lights();
+    // Copies the transform and hidden flag of every game object into
+    // objects, then updates the bounds and bvh of the objects that moved,
+    // were hidden or shown, or had their meshes changed. Called by the
+    // renderer before it reads the store
+    void sync_game_objects(ThreadPool* pool = nullptr);
+    // The game object mirrored at handle, for turning the results of the
+    // objects queries back into game objects. nullptr for objects that were
+    // created in the store directly
+    GameObject* find_game_object(ObjectHandle handle) const;
 
 private:
-    // How lights are in use
-    size_t _n_point_lights = 0;
-    size_t _n_spot_lights = 0;
-    size_t _n_dir_lights = 0;
-
     Skybox _skybox;
+    AssetHandle<Skybox> _skybox_asset;
+    // Indexed by store slot
+    std::vector<GameObject*> _slot_game_objects;
 
     // NOTE: super simple rn. just increments a counter and returns the result
     uint generate_id();
+    void register_game_object(GameObject* game_object);
     // returns -1 if no index is found
     int get_game_object_index(int obj_id);
 };
@@ -42,6 +42,21 @@ bool Shader::check_shader_compilation_success(int shader) {
 bool Shader::load_shader_from_path(const char* path, int flag) {
     int shader = glCreateShader(flag);
     std::string source = get_file_contents(path);
+    std::string header;
+    for (const auto& define : _defines) {
+        header += "#define " + define + "\n";
+    }
+    if (flag == GL_FRAGMENT_SHADER) {
+        for (const auto& include : _fragment_includes) {
+            header += get_file_contents(include.c_str()) + "\n";
+        }
+    }
+    if (!header.empty()) {
+        // #version has to stay the first line
+        size_t line_end = source.find('\n');
+        size_t insert_at = line_end == std::string::npos ? source.size() : line_end + 1;
+        source.insert(insert_at, header);
+    }
     const char* csrc = source.c_str();
     glShaderSource(shader, 1, &csrc, NULL);
     glCompileShader(shader);
@@ -56,8 +71,21 @@ bool Shader::load_shader_from_path(const char* path, int flag) {
 void Shader::load_shaders() {
     ASSERT(load_shader_from_path(_vertex_path.c_str(), GL_VERTEX_SHADER), 
            "Bad vertex shader load at path: %s\n%s\n", _vertex_path.c_str(), _error);
-    ASSERT(load_shader_from_path(_fragment_path.c_str(), GL_FRAGMENT_SHADER), 
-           "Bad fragment shader load at path: %s\n%s\n", _fragment_path.c_str(), _error);
+    if (!_geometry_path.empty()) {
+        ASSERT(load_shader_from_path(_geometry_path.c_str(), GL_GEOMETRY_SHADER),
+               "Bad geometry shader load at path: %s\n%s\n", _geometry_path.c_str(), _error);
+    }
+    if (!_fragment_path.empty()) {
+        ASSERT(load_shader_from_path(_fragment_path.c_str(), GL_FRAGMENT_SHADER), 
+               "Bad fragment shader load at path: %s\n%s\n", _fragment_path.c_str(), _error);
+    }
+    if (!_transform_feedback_varyings.empty()) {
+        std::vector<const char*> varyings;
+        for (const auto& varying : _transform_feedback_varyings) {
+            varyings.push_back(varying.c_str());
+        }
+        glTransformFeedbackVaryings(ID, varyings.size(), varyings.data(), GL_INTERLEAVED_ATTRIBS);
+    }
     glLinkProgram(ID);
     int success = 0;
     glGetProgramiv(ID, GL_LINK_STATUS, &success);
@@ -67,19 +95,108 @@ void Shader::load_shaders() {
         ERROR("Shader linking error: %s", _error);
     }
     /*ASSERT(success, "Bad shader program link\n");*/
-           
+
+    reflect_uniforms();
     _shader_loaded = true;
 }
 
+void Shader::reflect_uniforms() {
+    _uniform_locations.clear();
+    _generation = _next_generation++;
+
+    int count = 0;
+    int max_length = 0;
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+    std::vector<char> buffer(max_length);
+
+    for (int i = 0; i < count; i++) {
+        int length = 0;
+        int size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(ID, i, max_length, &length, &size, &type, buffer.data());
+        std::string name(buffer.data(), length);
+
+        int location = glGetUniformLocation(ID, name.c_str());
+        // Uniform block members don't have a location
+        if (location == -1) {
+            continue;
+        }
+        _uniform_locations[name] = location;
+
+        // Arrays are reported as "name[0]"
+        if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0) {
+            std::string base = name.substr(0, name.size() - 3);
+            _uniform_locations[base] = location;
+            for (int element = 1; element < size; element++) {
+                std::string element_name = base + "[" + std::to_string(element) + "]";
+                _uniform_locations[element_name] = glGetUniformLocation(ID, element_name.c_str());
+            }
+        }
+    }
+}
+
+void Shader::reset_frame_stats() {
+    last_frame_stats = frame_stats;
+    frame_stats = UniformStats();
+}
+
+int Shader::uniform_location(const std::string& name) const {
+    frame_stats.lookups++;
+    auto it = _uniform_locations.find(name);
+    return it == _uniform_locations.end() ? -1 : it->second;
+}
+
+int Shader::location(const std::string& name) const {
+    frame_stats.sets++;
+    return uniform_location(name);
+}
+
+int Shader::location(const Uniform& uniform) const {
+    ASSERT(uniform.shader() == this,
+           "Uniform %s belongs to a different shader, path: %s\n",
+           uniform.name().c_str(), _vertex_path.c_str());
+    frame_stats.sets++;
+    return uniform.location();
+}
+
 void Shader::load(const std::string& vertex_path, const std::string& fragment_path) {
+    load(vertex_path, "", fragment_path);
+}
+
+void Shader::load(const std::string& vertex_path,
+                  const std::string& geometry_path,
+                  const std::string& fragment_path) {
     if (_shader_loaded) {
         LOG("WARNING: Shader already loaded: %s, %s\n", _vertex_path.c_str(), _fragment_path.c_str());
     }
     _vertex_path = vertex_path;
+    _geometry_path = geometry_path;
     _fragment_path = fragment_path;
     load_shaders();
 }
 
+void Shader::set_transform_feedback_varyings(const std::vector<std::string>& varyings) {
+    ASSERT(!_shader_loaded,
+           "Transform feedback varyings have to be set before loading, path: %s\n",
+           _vertex_path.c_str());
+    _transform_feedback_varyings = varyings;
+}
+
+void Shader::set_defines(const std::vector<std::string>& defines) {
+    ASSERT(!_shader_loaded,
+           "Defines have to be set before loading, path: %s\n",
+           _vertex_path.c_str());
+    _defines = defines;
+}
+
+void Shader::set_fragment_includes(const std::vector<std::string>& paths) {
+    ASSERT(!_shader_loaded,
+           "Fragment includes have to be set before loading, path: %s\n",
+           _vertex_path.c_str());
+    _fragment_includes = paths;
+}
+
 void Shader::reload() {
     ASSERT(_shader_loaded,
            "Shader has to be loaded before it can be reloaded, path: %s, %s\n",
@@ -121,50 +238,107 @@ std::string Shader::get_file_contents(const char* path) {
 }
 
 void Shader::set_bool(const std::string& name, bool value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value ? 1 : 0);
+    glUniform1i(location(name), (int)value ? 1 : 0);
 }
 
 void Shader::set_int(const std::string& name, int value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1i(location(name), value);
 }
 
 void Shader::set_uint(const std::string& name, uint value) const {
-    glUniform1ui(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1ui(location(name), value);
 }
 
 void Shader::set_float(const std::string& name, float value) const {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1f(location(name), value);
 }
 
 void Shader::set_vec3(const std::string& name, const glm::vec3& value) const {
-    glUniform3f(glGetUniformLocation(ID, name.c_str()), value.x, value.y, value.z);
+    glUniform3f(location(name), value.x, value.y, value.z);
 }
 
 void Shader::set_vec3(const std::string& name, float x, float y, float z) const {
-    glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+    glUniform3f(location(name), x, y, z);
 }
 
 void Shader::set_vec3(const std::string& name, const ImVec4& value) const {
-    glUniform3f(glGetUniformLocation(ID, name.c_str()), value.x, value.y, value.z);
+    glUniform3f(location(name), value.x, value.y, value.z);
 }
 
 void Shader::set_vec4(const std::string& name, const glm::vec4& value) const {
-    glUniform4f(glGetUniformLocation(ID, name.c_str()), value.x, value.y, value.z, value.w);
+    glUniform4f(location(name), value.x, value.y, value.z, value.w);
 }
 
 void Shader::set_mat3(const std::string& name, const glm::mat3& value) const {
-    glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(value));
+    glUniformMatrix3fv(location(name), 1, GL_FALSE, glm::value_ptr(value));
 }
 
 void Shader::set_mat4(const std::string& name, const glm::mat4& value) const {
     // glm::value_ptr gets glsl compatible values
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(value));
+    glUniformMatrix4fv(location(name), 1, GL_FALSE, glm::value_ptr(value));
 }
 
 void Shader::set_vec2(const std::string& name, const glm::vec2& value) const {
-    glUniform2f(glGetUniformLocation(ID, name.c_str()), value.x, value.y);
+    glUniform2f(location(name), value.x, value.y);
 }
 void Shader::set_vec2(const std::string& name, float x, float y) const {
-    glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+    glUniform2f(location(name), x, y);
+}
+
+
+void Shader::set_bool(const Uniform& uniform, bool value) const {
+    glUniform1i(location(uniform), value ? 1 : 0);
+}
+
+void Shader::set_int(const Uniform& uniform, int value) const {
+    glUniform1i(location(uniform), value);
+}
+
+void Shader::set_uint(const Uniform& uniform, uint value) const {
+    glUniform1ui(location(uniform), value);
+}
+
+void Shader::set_float(const Uniform& uniform, float value) const {
+    glUniform1f(location(uniform), value);
+}
+
+void Shader::set_vec2(const Uniform& uniform, const glm::vec2& value) const {
+    glUniform2f(location(uniform), value.x, value.y);
+}
+
+void Shader::set_vec3(const Uniform& uniform, const glm::vec3& value) const {
+    glUniform3f(location(uniform), value.x, value.y, value.z);
+}
+
+void Shader::set_vec3(const Uniform& uniform, float x, float y, float z) const {
+    glUniform3f(location(uniform), x, y, z);
+}
+
+void Shader::set_vec4(const Uniform& uniform, const glm::vec4& value) const {
+    glUniform4f(location(uniform), value.x, value.y, value.z, value.w);
+}
+
+void Shader::set_vec4_array(const Uniform& uniform, const glm::vec4* values, uint count) const {
+    glUniform4fv(location(uniform), count, glm::value_ptr(values[0]));
 }
 
+void Shader::set_mat3(const Uniform& uniform, const glm::mat3& value) const {
+    glUniformMatrix3fv(location(uniform), 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void Shader::set_mat4(const Uniform& uniform, const glm::mat4& value) const {
+    glUniformMatrix4fv(location(uniform), 1, GL_FALSE, glm::value_ptr(value));
+}
+
+Uniform::Uniform(const Shader& shader, const std::string& name)
+    : _shader(&shader),
+      _name(name) {}
+
+int Uniform::location() const {
+    ASSERT(_shader, "Uniform %s used without a shader", _name.c_str());
+    if (_generation != _shader->generation()) {
+        _location = _shader->uniform_location(_name);
+        _generation = _shader->generation();
+    }
+    return _location;
+}
@@ -2,10 +2,22 @@
 
 #include "imgui.h"
 #include <string>
+#include <unordered_map>
+#include <vector>
 #include <glm/glm.hpp>
 
 using uint = unsigned int;
 
+class Uniform;
+
+// Counts how uniforms get set
+struct UniformStats {
+    // Names resolved to locations through the hash table
+    uint lookups = 0;
+    // All set_* calls, whether through a name or a Uniform
+    uint sets = 0;
+};
+
 // Shader program
 class Shader {
 public:
@@ -23,6 +35,21 @@ public:
     // to be used when shader was initialized using the default constructor
     // returns an error otherwise
     void load(const std::string& vertex_path, const std::string& fragment_path);
+    // geometry_path or fragment_path can be empty to skip that stage
+    void load(const std::string& vertex_path,
+              const std::string& geometry_path,
+              const std::string& fragment_path);
+
+    // Has to be called before the shader is loaded. varyings get captured
+    // interleaved, use "gl_NextBuffer" to move on to the next buffer binding
+    void set_transform_feedback_varyings(const std::vector<std::string>& varyings);
+    // Has to be called before the shader is loaded. Every stage gets a
+    // "#define name" for each of these right after its #version line
+    void set_defines(const std::vector<std::string>& defines);
+    // Has to be called before the shader is loaded. The contents of these
+    // files go into the fragment stage after the defines, for code shared
+    // between shaders
+    void set_fragment_includes(const std::vector<std::string>& paths);
 
     // used for hotloading - shader has to be previously loaded for this to work
     void reload();
@@ -30,6 +57,17 @@ public:
     // Activate the shader
     void use();
 
+    // Reset every frame by the engine
+    static inline UniformStats frame_stats;
+    static inline UniformStats last_frame_stats;
+    static void reset_frame_stats();
+
+    // -1 if the uniform isn't active, which set_* ignores like glUniform does.
+    // Prefer keeping a Uniform around over calling this every frame
+    int uniform_location(const std::string& name) const;
+    // Changes every time the program is linked
+    uint generation() const { return _generation; }
+
     // Functions for setting uniforms
     void set_bool(const std::string& name, bool value) const;
     void set_int(const std::string& name, int value) const;
@@ -44,18 +82,67 @@ public:
     void set_mat3(const std::string& name, const glm::mat3& value) const;
     void set_mat4(const std::string& name, const glm::mat4& value) const;
 
+    // Same as above without looking up the name
+    void set_bool(const Uniform& uniform, bool value) const;
+    void set_int(const Uniform& uniform, int value) const;
+    void set_uint(const Uniform& uniform, uint value) const;
+    void set_float(const Uniform& uniform, float value) const;
+    void set_vec2(const Uniform& uniform, const glm::vec2& value) const;
+    void set_vec3(const Uniform& uniform, const glm::vec3& value) const;
+    void set_vec3(const Uniform& uniform, float x, float y, float z) const;
+    void set_vec4(const Uniform& uniform, const glm::vec4& value) const;
+    void set_vec4_array(const Uniform& uniform, const glm::vec4* values, uint count) const;
+    void set_mat3(const Uniform& uniform, const glm::mat3& value) const;
+    void set_mat4(const Uniform& uniform, const glm::mat4& value) const;
+
     const std::string get_error() const;
 
 private:
     std::string _vertex_path;
+    std::string _geometry_path;
     std::string _fragment_path;
+    std::vector<std::string> _transform_feedback_varyings;
+    std::vector<std::string> _defines;
+    std::vector<std::string> _fragment_includes;
     bool _shader_loaded = false;
 
+    // Every active uniform, filled in after linking. Arrays are stored
+    // under their plain name and under every element's name
+    std::unordered_map<std::string, int> _uniform_locations;
+    uint _generation = 0;
+    static inline uint _next_generation = 1;
+
     char _error[512];
 
+    void reflect_uniforms();
+    // Both count the set, the Uniform one also checks
+    // that uniform belongs to this shader
+    int location(const std::string& name) const;
+    int location(const Uniform& uniform) const;
+
     bool check_shader_compilation_success(int shader);
     bool load_shader_from_path(const char* path, int flag);
     void load_shaders();
     std::string get_file_contents(const char* path);
 };
 
+
+// A uniform's location in a single shader. Caches the location so setting it
+// doesn't go through a string, and looks it up again after the shader has been
+// reloaded. Meant to be created once and kept around.
+class Uniform {
+public:
+    Uniform() = default;
+    Uniform(const Shader& shader, const std::string& name);
+
+    int location() const;
+    const Shader* shader() const { return _shader; }
+    const std::string& name() const { return _name; }
+
+private:
+    const Shader* _shader = nullptr;
+    std::string _name;
+    mutable int _location = -1;
+    // 0 never matches a linked shader so the first location() resolves
+    mutable uint _generation = 0;
+};
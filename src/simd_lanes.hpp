@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include "types.hpp"
+
+#if defined(__AVX2__) && defined(__FMA__)
+#define SIMD_LANES_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#define SIMD_LANES_SSE2
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define SIMD_LANES_NEON
+#include <arm_neon.h>
+#endif
+
+// Each lane type wraps one instruction set so kernels can be written once
+// as templates over it. SimdLanes is the widest one the compiler was told it
+// can use: AVX2 needs -mavx2 -mfma, otherwise SSE2 is used on x86 and NEON on
+// arm. ScalarLanes does one float at a time, it handles the leftovers at
+// the end of an array and is SimdLanes when there's nothing wider
+
+struct ScalarLanes {
+    using V = float;
+    static constexpr size_t width = 1;
+    static constexpr const char* name = "scalar";
+
+    static V load(const float* p) { return *p; }
+    static V set(float x) { return x; }
+    static V add(V a, V b) { return a + b; }
+    static V sub(V a, V b) { return a - b; }
+    static V mul(V a, V b) { return a * b; }
+    static V div(V a, V b) { return a / b; }
+    static V max(V a, V b) { return a > b ? a : b; }
+    static V min(V a, V b) { return a < b ? a : b; }
+    static V abs(V a) { return std::abs(a); }
+    // a * b + c
+    static V mul_add(V a, V b, V c) { return a * b + c; }
+    static void store(V v, float* p) { *p = v; }
+    // p[0], p[stride], p[stride * 2]...
+    static V load_strided(const float* p, size_t) { return *p; }
+    // Bit i is the sign bit of lane i
+    static uint sign_mask(V v) { return std::signbit(v) ? 1 : 0; }
+    // Writes (x[i], y[i], z[i], w[i]) to dst + i * stride
+    static void store_vec4(V x, V y, V z, V w, float* dst, size_t) {
+        dst[0] = x;
+        dst[1] = y;
+        dst[2] = z;
+        dst[3] = w;
+    }
+};
+
+#ifdef SIMD_LANES_SSE2
+struct SSE2Lanes {
+    using V = __m128;
+    static constexpr size_t width = 4;
+    static constexpr const char* name = "sse2";
+
+    static V load(const float* p) { return _mm_loadu_ps(p); }
+    static V set(float x) { return _mm_set1_ps(x); }
+    static V add(V a, V b) { return _mm_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+    static V div(V a, V b) { return _mm_div_ps(a, b); }
+    static V max(V a, V b) { return _mm_max_ps(a, b); }
+    static V min(V a, V b) { return _mm_min_ps(a, b); }
+    static V abs(V a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+    static V mul_add(V a, V b, V c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static void store(V v, float* p) { _mm_storeu_ps(p, v); }
+    static V load_strided(const float* p, size_t stride) {
+        return _mm_setr_ps(p[0], p[stride], p[stride * 2], p[stride * 3]);
+    }
+    static uint sign_mask(V v) { return _mm_movemask_ps(v); }
+    static void store_vec4(V x, V y, V z, V w, float* dst, size_t stride) {
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        _mm_storeu_ps(dst, x);
+        _mm_storeu_ps(dst + stride, y);
+        _mm_storeu_ps(dst + stride * 2, z);
+        _mm_storeu_ps(dst + stride * 3, w);
+    }
+};
+using SimdLanes = SSE2Lanes;
+#endif
+
+#ifdef SIMD_LANES_AVX2
+struct AVX2Lanes {
+    using V = __m256;
+    static constexpr size_t width = 8;
+    static constexpr const char* name = "avx2";
+
+    static V load(const float* p) { return _mm256_loadu_ps(p); }
+    static V set(float x) { return _mm256_set1_ps(x); }
+    static V add(V a, V b) { return _mm256_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+    static V div(V a, V b) { return _mm256_div_ps(a, b); }
+    static V max(V a, V b) { return _mm256_max_ps(a, b); }
+    static V min(V a, V b) { return _mm256_min_ps(a, b); }
+    static V abs(V a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+    static V mul_add(V a, V b, V c) { return _mm256_fmadd_ps(a, b, c); }
+    static void store(V v, float* p) { _mm256_storeu_ps(p, v); }
+    static V load_strided(const float* p, size_t stride) {
+        return _mm256_setr_ps(
+            p[0], p[stride], p[stride * 2], p[stride * 3],
+            p[stride * 4], p[stride * 5], p[stride * 6], p[stride * 7]
+        );
+    }
+    static uint sign_mask(V v) { return _mm256_movemask_ps(v); }
+    static void store_vec4(V x, V y, V z, V w, float* dst, size_t stride) {
+        // 4x4 transpose within each 128 bit half
+        V xy_lo = _mm256_unpacklo_ps(x, y);
+        V xy_hi = _mm256_unpackhi_ps(x, y);
+        V zw_lo = _mm256_unpacklo_ps(z, w);
+        V zw_hi = _mm256_unpackhi_ps(z, w);
+        V v0 = _mm256_shuffle_ps(xy_lo, zw_lo, _MM_SHUFFLE(1, 0, 1, 0));
+        V v1 = _mm256_shuffle_ps(xy_lo, zw_lo, _MM_SHUFFLE(3, 2, 3, 2));
+        V v2 = _mm256_shuffle_ps(xy_hi, zw_hi, _MM_SHUFFLE(1, 0, 1, 0));
+        V v3 = _mm256_shuffle_ps(xy_hi, zw_hi, _MM_SHUFFLE(3, 2, 3, 2));
+        // lanes 0-3 are in the low halves, 4-7 in the high ones
+        _mm_storeu_ps(dst, _mm256_castps256_ps128(v0));
+        _mm_storeu_ps(dst + stride, _mm256_castps256_ps128(v1));
+        _mm_storeu_ps(dst + stride * 2, _mm256_castps256_ps128(v2));
+        _mm_storeu_ps(dst + stride * 3, _mm256_castps256_ps128(v3));
+        _mm_storeu_ps(dst + stride * 4, _mm256_extractf128_ps(v0, 1));
+        _mm_storeu_ps(dst + stride * 5, _mm256_extractf128_ps(v1, 1));
+        _mm_storeu_ps(dst + stride * 6, _mm256_extractf128_ps(v2, 1));
+        _mm_storeu_ps(dst + stride * 7, _mm256_extractf128_ps(v3, 1));
+    }
+};
+using SimdLanes = AVX2Lanes;
+#endif
+
+#ifdef SIMD_LANES_NEON
+struct NEONLanes {
+    using V = float32x4_t;
+    static constexpr size_t width = 4;
+    static constexpr const char* name = "neon";
+
+    static V load(const float* p) { return vld1q_f32(p); }
+    static V set(float x) { return vdupq_n_f32(x); }
+    static V add(V a, V b) { return vaddq_f32(a, b); }
+    static V sub(V a, V b) { return vsubq_f32(a, b); }
+    static V mul(V a, V b) { return vmulq_f32(a, b); }
+    static V div(V a, V b) { return vdivq_f32(a, b); }
+    static V max(V a, V b) { return vmaxq_f32(a, b); }
+    static V min(V a, V b) { return vminq_f32(a, b); }
+    static V abs(V a) { return vabsq_f32(a); }
+    static V mul_add(V a, V b, V c) { return vfmaq_f32(c, a, b); }
+    static void store(V v, float* p) { vst1q_f32(p, v); }
+    static V load_strided(const float* p, size_t stride) {
+        const float lanes[4] = { p[0], p[stride], p[stride * 2], p[stride * 3] };
+        return vld1q_f32(lanes);
+    }
+    static uint sign_mask(V v) {
+        const int32x4_t shift = { 0, 1, 2, 3 };
+        uint32x4_t signs = vshrq_n_u32(vreinterpretq_u32_f32(v), 31);
+        return vaddvq_u32(vshlq_u32(signs, shift));
+    }
+    static void store_vec4(V x, V y, V z, V w, float* dst, size_t stride) {
+        float32x4x2_t xz = vzipq_f32(x, z);
+        float32x4x2_t yw = vzipq_f32(y, w);
+        float32x4x2_t lo = vzipq_f32(xz.val[0], yw.val[0]);
+        float32x4x2_t hi = vzipq_f32(xz.val[1], yw.val[1]);
+        vst1q_f32(dst, lo.val[0]);
+        vst1q_f32(dst + stride, lo.val[1]);
+        vst1q_f32(dst + stride * 2, hi.val[0]);
+        vst1q_f32(dst + stride * 3, hi.val[1]);
+    }
+};
+using SimdLanes = NEONLanes;
+#endif
+
+#if !defined(SIMD_LANES_SSE2) && !defined(SIMD_LANES_AVX2) && !defined(SIMD_LANES_NEON)
+using SimdLanes = ScalarLanes;
+#endif
@@ -1,10 +1,39 @@
 #include <glad/glad.h>
-#include <stb_image.h>
 #include "skybox.hpp"
 #include "debug.hpp"
 #include "common.hpp"
 
 void Skybox::load() {
+    Faces faces;
+    bool decoded = decode(face_textures, faces);
+    ASSERT(decoded, "bad skybox read");
+    (void) decoded;
+    load(faces);
+}
+
+bool Skybox::decode(const std::array<std::string, 6>& paths, Faces& faces) {
+    uint compressed_faces = 0;
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (!Texture2D::decode(paths[i], faces[i], false)) {
+            LOG("bad file read: %s", paths[i].c_str());
+            return false;
+        }
+        compressed_faces += faces[i].compressed.valid();
+    }
+    // A cube map's faces have to share a format, so either all of them
+    // are compressed or none are
+    if (compressed_faces > 0 && compressed_faces < faces.size()) {
+        for (size_t i = 0; i < paths.size(); i++) {
+            if (faces[i].compressed.valid() && !Texture2D::decode(paths[i], faces[i], false, false)) {
+                LOG("bad file read: %s", paths[i].c_str());
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void Skybox::load(const Faces& faces) {
     if (_loaded) {
         LOG("skybox already loaded");
         return;
@@ -12,15 +41,14 @@ void Skybox::load() {
     glGenTextures(1, &_texture_id);
     glBindTexture(GL_TEXTURE_CUBE_MAP, _texture_id);
 
-    int width, height, nr_channels;
-    u8* data;
-    stbi_set_flip_vertically_on_load(false);
-    for (size_t i = 0; i < face_textures.size(); i++) {
-        data = stbi_load(face_textures[i].c_str(), &width, &height, &nr_channels, 0);
-        ASSERT(data, "bad file read: %s", face_textures[i].c_str());
+    for (size_t i = 0; i < faces.size(); i++) {
         // + i makes it go through all the faces
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width,
-                     height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+        if (faces[i].compressed.valid()) {
+            Texture2D::upload_compressed(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, faces[i].compressed);
+            continue;
+        }
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, faces[i].width,
+                     faces[i].height, 0, GL_RGB, GL_UNSIGNED_BYTE, faces[i].pixels);
     }
 
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
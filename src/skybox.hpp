@@ -2,11 +2,14 @@
 
 #include <string>
 #include <array>
+#include "texture2d.hpp"
 
 using uint = unsigned int;
 
 class Skybox {
 public:
+    using Faces = std::array<Texture2D::Image, 6>;
+
     Skybox() {}
     ~Skybox() {
         if (_loaded) {
@@ -24,6 +27,10 @@ public:
     */
     std::array<std::string, 6> face_textures;
     void load();
+    // Uploads faces decoded with Skybox::decode
+    void load(const Faces& faces);
+    // Decodes the face textures without touching gl, so it can run on any thread
+    static bool decode(const std::array<std::string, 6>& paths, Faces& faces);
     bool loaded() const { return _loaded; }
 
     uint get_texture_id() { return _texture_id; }
@@ -0,0 +1,162 @@
+#include <chrono>
+#include <cstring>
+#include <glad/glad.h>
+#include "stream_buffer.hpp"
+#include "debug.hpp"
+
+StreamBuffer::~StreamBuffer() {
+    destroy();
+    glDeleteBuffers(_retired.size(), _retired.data());
+}
+
+void StreamBuffer::init(size_t frame_size) {
+    ASSERT(_buffer == 0, "StreamBuffer already initialized");
+    create(frame_size);
+    LOG(
+        "Stream buffer: %zu KB per frame, %s",
+        frame_size / 1024,
+        persistent() ? "persistent mapping" : "unsynchronized mapping"
+    );
+}
+
+void StreamBuffer::create(size_t frame_size) {
+    _frame_size = frame_size;
+    size_t size = frame_size * frame_count;
+
+    glGenBuffers(1, &_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, _buffer);
+    // GLAD_GL_VERSION_4_4 is only set if the context supports it
+    if (GLAD_GL_VERSION_4_4) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, size, nullptr, flags);
+        _mapped = (char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+        ASSERT(_mapped != nullptr, "Failed to persistently map the stream buffer");
+    }
+    else {
+        glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    _region = 0;
+    _cursor = 0;
+}
+
+void StreamBuffer::unmap() {
+    if (_mapped) {
+        glBindBuffer(GL_ARRAY_BUFFER, _buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        _mapped = nullptr;
+    }
+}
+
+void StreamBuffer::destroy() {
+    for (void*& fence : _fences) {
+        if (fence) {
+            glDeleteSync(static_cast<GLsync>(fence));
+            fence = nullptr;
+        }
+    }
+    unmap();
+    if (_buffer) {
+        glDeleteBuffers(1, &_buffer);
+        _buffer = 0;
+    }
+}
+
+void StreamBuffer::begin_frame() {
+    ASSERT(_buffer != 0, "StreamBuffer used before init");
+    _frame_stats = Stats();
+    _frame_stats.grows = _stats.grows;
+
+    _region = (_region + 1) % frame_count;
+    _cursor = 0;
+    wait(_region);
+}
+
+void StreamBuffer::end_frame() {
+    ASSERT(_fences[_region] == nullptr, "Stream buffer region fenced twice");
+    _fences[_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    // Draws that read from them have been issued, so the driver can free
+    // them once they're done
+    glDeleteBuffers(_retired.size(), _retired.data());
+    _retired.clear();
+
+    _stats = _frame_stats;
+}
+
+void StreamBuffer::wait(uint region) {
+    if (!_fences[region]) {
+        return;
+    }
+    GLsync fence = static_cast<GLsync>(_fences[region]);
+    GLenum result = glClientWaitSync(fence, 0, 0);
+    if (result == GL_TIMEOUT_EXPIRED) {
+        auto start = std::chrono::steady_clock::now();
+        // 1 ms at a time, the flush only has to happen once
+        GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        do {
+            result = glClientWaitSync(fence, flags, 1000000);
+            flags = 0;
+        } while (result == GL_TIMEOUT_EXPIRED);
+        _frame_stats.fence_waits++;
+        _frame_stats.wait_ms += std::chrono::duration<float, std::milli>(
+            std::chrono::steady_clock::now() - start
+        ).count();
+    }
+    if (result == GL_WAIT_FAILED) {
+        LOG("WARNING: waiting on a stream buffer fence failed");
+    }
+    glDeleteSync(fence);
+    _fences[region] = nullptr;
+}
+
+size_t StreamBuffer::write(const void* data, size_t size, size_t alignment) {
+    ASSERT(_buffer != 0, "StreamBuffer used before init");
+    ASSERT(alignment > 0, "Stream buffer alignment has to be at least 1");
+
+    size_t region_start = _region * _frame_size;
+    // Nothing to copy and data may be null. The offset is never read
+    if (size == 0) {
+        return region_start + _cursor;
+    }
+    // Alignment isn't always a power of 2 since it can be a vertex size
+    size_t offset = (region_start + _cursor + alignment - 1) / alignment * alignment;
+    if (offset + size > region_start + _frame_size) {
+        // Earlier writes this frame stay in the old buffer, which is kept
+        // alive until the end of the frame
+        size_t frame_size = _frame_size;
+        while (frame_size < size + alignment) {
+            frame_size *= 2;
+        }
+        frame_size *= 2;
+        unmap();
+        _retired.push_back(_buffer);
+        _buffer = 0;
+        destroy();
+        create(frame_size);
+        _frame_stats.grows++;
+        LOG("Stream buffer grown to %zu KB per frame", frame_size / 1024);
+
+        region_start = 0;
+        offset = 0;
+    }
+
+    if (_mapped) {
+        std::memcpy(_mapped + offset, data, size);
+    }
+    else {
+        glBindBuffer(GL_ARRAY_BUFFER, _buffer);
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+        void* mapped = glMapBufferRange(GL_ARRAY_BUFFER, offset, size, flags);
+        ASSERT(mapped != nullptr, "Failed to map %zu bytes of the stream buffer", size);
+        std::memcpy(mapped, data, size);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    _cursor = offset + size - region_start;
+    _frame_stats.bytes_written += size;
+    return offset;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <vector>
+#include "types.hpp"
+
+// Vertex data written by the cpu every frame. The buffer is split into
+// frame_count regions used round robin, and a fence is placed after each
+// frame's draws, so writing into a region only has to wait for the gpu to
+// finish with it three frames ago instead of on every upload.
+//
+// With GL 4.4 the buffer is persistently mapped once, otherwise every write
+// maps its own range unsynchronized since the fence already guarantees the
+// gpu is done with it.
+//
+// NOTE: the buffer gets recreated when a frame doesn't fit, so vao
+// attribute pointers into it have to be set again every frame
+class StreamBuffer {
+public:
+    static constexpr uint frame_count = 3;
+
+    struct Stats {
+        size_t bytes_written = 0;
+        // Times begin_frame had to wait on the gpu, and for how long
+        uint fence_waits = 0;
+        float wait_ms = 0;
+        uint grows = 0;
+    };
+
+    StreamBuffer() {}
+    ~StreamBuffer();
+
+    // frame_size is the starting capacity of a single frame
+    void init(size_t frame_size);
+
+    // Moves on to the next region, waiting for the gpu if it's still using it
+    void begin_frame();
+    // Fences the draws that used this frame's region
+    void end_frame();
+
+    // Copies the data into the current frame's region and returns its
+    // offset in the buffer. The offset is a multiple of alignment, so
+    // passing the vertex size lets draws use offset / size as their first
+    // vertex. Grows the buffer if the frame runs out of space. Writing 0
+    // bytes does nothing
+    size_t write(const void* data, size_t size, size_t alignment = 16);
+
+    uint id() const { return _buffer; }
+    bool persistent() const { return _mapped != nullptr; }
+    size_t frame_size() const { return _frame_size; }
+
+    const Stats& stats() const { return _stats; }
+
+private:
+    uint _buffer = 0;
+    size_t _frame_size = 0;
+    // Persistent mapping of the whole buffer, null if not supported
+    char* _mapped = nullptr;
+
+    uint _region = 0;
+    // Write position inside the current region
+    size_t _cursor = 0;
+    std::array<void*, frame_count> _fences = {};
+    // Replaced by a bigger buffer this frame, deleted at the end of it
+    std::vector<uint> _retired;
+
+    Stats _frame_stats;
+    Stats _stats;
+
+    void create(size_t frame_size);
+    void unmap();
+    void destroy();
+    void wait(uint region);
+};
@@ -2,15 +2,38 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
+#include <cstring>
+#include <filesystem>
 #include <glad/glad.h>
 #include <sstream>
 #include "texture2d.hpp"
 
+// From EXT_texture_compression_s3tc, which glad wasn't generated with
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+namespace {
+    // The container has to be made from the same version of the file
+    bool container_up_to_date(const std::string& path, const std::string& container_path) {
+        std::error_code error;
+        auto container_time = std::filesystem::last_write_time(container_path, error);
+        if (error) {
+            return false;
+        }
+        auto source_time = std::filesystem::last_write_time(path, error);
+        // Fine to ship only the container
+        return error || container_time >= source_time;
+    }
+}
+
 Texture2D::Texture2D(const std::string& path,
                     TextureType type,
                     bool default_texture_sampling)
     : _path(path), type(type) {
-    stbi_set_flip_vertically_on_load(true);
     load(default_texture_sampling);
 }
 
@@ -87,10 +110,32 @@ void Texture2D::load(u8* data, bool default_texture_sampling) {
 void Texture2D::load(bool default_texture_sampling) {
     if (_texture_loaded) return;
 
+    Image image;
+    bool decoded = decode(_path, image);
+    ASSERT(decoded, "Bad texture load at path: %s", _path.c_str());
+    (void) decoded;
+    load(_path, image, default_texture_sampling);
+}
+
+void Texture2D::load(const std::string& path, const Image& image, bool default_texture_sampling) {
+    if (_texture_loaded) return;
+
+    _path = path;
+    width = image.width;
+    height = image.height;
+    nr_channels = image.channels;
     glGenTextures(1, &ID);
 
-    _data = stbi_load(_path.c_str(), &width, &height, &nr_channels, 0);
-    ASSERT(_data != nullptr, "Bad texture load at path: %s", _path.c_str());
+    if (image.compressed.valid()) {
+        bind();
+        upload_compressed(GL_TEXTURE_2D, image.compressed);
+        if (default_texture_sampling) {
+            enable_default_texture_sampling();
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        _texture_loaded = true;
+        return;
+    }
 
     GLenum format;
     switch(nr_channels) {
@@ -105,17 +150,106 @@ void Texture2D::load(bool default_texture_sampling) {
     }
 
     bind();
-    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, _data);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, image.pixels);
     glGenerateMipmap(GL_TEXTURE_2D);
     if (default_texture_sampling) {
         enable_default_texture_sampling();
     }
 
     glBindTexture(GL_TEXTURE_2D, 0);
-    stbi_image_free(_data);
     _texture_loaded = true;
 }
 
+bool Texture2D::decode(const std::string& path, Image& image, bool flip_vertically, bool allow_compressed) {
+    image = Image();
+    if (allow_compressed && compression_supported && use_compressed_textures) {
+        std::string container_path = CompressedTexture::container_path(path);
+        if (container_up_to_date(path, container_path)
+            && image.compressed.read(container_path)
+            && image.compressed.flipped == flip_vertically) {
+            image.width = image.compressed.width;
+            image.height = image.compressed.height;
+            image.channels = image.compressed.format == CompressedFormat::BC1 ? 3 : 4;
+            return true;
+        }
+        image.compressed = CompressedTexture();
+    }
+
+    // The thread version so decoders on other threads don't flip each other
+    stbi_set_flip_vertically_on_load_thread(flip_vertically);
+    image.pixels = stbi_load(path.c_str(), &image.width, &image.height, &image.channels, 0);
+    return image.pixels != nullptr;
+}
+
+void Texture2D::detect_compression_support() {
+    GLint extension_count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extension_count);
+    for (GLint i = 0; i < extension_count; i++) {
+        const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if (std::strcmp(extension, "GL_EXT_texture_compression_s3tc") == 0) {
+            compression_supported = true;
+        }
+    }
+    LOG("S3TC compressed textures %s", compression_supported ? "supported" : "not supported");
+}
+
+void Texture2D::upload_compressed(uint target, const CompressedTexture& texture) {
+    GLenum format = texture.format == CompressedFormat::BC1
+        ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+        : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    for (uint level = 0; level < texture.levels.size(); level++) {
+        const CompressedTexture::Level& mip = texture.levels[level];
+        glCompressedTexImage2D(
+            target,
+            level,
+            format,
+            mip.width,
+            mip.height,
+            0,
+            mip.size,
+            texture.level_data(level)
+        );
+    }
+}
+
+size_t Texture2D::Image::gpu_bytes() const {
+    if (compressed.valid()) {
+        return compressed.size();
+    }
+    // The mip chain adds about a third, drivers may pad rgb to rgba
+    return (size_t)width * height * channels * 4 / 3;
+}
+
+Texture2D::Image::~Image() {
+    if (pixels) {
+        stbi_image_free(pixels);
+    }
+}
+
+Texture2D::Image::Image(Image&& other)
+    : width(other.width),
+      height(other.height),
+      channels(other.channels),
+      pixels(other.pixels),
+      compressed(std::move(other.compressed)) {
+    other.pixels = nullptr;
+}
+
+Texture2D::Image& Texture2D::Image::operator=(Image&& other) {
+    if (this != &other) {
+        if (pixels) {
+            stbi_image_free(pixels);
+        }
+        width = other.width;
+        height = other.height;
+        channels = other.channels;
+        pixels = other.pixels;
+        compressed = std::move(other.compressed);
+        other.pixels = nullptr;
+    }
+    return *this;
+}
+
 void Texture2D::unload() {
     if (_texture_loaded) {
         glDeleteTextures(1, &ID);
@@ -1,9 +1,7 @@
 #pragma once
 
 #include <string>
-
-using uint = unsigned int;
-using u8 = std::uint8_t;
+#include "compressed_texture.hpp"
 
 enum class TextureType {
     NONE,
@@ -13,6 +11,31 @@ enum class TextureType {
 
 class Texture2D {
 public:
+    // Pixels decoded by stb_image, freed with it. Holds the mip chain
+    // instead if a compressed version of the file was found
+    struct Image {
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        u8* pixels = nullptr;
+        CompressedTexture compressed;
+
+        // Estimated memory the texture takes on the gpu, mipmaps included
+        size_t gpu_bytes() const;
+
+        Image() {}
+        ~Image();
+        Image(Image&& other);
+        Image& operator=(Image&& other);
+        Image(const Image&) = delete;
+        Image& operator=(const Image&) = delete;
+    };
+
+    // Set by detect_compression_support
+    inline static bool compression_supported = false;
+    // Lets .btex files made by tools/texconv be used instead of the source
+    inline static bool use_compressed_textures = true;
+
     uint ID = 0;
     int width = 0;
     int height = 0;
@@ -33,12 +56,31 @@ public:
     Texture2D(TextureType type);
     // For Already loaded textured
 
-    // FIXME: THIS SHOULD NOT UNLOAD TEXTURES
-    ~Texture2D(); // automatically unloads texture
+    // Doesn't unload the texture, a Texture2D is only a view of it. Use
+    // TextureCache for textures that should be freed when unused
+    ~Texture2D();
 
     // Manually load the texture if you have your own data
     // Use the Texture2D(TextureType) constructor
     void load(u8* data, bool default_texture_sampling = true);
+    // Uploads an image decoded with Texture2D::decode
+    void load(const std::string& path, const Image& image, bool default_texture_sampling = true);
+
+    // Reads and decodes the file without touching gl, so it can run on
+    // any thread. Returns false if the file couldn't be loaded.
+    // Loads the file's .btex instead if compressed textures are enabled
+    // and it's at least as new as the file
+    static bool decode(
+        const std::string& path,
+        Image& image,
+        bool flip_vertically = true,
+        bool allow_compressed = true
+    );
+
+    // Needs a gl context
+    static void detect_compression_support();
+    // Uploads every mip level of texture to the bound texture's target
+    static void upload_compressed(uint target, const CompressedTexture& texture);
 
     const std::string& path();
     // manually unload a texture
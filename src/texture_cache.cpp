@@ -0,0 +1,138 @@
+#include <filesystem>
+#include <glad/glad.h>
+#include "texture_cache.hpp"
+#include "debug.hpp"
+
+struct TextureHandle::Entry {
+    uint id = 0;
+    std::string path;
+    int width = 0;
+    int height = 0;
+    size_t bytes = 0;
+
+    ~Entry() {
+        glDeleteTextures(1, &id);
+    }
+};
+
+uint TextureHandle::id() const {
+    ASSERT(valid(), "Texture handle doesn't refer to a texture");
+    return _entry->id;
+}
+
+const std::string& TextureHandle::path() const {
+    ASSERT(valid(), "Texture handle doesn't refer to a texture");
+    return _entry->path;
+}
+
+int TextureHandle::width() const {
+    ASSERT(valid(), "Texture handle doesn't refer to a texture");
+    return _entry->width;
+}
+
+int TextureHandle::height() const {
+    ASSERT(valid(), "Texture handle doesn't refer to a texture");
+    return _entry->height;
+}
+
+size_t TextureHandle::bytes() const {
+    ASSERT(valid(), "Texture handle doesn't refer to a texture");
+    return _entry->bytes;
+}
+
+Texture2D TextureHandle::texture(TextureType type) const {
+    return Texture2D(id(), type);
+}
+
+TextureHandle TextureCache::load(const std::string& path, bool default_texture_sampling) {
+    if (TextureHandle handle = find(path); handle.valid()) {
+        return handle;
+    }
+    Texture2D::Image image;
+    if (!Texture2D::decode(path, image)) {
+        LOG("WARNING: bad texture load at path: %s", path.c_str());
+        return TextureHandle();
+    }
+    return upload(path, image, default_texture_sampling);
+}
+
+TextureHandle TextureCache::upload(
+    const std::string& path,
+    const Texture2D::Image& image,
+    bool default_texture_sampling) {
+
+    std::string key = canonical_path(path);
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (TextureHandle handle = find_locked(key); handle.valid()) {
+        return handle;
+    }
+    _misses++;
+
+    Texture2D texture(TextureType::NONE);
+    texture.load(path, image, default_texture_sampling);
+
+    auto entry = std::make_shared<TextureHandle::Entry>();
+    entry->id = texture.ID;
+    entry->path = key;
+    entry->width = texture.width;
+    entry->height = texture.height;
+    entry->bytes = image.gpu_bytes();
+    _entries[key] = entry;
+
+    TextureHandle handle;
+    handle._entry = std::move(entry);
+    return handle;
+}
+
+TextureHandle TextureCache::find(const std::string& path) {
+    std::string key = canonical_path(path);
+    std::lock_guard<std::mutex> lock(_mutex);
+    return find_locked(key);
+}
+
+TextureHandle TextureCache::find_locked(const std::string& key) {
+    TextureHandle handle;
+    auto it = _entries.find(key);
+    if (it == _entries.end()) {
+        return handle;
+    }
+    handle._entry = it->second.lock();
+    if (handle.valid()) {
+        _hits++;
+    }
+    else {
+        // Every handle is gone so the texture has been deleted
+        _entries.erase(it);
+    }
+    return handle;
+}
+
+bool TextureCache::contains(const std::string& path) const {
+    std::string key = canonical_path(path);
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _entries.find(key);
+    return it != _entries.end() && !it->second.expired();
+}
+
+TextureCache::Stats TextureCache::stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    Stats stats;
+    stats.hits = _hits;
+    stats.misses = _misses;
+    for (const auto& [key, weak_entry] : _entries) {
+        if (auto entry = weak_entry.lock()) {
+            stats.textures++;
+            stats.resident_bytes += entry->bytes;
+        }
+    }
+    return stats;
+}
+
+std::string TextureCache::canonical_path(const std::string& path) {
+    std::error_code error;
+    std::filesystem::path canonical = std::filesystem::weakly_canonical(path, error);
+    if (error) {
+        return std::filesystem::path(path).lexically_normal().string();
+    }
+    return canonical.string();
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "texture2d.hpp"
+
+// Owns a gl texture shared through the TextureCache. Copies share the same
+// texture, and it's deleted as soon as the last handle goes away
+class TextureHandle {
+public:
+    TextureHandle() {}
+
+    bool valid() const { return _entry != nullptr; }
+    uint id() const;
+    const std::string& path() const;
+    int width() const;
+    int height() const;
+    // Estimated gpu memory, mipmaps included
+    size_t bytes() const;
+    // Number of handles sharing the texture
+    long use_count() const { return _entry.use_count(); }
+
+    // A Texture2D for materials. It doesn't own anything, so it's only
+    // valid while a handle to the texture is alive
+    Texture2D texture(TextureType type) const;
+
+private:
+    friend class TextureCache;
+    struct Entry;
+
+    std::shared_ptr<const Entry> _entry;
+};
+
+// Textures loaded from files, keyed by their canonical path so the same
+// file is only ever decoded and uploaded once. The cache itself only keeps
+// weak references, the handles it gives out own the textures.
+//
+// NOTE: only contains can be called from other threads. Handles have to be
+// released on the gl thread since the last one deletes the texture
+class TextureCache {
+public:
+    struct Stats {
+        uint textures = 0;
+        size_t resident_bytes = 0;
+        uint hits = 0;
+        uint misses = 0;
+    };
+
+    TextureCache() {}
+    TextureCache(const TextureCache&) = delete;
+    TextureCache& operator=(const TextureCache&) = delete;
+
+    // Decodes and uploads the texture unless it's already loaded. Returns
+    // an invalid handle if the file can't be loaded
+    TextureHandle load(const std::string& path, bool default_texture_sampling = true);
+    // Same as load for an image that's already decoded, like on a loader
+    // thread. The image is ignored if the texture is already loaded
+    TextureHandle upload(
+        const std::string& path,
+        const Texture2D::Image& image,
+        bool default_texture_sampling = true
+    );
+    // Invalid handle if it isn't loaded
+    TextureHandle find(const std::string& path);
+    bool contains(const std::string& path) const;
+
+    // Walks every texture, fine for a readout but not per draw
+    Stats stats() const;
+
+    // Absolute and normalized, so different spellings of a path share an entry
+    static std::string canonical_path(const std::string& path);
+
+private:
+    mutable std::mutex _mutex;
+    std::unordered_map<std::string, std::weak_ptr<const TextureHandle::Entry>> _entries;
+    uint _hits = 0;
+    uint _misses = 0;
+
+    // Expects the mutex to be locked
+    TextureHandle find_locked(const std::string& key);
+};
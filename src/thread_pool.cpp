@@ -0,0 +1,138 @@
+#include <atomic>
+#include "thread_pool.hpp"
+#include "debug.hpp"
+
+namespace {
+    // Which pool and queue the current thread works for, if any
+    thread_local const ThreadPool* current_pool = nullptr;
+    thread_local uint current_queue = 0;
+}
+
+ThreadPool::ThreadPool(uint thread_count) {
+    if (thread_count == 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    _queues.reserve(thread_count);
+    for (uint i = 0; i < thread_count; i++) {
+        _queues.push_back(std::make_unique<Queue>());
+    }
+    _threads.reserve(thread_count);
+    for (uint i = 0; i < thread_count; i++) {
+        _threads.emplace_back(&ThreadPool::worker, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _condition.notify_all();
+    for (auto& thread : _threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::parallel_for(size_t count, size_t batch_size, const std::function<void(size_t, size_t)>& fn) {
+    ASSERT(batch_size > 0, "batch_size can't be 0");
+    size_t batch_count = (count + batch_size - 1) / batch_size;
+    if (batch_count == 0) {
+        return;
+    }
+
+    // Shared with helper tasks that may only start running after this returns
+    struct Work {
+        std::atomic<size_t> next_batch{0};
+        std::atomic<size_t> done_batches{0};
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+    auto work = std::make_shared<Work>();
+
+    // Only valid while batches are left, which is while the caller is waiting
+    const std::function<void(size_t, size_t)>* body = &fn;
+    auto run_batches = [work, body, count, batch_size, batch_count]() {
+        size_t batch;
+        while ((batch = work->next_batch++) < batch_count) {
+            size_t begin = batch * batch_size;
+            (*body)(begin, std::min(begin + batch_size, count));
+            if (++work->done_batches == batch_count) {
+                std::lock_guard<std::mutex> lock(work->mutex);
+                work->done.notify_all();
+            }
+        }
+    };
+
+    size_t helpers = std::min<size_t>(_threads.size(), batch_count - 1);
+    for (size_t i = 0; i < helpers; i++) {
+        push(run_batches);
+    }
+    run_batches();
+
+    // NOTE: waits for the batches and not the helper tasks. Helpers that are
+    // still queued behind other work find nothing left to do, so this can't
+    // deadlock when every worker is itself inside a parallel_for
+    std::unique_lock<std::mutex> lock(work->mutex);
+    work->done.wait(lock, [&]() { return work->done_batches == batch_count; });
+}
+
+void ThreadPool::push(std::function<void()> task) {
+    uint index = current_pool == this
+        ? current_queue
+        : _next_queue++ % _queues.size();
+    // Counted before it's queued, pop can only take it afterwards so
+    // _pending never goes below zero
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_queues[index]->mutex);
+        _queues[index]->tasks.push_back(std::move(task));
+    }
+    _condition.notify_one();
+}
+
+bool ThreadPool::pop(uint index, std::function<void()>& task) {
+    // Newest task of our own first, its data is most likely still in cache
+    {
+        Queue& queue = *_queues[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            _pending--;
+            return true;
+        }
+    }
+    // Then the oldest from everyone else, which tend to be the biggest
+    for (size_t i = 1; i < _queues.size(); i++) {
+        Queue& queue = *_queues[(index + i) % _queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            _pending--;
+            _steals++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::worker(uint index) {
+    current_pool = this;
+    current_queue = index;
+    while (true) {
+        std::function<void()> task;
+        if (pop(index, task)) {
+            task();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(_mutex);
+        _condition.wait(lock, [this]() { return _stopping || _pending > 0; });
+        if (_stopping && _pending == 0) {
+            return;
+        }
+    }
+}
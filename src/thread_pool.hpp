@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "common.hpp"
+
+// Fixed set of worker threads with a task queue each. Tasks pushed from a
+// worker go on its own queue and it takes the newest one first, while idle
+// workers steal the oldest tasks off the others. Tasks pushed from outside
+// the pool are spread over the queues round robin
+class ThreadPool {
+public:
+    // 0 uses one thread per hardware thread
+    ThreadPool(uint thread_count = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    uint thread_count() const { return _threads.size(); }
+
+    template<typename F>
+    auto submit(F&& task) -> std::future<decltype(task())> {
+        using Result = decltype(task());
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+        std::future<Result> future = packaged->get_future();
+        push([packaged]() { (*packaged)(); });
+        return future;
+    }
+
+    // Calls fn(begin, end) over [0, count) in batches of batch_size and blocks
+    // until every batch is done. The calling thread works on batches too, so
+    // this is safe to call from inside a task running on the pool.
+    void parallel_for(size_t count, size_t batch_size, const std::function<void(size_t, size_t)>& fn);
+
+    // Tasks taken from another worker's queue since the pool was created
+    size_t steal_count() const { return _steals; }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::thread> _threads;
+    std::vector<std::unique_ptr<Queue>> _queues;
+    std::atomic<size_t> _next_queue{0};
+    std::atomic<size_t> _steals{0};
+
+    // Sleeping workers wait on this. _pending goes up under _mutex so a
+    // wakeup can't be missed, and comes down in pop under a queue's mutex.
+    // It can briefly count a task that isn't queued yet, never the reverse
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    std::atomic<size_t> _pending{0};
+    bool _stopping = false;
+
+    void push(std::function<void()> task);
+    bool pop(uint index, std::function<void()>& task);
+    void worker(uint index);
+};
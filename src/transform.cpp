@@ -25,6 +25,19 @@ glm::mat4 Transform::get_mat4() const {
     return mat;
 }
 
+Transform Transform::lerp(const Transform& from, const Transform& to, float t) {
+    auto mix = [t](float a, float b) { return a + (b - a) * t; };
+    return Transform(
+        glm::mix(from.position, to.position, t),
+        glm::mix(from.scale, to.scale, t),
+        Rotation(
+            mix(from.rotation.yaw, to.rotation.yaw),
+            mix(from.rotation.pitch, to.rotation.pitch),
+            mix(from.rotation.roll, to.rotation.roll)
+        )
+    );
+}
+
 bool operator==(const Rotation& r1, const Rotation& r2) {
     return (r1.yaw == r2.yaw)
         && (r1.pitch == r2.pitch)
@@ -26,6 +26,10 @@ public:
     // only factors in position and scale
     glm::mat4 get_mat4() const;
 
+    // Blends between two simulation states for rendering. Angles are
+    // blended as they are, so keep them unwrapped between the two
+    static Transform lerp(const Transform& from, const Transform& to, float t);
+
     friend bool operator==(const Transform& t1, const Transform& t2);
     friend bool operator!=(const Transform& t1, const Transform& t2);
 };
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include "transform_batch.hpp"
+#include "cpu_timer.hpp"
+#include "debug.hpp"
+#include "random.hpp"
+#include "transform_batch_kernel.hpp"
+#include "utils.hpp"
+
+void TransformSoA::clear() {
+    for (auto* component : {
+        &position_x, &position_y, &position_z,
+        &scale_x, &scale_y, &scale_z,
+        &yaw, &pitch, &roll }) {
+        component->clear();
+    }
+}
+
+void TransformSoA::reserve(size_t count) {
+    for (auto* component : {
+        &position_x, &position_y, &position_z,
+        &scale_x, &scale_y, &scale_z,
+        &yaw, &pitch, &roll }) {
+        component->reserve(count);
+    }
+}
+
+void TransformSoA::resize(size_t count) {
+    for (auto* component : {
+        &position_x, &position_y, &position_z,
+        &scale_x, &scale_y, &scale_z,
+        &yaw, &pitch, &roll }) {
+        component->resize(count);
+    }
+}
+
+void TransformSoA::set(size_t index, const Transform& transform) {
+    position_x[index] = transform.position.x;
+    position_y[index] = transform.position.y;
+    position_z[index] = transform.position.z;
+    scale_x[index] = transform.scale.x;
+    scale_y[index] = transform.scale.y;
+    scale_z[index] = transform.scale.z;
+    yaw[index] = transform.rotation.yaw;
+    pitch[index] = transform.rotation.pitch;
+    roll[index] = transform.rotation.roll;
+}
+
+Transform TransformSoA::get(size_t index) const {
+    return Transform(
+        glm::vec3(position_x[index], position_y[index], position_z[index]),
+        glm::vec3(scale_x[index], scale_y[index], scale_z[index]),
+        Rotation(yaw[index], pitch[index], roll[index])
+    );
+}
+
+void TransformSoA::pop_back() {
+    for (auto* component : {
+        &position_x, &position_y, &position_z,
+        &scale_x, &scale_y, &scale_z,
+        &yaw, &pitch, &roll }) {
+        component->pop_back();
+    }
+}
+
+void TransformSoA::push_back(const Transform& transform) {
+    position_x.push_back(transform.position.x);
+    position_y.push_back(transform.position.y);
+    position_z.push_back(transform.position.z);
+    scale_x.push_back(transform.scale.x);
+    scale_y.push_back(transform.scale.y);
+    scale_z.push_back(transform.scale.z);
+    yaw.push_back(transform.rotation.yaw);
+    pitch.push_back(transform.rotation.pitch);
+    roll.push_back(transform.rotation.roll);
+}
+
+// The AVX2 kernel if it was built and the cpu can run it, otherwise
+// nothing and SimdLanes does all the work
+static const transform_batch::KernelInfo& widest_kernel() {
+    static const transform_batch::KernelInfo none = { nullptr, nullptr };
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if (has_avx2 && transform_batch::avx2_kernel.build) {
+        return transform_batch::avx2_kernel;
+    }
+#endif
+    return none;
+}
+
+void transform_batch::build(
+    const TransformSoA& transforms,
+    glm::mat4* models,
+    glm::mat3* normal_matrices) {
+
+    build(transforms, 0, transforms.size(), models, normal_matrices);
+}
+
+void transform_batch::build(
+    const TransformSoA& transforms,
+    size_t begin,
+    size_t end,
+    glm::mat4* models,
+    glm::mat3* normal_matrices) {
+
+    const Columns columns = {
+        transforms.position_x.data(),
+        transforms.position_y.data(),
+        transforms.position_z.data(),
+        transforms.scale_x.data(),
+        transforms.scale_y.data(),
+        transforms.scale_z.data(),
+        transforms.yaw.data(),
+        transforms.pitch.data(),
+        transforms.roll.data()
+    };
+    float* model_floats = reinterpret_cast<float*>(models);
+    float* normal_floats = reinterpret_cast<float*>(normal_matrices);
+
+    size_t done = begin;
+    if (const Kernel kernel = widest_kernel().build) {
+        done = kernel(columns, done, end, model_floats, normal_floats);
+    }
+    // Leftovers that don't fill a whole register
+    done = build_range<SimdLanes>(columns, done, end, model_floats, normal_floats);
+    build_range<ScalarLanes>(columns, done, end, model_floats, normal_floats);
+}
+
+const char* transform_batch::kernel_name() {
+    const KernelInfo& kernel = widest_kernel();
+    return kernel.build ? kernel.name : SimdLanes::name;
+}
+
+transform_batch::BenchmarkResult transform_batch::benchmark(size_t count) {
+    std::vector<Transform> transforms(count);
+    TransformSoA soa;
+    soa.reserve(count);
+    CounterRng rng(42);
+    for (auto& transform : transforms) {
+        transform.position = glm::vec3(
+            rng.next_float(-100, 100),
+            rng.next_float(-100, 100),
+            rng.next_float(-100, 100)
+        );
+        transform.scale = glm::vec3(
+            rng.next_float(0.1f, 10),
+            rng.next_float(0.1f, 10),
+            rng.next_float(0.1f, 10)
+        );
+        transform.rotation = Rotation(
+            rng.next_float(-720, 720),
+            rng.next_float(-720, 720),
+            rng.next_float(-720, 720)
+        );
+        soa.push_back(transform);
+    }
+
+    BenchmarkResult result;
+    result.count = count;
+
+    // What Renderer::render_game_objects used to do per object
+    std::vector<glm::mat4> glm_models(count);
+    std::vector<glm::mat3> glm_normals(count);
+    CpuTimer timer;
+    for (size_t i = 0; i < count; i++) {
+        glm_models[i] = transforms[i].get_mat4();
+        glm_normals[i] = utils::inverse_model(glm_models[i]);
+    }
+    result.glm_ms = timer.elapsed_ms();
+
+    std::vector<glm::mat4> models(count);
+    std::vector<glm::mat3> normals(count);
+    timer.restart();
+    build(soa, models.data(), normals.data());
+    result.batch_ms = timer.elapsed_ms();
+
+    for (size_t i = 0; i < count; i++) {
+        for (uint col = 0; col < 4; col++) {
+            for (uint row = 0; row < 4; row++) {
+                float error = glm::abs(models[i][col][row] - glm_models[i][col][row]);
+                result.max_error = std::max(result.max_error, error);
+            }
+        }
+        for (uint col = 0; col < 3; col++) {
+            for (uint row = 0; row < 3; row++) {
+                float error = glm::abs(normals[i][col][row] - glm_normals[i][col][row]);
+                result.max_error = std::max(result.max_error, error);
+            }
+        }
+    }
+    LOG(
+        "%zu transforms: glm %.3f ms, %s %.3f ms, max error %g",
+        count,
+        result.glm_ms,
+        kernel_name(),
+        result.batch_ms,
+        result.max_error
+    );
+    return result;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "transform.hpp"
+
+// Transforms stored as one array per component so they can be
+// loaded straight into simd registers
+struct TransformSoA {
+    std::vector<float> position_x;
+    std::vector<float> position_y;
+    std::vector<float> position_z;
+    std::vector<float> scale_x;
+    std::vector<float> scale_y;
+    std::vector<float> scale_z;
+    // Degrees, same as Rotation
+    std::vector<float> yaw;
+    std::vector<float> pitch;
+    std::vector<float> roll;
+
+    size_t size() const { return position_x.size(); }
+    void clear();
+    void reserve(size_t count);
+    void resize(size_t count);
+    void push_back(const Transform& transform);
+    void pop_back();
+    // Doesn't touch any other index, so threads can fill separate ranges
+    void set(size_t index, const Transform& transform);
+    Transform get(size_t index) const;
+};
+
+// Builds model matrices for many transforms at once. Produces the same
+// matrices as Transform::get_mat4 (T * S * Ry * Rx * Rz) without going
+// through glm::rotate.
+//
+// NOTE: on x86 the AVX2 kernel is used when the cpu has AVX2 and FMA, it's
+// built separately with -mavx2 -mfma. Otherwise the kernel is picked at
+// compile time, SSE2 on x86 and NEON on arm. Anything else gets scalar code
+namespace transform_batch {
+
+// normal_matrices is optional and gets the inverse transpose of each
+// model's upper 3x3, the same as utils::inverse_model
+void build(
+    const TransformSoA& transforms,
+    glm::mat4* models,
+    glm::mat3* normal_matrices = nullptr
+);
+// Only builds [begin, end), models and normal_matrices are indexed the same
+// as transforms. Separate ranges can be built on separate threads
+void build(
+    const TransformSoA& transforms,
+    size_t begin,
+    size_t end,
+    glm::mat4* models,
+    glm::mat3* normal_matrices = nullptr
+);
+
+// Name of the kernel build uses
+const char* kernel_name();
+
+struct BenchmarkResult {
+    size_t count = 0;
+    double glm_ms = 0;
+    double batch_ms = 0;
+    // Largest difference of any matrix element from the glm path
+    float max_error = 0;
+};
+
+// Builds count random transforms with get_mat4 + inverse and with build
+BenchmarkResult benchmark(size_t count);
+
+}
@@ -0,0 +1,12 @@
+#include "transform_batch_kernel.hpp"
+
+// The Makefile builds this file with -mavx2 -mfma on x86, transform_batch
+// only calls into it on cpus that have both
+#ifdef SIMD_LANES_AVX2
+const transform_batch::KernelInfo transform_batch::avx2_kernel = {
+    build_range<AVX2Lanes>,
+    AVX2Lanes::name
+};
+#else
+const transform_batch::KernelInfo transform_batch::avx2_kernel = { nullptr, nullptr };
+#endif
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstddef>
+#include "simd_lanes.hpp"
+
+// The transform_batch kernels, only for transform_batch.cpp and
+// transform_batch_avx2.cpp. The second one is built with -mavx2 -mfma, so
+// nothing in here may use inline functions that the rest of the program
+// also uses. The linker could keep the AVX2 copy for everyone. That's why
+// the kernels take raw pointers instead of TransformSoA and glm types
+namespace transform_batch {
+
+// TransformSoA's arrays
+struct Columns {
+    const float* position_x;
+    const float* position_y;
+    const float* position_z;
+    const float* scale_x;
+    const float* scale_y;
+    const float* scale_z;
+    const float* yaw;
+    const float* pitch;
+    const float* roll;
+};
+
+// Builds [begin, end) in whole registers and returns where it stopped.
+// models are 16 floats each and normal_matrices 9, both indexed like the
+// transforms. normal_matrices can be null
+using Kernel = size_t (*)(
+    const Columns& transforms,
+    size_t begin,
+    size_t end,
+    float* models,
+    float* normal_matrices
+);
+
+struct KernelInfo {
+    Kernel build;
+    const char* name;
+};
+// Defined in transform_batch_avx2.cpp, build is null if it wasn't compiled
+// with AVX2 and FMA
+extern const KernelInfo avx2_kernel;
+
+}
+
+namespace {
+
+// Round to nearest for |x| < 2^22 using only adds
+template<typename L>
+typename L::V round(typename L::V x) {
+    const auto magic = L::set(12582912.0f); // 1.5 * 2^23
+    return L::sub(L::add(x, magic), magic);
+}
+
+// sin and cos of an angle in degrees. Max error is around 1e-7, about the
+// same as std::sin. Uses cephes' minimax polynomials on [-pi/4, pi/4]
+template<typename L>
+void sincos(typename L::V degrees, typename L::V& s, typename L::V& c) {
+    using V = typename L::V;
+    const V one = L::set(1.0f);
+
+    // Reduce to turns in [-0.5, 0.5], then to a quarter turn q and
+    // the remaining angle x in [-pi/4, pi/4]
+    V turns = L::mul(degrees, L::set(1.0f / 360.0f));
+    turns = L::sub(turns, round<L>(turns));
+    V q = round<L>(L::mul(turns, L::set(4.0f)));
+    V x = L::mul(L::mul_add(q, L::set(-0.25f), turns), L::set(6.28318530717958647692f));
+    V z = L::mul(x, x);
+
+    V sin_x = L::mul_add(L::set(-1.9515295891e-4f), z, L::set(8.3321608736e-3f));
+    sin_x = L::mul_add(sin_x, z, L::set(-1.6666654611e-1f));
+    sin_x = L::mul_add(L::mul(sin_x, z), x, x);
+
+    V cos_x = L::mul_add(L::set(2.443315711809948e-5f), z, L::set(-1.388731625493765e-3f));
+    cos_x = L::mul_add(cos_x, z, L::set(4.166664568298827e-2f));
+    cos_x = L::mul_add(L::mul(cos_x, z), z, L::mul_add(z, L::set(-0.5f), one));
+
+    // Rotate by q quarter turns without branching. For q in [-2, 2]
+    // cos(q * pi/2) = 1 - |q| and sin(q * pi/2) = q * (2 - |q|)
+    V abs_q = L::max(q, L::sub(L::set(0.0f), q));
+    V cos_q = L::sub(one, abs_q);
+    V sin_q = L::mul(q, L::sub(L::set(2.0f), abs_q));
+
+    s = L::mul_add(sin_x, cos_q, L::mul(cos_x, sin_q));
+    c = L::sub(L::mul(cos_x, cos_q), L::mul(sin_x, sin_q));
+}
+
+// Builds matrices for [begin, end) in steps of L::width
+// and returns where it stopped
+template<typename L>
+size_t build_range(
+    const transform_batch::Columns& t,
+    size_t begin,
+    size_t end,
+    float* models,
+    float* normal_matrices) {
+
+    using V = typename L::V;
+    const V zero = L::set(0.0f);
+    const V one = L::set(1.0f);
+
+    size_t i = begin;
+    for (; i + L::width <= end; i += L::width) {
+        V sx = L::load(t.scale_x + i);
+        V sy = L::load(t.scale_y + i);
+        V sz = L::load(t.scale_z + i);
+
+        V sa, ca, sb, cb, sc, cc;
+        sincos<L>(L::load(t.yaw + i), sa, ca);
+        sincos<L>(L::load(t.pitch + i), sb, cb);
+        sincos<L>(L::load(t.roll + i), sc, cc);
+
+        // R = Ry(yaw) * Rx(pitch) * Rz(roll), rRC is row R column C
+        V sa_sb = L::mul(sa, sb);
+        V ca_sb = L::mul(ca, sb);
+        V r00 = L::mul_add(sa_sb, sc, L::mul(ca, cc));
+        V r01 = L::sub(L::mul(sa_sb, cc), L::mul(ca, sc));
+        V r02 = L::mul(sa, cb);
+        V r10 = L::mul(cb, sc);
+        V r11 = L::mul(cb, cc);
+        V r12 = L::sub(zero, sb);
+        V r20 = L::sub(L::mul(ca_sb, sc), L::mul(sa, cc));
+        V r21 = L::mul_add(ca_sb, cc, L::mul(sa, sc));
+        V r22 = L::mul(ca, cb);
+
+        // Model = T * S * R, scale multiplies the rows of R
+        float* model = models + i * 16;
+        L::store_vec4(L::mul(sx, r00), L::mul(sy, r10), L::mul(sz, r20), zero, model, 16);
+        L::store_vec4(L::mul(sx, r01), L::mul(sy, r11), L::mul(sz, r21), zero, model + 4, 16);
+        L::store_vec4(L::mul(sx, r02), L::mul(sy, r12), L::mul(sz, r22), zero, model + 8, 16);
+        L::store_vec4(
+            L::load(t.position_x + i),
+            L::load(t.position_y + i),
+            L::load(t.position_z + i),
+            one,
+            model + 12,
+            16
+        );
+
+        if (normal_matrices) {
+            // inverse(S * R)^T = S^-1 * R since R is orthonormal
+            V inv_sx = L::div(one, sx);
+            V inv_sy = L::div(one, sy);
+            V inv_sz = L::div(one, sz);
+            const V normal[9] = {
+                L::mul(inv_sx, r00), L::mul(inv_sy, r10), L::mul(inv_sz, r20),
+                L::mul(inv_sx, r01), L::mul(inv_sy, r11), L::mul(inv_sz, r21),
+                L::mul(inv_sx, r02), L::mul(inv_sy, r12), L::mul(inv_sz, r22),
+            };
+            // NOTE: mat3 columns aren't 16 byte aligned
+            // so these go through the stack instead
+            alignas(32) float lanes[9][L::width];
+            for (uint e = 0; e < 9; e++) {
+                L::store(normal[e], lanes[e]);
+            }
+            for (uint lane = 0; lane < L::width; lane++) {
+                float* dst = normal_matrices + (i + lane) * 9;
+                for (uint e = 0; e < 9; e++) {
+                    dst[e] = lanes[e][lane];
+                }
+            }
+        }
+    }
+    return i;
+}
+
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+// The short integer names used everywhere. common.hpp pulls this in along
+// with the shapes, headers that only need the names include just this
+using uint = unsigned int;
+using u8 = unsigned char;
@@ -1,5 +1,118 @@
+#include <algorithm>
+#include <cmath>
+#include <glad/glad.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 #include "vertex.hpp"
 
 Vertex::Vertex(glm::vec3 position, glm::vec3 normal, glm::vec2 tex_coords)
     : position(position), normal(normal), tex_coords(tex_coords) {}
 
+void VertexLayout::apply() const {
+    for (const VertexAttribute& attribute : attributes) {
+        glEnableVertexAttribArray(attribute.location);
+        glVertexAttribPointer(
+            attribute.location,
+            attribute.components,
+            attribute.type,
+            attribute.normalized ? GL_TRUE : GL_FALSE,
+            stride,
+            (void*)attribute.offset
+        );
+    }
+}
+
+const VertexLayout& Vertex::layout() {
+    static const VertexLayout layout = {
+        sizeof(Vertex),
+        {
+            { 0, 3, GL_FLOAT, false, offsetof(Vertex, position) },
+            { 1, 3, GL_FLOAT, false, offsetof(Vertex, normal) },
+            { 2, 2, GL_FLOAT, false, offsetof(Vertex, tex_coords) },
+        }
+    };
+    return layout;
+}
+
+const VertexLayout& QuantizedVertex::layout() {
+    static_assert(sizeof(QuantizedVertex) == 16, "QuantizedVertex should be half of Vertex");
+    static const VertexLayout layout = {
+        sizeof(QuantizedVertex),
+        {
+            { 0, 4, GL_UNSIGNED_SHORT, true, offsetof(QuantizedVertex, position) },
+            { 1, 2, GL_SHORT, true, offsetof(QuantizedVertex, normal) },
+            { 2, 2, GL_HALF_FLOAT, false, offsetof(QuantizedVertex, tex_coords) },
+        }
+    };
+    return layout;
+}
+
+namespace vertex_quantization {
+
+glm::mat4 quantize(const Vertex* vertices, size_t count, QuantizedVertex* out) {
+    glm::vec3 min(0);
+    glm::vec3 max(0);
+    if (count > 0) {
+        min = max = vertices[0].position;
+    }
+    for (size_t i = 1; i < count; i++) {
+        min = glm::min(min, vertices[i].position);
+        max = glm::max(max, vertices[i].position);
+    }
+    glm::vec3 extent = max - min;
+    // A flat axis has nothing to spread over, every vertex ends up on min
+    glm::vec3 inverse_extent(0);
+    for (int axis = 0; axis < 3; axis++) {
+        if (extent[axis] > 0) {
+            inverse_extent[axis] = 1.0f / extent[axis];
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const Vertex& vertex = vertices[i];
+        QuantizedVertex& quantized = out[i];
+
+        glm::vec3 position = (vertex.position - min) * inverse_extent;
+        for (int axis = 0; axis < 3; axis++) {
+            quantized.position[axis] = glm::packUnorm1x16(position[axis]);
+        }
+        quantized.position[3] = 0;
+
+        glm::vec2 normal = octahedral_encode(vertex.normal);
+        quantized.normal[0] = glm::packSnorm1x16(normal.x);
+        quantized.normal[1] = glm::packSnorm1x16(normal.y);
+
+        quantized.tex_coords[0] = glm::packHalf1x16(vertex.tex_coords.x);
+        quantized.tex_coords[1] = glm::packHalf1x16(vertex.tex_coords.y);
+    }
+
+    // The shader sees positions in [0, 1]
+    glm::mat4 transform = glm::translate(glm::mat4(1), min);
+    return glm::scale(transform, extent);
+}
+
+glm::vec2 octahedral_encode(glm::vec3 normal) {
+    float length = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    if (length == 0) {
+        return glm::vec2(0);
+    }
+    normal /= length;
+    glm::vec2 encoded(normal.x, normal.y);
+    // The lower half gets folded over the diagonals onto the corners
+    if (normal.z < 0) {
+        encoded = (1.0f - glm::abs(glm::vec2(encoded.y, encoded.x)))
+            * glm::vec2(encoded.x >= 0 ? 1.0f : -1.0f, encoded.y >= 0 ? 1.0f : -1.0f);
+    }
+    return encoded;
+}
+
+glm::vec3 octahedral_decode(glm::vec2 encoded) {
+    // Same as the shaders
+    glm::vec3 normal(encoded, 1.0f - std::abs(encoded.x) - std::abs(encoded.y));
+    float fold = std::max(-normal.z, 0.0f);
+    normal.x += normal.x >= 0 ? -fold : fold;
+    normal.y += normal.y >= 0 ? -fold : fold;
+    return glm::normalize(normal);
+}
+
+}
@@ -1,6 +1,40 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <vector>
 #include <glm/glm.hpp>
+#include "types.hpp"
+
+// One attribute of a vertex buffer, what glVertexAttribPointer takes
+struct VertexAttribute {
+    uint location = 0;
+    uint components = 0;
+    // GL_FLOAT, GL_HALF_FLOAT, GL_UNSIGNED_SHORT...
+    uint type = 0;
+    // Integer types are read as [0, 1] or [-1, 1] instead of their value
+    bool normalized = false;
+    size_t offset = 0;
+};
+
+// How a vertex buffer is laid out, so the attribute setup doesn't have to
+// be written out for every vertex type
+struct VertexLayout {
+    size_t stride = 0;
+    std::vector<VertexAttribute> attributes;
+
+    // Sets up the attributes of the bound vao to read from the bound
+    // GL_ARRAY_BUFFER
+    void apply() const;
+};
+
+// Which vertex type a mesh's buffer is made of
+enum class VertexFormat {
+    // Vertex
+    FLOAT,
+    // QuantizedVertex
+    QUANTIZED,
+};
 
 struct Vertex {
     glm::vec3 position = glm::vec3(0);
@@ -9,5 +43,33 @@ struct Vertex {
 
     Vertex() = default;
     Vertex(glm::vec3 position, glm::vec3 normal, glm::vec2 tex_coords);
+
+    static const VertexLayout& layout();
+};
+
+// Half the size of Vertex. Positions are 16 bit fractions of the mesh's
+// bounding box, so the mesh has to be drawn with the transform quantize
+// returns applied to its model matrix.
+//
+// Shaders that need the normal decode it when a_position.w is 0, see
+// light_mesh.vert. Float positions only have 3 components so their w is 1
+struct QuantizedVertex {
+    // Unsigned normalized xyz, w is always 0
+    uint16_t position[4];
+    // Octahedral, signed normalized
+    int16_t normal[2];
+    // Half floats
+    uint16_t tex_coords[2];
+
+    static const VertexLayout& layout();
 };
 
+namespace vertex_quantization {
+    // Fills out with count vertices and returns the matrix that maps their
+    // positions back to the space vertices were in
+    glm::mat4 quantize(const Vertex* vertices, size_t count, QuantizedVertex* out);
+
+    // Unit vector to a point in [-1, 1]², the octahedron folded flat
+    glm::vec2 octahedral_encode(glm::vec3 normal);
+    glm::vec3 octahedral_decode(glm::vec2 encoded);
+}
@@ -0,0 +1,137 @@
+// Compresses textures ahead of time for the engine, see CompressedTexture.
+//
+// usage: texconv [--format bc1|bc3] [--no-flip] images...
+//
+// Every image is written next to itself as a .btex file with its whole mip
+// chain. Without --format, rgba images become BC3 and everything else BC1.
+// Textures are flipped like Texture2D does by default, skybox faces aren't
+// flipped so they need --no-flip.
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../src/compressed_texture.hpp"
+
+namespace {
+    const char* format_name(CompressedFormat format) {
+        return format == CompressedFormat::BC1 ? "BC1" : "BC3";
+    }
+
+    void usage() {
+        std::fprintf(stderr, "usage: texconv [--format bc1|bc3] [--no-flip] images...\n");
+    }
+}
+
+int main(int argc, char** argv) {
+    bool auto_format = true;
+    CompressedFormat format = CompressedFormat::BC1;
+    bool flip = true;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--no-flip") == 0) {
+            flip = false;
+        }
+        else if (std::strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            std::string name = argv[++i];
+            auto_format = false;
+            if (name == "bc1") {
+                format = CompressedFormat::BC1;
+            }
+            else if (name == "bc3") {
+                format = CompressedFormat::BC3;
+            }
+            else {
+                usage();
+                return 1;
+            }
+        }
+        else if (argv[i][0] == '-') {
+            usage();
+            return 1;
+        }
+        else {
+            paths.push_back(argv[i]);
+        }
+    }
+    if (paths.empty()) {
+        usage();
+        return 1;
+    }
+
+    int failed = 0;
+    for (const std::string& path : paths) {
+        auto start = std::chrono::steady_clock::now();
+        int width, height, channels;
+        u8* pixels = stbi_load(path.c_str(), &width, &height, &channels, 0);
+        if (!pixels) {
+            std::fprintf(stderr, "%s: %s\n", path.c_str(), stbi_failure_reason());
+            failed++;
+            continue;
+        }
+        // Grey images are expanded so they read the same as GL_RED in .r
+        std::vector<u8> expanded;
+        if (channels < 3) {
+            expanded.resize((size_t)width * height * 4);
+            for (size_t p = 0; p < (size_t)width * height; p++) {
+                u8 grey = pixels[p * channels];
+                u8 alpha = channels == 2 ? pixels[p * channels + 1] : 255;
+                expanded[p * 4 + 0] = grey;
+                expanded[p * 4 + 1] = grey;
+                expanded[p * 4 + 2] = grey;
+                expanded[p * 4 + 3] = alpha;
+            }
+            channels = 4;
+        }
+        const u8* source = expanded.empty() ? pixels : expanded.data();
+
+        CompressedFormat texture_format = format;
+        if (auto_format) {
+            bool has_alpha = false;
+            for (size_t p = 0; channels == 4 && p < (size_t)width * height && !has_alpha; p++) {
+                has_alpha = source[p * 4 + 3] != 255;
+            }
+            texture_format = has_alpha ? CompressedFormat::BC3 : CompressedFormat::BC1;
+        }
+
+        CompressedTexture texture = CompressedTexture::encode(
+            source,
+            width,
+            height,
+            channels,
+            texture_format,
+            flip
+        );
+        stbi_image_free(pixels);
+
+        std::string out_path = CompressedTexture::container_path(path);
+        if (!texture.write(out_path)) {
+            std::fprintf(stderr, "%s: couldn't write %s\n", path.c_str(), out_path.c_str());
+            failed++;
+            continue;
+        }
+        float ms = std::chrono::duration<float, std::milli>(
+            std::chrono::steady_clock::now() - start
+        ).count();
+        // What Texture2D uploads uncompressed, with the mips glGenerateMipmap adds
+        size_t raw_size = (size_t)width * height * 4 * 4 / 3;
+        std::printf(
+            "%s -> %s: %dx%d %s, %zu mips, %.1f KB (%.1fx smaller) in %.1f ms\n",
+            path.c_str(),
+            out_path.c_str(),
+            width,
+            height,
+            format_name(texture_format),
+            texture.levels.size(),
+            texture.size() / 1024.0f,
+            (float)raw_size / texture.size(),
+            ms
+        );
+    }
+    return failed > 0 ? 1 : 0;
+}